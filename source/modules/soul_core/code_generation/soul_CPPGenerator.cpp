@@ -79,6 +79,10 @@ struct CPPGenerator
         if (! options.classNamespace.empty())
             stream << "}  // namespace " << options.classNamespace << newLine;
 
+        if (options.generateSharedLibraryInterface && ! (options.generateJUCEHeader || options.generateJUCECPP))
+            printSharedLibraryInterface (options.classNamespace.empty() ? options.className
+                                                                        : options.classNamespace + "::" + options.className);
+
         return true;
     }
 
@@ -133,6 +137,9 @@ struct CPPGenerator
 
             printDirectPerformerMethods();
 
+            if (options.generateSharedLibraryInterface)
+                printStateAccessMethods();
+
             if (options.createEndpointFunctions)
                 printEndpointListMethods();
 
@@ -254,24 +261,7 @@ struct CPPGenerator
                 stream << "auto framesRemaining = context.numFrames - startFrame;" << newLine
                        << "auto numFramesToDo = framesRemaining < maxBlockSize ? framesRemaining : maxBlockSize;" << newLine;
 
-                if (midiIns.empty())
-                {
-                    stream << "prepare (numFramesToDo);" << blankLine;
-                }
-                else
-                {
-                    stream << choc::text::trimStart (renderMIDIPreamble);
-
-                    auto indent3 = stream.createIndentWithBraces();
-                    stream << "auto midi = context.incomingMIDI.messages[startMIDIIndex++];" << newLine
-                           << "auto packed = (static_cast<uint32_t> (midi.byte0) << 16) | (static_cast<uint32_t> (midi.byte1) << 8) | static_cast<uint32_t> (midi.byte2);" << newLine;
-
-                    for (auto& input : findMIDIInputs())
-                    {
-                        auto fn = FunctionNames::addInputEvent (input, input->getSingleEventType());
-                        stream << fn << " (state, { static_cast<int32_t> (packed) });" << newLine;
-                    }
-                }
+                stream << "prepare (numFramesToDo);" << blankLine;
 
                 size_t inChanIndex = 0, outChanIndex = 0;
 
@@ -285,8 +275,12 @@ struct CPPGenerator
                     inChanIndex += numChans;
                 }
 
-                stream << blankLine
-                       << "advance();" << blankLine;
+                stream << blankLine;
+
+                if (midiIns.empty())
+                    stream << "advance();" << blankLine;
+                else
+                    printMIDIDispatchingAdvance (midiIns);
 
                 for (auto& output : audioOuts)
                 {
@@ -305,6 +299,39 @@ struct CPPGenerator
         }
     }
 
+    /// Rather than splitting the block at each MIDI event, the events are dispatched
+    /// between calls to run(), so that the inputs only need to be prepared once.
+    void printMIDIDispatchingAdvance (const decltype (Module::inputs)& midiIns)
+    {
+        stream << choc::text::trimStart (renderMIDIAdvancePreamble);
+
+        {
+            auto indent1 = stream.createIndentWithBraces();
+
+            stream << "auto currentFrame = startFrame + framesDone;" << newLine
+                   << "auto framesThisCall = numFramesToDo - framesDone;" << blankLine
+                   << "while (startMIDIIndex < context.incomingMIDI.numMessages)" << newLine;
+
+            {
+                auto indent2 = stream.createIndentWithBraces();
+
+                stream << choc::text::trimStart (renderMIDINextEventCheck)
+                       << "auto midi = context.incomingMIDI.messages[startMIDIIndex++];" << newLine
+                       << "auto packed = (static_cast<uint32_t> (midi.byte0) << 16) | (static_cast<uint32_t> (midi.byte1) << 8) | static_cast<uint32_t> (midi.byte2);" << newLine;
+
+                for (auto& input : midiIns)
+                    stream << FunctionNames::addInputEvent (input, input->getSingleEventType()) << " (state, { static_cast<int32_t> (packed) });" << newLine;
+            }
+
+            stream << blankLine
+                   << "run (state, static_cast<int32_t> (framesThisCall));" << newLine
+                   << "totalFramesElapsed += framesThisCall;" << newLine
+                   << "framesDone += framesThisCall;" << newLine;
+        }
+
+        stream << blankLine;
+    }
+
     //==============================================================================
     decltype (Module::inputs) findAudioInputs() const
     {
@@ -492,6 +519,183 @@ struct CPPGenerator
         }
     }
 
+    //==============================================================================
+    void printSharedLibraryInterface (const std::string& className)
+    {
+        stream << sectionBreak
+               << choc::text::trimStart (sharedLibraryPreamble)
+               << blankLine;
+
+        for (auto& input : mainProcessor.inputs)
+            for (auto& type : input->dataTypes)
+                printPackedSizeCheck (className, type);
+
+        for (auto& output : mainProcessor.outputs)
+            for (auto& type : output->dataTypes)
+                printPackedSizeCheck (className, type);
+
+        auto call = "static_cast<" + className + "*> (instance)->";
+
+        printExportedFunction ("void*", "create", {}, "return new " + className + "();");
+        printExportedFunction ("void", "destroy", "void* instance", "delete static_cast<" + className + "*> (instance);");
+        printExportedFunction ("void", "init", "void* instance, double sampleRate, int32_t sessionID", call + "init (sampleRate, sessionID);");
+        printExportedFunction ("void", "reset", "void* instance", call + "reset();");
+        printExportedFunction ("void", "prepare", "void* instance, uint32_t numFrames", call + "prepare (numFrames);");
+        printExportedFunction ("void", "advance", "void* instance", call + "advance();");
+        printExportedFunction ("uint32_t", "getNumXRuns", "void* instance", "return " + call + "getNumXRuns();");
+        printExportedFunction ("void*", "getState", "void* instance", "return " + call + "getStateData();");
+        printExportedFunction ("uint64_t", "getStateSize", "", "return " + className + "::getStateSize();");
+
+        printExportedFunction ("void", "setInputStreamFrames", "void* instance, uint32_t endpointIndex, const void* frames, uint32_t numFrames", {});
+        printEndpointSwitch (mainProcessor.inputs,
+                             [] (const heart::InputDeclaration& i) { return i.isStreamEndpoint(); },
+                             [&] (const heart::InputDeclaration& i)
+                             {
+                                 stream << call << "setNextInputStreamFrames_" << i.name.toString()
+                                        << " (static_cast<const " << getType (i.getFrameType(), className) << "*> (frames), numFrames);" << newLine
+                                        << "break;" << newLine;
+                             });
+
+        printExportedFunction ("void", "setSparseInputStreamTarget", "void* instance, uint32_t endpointIndex, const void* targetValue, uint32_t numFramesToReachValue", {});
+        printEndpointSwitch (mainProcessor.inputs,
+                             [] (const heart::InputDeclaration& i) { return i.isStreamEndpoint(); },
+                             [&] (const heart::InputDeclaration& i)
+                             {
+                                 stream << call << "setNextInputStreamSparseFrames_" << i.name.toString()
+                                        << " (" << getValueFromVoidPointer (className, i.getFrameType(), "targetValue") << ", numFramesToReachValue);" << newLine
+                                        << "break;" << newLine;
+                             });
+
+        printExportedFunction ("void", "setInputValue", "void* instance, uint32_t endpointIndex, const void* newValue", {});
+        printEndpointSwitch (mainProcessor.inputs,
+                             [] (const heart::InputDeclaration& i) { return i.isValueEndpoint(); },
+                             [&] (const heart::InputDeclaration& i)
+                             {
+                                 stream << call << "setInputValue_" << i.name.toString()
+                                        << " (" << getValueFromVoidPointer (className, i.getValueType(), "newValue") << ");" << newLine
+                                        << "break;" << newLine;
+                             });
+
+        printExportedFunction ("void", "addInputEvent", "void* instance, uint32_t endpointIndex, uint32_t typeIndex, const void* eventData", {});
+        printEndpointSwitch (mainProcessor.inputs,
+                             [] (const heart::InputDeclaration& i) { return i.isEventEndpoint(); },
+                             [&] (const heart::InputDeclaration& i)
+                             {
+                                 stream << "switch (typeIndex)" << newLine;
+
+                                 {
+                                     auto indent = stream.createIndentWithBraces();
+
+                                     for (size_t type = 0; type < i.dataTypes.size(); ++type)
+                                         stream << "case " << type << ": " << call << "addInputEvent_" << i.name.toString()
+                                                << " (" << getValueFromVoidPointer (className, i.dataTypes[type], "eventData") << "); break;" << newLine;
+
+                                     stream << "default: break;" << newLine;
+                                 }
+
+                                 stream << newLine << "break;" << newLine;
+                             });
+
+        printExportedFunction ("const void*", "getOutputStreamFrames", "void* instance, uint32_t endpointIndex", {});
+        printEndpointSwitch (mainProcessor.outputs,
+                             [] (const heart::OutputDeclaration& o) { return o.isStreamEndpoint(); },
+                             [&] (const heart::OutputDeclaration& o)
+                             {
+                                 stream << "return " << call << "getOutputStreamFrames_" << o.name.toString() << "().elements;" << newLine;
+                             },
+                             "return nullptr;");
+
+        printExportedFunction ("void", "getOutputValue", "void* instance, uint32_t endpointIndex, void* destValue", {});
+        printEndpointSwitch (mainProcessor.outputs,
+                             [] (const heart::OutputDeclaration& o) { return o.isValueEndpoint(); },
+                             [&] (const heart::OutputDeclaration& o)
+                             {
+                                 stream << "{" << newLine;
+
+                                 {
+                                     auto indent = stream.createIndent();
+                                     stream << "auto value = " << call << "getOutputValue_" << o.name.toString() << "();" << newLine
+                                            << "std::memcpy (destValue, &value, sizeof (value));" << newLine
+                                            << "break;" << newLine;
+                                 }
+
+                                 stream << "}" << newLine;
+                             });
+
+        printExportedFunction ("void", "iterateOutputEvents", "void* instance, uint32_t endpointIndex, void* context, soul_native_HandleOutputEventFn handleEvent", {});
+        printEndpointSwitch (mainProcessor.outputs,
+                             [] (const heart::OutputDeclaration& o) { return o.isEventEndpoint(); },
+                             [&] (const heart::OutputDeclaration& o)
+                             {
+                                 stream << call << "iterateOutputEvents_" << o.name.toString() << " (";
+
+                                 for (size_t type = 0; type < o.dataTypes.size(); ++type)
+                                     stream << (type == 0 ? "" : ", ")
+                                            << "[&] (uint32_t frame, const auto& e) { return handleEvent (context, frame, "
+                                            << type << ", &e); }";
+
+                                 stream << ");" << newLine
+                                        << "break;" << newLine;
+                             });
+    }
+
+    void printStateAccessMethods()
+    {
+        stream << sectionBreak
+               << "// The following methods give a host raw access to the processor's state, so that" << newLine
+               << "// it can be moved to or from another instance of the same program." << newLine
+               << "void* getStateData() noexcept                     { return std::addressof (state); }" << newLine
+               << "static constexpr uint64_t getStateSize() noexcept { return sizeof (_State); }" << newLine;
+    }
+
+    void printExportedFunction (const std::string& returnType, const std::string& name,
+                                const std::string& params, const std::string& body)
+    {
+        stream << blankLine
+               << "SOUL_SHARED_LIBRARY_EXPORT " << returnType << " " << sharedLibrarySymbolPrefix << name
+               << " (" << params << ")" << newLine;
+
+        if (! body.empty())
+            stream << "{ " << body << " }" << newLine;
+    }
+
+    void printPackedSizeCheck (const std::string& className, const Type& type)
+    {
+        stream << "static_assert (sizeof (" << getType (type, className) << ") == " << type.getPackedSizeInBytes()
+               << ", \"The C++ layout of an endpoint type must match its packed layout\");" << newLine;
+    }
+
+    std::string getValueFromVoidPointer (const std::string& className, const Type& type, const std::string& source)
+    {
+        return "*static_cast<const " + getType (type.removeReferenceIfPresent(), className) + "*> (" + source + ")";
+    }
+
+    template <typename EndpointList, typename ShouldIncludeFn, typename PrintCaseFn>
+    void printEndpointSwitch (const EndpointList& endpoints, ShouldIncludeFn&& shouldInclude,
+                              PrintCaseFn&& printCase, const char* defaultAction = "break;")
+    {
+        auto indent1 = stream.createIndentWithBraces();
+        stream << "switch (endpointIndex)" << newLine;
+
+        {
+            auto indent2 = stream.createIndentWithBraces();
+
+            for (size_t i = 0; i < endpoints.size(); ++i)
+            {
+                if (shouldInclude (endpoints[i].get()))
+                {
+                    stream << "case " << i << ":" << newLine;
+                    auto indent3 = stream.createIndent();
+                    printCase (endpoints[i].get());
+                }
+            }
+
+            stream << "default: " << defaultAction << newLine;
+        }
+
+        stream << newLine;
+    }
+
     //==============================================================================
     void printPrivateContent()
     {
@@ -806,7 +1010,7 @@ struct CPPGenerator
         stream << sectionBreak;
         auto& dictionary = program.getStringDictionary();
 
-        if (dictionary.strings.empty())
+        if (dictionary.empty())
         {
             stream << "// The program contains no string literals, so this function should never be called" << newLine
                    << "static constexpr const char* lookupStringLiteral (int32_t)  { return {}; }" << newLine;
@@ -819,7 +1023,7 @@ struct CPPGenerator
 
         PaddedStringTable cases;
 
-        for (auto& item : dictionary.strings)
+        for (auto& item : dictionary)
         {
             cases.startRow();
             cases.appendItem ("case " + std::to_string (item.handle.handle) + ":");
@@ -1423,6 +1627,10 @@ struct CPPGenerator
             case heart::ProcessorProperty::Property::period:      return "(1.0 / (sampleRate * " + choc::text::floatToString (currentModule->sampleRate) + "))";
             case heart::ProcessorProperty::Property::latency:     return std::to_string (currentModule->latency);
 
+            case heart::ProcessorProperty::Property::framesAvailable:
+                p.location.throwError (Errors::multiFrameStreamAccessNotSupported());
+                break;
+
             case heart::ProcessorProperty::Property::none:
             case heart::ProcessorProperty::Property::id:
             case heart::ProcessorProperty::Property::session:
@@ -33,8 +33,13 @@ namespace soul::cpp
         bool packStructures = false;         ///< Whether to pack the generated class
         bool generateJUCEHeader = false;     ///< If true, creates the .h for a juce::AudioPluginInstance
         bool generateJUCECPP = false;        ///< If true, creates the .cpp header for a juce::AudioPluginInstance
+        bool generateSharedLibraryInterface = false; ///< If true, appends a set of extern "C" functions that let a host drive the class from a shared library
     };
 
+    /// When CodeGenOptions::generateSharedLibraryInterface is enabled, every function in the
+    /// C interface that gets generated has a name which begins with this prefix.
+    static constexpr const char* sharedLibrarySymbolPrefix = "soul_native_";
+
     /// Runs the C++ generator with the given options, writing the C++ to the given CodePrinter.
     /// Any errors will be reported to the message list provided.
     /// On exit, the generator will have updated the CodeGenOptions::className field so you can
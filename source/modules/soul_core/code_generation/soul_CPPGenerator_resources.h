@@ -206,29 +206,21 @@ struct RenderContext
 )cppcode";
 
 //==============================================================================
-static constexpr auto renderMIDIPreamble = R"cppcode(
-auto endMIDIIndex = startMIDIIndex;
-
-while (endMIDIIndex < context.incomingMIDI.numMessages)
-{
-    auto eventTime = context.incomingMIDI.messages[endMIDIIndex].frameIndex;
-
-    if (eventTime > startFrame)
-    {
-        auto framesUntilEvent = eventTime - startFrame;
+static constexpr auto renderMIDIAdvancePreamble = R"cppcode(
+for (uint32_t framesDone = 0; framesDone < numFramesToDo;)
+)cppcode";
 
-        if (framesUntilEvent < numFramesToDo)
-            numFramesToDo = framesUntilEvent;
+static constexpr auto renderMIDINextEventCheck = R"cppcode(
+auto eventTime = context.incomingMIDI.messages[startMIDIIndex].frameIndex;
 
-        break;
-    }
+if (eventTime > currentFrame)
+{
+    if (eventTime - currentFrame < framesThisCall)
+        framesThisCall = eventTime - currentFrame;
 
-    ++endMIDIIndex;
+    break;
 }
 
-prepare (numFramesToDo);
-
-while (startMIDIIndex < endMIDIIndex)
 )cppcode";
 
 //==============================================================================
@@ -1322,4 +1314,25 @@ void CLASS_NAME::storeEditorSize (EditorSize newSize)
 }
 )cppcode";
 
+//==============================================================================
+static constexpr auto sharedLibraryPreamble = R"cppcode(
+//==============================================================================
+//==============================================================================
+//
+// The following functions provide a plain C interface to the generated class,
+// so that it can be built into a shared library and driven by a host which
+// only knows about the raw, packed layout of the endpoint data.
+//
+//==============================================================================
+//==============================================================================
+
+#ifdef _WIN32
+ #define SOUL_SHARED_LIBRARY_EXPORT extern "C" __declspec(dllexport)
+#else
+ #define SOUL_SHARED_LIBRARY_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+using soul_native_HandleOutputEventFn = bool(*)(void* context, uint32_t frameOffset, uint32_t typeIndex, const void* eventData);
+)cppcode";
+
 }
@@ -0,0 +1,1019 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+
+namespace soul::cpp
+{
+
+//==============================================================================
+struct NativePerformer  : public Performer
+{
+    NativePerformer (NativePerformerOptions o) : options (std::move (o))
+    {
+        // There's no default for this stage: see createNativePerformer()
+        SOUL_ASSERT (options.prepareProgramForCodeGen != nullptr);
+    }
+    ~NativePerformer() override   { unload(); }
+
+    //==============================================================================
+    bool load (CompileMessageList& messageList, const Program& programToLoad) noexcept override
+    {
+        unload();
+
+        try
+        {
+            CompileMessageHandler handler (messageList);
+            program = programToLoad.clone();
+            auto& mainProcessor = program.getMainProcessor();
+
+            for (auto& input : mainProcessor.inputs)
+                endpoints.push_back (std::make_unique<EndpointInfo> (input->getDetails(), true, input->dataTypes));
+
+            for (auto& output : mainProcessor.outputs)
+                endpoints.push_back (std::make_unique<EndpointInfo> (output->getDetails(), false, output->dataTypes));
+
+            for (auto& e : endpoints)
+                (e->isInput ? inputEndpoints : outputEndpoints).push_back (e->details);
+
+            for (auto& v : program.getExternalVariables())
+                externalVariables.push_back ({ getExternalVariableName (v), v->type.getExternalType(), v->annotation.toExternalValue() });
+
+            return true;
+        }
+        catch (AbortCompilationException) {}
+
+        unload();
+        return false;
+    }
+
+    void unload() noexcept override
+    {
+        unlinkLibrary();
+        program = {};
+        endpoints.clear();
+        inputEndpoints.clear();
+        outputEndpoints.clear();
+        externalVariables.clear();
+    }
+
+    choc::span<const EndpointDetails> getInputEndpoints() noexcept override       { return inputEndpoints; }
+    choc::span<const EndpointDetails> getOutputEndpoints() noexcept override      { return outputEndpoints; }
+    choc::span<const ExternalVariable> getExternalVariables() noexcept override   { return externalVariables; }
+
+    bool setExternalVariable (const char* name, const choc::value::ValueView& value) noexcept override
+    {
+        if (! isLoaded() || isLinked())
+            return false;
+
+        for (auto& v : program.getExternalVariables())
+        {
+            if (getExternalVariableName (v) == name)
+            {
+                CompileMessageList messageList;
+
+                try
+                {
+                    CompileMessageHandler handler (messageList);
+                    auto newValue = Value::fromExternalValue (v->type, value, program.getConstantTable(), program.getStringDictionary());
+                    v->externalHandle = program.getConstantTable().getHandleForValue (std::move (newValue));
+                    return true;
+                }
+                catch (AbortCompilationException) {}
+
+                return false;
+            }
+        }
+
+        return false;
+    }
+
+    //==============================================================================
+    bool link (CompileMessageList& messageList, const BuildSettings& settings, LinkerCache* cache) noexcept override
+    {
+        if (! isLoaded())
+            return false;
+
+        if (isLinked())
+            return true;
+
+        try
+        {
+            CompileMessageHandler handler (messageList);
+            linkProgram (messageList, settings, cache);
+            return true;
+        }
+        catch (AbortCompilationException) {}
+
+        unlinkLibrary();
+        return false;
+    }
+
+    bool isLoaded() noexcept override     { return ! program.isEmpty(); }
+    bool isLinked() noexcept override     { return instance != nullptr; }
+
+    void reset() noexcept override
+    {
+        if (isLinked())
+            functions.reset (instance);
+    }
+
+    EndpointHandle getEndpointHandle (const EndpointID& endpointID) noexcept override
+    {
+        for (size_t i = 0; i < endpoints.size(); ++i)
+        {
+            auto& e = *endpoints[i];
+
+            if (e.details.endpointID == endpointID)
+            {
+                e.isActive = true;
+                return EndpointHandle::create (e.details.endpointType, static_cast<uint32_t> (i + 1));
+            }
+        }
+
+        return {};
+    }
+
+    bool isEndpointActive (const EndpointID& endpointID) noexcept override
+    {
+        for (auto& e : endpoints)
+            if (e->details.endpointID == endpointID)
+                return e->isActive;
+
+        return false;
+    }
+
+    //==============================================================================
+    void prepare (uint32_t numFramesToBeRendered) noexcept override
+    {
+        SOUL_ASSERT (isLinked() && numFramesToBeRendered <= blockSize);
+        numFramesInBlock = numFramesToBeRendered;
+        functions.prepare (instance, numFramesToBeRendered);
+    }
+
+    void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+        {
+            auto numFrames = std::min (static_cast<uint32_t> (frameArray.size()), numFramesInBlock);
+            auto frameSize = e->types.front().getPackedSizeInBytes();
+
+            if (frameArray.getType().getValueDataSize() == frameArray.size() * frameSize)
+                return functions.setInputStreamFrames (instance, e->nativeIndex, frameArray.getRawData(), numFrames);
+
+            // If the caller's data isn't laid out in the way that the native code expects,
+            // each frame has to be individually converted to the endpoint's frame type
+            for (uint32_t i = 0; i < numFrames; ++i)
+                if (! writePackedValue (e->types.front(), frameArray[i], e->scratchSpace.data() + i * frameSize))
+                    return;
+
+            functions.setInputStreamFrames (instance, e->nativeIndex, e->scratchSpace.data(), numFrames);
+        }
+    }
+
+    void setSparseInputStreamTarget (EndpointHandle handle, const choc::value::ValueView& targetFrameValue,
+                                     uint32_t numFramesToReachValue) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+            if (auto target = convertValue (*e, 0, targetFrameValue))
+                functions.setSparseInputStreamTarget (instance, e->nativeIndex, target, numFramesToReachValue);
+    }
+
+    void setInputValue (EndpointHandle handle, const choc::value::ValueView& newValue) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+            if (auto value = convertValue (*e, 0, newValue))
+                functions.setInputValue (instance, e->nativeIndex, value);
+    }
+
+    void addInputEvent (EndpointHandle handle, const choc::value::ValueView& eventData) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+        {
+            auto typeIndex = e->findTypeIndexForValue (eventData);
+
+            if (typeIndex >= 0)
+                if (auto value = convertValue (*e, static_cast<size_t> (typeIndex), eventData))
+                    functions.addInputEvent (instance, e->nativeIndex, static_cast<uint32_t> (typeIndex), value);
+        }
+    }
+
+    void advance() noexcept override
+    {
+        functions.advance (instance);
+    }
+
+    //==============================================================================
+    choc::value::ValueView getOutputStreamFrames (EndpointHandle handle) noexcept override
+    {
+        if (auto e = getEndpoint (handle, false))
+            if (auto frames = functions.getOutputStreamFrames (instance, e->nativeIndex))
+                return choc::value::ValueView (choc::value::Type::createArray (e->externalTypes.front(), numFramesInBlock),
+                                               const_cast<void*> (frames), nullptr);
+
+        return {};
+    }
+
+    choc::value::ValueView getOutputValue (EndpointHandle handle) noexcept override
+    {
+        if (auto e = getEndpoint (handle, false))
+        {
+            functions.getOutputValue (instance, e->nativeIndex, e->outputValue.getRawData());
+            return e->outputValue;
+        }
+
+        return {};
+    }
+
+    void iterateOutputEvents (EndpointHandle handle, HandleNextOutputEventFn handleEvent) noexcept override
+    {
+        if (auto e = getEndpoint (handle, false))
+        {
+            struct IterationContext
+            {
+                EndpointInfo& endpoint;
+                HandleNextOutputEventFn& callback;
+            };
+
+            IterationContext context { *e, handleEvent };
+
+            functions.iterateOutputEvents (instance, e->nativeIndex, std::addressof (context),
+                                           [] (void* contextPtr, uint32_t frameOffset, uint32_t typeIndex, const void* data) -> bool
+            {
+                auto& c = *static_cast<IterationContext*> (contextPtr);
+                auto type = c.endpoint.externalTypes[typeIndex];
+                return c.callback (frameOffset, choc::value::ValueView (std::move (type), const_cast<void*> (data), nullptr));
+            });
+        }
+    }
+
+    //==============================================================================
+    uint32_t getLatency() noexcept override           { return isLoaded() ? program.getMainProcessor().latency : 0; }
+    uint32_t getXRuns() noexcept override             { return isLinked() ? functions.getNumXRuns (instance) : 0; }
+    uint32_t getBlockSize() noexcept override         { return blockSize; }
+    bool hasError() noexcept override                 { return false; }
+    const char* getError() noexcept override          { return nullptr; }
+
+    choc::value::Value getState() noexcept override
+    {
+        if (! (isLinked() && stateType.isValid()))
+            return {};
+
+        return PerformerState::capture (stateType, functions.getState (instance));
+    }
+
+    bool setState (const choc::value::ValueView& state) noexcept override
+    {
+        if (! (isLinked() && stateType.isValid()))
+            return false;
+
+        return PerformerState::restore (stateType, functions.getState (instance), state);
+    }
+
+    bool getStateData (void* dest, size_t size) noexcept override
+    {
+        if (! (isLinked() && stateType.isValid())
+             || PerformerState::captureData (stateType, functions.getState (instance), nullptr) != size)
+            return false;
+
+        PerformerState::captureData (stateType, functions.getState (instance), dest);
+        return true;
+    }
+
+    bool setStateData (const void* source, size_t size) noexcept override
+    {
+        if (! (isLinked() && stateType.isValid())
+             || PerformerState::captureData (stateType, functions.getState (instance), nullptr) != size)
+            return false;
+
+        PerformerState::restoreData (stateType, functions.getState (instance), source);
+        return true;
+    }
+
+private:
+    //==============================================================================
+    static constexpr uint32_t defaultBlockSize = 512;
+
+    struct EndpointInfo
+    {
+        EndpointInfo (EndpointDetails d, bool input, const std::vector<Type>& t)
+            : details (std::move (d)), isInput (input), types (t)
+        {
+            for (auto& type : types)
+            {
+                externalTypes.push_back (type.getExternalType());
+
+                if (isInput)
+                    packedValues.emplace_back (static_cast<size_t> (type.getPackedSizeInBytes()));
+            }
+
+            if (details.endpointType == EndpointType::value && ! isInput)
+                outputValue = choc::value::Value (externalTypes.front());
+        }
+
+        int findTypeIndexForValue (const choc::value::ValueView& v) const
+        {
+            for (size_t i = 0; i < externalTypes.size(); ++i)
+                if (externalTypes[i] == v.getType())
+                    return static_cast<int> (i);
+
+            return externalTypes.size() == 1 ? 0 : -1;
+        }
+
+        EndpointDetails details;
+        bool isInput, isActive = false;
+        std::vector<Type> types;
+        std::vector<choc::value::Type> externalTypes;
+        uint32_t nativeIndex = 0;
+        choc::value::Value outputValue;
+
+        // Space for converting incoming values into the native layout, so that the audio
+        // thread doesn't need to allocate. There's one value for each of the types, and
+        // enough frames of a stream for the largest block.
+        std::vector<std::vector<uint8_t>> packedValues;
+        std::vector<uint8_t> scratchSpace;
+    };
+
+    //==============================================================================
+    struct SharedLibrary
+    {
+        SharedLibrary (const std::string& path) : handle (openLibrary (path.c_str())) {}
+        ~SharedLibrary()     { if (handle != nullptr) closeLibrary (handle); }
+
+        template <typename FunctionType>
+        void findFunction (FunctionType& result, const char* name, const std::string& libraryPath)
+        {
+            result = reinterpret_cast<FunctionType> (getFunction (handle, (std::string (sharedLibrarySymbolPrefix) + name).c_str()));
+
+            if (result == nullptr)
+                CodeLocation().throwError (Errors::cannotLoadLibrary (libraryPath));
+        }
+
+        void* handle = nullptr;
+
+       #ifdef WIN32
+        static void* openLibrary (const char* name)           { return ::LoadLibraryA (name); }
+        static void closeLibrary (void* h)                    { ::FreeLibrary ((HMODULE) h); }
+        static void* getFunction (void* h, const char* name)  { return (void*) ::GetProcAddress ((HMODULE) h, name); }
+       #else
+        static void* openLibrary (const char* name)           { return ::dlopen (name, RTLD_LOCAL | RTLD_NOW); }
+        static void closeLibrary (void* h)                    { ::dlclose (h); }
+        static void* getFunction (void* h, const char* name)  { return ::dlsym (h, name); }
+       #endif
+    };
+
+    using HandleOutputEventFn = bool(*)(void*, uint32_t, uint32_t, const void*);
+
+    struct LibraryFunctions
+    {
+        void* (*create)() = {};
+        void (*destroy) (void*) = {};
+        void (*init) (void*, double, int32_t) = {};
+        void (*reset) (void*) = {};
+        void (*prepare) (void*, uint32_t) = {};
+        void (*advance) (void*) = {};
+        uint32_t (*getNumXRuns) (void*) = {};
+        void* (*getState) (void*) = {};
+        uint64_t (*getStateSize)() = {};
+        void (*setInputStreamFrames) (void*, uint32_t, const void*, uint32_t) = {};
+        void (*setSparseInputStreamTarget) (void*, uint32_t, const void*, uint32_t) = {};
+        void (*setInputValue) (void*, uint32_t, const void*) = {};
+        void (*addInputEvent) (void*, uint32_t, uint32_t, const void*) = {};
+        const void* (*getOutputStreamFrames) (void*, uint32_t) = {};
+        void (*getOutputValue) (void*, uint32_t, void*) = {};
+        void (*iterateOutputEvents) (void*, uint32_t, void*, HandleOutputEventFn) = {};
+
+        void findAll (SharedLibrary& library, const std::string& libraryPath)
+        {
+            library.findFunction (create,                      "create",                      libraryPath);
+            library.findFunction (destroy,                     "destroy",                     libraryPath);
+            library.findFunction (init,                        "init",                        libraryPath);
+            library.findFunction (reset,                       "reset",                       libraryPath);
+            library.findFunction (prepare,                     "prepare",                     libraryPath);
+            library.findFunction (advance,                     "advance",                     libraryPath);
+            library.findFunction (getNumXRuns,                 "getNumXRuns",                 libraryPath);
+            library.findFunction (getState,                    "getState",                    libraryPath);
+            library.findFunction (getStateSize,                "getStateSize",                libraryPath);
+            library.findFunction (setInputStreamFrames,        "setInputStreamFrames",        libraryPath);
+            library.findFunction (setSparseInputStreamTarget,  "setSparseInputStreamTarget",  libraryPath);
+            library.findFunction (setInputValue,               "setInputValue",               libraryPath);
+            library.findFunction (addInputEvent,               "addInputEvent",               libraryPath);
+            library.findFunction (getOutputStreamFrames,       "getOutputStreamFrames",       libraryPath);
+            library.findFunction (getOutputValue,              "getOutputValue",              libraryPath);
+            library.findFunction (iterateOutputEvents,         "iterateOutputEvents",         libraryPath);
+        }
+    };
+
+    //==============================================================================
+    NativePerformerOptions options;
+    Program program;
+    std::vector<std::unique_ptr<EndpointInfo>> endpoints;
+    std::vector<EndpointDetails> inputEndpoints, outputEndpoints;
+    std::vector<ExternalVariable> externalVariables;
+
+    std::unique_ptr<SharedLibrary> library;
+    LibraryFunctions functions;
+    void* instance = nullptr;
+
+    // The program that the native code was generated from, which owns the _State structure
+    Program preparedProgram;
+    Type stateType;
+    uint32_t blockSize = 0, numFramesInBlock = 0;
+
+    //==============================================================================
+    std::string getExternalVariableName (const heart::Variable& v) const
+    {
+        return Program::stripRootNamespaceFromQualifiedPath (program.getExternalVariableName (v));
+    }
+
+    EndpointInfo* getEndpoint (EndpointHandle handle, bool isInput)
+    {
+        auto index = handle.getRawHandle() - 1;
+
+        if (isLinked() && index < endpoints.size())
+        {
+            auto& e = *endpoints[index];
+
+            if (e.isInput == isInput)
+                return std::addressof (e);
+        }
+
+        return nullptr;
+    }
+
+    /// Converts an incoming value into the endpoint's buffer for the given type, and returns a pointer
+    /// to it, or nullptr if it couldn't be converted. Only strings and unsized arrays, which have to be
+    /// added to the program's tables, need to go through a Value, which allocates.
+    const void* convertValue (EndpointInfo& e, size_t typeIndex, const choc::value::ValueView& source)
+    {
+        auto& type = e.types[typeIndex];
+        auto dest = e.packedValues[typeIndex].data();
+
+        if (writePackedValue (type, source, dest))
+            return dest;
+
+        CompileMessageList messageList;
+
+        try
+        {
+            CompileMessageHandler handler (messageList);
+            auto value = Value::fromExternalValue (type, source, program.getConstantTable(), program.getStringDictionary());
+            std::memcpy (dest, value.getPackedData(), e.packedValues[typeIndex].size());
+            return dest;
+        }
+        catch (AbortCompilationException) {}
+
+        return nullptr;
+    }
+
+    template <typename PrimitiveType>
+    static bool writePrimitive (uint8_t* dest, PrimitiveType value)
+    {
+        std::memcpy (dest, std::addressof (value), sizeof (value));
+        return true;
+    }
+
+    /// Writes a value in the packed layout that the native code uses for the given type, without
+    /// allocating. This follows the same rules as Value::fromExternalValue(), but returns false for
+    /// the types that it can't handle, or if the value can't be converted.
+    static bool writePackedValue (const Type& type, const choc::value::ValueView& source, uint8_t* dest)
+    {
+        if (type.isPrimitive())
+        {
+            if (! (source.isPrimitive() || source.getType().isVectorSize1()))
+                return false;
+
+            if (type.isFloat32())    return writePrimitive (dest, source.get<float>());
+            if (type.isFloat64())    return writePrimitive (dest, source.get<double>());
+            if (type.isInteger32())  return writePrimitive (dest, source.get<int32_t>());
+            if (type.isInteger64())  return writePrimitive (dest, source.get<int64_t>());
+            if (type.isBool())       return writePrimitive (dest, static_cast<uint8_t> (source.get<bool>() ? 1 : 0));
+
+            return false;
+        }
+
+        if (type.isVector())
+        {
+            auto size = static_cast<uint32_t> (type.getVectorSize());
+            Type elementType (type.getVectorElementType());
+            auto elementSize = static_cast<size_t> (elementType.getPackedSizeInBytes());
+
+            if (source.isPrimitive())
+            {
+                for (uint32_t i = 0; i < size; ++i)
+                    if (! writePackedValue (elementType, source, dest + i * elementSize))
+                        return false;
+
+                return true;
+            }
+
+            if (! (source.isVector() && source.size() == size))
+                return false;
+
+            for (uint32_t i = 0; i < size; ++i)
+                if (! writePackedValue (elementType, source[i], dest + i * elementSize))
+                    return false;
+
+            return true;
+        }
+
+        if (type.isFixedSizeArray())
+        {
+            auto size = static_cast<uint32_t> (type.getArraySize());
+            auto elementType = type.getArrayElementType();
+            auto elementSize = static_cast<size_t> (elementType.getPackedSizeInBytes());
+
+            if (! (source.isArray() && source.size() == size))
+                return false;
+
+            for (uint32_t i = 0; i < size; ++i)
+                if (! writePackedValue (elementType, source[i], dest + i * elementSize))
+                    return false;
+
+            return true;
+        }
+
+        if (type.isStruct())
+        {
+            auto& members = type.getStructRef().getMembers();
+
+            if (! (source.isObject() && source.size() == members.size()))
+                return false;
+
+            for (auto& m : members)
+            {
+                bool found = false;
+
+                for (uint32_t i = 0; i < source.size(); ++i)
+                {
+                    auto sourceMember = source.getObjectMemberAt (i);
+
+                    if (m.name == sourceMember.name)
+                    {
+                        if (! writePackedValue (m.type, sourceMember.value, dest))
+                            return false;
+
+                        found = true;
+                        break;
+                    }
+                }
+
+                if (! found)
+                    return false;
+
+                dest += m.type.getPackedSizeInBytes();
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void unlinkLibrary()
+    {
+        if (instance != nullptr)
+        {
+            functions.destroy (instance);
+            instance = nullptr;
+        }
+
+        functions = {};
+        library.reset();
+        stateType = {};
+        preparedProgram = {};
+        blockSize = 0;
+        numFramesInBlock = 0;
+    }
+
+    //==============================================================================
+    void linkProgram (CompileMessageList& messageList, const BuildSettings& settings, LinkerCache* cache)
+    {
+        for (auto& v : program.getExternalVariables())
+            if (v->externalHandle == 0)
+                v->location.throwError (Errors::unresolvedExternal (getExternalVariableName (v)));
+
+        if (heart::Utilities::usesMultiFrameStreamAccess (program))
+            CodeLocation().throwError (Errors::multiFrameStreamAccessNotSupported());
+
+        auto buildSettings = settings;
+
+        if (buildSettings.maxBlockSize == 0)
+            buildSettings.maxBlockSize = defaultBlockSize;
+
+        preparedProgram = options.prepareProgramForCodeGen (program.clone(), buildSettings);
+        findNativeEndpointIndexes (preparedProgram.getMainProcessor());
+
+        CodeGenOptions codeGenOptions;
+        codeGenOptions.buildSettings = buildSettings;
+        codeGenOptions.generateRenderMethod = false;
+        codeGenOptions.generatePluginMethods = false;
+        codeGenOptions.createEndpointFunctions = false;
+        codeGenOptions.packStructures = true;
+        codeGenOptions.generateSharedLibraryInterface = true;
+
+        auto code = generateCode (preparedProgram, messageList, codeGenOptions);
+
+        if (code.empty())
+            throw AbortCompilationException();
+
+        auto libraryFile = buildLibrary (code, cache);
+        library = std::make_unique<SharedLibrary> (libraryFile);
+
+        if (library->handle == nullptr)
+            CodeLocation().throwError (Errors::cannotLoadLibrary (libraryFile));
+
+        functions.findAll (*library, libraryFile);
+
+        instance = functions.create();
+        functions.init (instance, buildSettings.sampleRate, buildSettings.sessionID);
+        blockSize = buildSettings.maxBlockSize;
+        findStateType();
+
+        for (auto& e : endpoints)
+            if (e->isInput && e->details.endpointType == EndpointType::stream)
+                e->scratchSpace.resize (blockSize * static_cast<size_t> (e->types.front().getPackedSizeInBytes()));
+    }
+
+    /// The state can only be moved to or from another performer if the native _State struct
+    /// has exactly the packed layout that its HEART type describes
+    void findStateType()
+    {
+        if (auto s = preparedProgram.getMainProcessor().structs.find ("_State"))
+        {
+            auto type = Type::createStruct (*s);
+
+            if (type.getPackedSizeInBytes() == functions.getStateSize())
+                stateType = type;
+        }
+    }
+
+    void findNativeEndpointIndexes (const Module& preparedMainProcessor)
+    {
+        auto findIndex = [] (const auto& list, const std::string& name) -> uint32_t
+        {
+            for (size_t i = 0; i < list.size(); ++i)
+                if (list[i]->name.toString() == name)
+                    return static_cast<uint32_t> (i);
+
+            CodeLocation().throwError (Errors::cannotFindEndpoint (name));
+        };
+
+        for (auto& e : endpoints)
+            e->nativeIndex = e->isInput ? findIndex (preparedMainProcessor.inputs, e->details.name)
+                                        : findIndex (preparedMainProcessor.outputs, e->details.name);
+    }
+
+    //==============================================================================
+    std::string getCompilerCommand() const
+    {
+        if (! options.compilerCommand.empty())
+            return options.compilerCommand;
+
+        if (auto cxx = std::getenv ("CXX"))
+            if (*cxx != 0)
+                return cxx;
+
+        return "c++";
+    }
+
+    std::filesystem::path getTemporaryFolder() const
+    {
+        if (! options.temporaryFolder.empty())
+            return options.temporaryFolder;
+
+        std::error_code error;
+        auto folder = std::filesystem::temp_directory_path (error);
+
+        if (error)
+            CodeLocation().throwError (Errors::cannotCreateFolder ("temp"));
+
+        return folder;
+    }
+
+    /** Returns a sub-folder of the temporary folder which only the current user can write to.
+        The temp folder itself is usually shared, so if libraries were built there, anyone
+        could leave a library with the right name for us to load. The sub-folder's ownership
+        and permissions are checked every time, in case someone else created it first.
+    */
+    std::filesystem::path getPrivateBuildFolder() const
+    {
+       #ifdef WIN32
+        // On Windows the temp folder is already inside the user's profile
+        auto folder = getTemporaryFolder() / "soul_native";
+        std::error_code error;
+        std::filesystem::create_directories (folder, error);
+
+        if (! std::filesystem::is_directory (folder, error))
+            CodeLocation().throwError (Errors::cannotCreateFolder (folder.string()));
+       #else
+        auto folder = getTemporaryFolder() / ("soul_native_" + std::to_string (::geteuid()));
+
+        if (::mkdir (folder.c_str(), 0700) != 0 && errno != EEXIST)
+            CodeLocation().throwError (Errors::cannotCreateFolder (folder.string()));
+
+        struct stat info;
+
+        if (::lstat (folder.c_str(), &info) != 0
+             || ! S_ISDIR (info.st_mode)
+             || info.st_uid != ::geteuid()
+             || (info.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+            CodeLocation().throwError (Errors::insecureBuildFolder (folder.string()));
+       #endif
+
+        return folder;
+    }
+
+    /// Checks that a library file is a regular file that belongs to us and that nobody else can modify
+    static bool isTrustedLibraryFile (const std::filesystem::path& file)
+    {
+       #ifdef WIN32
+        std::error_code error;
+        return std::filesystem::is_regular_file (file, error);
+       #else
+        struct stat info;
+
+        return ::lstat (file.c_str(), &info) == 0
+                && S_ISREG (info.st_mode)
+                && info.st_uid == ::geteuid()
+                && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+       #endif
+    }
+
+    static const char* getLibrarySuffix()
+    {
+       #ifdef WIN32
+        return ".dll";
+       #elif __APPLE__
+        return ".dylib";
+       #else
+        return ".so";
+       #endif
+    }
+
+    static void writeFile (const std::filesystem::path& file, const void* data, size_t size)
+    {
+        std::ofstream out (file, std::ios::binary | std::ios::trunc);
+
+        if (! (out && out.write (static_cast<const char*> (data), static_cast<std::streamsize> (size))))
+            CodeLocation().throwError (Errors::cannotWriteFile (file.string()));
+    }
+
+    static void appendArguments (std::vector<std::string>& args, const std::string& text)
+    {
+        for (auto& arg : choc::text::splitAtWhitespace (text, false))
+            if (! arg.empty())
+                args.push_back (arg);
+    }
+
+    /** Runs a process directly, without going through a shell, so that nothing in the
+        arguments can be interpreted as a command. Its output is written to the log file, and
+        the result is the process's exit code, or -1 if it couldn't be run.
+    */
+    static int runProcess (const std::vector<std::string>& args, const std::filesystem::path& logFile)
+    {
+        SOUL_ASSERT (! args.empty());
+
+       #ifdef WIN32
+        std::string commandLine;
+
+        for (auto& arg : args)
+        {
+            if (! commandLine.empty())
+                commandLine += ' ';
+
+            commandLine += quoteWindowsArgument (arg);
+        }
+
+        SECURITY_ATTRIBUTES security = { sizeof (SECURITY_ATTRIBUTES), nullptr, TRUE };
+        auto log = ::CreateFileW (logFile.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ, &security,
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (log == INVALID_HANDLE_VALUE)
+            return -1;
+
+        STARTUPINFOA startupInfo = {};
+        startupInfo.cb = sizeof (startupInfo);
+        startupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startupInfo.hStdInput = ::GetStdHandle (STD_INPUT_HANDLE);
+        startupInfo.hStdOutput = log;
+        startupInfo.hStdError = log;
+
+        PROCESS_INFORMATION processInfo = {};
+        DWORD exitCode = 0;
+
+        if (! ::CreateProcessA (nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW,
+                                nullptr, nullptr, &startupInfo, &processInfo))
+        {
+            ::CloseHandle (log);
+            return -1;
+        }
+
+        ::WaitForSingleObject (processInfo.hProcess, INFINITE);
+        auto gotExitCode = ::GetExitCodeProcess (processInfo.hProcess, &exitCode);
+        ::CloseHandle (processInfo.hProcess);
+        ::CloseHandle (processInfo.hThread);
+        ::CloseHandle (log);
+
+        return gotExitCode ? static_cast<int> (exitCode) : -1;
+       #else
+        std::vector<char*> argv;
+
+        for (auto& arg : args)
+            argv.push_back (const_cast<char*> (arg.c_str()));
+
+        argv.push_back (nullptr);
+
+        posix_spawn_file_actions_t actions;
+        ::posix_spawn_file_actions_init (&actions);
+        ::posix_spawn_file_actions_addopen (&actions, STDOUT_FILENO, logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        ::posix_spawn_file_actions_adddup2 (&actions, STDOUT_FILENO, STDERR_FILENO);
+
+        pid_t processID = 0;
+        auto spawnResult = ::posix_spawnp (&processID, argv.front(), &actions, nullptr, argv.data(), environ);
+        ::posix_spawn_file_actions_destroy (&actions);
+
+        if (spawnResult != 0)
+            return -1;
+
+        int status = 0;
+
+        while (::waitpid (processID, &status, 0) < 0)
+            if (errno != EINTR)
+                return -1;
+
+        return WIFEXITED (status) ? WEXITSTATUS (status) : -1;
+       #endif
+    }
+
+   #ifdef WIN32
+    /// Quotes an argument using the rules that the Microsoft C runtime uses to split a command line
+    static std::string quoteWindowsArgument (const std::string& arg)
+    {
+        if (! arg.empty() && arg.find_first_of (" \t\n\v\"") == std::string::npos)
+            return arg;
+
+        std::string result ("\"");
+        size_t numBackslashes = 0;
+
+        for (auto c : arg)
+        {
+            if (c == '\\')
+            {
+                ++numBackslashes;
+                continue;
+            }
+
+            result.append (c == '"' ? numBackslashes * 2 + 1 : numBackslashes, '\\');
+            result += c;
+            numBackslashes = 0;
+        }
+
+        result.append (numBackslashes * 2, '\\');
+        return result + '"';
+    }
+   #endif
+
+    /** Returns the path of a shared library built from the given code. Because the library
+        filename is a hash of the code and compiler settings, a library that's already in the
+        build folder can be re-used directly. Otherwise it's fetched from the LinkerCache, or
+        compiled. The library is written under a temporary name and then renamed so that other
+        performers can never see a partially-written file. Libraries are only ever loaded from
+        a folder that belongs to the current user, and only if nobody else could have modified them.
+    */
+    std::string buildLibrary (const std::string& code, LinkerCache* cache)
+    {
+        auto compiler = getCompilerCommand();
+
+        HashBuilder hash;
+        hash << code << compiler << options.compilerFlags;
+        auto key = sharedLibrarySymbolPrefix + hash.toString();
+
+        auto folder = getPrivateBuildFolder();
+        auto libraryFile = folder / (key + getLibrarySuffix());
+        std::error_code error;
+
+        if (std::filesystem::exists (libraryFile, error))
+        {
+            if (isTrustedLibraryFile (libraryFile))
+                return libraryFile.string();
+
+            std::filesystem::remove (libraryFile, error);
+        }
+
+        auto uniqueSuffix = "_" + choc::text::createHexString (reinterpret_cast<uintptr_t> (this));
+        auto tempLibraryFile = folder / (key + uniqueSuffix + getLibrarySuffix());
+
+        if (! readLibraryFromCache (cache, key, tempLibraryFile))
+        {
+            auto sourceFile = folder / (key + uniqueSuffix + ".cpp");
+            auto logFile    = folder / (key + uniqueSuffix + ".log");
+
+            writeFile (sourceFile, code.data(), code.length());
+
+            std::vector<std::string> args;
+            appendArguments (args, compiler);
+            args.insert (args.end(), { "-std=c++17", "-shared", "-fPIC" });
+            appendArguments (args, options.compilerFlags);
+            args.insert (args.end(), { "-o", tempLibraryFile.string(), sourceFile.string() });
+
+            if (args.front().empty())
+                CodeLocation().throwError (Errors::nativeCompilationFailed (compiler));
+
+            auto result = runProcess (args, logFile);
+            auto log = choc::text::trim (loadFileAsString (logFile.string().c_str()));
+
+            std::filesystem::remove (sourceFile, error);
+            std::filesystem::remove (logFile, error);
+
+            if (result != 0 || ! std::filesystem::exists (tempLibraryFile, error))
+                CodeLocation().throwError (Errors::nativeCompilationFailed (log.empty() ? choc::text::joinStrings (args, " ") : log));
+
+            if (cache != nullptr)
+            {
+                auto binary = loadFileAsString (tempLibraryFile.string().c_str());
+
+                if (! binary.empty())
+                    cache->storeItem (key.c_str(), binary.data(), binary.size());
+            }
+        }
+
+        std::filesystem::permissions (tempLibraryFile, std::filesystem::perms::owner_all,
+                                      std::filesystem::perm_options::replace, error);
+        std::filesystem::rename (tempLibraryFile, libraryFile, error);
+
+        if (error)
+            std::filesystem::remove (tempLibraryFile, error);
+
+        if (! isTrustedLibraryFile (libraryFile))
+            CodeLocation().throwError (Errors::cannotLoadLibrary (libraryFile.string()));
+
+        return libraryFile.string();
+    }
+
+    static bool readLibraryFromCache (LinkerCache* cache, const std::string& key, const std::filesystem::path& destFile)
+    {
+        if (cache == nullptr)
+            return false;
+
+        auto size = cache->readItem (key.c_str(), nullptr, 0);
+
+        if (size == 0)
+            return false;
+
+        std::vector<char> data (static_cast<size_t> (size));
+
+        if (cache->readItem (key.c_str(), data.data(), size) != size)
+            return false;
+
+        writeFile (destFile, data.data(), data.size());
+        return true;
+    }
+};
+
+//==============================================================================
+std::unique_ptr<Performer> createNativePerformer (NativePerformerOptions options)
+{
+    if (options.prepareProgramForCodeGen == nullptr)
+        return {};
+
+    return std::make_unique<NativePerformer> (std::move (options));
+}
+
+std::unique_ptr<PerformerFactory> createNativePerformerFactory (NativePerformerOptions options)
+{
+    struct NativePerformerFactory  : public PerformerFactory
+    {
+        NativePerformerFactory (NativePerformerOptions o) : options (std::move (o)) {}
+
+        std::unique_ptr<Performer> createPerformer() override   { return createNativePerformer (options); }
+
+        NativePerformerOptions options;
+    };
+
+    if (options.prepareProgramForCodeGen == nullptr)
+        return {};
+
+    return std::make_unique<NativePerformerFactory> (std::move (options));
+}
+
+} // namespace soul::cpp
@@ -0,0 +1,49 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul::cpp
+{
+    struct NativePerformerOptions
+    {
+        std::string compilerCommand;         ///< The C++ compiler to run. If empty, this uses the CXX environment variable, or "c++"
+        std::string compilerFlags = "-O2";   ///< Any extra flags to pass to the compiler
+        std::string temporaryFolder;         ///< Where to write the generated source and library. If empty, the system temp folder is used
+
+        /// The C++ generator needs the program to have been through the code-gen lowering stage
+        /// (creating the _State struct, endpoint accessor functions, etc.) before it's called.
+        /// This function must perform that transformation, and may update the BuildSettings.
+        std::function<Program(Program, BuildSettings&)> prepareProgramForCodeGen;
+    };
+
+    /// Creates a Performer which links a program by generating C++ for it, building that
+    /// into a shared library with the system's C++ compiler, and then running the native code.
+    /// If a LinkerCache is provided at link time, it's used to store the compiled libraries so
+    /// that programs which generate identical code don't need to be re-compiled.
+    ///
+    /// The code-gen preparation stage isn't part of this library (it lives with the closed-source
+    /// backend that turns HEART into something playable), so there's no default for it, and this
+    /// returns nullptr unless the options provide one in prepareProgramForCodeGen. For the same
+    /// reason, none of the venues or tools here create native performers by themselves.
+    std::unique_ptr<Performer> createNativePerformer (NativePerformerOptions);
+
+    /// Returns a factory that creates native performers using the given options, or nullptr
+    /// if the options don't provide a prepareProgramForCodeGen function.
+    std::unique_ptr<PerformerFactory> createNativePerformerFactory (NativePerformerOptions);
+}
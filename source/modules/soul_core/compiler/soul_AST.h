@@ -21,6 +21,8 @@
 namespace soul
 {
 
+struct ASTCloner;
+
 //==============================================================================
 /**
     High-level compiler AST classes
@@ -104,6 +106,24 @@ struct AST
         #undef SOUL_DECLARE_ENUM
     };
 
+    template <typename Type>
+    static constexpr bool isConcreteObjectType()
+    {
+        #define SOUL_CHECK_TYPE(T)    std::is_same<Type, T>::value ||
+        return SOUL_AST_ALL_TYPES (SOUL_CHECK_TYPE) false;
+        #undef SOUL_CHECK_TYPE
+    }
+
+    template <typename Type>
+    static constexpr ObjectType getObjectType()
+    {
+        static_assert (isConcreteObjectType<Type>());
+        #define SOUL_GET_OBJECT_TYPE(T)    if constexpr (std::is_same<Type, T>::value) return ObjectType::T; else
+        SOUL_AST_ALL_TYPES (SOUL_GET_OBJECT_TYPE)
+        #undef SOUL_GET_OBJECT_TYPE
+        return {};
+    }
+
     static constexpr size_t maxIdentifierLength = 128;
     static constexpr size_t maxInitialiserListLength = 1024 * 64;
     static constexpr size_t maxEndpointArraySize = 256;
@@ -155,7 +175,19 @@ struct AST
         Allocator (Allocator&&) = default;
 
         template <typename Type, typename... Args>
-        Type& allocate (Args&&... args)   { return pool.allocate<Type> (std::forward<Args> (args)...); }
+        Type& allocate (Args&&... args)
+        {
+            auto& o = pool.allocate<Type> (std::forward<Args> (args)...);
+
+            if constexpr (std::is_base_of<ASTObject, Type>::value)
+            {
+                CompileProfiler::countAllocation (CompileProfiler::Counter::astObjects, sizeof (Type));
+                static_assert (isConcreteObjectType<Type>(), "All ASTObject classes must be listed in SOUL_AST_ALL_TYPES");
+                SOUL_ASSERT (o.objectType == getObjectType<Type>());
+            }
+
+            return o;
+        }
 
         template <typename Type>
         Identifier get (const Type& newString)  { return identifiers.get (newString); }
@@ -230,6 +262,26 @@ struct AST
 
         Scope* getParentScope() const           { return context.parentScope; }
 
+        /// Allows soul::cast() to use the objectType rather than a dynamic_cast
+        using CastRootType = ASTObject;
+
+        template <typename TargetType>
+        static TargetType* castTo (ASTObject& o) noexcept
+        {
+            switch (o.objectType)
+            {
+                #define SOUL_CAST_TO_TARGET(Type) \
+                    case ObjectType::Type: \
+                        if constexpr (std::is_base_of<TargetType, Type>::value) return static_cast<Type*> (std::addressof (o)); \
+                        else return nullptr;
+
+                SOUL_AST_ALL_TYPES (SOUL_CAST_TO_TARGET)
+                #undef SOUL_CAST_TO_TARGET
+            }
+
+            return nullptr;
+        }
+
         const ObjectType objectType;
         Context context;
     };
@@ -324,6 +376,119 @@ struct AST
         ArrayWithPreallocation<std::string, 4> imports;
     };
 
+    //==============================================================================
+    /** A list of the named items that are declared in a scope.
+
+        As well as holding the items in order, this keeps an index of their names, so that
+        looking one up doesn't need to scan the whole list. The index is kept up to date as
+        items are appended, and rebuilt lazily after any other kind of change. If an item's
+        name is changed after it has been added, call invalidateIndex() afterwards.
+    */
+    template <typename ItemType>
+    struct DeclarationList
+    {
+        using value_type = pool_ref<ItemType>;
+        using const_iterator = typename std::vector<pool_ref<ItemType>>::const_iterator;
+        using iterator = const_iterator;
+        using difference_type = typename std::vector<pool_ref<ItemType>>::difference_type;
+
+        size_t size() const noexcept                                        { return items.size(); }
+        bool empty() const noexcept                                         { return items.empty(); }
+        const pool_ref<ItemType>* data() const noexcept                     { return items.data(); }
+        const pool_ref<ItemType>& operator[] (size_t i) const noexcept      { return items[i]; }
+        const pool_ref<ItemType>& front() const noexcept                    { return items.front(); }
+        const pool_ref<ItemType>& back() const noexcept                     { return items.back(); }
+        const_iterator begin() const noexcept                               { return items.begin(); }
+        const_iterator end() const noexcept                                 { return items.end(); }
+
+        void reserve (size_t numItems)                                      { items.reserve (numItems); }
+
+        void push_back (pool_ref<ItemType> item)
+        {
+            items.push_back (item);
+
+            if (indexIsValid)
+            {
+                // items which get their names after being added can't be indexed yet
+                if (item->name.isValid())
+                    index[item->name].push_back (static_cast<uint32_t> (items.size() - 1));
+                else
+                    invalidateIndex();
+            }
+        }
+
+        void insert (const_iterator position, pool_ref<ItemType> item)     { items.insert (position, item); invalidateIndex(); }
+        void erase (const_iterator position)                                { items.erase (position); invalidateIndex(); }
+        void erase (const_iterator first, const_iterator last)              { items.erase (first, last); invalidateIndex(); }
+        void clear()                                                        { items.clear(); invalidateIndex(); }
+
+        void set (size_t position, pool_ref<ItemType> newItem)
+        {
+            if (items[position] != newItem)
+            {
+                items[position] = newItem;
+                invalidateIndex();
+            }
+        }
+
+        template <typename Predicate>
+        bool removeIf (Predicate&& pred)
+        {
+            if (! soul::removeIf (items, pred))
+                return false;
+
+            invalidateIndex();
+            return true;
+        }
+
+        /// Returns the first item with the given name, or nullptr if there isn't one
+        pool_ptr<ItemType> findFirst (Identifier name) const
+        {
+            if (auto positions = findPositions (name))
+                return items[positions->front()];
+
+            return {};
+        }
+
+        /// Calls a function for each item with the given name, in the order they were declared
+        template <typename Fn>
+        void forEachWithName (Identifier name, Fn&& fn) const
+        {
+            if (auto positions = findPositions (name))
+                for (auto i : *positions)
+                    fn (items[i].get());
+        }
+
+        void invalidateIndex() noexcept     { indexIsValid = false; }
+
+    private:
+        using PositionList = ArrayWithPreallocation<uint32_t, 2>;
+
+        std::vector<pool_ref<ItemType>> items;
+        mutable std::unordered_map<Identifier, PositionList, Identifier::Hash> index;
+        mutable bool indexIsValid = false;
+
+        const PositionList* findPositions (Identifier name) const
+        {
+            if (! indexIsValid)
+                rebuildIndex();
+
+            auto found = index.find (name);
+            return found != index.end() ? std::addressof (found->second) : nullptr;
+        }
+
+        void rebuildIndex() const
+        {
+            index.clear();
+
+            for (uint32_t i = 0; i < items.size(); ++i)
+                if (items[i]->name.isValid())
+                    index[items[i]->name].push_back (i);
+
+            indexIsValid = true;
+        }
+    };
+
     //==============================================================================
     struct Scope
     {
@@ -386,6 +551,14 @@ struct AST
         virtual choc::span<pool_ref<ProcessorAliasDeclaration>>  getProcessorAliases() const     { return {}; }
         virtual choc::span<pool_ref<ProcessorInstance>>          getProcessorInstances() const   { return {}; }
 
+        /// For scopes which keep their declarations in a DeclarationList, these provide
+        /// access to the lists, so that names can be looked up using their indexes
+        virtual const DeclarationList<VariableDeclaration>*         getVariableList() const             { return {}; }
+        virtual const DeclarationList<Function>*                    getFunctionListIfPresent() const    { return {}; }
+        virtual const DeclarationList<EndpointDeclaration>*         getEndpointList() const             { return {}; }
+        virtual const DeclarationList<ModuleBase>*                  getSubModuleList() const            { return {}; }
+        virtual const DeclarationList<ProcessorAliasDeclaration>*   getProcessorAliasList() const       { return {}; }
+
         //==============================================================================
         struct NameSearch
         {
@@ -415,6 +588,13 @@ struct AST
                 addFirstWithName (array, partiallyQualifiedPath.getLastPart());
             }
 
+            template <typename ItemType>
+            void addFirstWithName (const DeclarationList<ItemType>& list, Identifier targetName)
+            {
+                if (auto found = list.findFirst (targetName))
+                    addResult (*found);
+            }
+
             template <typename ArrayType>
             void addFirstWithName (const ArrayType& array, Identifier targetName)
             {
@@ -453,9 +633,19 @@ struct AST
 
         pool_ptr<ModuleBase> findSubModuleNamed (Identifier name) const
         {
-            for (auto& m : getSubModules())
-                if (m->name == name && (! m->isTemplateModule()))
-                    return m;
+            if (auto subModules = getSubModuleList())
+            {
+                pool_ptr<ModuleBase> found;
+
+                subModules->forEachWithName (name, [&] (ModuleBase& m)
+                {
+                    if (found == nullptr && ! m.isTemplateModule())
+                        found = m;
+                });
+
+                if (found != nullptr)
+                    return found;
+            }
 
             for (auto& a : getNamespaceAliases())
                 if (a->name == name)
@@ -600,8 +790,8 @@ struct AST
         choc::span<pool_ref<UsingDeclaration>>                 getUsingDeclarations() const override { return usings; }
         choc::span<pool_ref<NamespaceAliasDeclaration>>        getNamespaceAliases() const override  { return namespaceAliases; }
 
-        virtual std::vector<pool_ref<VariableDeclaration>>&    getStateVariableList() = 0;
-        virtual std::vector<pool_ref<Function>>*               getFunctionList() = 0;
+        virtual DeclarationList<VariableDeclaration>&          getStateVariableList() = 0;
+        virtual DeclarationList<Function>*                     getFunctionList() = 0;
 
         size_t getNumInputs() const                 { return countEndpoints (true); }
         size_t getNumOutputs() const                { return countEndpoints (false); }
@@ -630,47 +820,55 @@ struct AST
             auto targetName = search.partiallyQualifiedPath.getLastPart();
 
             if (search.findVariables)
-                search.addFirstWithName (getVariables(), targetName);
+                if (auto variables = getVariableList())
+                    search.addFirstWithName (*variables, targetName);
 
             if (search.findTypes)
             {
-                search.addFirstWithName (getStructDeclarations(), targetName);
-                search.addFirstWithName (getUsingDeclarations(), targetName);
+                search.addFirstWithName (structures, targetName);
+                search.addFirstWithName (usings, targetName);
             }
 
             if (search.findFunctions)
             {
-                for (auto& f : getFunctions())
+                if (auto functions = getFunctionListIfPresent())
                 {
-                    if (f->name == targetName
-                         && (search.requiredNumFunctionArgs < 0
-                              || f->parameters.size() == static_cast<uint32_t> (search.requiredNumFunctionArgs)))
+                    functions->forEachWithName (targetName, [&] (Function& f)
                     {
-                        search.addResult (f);
-                    }
+                        if (search.requiredNumFunctionArgs < 0
+                             || f.parameters.size() == static_cast<uint32_t> (search.requiredNumFunctionArgs))
+                            search.addResult (f);
+                    });
                 }
             }
 
             if (search.findEndpoints)
-                search.addFirstWithName (getEndpoints(), targetName);
+                if (auto endpoints = getEndpointList())
+                    search.addFirstWithName (*endpoints, targetName);
 
             if (search.findNamespaces || search.findProcessors)
             {
-                for (auto& m : getSubModules())
+                if (auto subModules = getSubModuleList())
                 {
-                    if (m->name == targetName)
+                    bool found = false;
+
+                    subModules->forEachWithName (targetName, [&] (ModuleBase& m)
                     {
-                        if ((search.findNamespaces && m->isNamespace())
-                             || (search.findProcessors && (m->isProcessor() || m->isGraph())))
+                        if (! found && ((search.findNamespaces && m.isNamespace())
+                                          || (search.findProcessors && (m.isProcessor() || m.isGraph()))))
                         {
                             search.addResult (m);
-                            break;
+                            found = true;
                         }
-                    }
+                    });
                 }
 
-                if (search.findNamespaces)  search.addFirstWithName (getNamespaceAliases(), targetName);
-                if (search.findProcessors)  search.addFirstWithName (getProcessorAliases(), targetName);
+                if (search.findNamespaces)
+                    search.addFirstWithName (namespaceAliases, targetName);
+
+                if (search.findProcessors)
+                    if (auto aliases = getProcessorAliasList())
+                        search.addFirstWithName (*aliases, targetName);
             }
         }
 
@@ -685,9 +883,9 @@ struct AST
         virtual void addSpecialisationParameter (NamespaceAliasDeclaration&) = 0;
 
         std::vector<pool_ref<ASTObject>> specialisationParams;
-        std::vector<pool_ref<UsingDeclaration>> usings;
-        std::vector<pool_ref<NamespaceAliasDeclaration>> namespaceAliases;
-        std::vector<pool_ref<StructDeclaration>> structures;
+        DeclarationList<UsingDeclaration> usings;
+        DeclarationList<NamespaceAliasDeclaration> namespaceAliases;
+        DeclarationList<StructDeclaration> structures;
         std::vector<pool_ref<StaticAssertion>> staticAssertions;
 
         std::function<ModuleBase&(Allocator&, Namespace& parentNamespace, const std::string& newName)> createClone;
@@ -719,6 +917,7 @@ struct AST
         ProcessorBase* getAsProcessor() override        { return this; }
 
         choc::span<pool_ref<EndpointDeclaration>>  getEndpoints() const override        { return endpoints; }
+        const DeclarationList<EndpointDeclaration>* getEndpointList() const override    { return std::addressof (endpoints); }
 
         template <typename StringType>
         pool_ptr<EndpointDeclaration> findEndpoint (const StringType& nameToFind, bool isInput) const
@@ -742,7 +941,7 @@ struct AST
 
         bool isSpecialisedInstance() const      { return owningInstance != nullptr; }
 
-        std::vector<pool_ref<EndpointDeclaration>> endpoints;
+        DeclarationList<EndpointDeclaration> endpoints;
         Annotation annotation;
         pool_ptr<ProcessorInstance> owningInstance;
         pool_ptr<ProcessorBase> originalBeforeSpecialisation;
@@ -769,8 +968,11 @@ struct AST
         choc::span<pool_ref<Function>>               getFunctions() const override           { return functions; }
         choc::span<pool_ref<StructDeclaration>>      getStructDeclarations() const override  { return structures; }
 
-        std::vector<pool_ref<VariableDeclaration>>&  getStateVariableList() override         { return stateVariables; }
-        std::vector<pool_ref<Function>>*             getFunctionList() override              { return &functions; }
+        DeclarationList<VariableDeclaration>&        getStateVariableList() override         { return stateVariables; }
+        DeclarationList<Function>*                   getFunctionList() override              { return &functions; }
+
+        const DeclarationList<VariableDeclaration>*  getVariableList() const override            { return &stateVariables; }
+        const DeclarationList<Function>*             getFunctionListIfPresent() const override   { return &functions; }
 
         pool_ptr<Expression> latency;
 
@@ -790,8 +992,8 @@ struct AST
         void addSpecialisationParameter (ProcessorAliasDeclaration&) override { SOUL_ASSERT_FALSE; }
         void addSpecialisationParameter (NamespaceAliasDeclaration&) override { SOUL_ASSERT_FALSE; }
 
-        std::vector<pool_ref<Function>> functions;
-        std::vector<pool_ref<VariableDeclaration>> stateVariables;
+        DeclarationList<Function> functions;
+        DeclarationList<VariableDeclaration> stateVariables;
     };
 
     //==============================================================================
@@ -821,13 +1023,16 @@ struct AST
         choc::span<pool_ref<VariableDeclaration>>       getVariables() const override            { return constants; }
         choc::span<pool_ref<ProcessorInstance>>         getProcessorInstances() const override   { return processorInstances; }
 
-        std::vector<pool_ref<VariableDeclaration>>&     getStateVariableList() override          { return constants; }
-        std::vector<pool_ref<Function>>*                getFunctionList() override               { return {}; }
+        DeclarationList<VariableDeclaration>&           getStateVariableList() override          { return constants; }
+        DeclarationList<Function>*                      getFunctionList() override               { return {}; }
+
+        const DeclarationList<VariableDeclaration>*        getVariableList() const override         { return &constants; }
+        const DeclarationList<ProcessorAliasDeclaration>*  getProcessorAliasList() const override   { return &processorAliases; }
 
         std::vector<pool_ref<ProcessorInstance>> processorInstances;
         std::vector<pool_ref<Connection>> connections;
-        std::vector<pool_ref<VariableDeclaration>> constants;
-        std::vector<pool_ref<ProcessorAliasDeclaration>> processorAliases;
+        DeclarationList<VariableDeclaration> constants;
+        DeclarationList<ProcessorAliasDeclaration> processorAliases;
 
         void addProcessorInstance (ProcessorInstance& newInstance)
         {
@@ -895,13 +1100,17 @@ struct AST
         choc::span<pool_ref<StructDeclaration>> getStructDeclarations() const override  { return structures; }
         choc::span<pool_ref<ModuleBase>> getSubModules() const override                 { return subModules; }
 
-        std::vector<pool_ref<Function>>* getFunctionList() override                     { return &functions; }
-        std::vector<pool_ref<VariableDeclaration>>& getStateVariableList() override     { return constants; }
+        DeclarationList<Function>* getFunctionList() override                           { return &functions; }
+        DeclarationList<VariableDeclaration>& getStateVariableList() override           { return constants; }
+
+        const DeclarationList<VariableDeclaration>* getVariableList() const override            { return &constants; }
+        const DeclarationList<Function>* getFunctionListIfPresent() const override              { return &functions; }
+        const DeclarationList<ModuleBase>* getSubModuleList() const override                    { return &subModules; }
 
         ImportsList importsList;
-        std::vector<pool_ref<Function>> functions;
-        std::vector<pool_ref<ModuleBase>> subModules;
-        std::vector<pool_ref<VariableDeclaration>> constants;
+        DeclarationList<Function> functions;
+        DeclarationList<ModuleBase> subModules;
+        DeclarationList<VariableDeclaration> constants;
 
         struct NamespaceInstance
         {
@@ -1291,6 +1500,7 @@ struct AST
         Annotation annotation;
         IntrinsicType intrinsic = IntrinsicType::none;
         bool eventFunction = false;
+        bool isFullyResolved = false; // set once the ResolutionPass has nothing left to do in this function
 
         pool_ptr<Block> block;
         pool_ptr<heart::Function> generatedFunction;
@@ -1394,10 +1604,10 @@ struct AST
 
         bool isResolved() const override
         {
-            if (isBeingResolved)
+            if (contains (ScopedResolver::getStructsBeingResolved(), this))
                 return false;
 
-            ScopedResolver scopedResolver (isBeingResolved);
+            ScopedResolver scopedResolver (*this);
 
             for (auto& m : members)
                 if (! isResolvedAsType (m.type.get()))
@@ -1431,17 +1641,24 @@ struct AST
         }
 
     private:
+        friend struct soul::ASTCloner;
+
+        /// Keeps track of recursive structs with a per-thread list rather than a flag in each
+        /// struct, because functions which use the same struct may be compiled on different threads
         struct ScopedResolver
         {
-            ScopedResolver (bool& b) : flag (b) { flag = true; }
-            ~ScopedResolver()                   { flag = false; }
+            ScopedResolver (const StructDeclaration& s)   { getStructsBeingResolved().push_back (std::addressof (s)); }
+            ~ScopedResolver()                             { getStructsBeingResolved().pop_back(); }
 
-            bool& flag;
+            static std::vector<const StructDeclaration*>& getStructsBeingResolved()
+            {
+                static thread_local std::vector<const StructDeclaration*> structs;
+                return structs;
+            }
         };
 
         mutable StructurePtr structure;
         ArrayWithPreallocation<Member, 16> members;
-        mutable bool isBeingResolved = false;
     };
 
     struct UsingDeclaration  : public TypeDeclarationBase
@@ -1564,8 +1781,16 @@ struct AST
         void performLocalNameSearch (NameSearch& search, const Statement* statementToSearchUpTo) const override
         {
             if (search.findVariables)
+                if (auto v = findVariableDeclaredBefore (search.partiallyQualifiedPath.getLastPart(), statementToSearchUpTo))
+                    search.addResult (*v);
+        }
+
+        /// Finds the last variable with this name that is declared before the given statement, or
+        /// anywhere in the block if the statement isn't one of its direct children
+        pool_ptr<VariableDeclaration> findVariableDeclaredBefore (Identifier name, const Statement* statementToSearchUpTo) const
+        {
+            if (statements.size() < minStatementsToIndex)
             {
-                auto name = search.partiallyQualifiedPath.getLastPart();
                 pool_ptr<VariableDeclaration> lastMatch;
 
                 for (auto& s : statements)
@@ -1578,8 +1803,43 @@ struct AST
                             lastMatch = v;
                 }
 
-                if (lastMatch != nullptr)
-                    search.addResult (*lastMatch);
+                return lastMatch;
+            }
+
+            if (! variableIndex.isValid)
+                rebuildVariableIndex();
+
+            auto found = variableIndex.positionsOfName.find (name);
+
+            if (found == variableIndex.positionsOfName.end())
+                return {};
+
+            auto endPosition = static_cast<uint32_t> (statements.size());
+            auto upTo = variableIndex.positionOfStatement.find (statementToSearchUpTo);
+
+            if (upTo != variableIndex.positionOfStatement.end())
+                endPosition = upTo->second;
+
+            auto& positions = found->second;
+
+            for (auto i = positions.size(); i > 0; --i)
+                if (positions[i - 1] < endPosition)
+                    return cast<VariableDeclaration> (statements[positions[i - 1]]);
+
+            return {};
+        }
+
+        /// Calls a function which may replace each of the statements in turn.
+        template <typename ReplaceFn>
+        void replaceStatements (ReplaceFn&& replace)
+        {
+            for (auto& s : statements)
+            {
+                auto oldStatement = s;
+                replace (s);
+
+                if (s != oldStatement)
+                    variableIndex.isValid = false;
             }
         }
 
@@ -1594,10 +1854,49 @@ struct AST
         Block* getAsBlock() override              { return this; }
         Scope* getParentScope() const override    { return ASTObject::getParentScope(); }
         bool isFunctionMainBlock() const          { return functionForWhichThisIsMain != nullptr; }
-        void addStatement (Statement& s)          { statements.push_back (s); }
+
+        const std::vector<pool_ref<Statement>>& getStatements() const   { return statements; }
+
+        void addStatement (Statement& s)
+        {
+            statements.push_back (s);
+            variableIndex.isValid = false;
+        }
 
         pool_ptr<Function> functionForWhichThisIsMain;
+
+    private:
+        // This is only modified by addStatement() and replaceStatements(), which keep the variable index up to date
         std::vector<pool_ref<Statement>> statements;
+
+        // Small blocks are quicker to scan than to index
+        static constexpr size_t minStatementsToIndex = 16;
+
+        struct VariableIndex
+        {
+            std::unordered_map<Identifier, ArrayWithPreallocation<uint32_t, 2>, Identifier::Hash> positionsOfName;
+            std::unordered_map<const Statement*, uint32_t> positionOfStatement;
+            bool isValid = false;
+        };
+
+        mutable VariableIndex variableIndex;
+
+        void rebuildVariableIndex() const
+        {
+            variableIndex.positionsOfName.clear();
+            variableIndex.positionOfStatement.clear();
+
+            for (uint32_t i = 0; i < statements.size(); ++i)
+            {
+                variableIndex.positionOfStatement[statements[i].getPointer()] = i;
+
+                if (auto v = cast<VariableDeclaration> (statements[i]))
+                    if (v->name.isValid())
+                        variableIndex.positionsOfName[v->name].push_back (i);
+            }
+
+            variableIndex.isValid = true;
+        }
     };
 
     //==============================================================================
@@ -0,0 +1,679 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+/** Performs a deep-clone of a tree of AST objects into a different allocator.
+
+    The tree may already have been through the resolution pass, so as well as its child
+    objects, it contains references between objects (e.g. from a call to its function,
+    or a variable to the block that it's in), and these all have to be remapped onto
+    the new copies. To cope with cycles, a new object is created with placeholder
+    references when the first reference to it is found, and it gets populated later
+    from a queue.
+
+    The identifiers, structures, types and source code that the objects use are also
+    remapped, so that the clone shares nothing with the original, and the two can be
+    used on different threads. (The exception is identifiers which come from a parent
+    Identifier::Pool, because those are safe to share between threads).
+*/
+struct ASTCloner
+{
+    ASTCloner (AST::Allocator& a) : allocator (a) {}
+
+    template <typename ObjectType>
+    ObjectType& clone (ObjectType& old)
+    {
+        auto& result = getRemapped (old);
+
+        while (! objectsToPopulate.empty())
+        {
+            auto item = objectsToPopulate.back();
+            objectsToPopulate.pop_back();
+            populateObject (*item.newObject, *item.oldObject);
+        }
+
+        return result;
+    }
+
+private:
+    //==============================================================================
+    AST::Allocator& allocator;
+
+    struct ObjectToPopulate
+    {
+        AST::ASTObject* oldObject;
+        AST::ASTObject* newObject;
+    };
+
+    std::vector<ObjectToPopulate> objectsToPopulate;
+    std::unordered_map<const AST::ASTObject*, AST::ASTObject*> objectMappings;
+    std::unordered_map<const AST::Connection::SharedEndpoint*, AST::Connection::SharedEndpoint*> sharedEndpointMappings;
+    std::unordered_map<const Structure*, StructurePtr> structMappings;
+    std::unordered_map<Identifier, Identifier, Identifier::Hash> identifierMappings;
+    std::unordered_map<const SourceCodeText*, SourceCodeText::Ptr> sourceCodeMappings;
+
+    //==============================================================================
+    AST::ASTObject& getRemappedObject (AST::ASTObject& old)
+    {
+        auto found = objectMappings.find (std::addressof (old));
+
+        if (found != objectMappings.end())
+            return *found->second;
+
+        auto& newObject = createObject (old);
+        objectMappings[std::addressof (old)] = std::addressof (newObject);
+        objectsToPopulate.push_back ({ std::addressof (old), std::addressof (newObject) });
+        return newObject;
+    }
+
+    template <typename ObjectType>
+    ObjectType& getRemapped (ObjectType& old)
+    {
+        return static_cast<ObjectType&> (getRemappedObject (old));
+    }
+
+    template <typename ObjectType>
+    pool_ptr<ObjectType> getRemappedPtr (pool_ptr<ObjectType> old)
+    {
+        if (old == nullptr)
+            return {};
+
+        return getRemapped (*old);
+    }
+
+    template <typename ArrayType>
+    void copyRemapped (ArrayType& dest, const ArrayType& source)
+    {
+        dest.reserve (source.size());
+
+        for (auto& o : source)
+            dest.push_back (getRemapped (o.get()));
+    }
+
+    AST::Scope* getRemappedScope (AST::Scope* old)
+    {
+        if (old == nullptr)                 return nullptr;
+        if (auto m = old->getAsModule())    return std::addressof (getRemapped (*m));
+        if (auto f = old->getAsFunction())  return std::addressof (getRemapped (*f));
+        if (auto b = old->getAsBlock())     return std::addressof (getRemapped (*b));
+
+        SOUL_ASSERT_FALSE;
+        return nullptr;
+    }
+
+    CodeLocation getRemappedLocation (const CodeLocation& old)
+    {
+        if (old.sourceCode == nullptr)
+            return old;
+
+        auto& mapping = sourceCodeMappings[old.sourceCode.get()];
+
+        if (mapping == nullptr)
+            mapping = old.sourceCode->isInternal ? SourceCodeText::createInternal (old.sourceCode->filename, old.sourceCode->content)
+                                                 : SourceCodeText::createForFile (old.sourceCode->filename, old.sourceCode->content);
+
+        CodeLocation l (mapping);
+
+        if (old.location.data() != nullptr)
+            l.location = choc::text::UTF8Pointer (mapping->utf8.data() + (old.location.data() - old.sourceCode->utf8.data()));
+
+        return l;
+    }
+
+    AST::Context getRemappedContext (const AST::Context& old)
+    {
+        return { getRemappedLocation (old.location), getRemappedScope (old.parentScope) };
+    }
+
+    AST::Connection::SharedEndpoint& getRemappedSharedEndpoint (AST::Connection::SharedEndpoint& old)
+    {
+        auto& mapping = sharedEndpointMappings[std::addressof (old)];
+
+        if (mapping == nullptr)
+            mapping = std::addressof (allocator.allocate<AST::Connection::SharedEndpoint> (getRemapped (old.endpoint.get())));
+
+        return *mapping;
+    }
+
+    Identifier getRemappedIdentifier (Identifier old)
+    {
+        if (! old.isValid())
+            return {};
+
+        auto& mapping = identifierMappings[old];
+
+        if (! mapping.isValid())
+            mapping = allocator.identifiers.get (old);
+
+        return mapping;
+    }
+
+    IdentifierPath getRemappedPath (const IdentifierPath& old)
+    {
+        IdentifierPath path;
+
+        for (auto& i : old.pathSections)
+            path.addSuffix (getRemappedIdentifier (i));
+
+        return path;
+    }
+
+    Structure& getRemappedStruct (const Structure& old)
+    {
+        auto found = structMappings.find (std::addressof (old));
+
+        if (found != structMappings.end())
+            return *found->second;
+
+        StructurePtr s (new Structure (old));
+        structMappings[std::addressof (old)] = s;
+
+        for (auto& m : s->getMembers())
+            m.type = getRemappedType (m.type);
+
+        if (auto declaration = static_cast<AST::StructDeclaration*> (old.backlinkToASTObject))
+            s->backlinkToASTObject = std::addressof (getRemapped (*declaration));
+
+        return *s;
+    }
+
+    Type getRemappedType (const Type& old)
+    {
+        if (old.isStruct())
+            return Type::createStruct (getRemappedStruct (old.getStructRef()))
+                     .withConstAndRefFlags (old.isConst(), old.isReference());
+
+        if (old.isArray())
+            return old.createCopyWithNewArrayElementType (getRemappedType (old.getArrayElementType()));
+
+        return old;
+    }
+
+    Value getRemappedValue (const Value& old)
+    {
+        return old.cloneWithEquivalentType (getRemappedType (old.getType()));
+    }
+
+    AST::Annotation getRemappedAnnotation (const AST::Annotation& old)
+    {
+        AST::Annotation a;
+
+        for (auto& p : old.properties)
+            a.addProperty ({ getRemapped (p.name.get()), getRemapped (p.value.get()) });
+
+        return a;
+    }
+
+    //==============================================================================
+    AST::ASTObject& createObject (AST::ASTObject& old)
+    {
+        #define SOUL_CREATE_OBJECT(ASTType) \
+            case AST::ObjectType::ASTType:  return create (static_cast<AST::ASTType&> (old));
+
+        switch (old.objectType)
+        {
+            SOUL_AST_ALL_TYPES (SOUL_CREATE_OBJECT)
+            default: break;
+        }
+
+        #undef SOUL_CREATE_OBJECT
+        throwInternalCompilerError ("Unknown AST object");
+    }
+
+    void populateObject (AST::ASTObject& newObject, AST::ASTObject& old)
+    {
+        #define SOUL_POPULATE_OBJECT(ASTType) \
+            case AST::ObjectType::ASTType:  populate (static_cast<AST::ASTType&> (newObject), static_cast<AST::ASTType&> (old)); return;
+
+        switch (old.objectType)
+        {
+            SOUL_AST_ALL_TYPES (SOUL_POPULATE_OBJECT)
+            default: break;
+        }
+
+        #undef SOUL_POPULATE_OBJECT
+        throwInternalCompilerError ("Unknown AST object");
+    }
+
+    // Any references which an object's constructor needs are given the old objects here, and
+    // get replaced when it's populated. Only the members which are plain C++ references are
+    // remapped up-front - their targets never need anything other than their context to be
+    // created, so this can't recurse back to the object being created.
+    template <typename ObjectType, typename... Args>
+    ObjectType& createWithContext (const ObjectType& old, Args&&... args)
+    {
+        return allocator.allocate<ObjectType> (getRemappedContext (old.context), std::forward<Args> (args)...);
+    }
+
+    template <typename ExpressionType, typename... Args>
+    ExpressionType& createExpression (const ExpressionType& old, Args&&... args)
+    {
+        auto& e = createWithContext (old, std::forward<Args> (args)...);
+        e.kind = old.kind;
+        return e;
+    }
+
+    AST::Processor&                 create (AST::Processor& old)                  { return allocator.allocate<AST::Processor> (getRemappedLocation (old.processorKeywordLocation), getRemappedContext (old.context), getRemappedIdentifier (old.name)); }
+    AST::Graph&                     create (AST::Graph& old)                      { return allocator.allocate<AST::Graph>     (getRemappedLocation (old.processorKeywordLocation), getRemappedContext (old.context), getRemappedIdentifier (old.name)); }
+    AST::Namespace&                 create (AST::Namespace& old)                  { return allocator.allocate<AST::Namespace> (getRemappedLocation (old.processorKeywordLocation), getRemappedContext (old.context), getRemappedIdentifier (old.name)); }
+    AST::Function&                  create (AST::Function& old)                   { return createWithContext (old); }
+    AST::ProcessorAliasDeclaration& create (AST::ProcessorAliasDeclaration& old)  { return createWithContext (old, getRemappedIdentifier (old.name)); }
+    AST::NamespaceAliasDeclaration& create (AST::NamespaceAliasDeclaration& old)  { return createWithContext (old, getRemappedIdentifier (old.name)); }
+    AST::ProcessorInstance&         create (AST::ProcessorInstance& old)          { return createWithContext (old); }
+    AST::EndpointDeclaration&       create (AST::EndpointDeclaration& old)        { return createWithContext (old, old.isInput); }
+    AST::Block&                     create (AST::Block& old)                      { return createWithContext (old, pool_ptr<AST::Function>()); }
+    AST::BreakStatement&            create (AST::BreakStatement& old)             { return createWithContext (old); }
+    AST::ContinueStatement&         create (AST::ContinueStatement& old)          { return createWithContext (old); }
+    AST::IfStatement&               create (AST::IfStatement& old)                { return createWithContext (old, old.isConstIf, old.condition.get(), old.trueBranch.get(), pool_ptr<AST::Statement>()); }
+    AST::LoopStatement&             create (AST::LoopStatement& old)              { return createWithContext (old); }
+    AST::NoopStatement&             create (AST::NoopStatement& old)              { return createWithContext (old); }
+    AST::ReturnStatement&           create (AST::ReturnStatement& old)            { return createWithContext (old); }
+    AST::VariableDeclaration&       create (AST::VariableDeclaration& old)        { return createWithContext (old, old.declaredType, old.initialValue, old.isConstant); }
+    AST::Connection&                create (AST::Connection& old)                 { return createWithContext (old, old.interpolationType, getRemappedSharedEndpoint (old.source), getRemappedSharedEndpoint (old.dest), pool_ptr<AST::Expression>()); }
+
+    AST::ConcreteType&              create (AST::ConcreteType& old)               { return createExpression (old, getRemappedType (old.type)); }
+    AST::SubscriptWithBrackets&     create (AST::SubscriptWithBrackets& old)      { return createExpression (old, old.lhs.get(), pool_ptr<AST::Expression>()); }
+    AST::SubscriptWithChevrons&     create (AST::SubscriptWithChevrons& old)      { return createExpression (old, old.lhs.get(), *old.rhs); }
+    AST::TypeMetaFunction&          create (AST::TypeMetaFunction& old)           { return createExpression (old, old.source.get(), old.operation); }
+    AST::Assignment&                create (AST::Assignment& old)                 { return createExpression (old, old.target.get(), old.newValue.get()); }
+    AST::BinaryOperator&            create (AST::BinaryOperator& old)             { return createExpression (old, old.lhs.get(), old.rhs.get(), old.operation); }
+    AST::Constant&                  create (AST::Constant& old)                   { return createExpression (old, getRemappedValue (old.value)); }
+    AST::DotOperator&               create (AST::DotOperator& old)                { return createExpression (old, old.lhs.get(), getRemapped (old.rhs)); }
+    AST::FunctionCall&              create (AST::FunctionCall& old)               { return createExpression (old, getRemapped (old.targetFunction), pool_ptr<AST::CommaSeparatedList>(), old.isMethodCall); }
+    AST::TypeCast&                  create (AST::TypeCast& old)                   { return createExpression (old, getRemappedType (old.targetType), old.source.get()); }
+    AST::PreOrPostIncOrDec&         create (AST::PreOrPostIncOrDec& old)          { return createExpression (old, old.target.get(), old.isIncrement, old.isPost); }
+    AST::InPlaceOperator&           create (AST::InPlaceOperator& old)            { return createExpression (old, old.target.get(), old.source.get(), old.operation); }
+    AST::ArrayElementRef&           create (AST::ArrayElementRef& old)            { return createExpression (old, *old.object, pool_ptr<AST::Expression>(), pool_ptr<AST::Expression>(), old.isSlice); }
+    AST::StructMemberRef&           create (AST::StructMemberRef& old)            { return createExpression (old, old.object.get(), StructurePtr (getRemappedStruct (*old.structure)), old.memberName); }
+    AST::ComplexMemberRef&          create (AST::ComplexMemberRef& old)           { return createExpression (old, old.object.get(), getRemappedType (old.complexType), old.memberName); }
+    AST::StructDeclaration&         create (AST::StructDeclaration& old)          { return createExpression (old, getRemappedIdentifier (old.name)); }
+    AST::StructDeclarationRef&      create (AST::StructDeclarationRef& old)       { return createExpression (old, getRemapped (old.structure)); }
+    AST::UsingDeclaration&          create (AST::UsingDeclaration& old)           { return createExpression (old, getRemappedIdentifier (old.name), old.targetType); }
+    AST::TernaryOp&                 create (AST::TernaryOp& old)                  { return createExpression (old, old.condition.get(), old.trueBranch.get(), old.falseBranch.get()); }
+    AST::UnaryOperator&             create (AST::UnaryOperator& old)              { return createExpression (old, old.source.get(), old.operation); }
+    AST::QualifiedIdentifier&       create (AST::QualifiedIdentifier& old)        { return createExpression (old); }
+    AST::UnqualifiedName&           create (AST::UnqualifiedName& old)            { return createExpression (old, getRemappedIdentifier (old.identifier)); }
+    AST::VariableRef&               create (AST::VariableRef& old)                { return createExpression (old, old.variable.get()); }
+    AST::InputEndpointRef&          create (AST::InputEndpointRef& old)           { return createExpression (old, old.input.get()); }
+    AST::OutputEndpointRef&         create (AST::OutputEndpointRef& old)          { return createExpression (old, old.output.get()); }
+    AST::ConnectionEndpointRef&     create (AST::ConnectionEndpointRef& old)      { return createExpression (old, pool_ptr<AST::ProcessorInstanceRef>(), pool_ptr<AST::UnqualifiedName>()); }
+    AST::ProcessorRef&              create (AST::ProcessorRef& old)               { return createExpression (old, getRemapped (old.processor)); }
+    AST::NamespaceRef&              create (AST::NamespaceRef& old)               { return createExpression (old, getRemapped (old.ns)); }
+    AST::ProcessorInstanceRef&      create (AST::ProcessorInstanceRef& old)       { return createExpression (old, getRemapped (old.processorInstance)); }
+    AST::CommaSeparatedList&        create (AST::CommaSeparatedList& old)         { return createExpression (old); }
+    AST::ProcessorProperty&         create (AST::ProcessorProperty& old)          { return createExpression (old, old.property); }
+    AST::WriteToEndpoint&           create (AST::WriteToEndpoint& old)            { return createExpression (old, old.target.get(), old.value.get()); }
+    AST::AdvanceClock&              create (AST::AdvanceClock& old)               { return createExpression (old); }
+    AST::StaticAssertion&           create (AST::StaticAssertion& old)            { return createExpression (old, old.condition.get(), old.errorMessage); }
+
+    AST::CallOrCast& create (AST::CallOrCast& old)
+    {
+        auto& c = allocator.allocate<AST::CallOrCast> (old.nameOrType.get(), pool_ptr<AST::CommaSeparatedList>(), old.isMethodCall);
+        c.context = getRemappedContext (old.context);
+        c.kind = old.kind;
+        return c;
+    }
+
+    //==============================================================================
+    void populateModule (AST::ModuleBase& m, const AST::ModuleBase& old)
+    {
+        m.isFullyResolved = old.isFullyResolved;
+        copyRemapped (m.specialisationParams, old.specialisationParams);
+        copyRemapped (m.usings, old.usings);
+        copyRemapped (m.namespaceAliases, old.namespaceAliases);
+        copyRemapped (m.structures, old.structures);
+        copyRemapped (m.staticAssertions, old.staticAssertions);
+        m.originalModule = getRemappedPtr (old.originalModule);
+
+        m.createClone = [&m] (AST::Allocator& a, AST::Namespace& parentNS, const std::string& newName) -> AST::ModuleBase&
+        {
+            return StructuralParser::cloneModuleWithNewName (a, parentNS, m, newName);
+        };
+    }
+
+    void populateProcessorBase (AST::ProcessorBase& p, const AST::ProcessorBase& old)
+    {
+        // A specialised processor's clone function also re-applies its specialisation arguments,
+        // and those can't be recreated here
+        if (old.isSpecialisedInstance() && old.originalBeforeSpecialisation != nullptr
+             && old.originalBeforeSpecialisation->isTemplateModule())
+            throwInternalCompilerError ("Cannot clone a specialised processor");
+
+        populateModule (p, old);
+        copyRemapped (p.endpoints, old.endpoints);
+        p.annotation = getRemappedAnnotation (old.annotation);
+        p.owningInstance = getRemappedPtr (old.owningInstance);
+        p.originalBeforeSpecialisation = getRemappedPtr (old.originalBeforeSpecialisation);
+    }
+
+    void populate (AST::Processor& p, AST::Processor& old)
+    {
+        populateProcessorBase (p, old);
+        p.latency = getRemappedPtr (old.latency);
+        copyRemapped (p.functions, old.functions);
+        copyRemapped (p.stateVariables, old.stateVariables);
+    }
+
+    void populate (AST::Graph& g, AST::Graph& old)
+    {
+        populateProcessorBase (g, old);
+        copyRemapped (g.processorInstances, old.processorInstances);
+        copyRemapped (g.connections, old.connections);
+        copyRemapped (g.constants, old.constants);
+        copyRemapped (g.processorAliases, old.processorAliases);
+    }
+
+    void populate (AST::Namespace& n, AST::Namespace& old)
+    {
+        populateModule (n, old);
+        n.importsList = old.importsList;
+        copyRemapped (n.functions, old.functions);
+        copyRemapped (n.subModules, old.subModules);
+        copyRemapped (n.constants, old.constants);
+
+        for (auto& i : old.namespaceInstances)
+            n.namespaceInstances.push_back ({ i.key, getRemappedPtr (i.instance) });
+    }
+
+    void populate (AST::Function& f, AST::Function& old)
+    {
+        f.returnType = getRemappedPtr (old.returnType);
+        f.name = getRemappedIdentifier (old.name);
+        f.nameLocation = getRemappedContext (old.nameLocation);
+        copyRemapped (f.parameters, old.parameters);
+        copyRemapped (f.genericWildcards, old.genericWildcards);
+        copyRemapped (f.genericSpecialisations, old.genericSpecialisations);
+        f.originalGenericFunction = getRemappedPtr (old.originalGenericFunction);
+        f.originalCallLeadingToSpecialisation = getRemappedPtr (old.originalCallLeadingToSpecialisation);
+        f.annotation = getRemappedAnnotation (old.annotation);
+        f.intrinsic = old.intrinsic;
+        f.eventFunction = old.eventFunction;
+        f.block = getRemappedPtr (old.block);
+    }
+
+    void populate (AST::ProcessorAliasDeclaration& a, AST::ProcessorAliasDeclaration& old)
+    {
+        a.targetProcessor = getRemappedPtr (old.targetProcessor);
+        a.resolvedProcessor = getRemappedPtr (old.resolvedProcessor);
+    }
+
+    void populate (AST::NamespaceAliasDeclaration& a, AST::NamespaceAliasDeclaration& old)
+    {
+        a.targetNamespace = getRemappedPtr (old.targetNamespace);
+        a.specialisationArgs = getRemappedPtr (old.specialisationArgs);
+        a.resolvedNamespace = getRemappedPtr (old.resolvedNamespace);
+    }
+
+    void populate (AST::Connection& c, AST::Connection& old)
+    {
+        c.delayLength = getRemappedPtr (old.delayLength);
+    }
+
+    void populate (AST::ProcessorInstance& i, AST::ProcessorInstance& old)
+    {
+        i.instanceName = getRemappedPtr (old.instanceName);
+        i.targetProcessor = getRemappedPtr (old.targetProcessor);
+        i.specialisationArgs = getRemappedPtr (old.specialisationArgs);
+        i.clockMultiplierRatio = getRemappedPtr (old.clockMultiplierRatio);
+        i.clockDividerRatio = getRemappedPtr (old.clockDividerRatio);
+        i.arraySize = getRemappedPtr (old.arraySize);
+
+        if (old.implicitInstanceSource != nullptr)
+            i.implicitInstanceSource = getRemappedSharedEndpoint (*old.implicitInstanceSource);
+    }
+
+    void populate (AST::EndpointDeclaration& e, AST::EndpointDeclaration& old)
+    {
+        e.name = getRemappedIdentifier (old.name);
+
+        if (old.details != nullptr)
+        {
+            auto& details = allocator.allocate<AST::EndpointDetails> (old.details->endpointType);
+            copyRemapped (details.dataTypes, old.details->dataTypes);
+            details.arraySize = getRemappedPtr (old.details->arraySize);
+            e.details = details;
+        }
+
+        if (old.childPath != nullptr)
+        {
+            auto& path = allocator.allocate<AST::ChildEndpointPath>();
+
+            for (auto& s : old.childPath->sections)
+                path.sections.push_back ({ getRemappedPtr (s.name), getRemappedPtr (s.index) });
+
+            e.childPath = path;
+        }
+
+        e.annotation = getRemappedAnnotation (old.annotation);
+        e.needsToBeExposedInParent = old.needsToBeExposedInParent;
+        e.isConsoleEndpoint = old.isConsoleEndpoint;
+    }
+
+    void populate (AST::Block& b, AST::Block& old)
+    {
+        b.functionForWhichThisIsMain = getRemappedPtr (old.functionForWhichThisIsMain);
+
+        for (auto& s : old.getStatements())
+            b.addStatement (getRemapped (s.get()));
+    }
+
+    void populate (AST::BreakStatement&, AST::BreakStatement&)        {}
+    void populate (AST::ContinueStatement&, AST::ContinueStatement&)  {}
+    void populate (AST::NoopStatement&, AST::NoopStatement&)          {}
+
+    void populate (AST::IfStatement& i, AST::IfStatement& old)
+    {
+        i.condition = getRemapped (old.condition.get());
+        i.trueBranch = getRemapped (old.trueBranch.get());
+        i.falseBranch = getRemappedPtr (old.falseBranch);
+    }
+
+    void populate (AST::LoopStatement& l, AST::LoopStatement& old)
+    {
+        l.iterator = getRemappedPtr (old.iterator);
+        l.body = getRemappedPtr (old.body);
+        l.condition = getRemappedPtr (old.condition);
+        l.numIterations = getRemappedPtr (old.numIterations);
+        l.rangeLoopInitialiser = getRemappedPtr (old.rangeLoopInitialiser);
+    }
+
+    void populate (AST::ReturnStatement& r, AST::ReturnStatement& old)
+    {
+        r.returnValue = getRemappedPtr (old.returnValue);
+    }
+
+    void populate (AST::VariableDeclaration& v, AST::VariableDeclaration& old)
+    {
+        v.name = getRemappedIdentifier (old.name);
+        v.declaredType = getRemappedPtr (old.declaredType);
+        v.initialValue = getRemappedPtr (old.initialValue);
+        v.annotation = getRemappedAnnotation (old.annotation);
+        v.isFunctionParameter = old.isFunctionParameter;
+        v.isExternal = old.isExternal;
+        v.isSpecialisation = old.isSpecialisation;
+        v.doNotConstantFold = old.doNotConstantFold;
+        v.numReads = old.numReads;
+        v.numWrites = old.numWrites;
+    }
+
+    void populate (AST::ConcreteType&, AST::ConcreteType&)              {}
+    void populate (AST::Constant&, AST::Constant&)                      {}
+    void populate (AST::ProcessorRef&, AST::ProcessorRef&)              {}
+    void populate (AST::NamespaceRef&, AST::NamespaceRef&)              {}
+    void populate (AST::ProcessorInstanceRef&, AST::ProcessorInstanceRef&)  {}
+    void populate (AST::StructDeclarationRef&, AST::StructDeclarationRef&)  {}
+    void populate (AST::UnqualifiedName&, AST::UnqualifiedName&)        {}
+    void populate (AST::ProcessorProperty&, AST::ProcessorProperty&)    {}
+    void populate (AST::AdvanceClock&, AST::AdvanceClock&)              {}
+
+    void populate (AST::SubscriptWithBrackets& s, AST::SubscriptWithBrackets& old)
+    {
+        s.lhs = getRemapped (old.lhs.get());
+        s.rhs = getRemappedPtr (old.rhs);
+    }
+
+    void populate (AST::SubscriptWithChevrons& s, AST::SubscriptWithChevrons& old)
+    {
+        s.lhs = getRemapped (old.lhs.get());
+        s.rhs = getRemappedPtr (old.rhs);
+    }
+
+    void populate (AST::TypeMetaFunction& t, AST::TypeMetaFunction& old)
+    {
+        t.source = getRemapped (old.source.get());
+    }
+
+    void populate (AST::Assignment& a, AST::Assignment& old)
+    {
+        a.target = getRemapped (old.target.get());
+        a.newValue = getRemapped (old.newValue.get());
+    }
+
+    void populate (AST::BinaryOperator& b, AST::BinaryOperator& old)
+    {
+        b.lhs = getRemapped (old.lhs.get());
+        b.rhs = getRemapped (old.rhs.get());
+    }
+
+    void populate (AST::DotOperator& d, AST::DotOperator& old)
+    {
+        d.lhs = getRemapped (old.lhs.get());
+    }
+
+    void populate (AST::CallOrCast& c, AST::CallOrCast& old)
+    {
+        c.arguments = getRemappedPtr (old.arguments);
+        c.nameOrType = getRemapped (old.nameOrType.get());
+    }
+
+    void populate (AST::FunctionCall& c, AST::FunctionCall& old)
+    {
+        c.arguments = getRemappedPtr (old.arguments);
+    }
+
+    void populate (AST::TypeCast& t, AST::TypeCast& old)
+    {
+        t.source = getRemapped (old.source.get());
+    }
+
+    void populate (AST::PreOrPostIncOrDec& p, AST::PreOrPostIncOrDec& old)
+    {
+        p.target = getRemapped (old.target.get());
+    }
+
+    void populate (AST::InPlaceOperator& o, AST::InPlaceOperator& old)
+    {
+        o.target = getRemapped (old.target.get());
+        o.source = getRemapped (old.source.get());
+    }
+
+    void populate (AST::ArrayElementRef& a, AST::ArrayElementRef& old)
+    {
+        a.object = getRemappedPtr (old.object);
+        a.startIndex = getRemappedPtr (old.startIndex);
+        a.endIndex = getRemappedPtr (old.endIndex);
+        a.suppressWrapWarning = old.suppressWrapWarning;
+    }
+
+    void populate (AST::StructMemberRef& s, AST::StructMemberRef& old)
+    {
+        s.object = getRemapped (old.object.get());
+    }
+
+    void populate (AST::ComplexMemberRef& c, AST::ComplexMemberRef& old)
+    {
+        c.object = getRemapped (old.object.get());
+    }
+
+    void populate (AST::StructDeclaration& s, AST::StructDeclaration& old)
+    {
+        for (auto& m : old.members)
+            s.members.push_back ({ getRemapped (m.type.get()), getRemappedIdentifier (m.name), getRemappedContext (m.nameLocation) });
+
+        if (old.structure != nullptr)
+            s.structure = getRemappedStruct (*old.structure);
+    }
+
+    void populate (AST::UsingDeclaration& u, AST::UsingDeclaration& old)
+    {
+        u.targetType = getRemappedPtr (old.targetType);
+    }
+
+    void populate (AST::TernaryOp& t, AST::TernaryOp& old)
+    {
+        t.condition = getRemapped (old.condition.get());
+        t.trueBranch = getRemapped (old.trueBranch.get());
+        t.falseBranch = getRemapped (old.falseBranch.get());
+    }
+
+    void populate (AST::UnaryOperator& u, AST::UnaryOperator& old)
+    {
+        u.source = getRemapped (old.source.get());
+    }
+
+    void populate (AST::QualifiedIdentifier& q, AST::QualifiedIdentifier& old)
+    {
+        for (auto& s : old.pathSections)
+            q.pathSections.push_back ({ getRemappedPath (s.path), getRemappedPtr (s.specialisationArgs) });
+
+        q.pathPrefix = getRemappedPath (old.pathPrefix);
+    }
+
+    void populate (AST::VariableRef& v, AST::VariableRef& old)
+    {
+        v.variable = getRemapped (old.variable.get());
+    }
+
+    void populate (AST::InputEndpointRef& e, AST::InputEndpointRef& old)
+    {
+        e.input = getRemapped (old.input.get());
+    }
+
+    void populate (AST::OutputEndpointRef& e, AST::OutputEndpointRef& old)
+    {
+        e.output = getRemapped (old.output.get());
+    }
+
+    void populate (AST::ConnectionEndpointRef& e, AST::ConnectionEndpointRef& old)
+    {
+        e.parentProcessorInstance = getRemappedPtr (old.parentProcessorInstance);
+        e.endpointName = getRemappedPtr (old.endpointName);
+    }
+
+    void populate (AST::CommaSeparatedList& l, AST::CommaSeparatedList& old)
+    {
+        copyRemapped (l.items, old.items);
+    }
+
+    void populate (AST::WriteToEndpoint& w, AST::WriteToEndpoint& old)
+    {
+        w.target = getRemapped (old.target.get());
+        w.value = getRemapped (old.value.get());
+    }
+
+    void populate (AST::StaticAssertion& a, AST::StaticAssertion& old)
+    {
+        a.condition = getRemapped (old.condition.get());
+    }
+};
+
+} // namespace soul
@@ -79,8 +79,7 @@ struct ASTUtilities
             if (auto sub = cast<AST::Namespace> (m))
                 removeModulesWithSpecialisationParams (*sub);
 
-        removeIf (ns.subModules,
-                  [] (pool_ref<AST::ModuleBase>& m) { return ! m->getSpecialisationParameters().empty(); });
+        ns.subModules.removeIf ([] (const pool_ref<AST::ModuleBase>& m) { return ! m->getSpecialisationParameters().empty(); });
     }
 
     static AST::WriteToEndpoint& getTopLevelWriteToEndpoint (AST::WriteToEndpoint& ws)
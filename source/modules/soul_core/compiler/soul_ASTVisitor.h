@@ -123,7 +123,7 @@ struct ASTVisitor
 
     virtual void visit (AST::Block& b)
     {
-        for (auto& s : b.statements)
+        for (auto& s : b.getStatements())
             visitObject (s);
     }
 
@@ -516,7 +516,7 @@ struct RewritingASTVisitor
 
             if (oldObject != newObject)
             {
-                array[i] = newObject;
+                array.set (i, newObject);
                 ++itemsReplaced;
             }
         }
@@ -568,9 +568,7 @@ struct RewritingASTVisitor
 
     virtual AST::Block& visit (AST::Block& b)
     {
-        for (auto& s : b.statements)
-            replaceStatement (s);
-
+        b.replaceStatements ([this] (pool_ref<AST::Statement>& s) { replaceStatement (s); });
         return b;
     }
 
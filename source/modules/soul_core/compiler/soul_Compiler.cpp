@@ -43,10 +43,10 @@ bool Compiler::addCode (CompileMessageList& messageList, CodeLocation code)
 
     if (topLevelNamespace == nullptr)
     {
-        topLevelNamespace = AST::createRootNamespace (allocator);
-
         if (includeStandardLibrary)
             addDefaultBuiltInLibrary();
+        else
+            topLevelNamespace = AST::createRootNamespace (allocator);
     }
 
     try
@@ -65,6 +65,40 @@ bool Compiler::addCode (CompileMessageList& messageList, CodeLocation code)
 }
 
 void Compiler::addDefaultBuiltInLibrary()
+{
+    // Parsing and resolving the built-in library takes much longer than most user code,
+    // so it's only done once, and each Compiler gets a deep copy of the result. Because
+    // resolving the user's code can add things to these namespaces, they can't be shared.
+    struct BuiltInLibrary
+    {
+        BuiltInLibrary() : compiler (false)
+        {
+            SOUL_PROFILE_PHASE ("compile built-in library")
+            compiler.topLevelNamespace = AST::createRootNamespace (compiler.allocator);
+            compiler.compileBuiltInLibrary();
+        }
+
+        Compiler compiler;
+        std::mutex lock;
+    };
+
+    static BuiltInLibrary library;
+
+    SOUL_PROFILE_PHASE ("clone built-in library")
+    std::lock_guard<std::mutex> l (library.lock);
+    allocator.identifiers.setParent (library.compiler.allocator.identifiers);
+    topLevelNamespace = ASTCloner (allocator).clone (*library.compiler.topLevelNamespace);
+    allocator.stringDictionary = library.compiler.allocator.stringDictionary;
+}
+
+// TODO: when we have import & module support, these will no longer be hard-coded here
+static constexpr const char* builtInSystemModules[] =
+{
+    "soul.audio.utils", "soul.midi", "soul.notes", "soul.frequency", "soul.mixing",
+    "soul.oscillators", "soul.noise", "soul.timeline", "soul.filters"
+};
+
+void Compiler::compileBuiltInLibrary()
 {
     CompileMessageList list;
 
@@ -73,16 +107,8 @@ void Compiler::addDefaultBuiltInLibrary()
         soul::CompileMessageHandler handler (list);
         compile (getDefaultLibraryCode());
 
-        // TODO: when we have import & module support, these will no longer be hard-coded here
-        compile (getSystemModule ("soul.audio.utils"));
-        compile (getSystemModule ("soul.midi"));
-        compile (getSystemModule ("soul.notes"));
-        compile (getSystemModule ("soul.frequency"));
-        compile (getSystemModule ("soul.mixing"));
-        compile (getSystemModule ("soul.oscillators"));
-        compile (getSystemModule ("soul.noise"));
-        compile (getSystemModule ("soul.timeline"));
-        compile (getSystemModule ("soul.filters"));
+        for (auto moduleName : builtInSystemModules)
+            compile (getSystemModule (moduleName));
     }
     catch (soul::AbortCompilationException)
     {
@@ -103,6 +129,8 @@ static void sanityCheckBuildSettings (const BuildSettings& settings,
 
     if (settings.optimisationLevel < -1 || settings.optimisationLevel > 3)
         CodeLocation().throwError (Errors::unsupportedOptimisationLevel());
+
+    ignoreUnused (heart::Checker::getVerificationMode (settings));
 }
 
 static ArrayWithPreallocation<CodeLocation, 4> getHEARTFiles (const BuildBundle& bundle)
@@ -125,8 +153,8 @@ static Program buildHEART (CompileMessageList& messageList, CodeLocation code)
     try
     {
         CompileMessageHandler handler (messageList);
-        auto program = heart::Parser::parse (code);
-        heart::Checker::sanityCheck (program);
+        auto program = CompileProfiler::measure ("parse HEART", [&] { return heart::Parser::parse (code); });
+        CompileProfiler::measure ("sanity check", [&] { heart::Checker::sanityCheck (program); });
         return program;
     }
     catch (AbortCompilationException) {}
@@ -134,11 +162,95 @@ static Program buildHEART (CompileMessageList& messageList, CodeLocation code)
     return {};
 }
 
+static Program buildSOUL (CompileMessageList& messageList, const BuildBundle& bundle)
+{
+    Compiler c (bundle.settings.overrideStandardLibrary.empty());
+
+    if (! bundle.settings.overrideStandardLibrary.empty())
+        for (auto& file : bundle.settings.overrideStandardLibrary)
+            if (! c.addCode (messageList, CodeLocation::createFromSourceFile (file)))
+                return {};
+
+    for (auto& file : bundle.sourceFiles)
+        if (! c.addCode (messageList, CodeLocation::createFromSourceFile (file)))
+            return {};
+
+    return c.link (messageList, bundle.settings);
+}
+
+//==============================================================================
+/** The cache key covers everything that can change the linked program: the compiler
+    and HEART format versions, the source files, the built-in library code, and any
+    settings that the compiler uses.
+*/
+static std::string getCacheKey (const BuildBundle& bundle)
+{
+    static const std::string builtInLibraryHash = []
+    {
+        HashBuilder hash;
+        hash << getLibraryVersion().toString() << '|'
+             << std::to_string (getHEARTFormatVersion()) << '|'
+             << std::string (getSystemModuleCode ("soul.intrinsics"))
+             << std::string (getSystemModuleCode ("soul.complex"));
+
+        for (auto moduleName : builtInSystemModules)
+            hash << std::string (getSystemModuleCode (moduleName));
+
+        return hash.toString();
+    }();
+
+    HashBuilder hash;
+    hash << builtInLibraryHash;
+
+    for (auto files : { &bundle.settings.overrideStandardLibrary, &bundle.sourceFiles })
+    {
+        hash << '|';
+
+        for (auto& file : *files)
+            hash << file.filename << '|' << file.content << '|';
+    }
+
+    hash << bundle.settings.mainProcessor << '|'
+         << std::to_string (bundle.settings.optimisationLevel) << '|'
+         << std::to_string (bundle.settings.maxStackSize);
+
+    if (bundle.settings.customSettings.isObject())
+        hash << '|' << choc::json::toString (bundle.settings.customSettings);
+
+    return "soul_program_" + hash.toString();
+}
+
+static Program readProgramFromCache (LinkerCache& cache, const std::string& key)
+{
+    auto size = cache.readItem (key.c_str(), nullptr, 0);
+
+    if (size == 0)
+        return {};
+
+    std::vector<uint8_t> data (static_cast<size_t> (size));
+
+    if (cache.readItem (key.c_str(), data.data(), size) != size)
+        return {};
+
+    // If the cached data is damaged, this just fails and the program gets rebuilt
+    CompileMessageList messages;
+    return Program::createFromBinary (messages, data.data(), data.size(), true);
+}
 
 //==============================================================================
-Program Compiler::build (CompileMessageList& messageList, const BuildBundle& bundle)
+Program Compiler::build (CompileMessageList& messageList, const BuildBundle& bundle, LinkerCache* cache)
 {
-    sanityCheckBuildSettings (bundle.settings);
+    SOUL_PROFILE_PHASE ("build")
+
+    try
+    {
+        CompileMessageHandler handler (messageList);
+        sanityCheckBuildSettings (bundle.settings);
+    }
+    catch (AbortCompilationException)
+    {
+        return {};
+    }
 
     auto heartFiles = getHEARTFiles (bundle);
 
@@ -150,18 +262,25 @@ Program Compiler::build (CompileMessageList& messageList, const BuildBundle& bun
         return buildHEART (messageList, heartFiles.front());
     }
 
-    Compiler c (bundle.settings.overrideStandardLibrary.empty());
+    if (cache == nullptr)
+        return buildSOUL (messageList, bundle);
 
-    if (! bundle.settings.overrideStandardLibrary.empty())
-        for (auto& file : bundle.settings.overrideStandardLibrary)
-            if (! c.addCode (messageList, CodeLocation::createFromSourceFile (file)))
-                return {};
+    auto key = getCacheKey (bundle);
 
-    for (auto& file : bundle.sourceFiles)
-        if (! c.addCode (messageList, CodeLocation::createFromSourceFile (file)))
-            return {};
+    if (auto cachedProgram = CompileProfiler::measure ("read cached program", [&] { return readProgramFromCache (*cache, key); }))
+        return cachedProgram;
 
-    return c.link (messageList, bundle.settings);
+    auto numMessagesBefore = messageList.messages.size();
+    auto program = buildSOUL (messageList, bundle);
+
+    // Builds which emit warnings aren't cached, so that a cache hit can't hide them
+    if (! program.isEmpty() && messageList.messages.size() == numMessagesBefore)
+    {
+        auto data = program.toBinary();
+        cache->storeItem (key.c_str(), data.data(), data.size());
+    }
+
+    return program;
 }
 
 std::vector<pool_ref<AST::ModuleBase>> Compiler::parseTopLevelDeclarations (AST::Allocator& allocator, CodeLocation code,
@@ -174,14 +293,18 @@ std::vector<pool_ref<AST::ModuleBase>> Compiler::parseTopLevelDeclarations (AST:
 void Compiler::compile (CodeLocation code)
 {
     SOUL_LOG_TIME_OF_SCOPE ("compile: " + code.getFilename());
+    SOUL_PROFILE_PHASE_WITH_DETAIL ("compile", [&] { return code.getFilename(); })
 
-    for (auto& m : StructuralParser::parseTopLevelDeclarations (allocator, code, *topLevelNamespace))
-        SanityCheckPass::runPreResolution (m);
+    CompileProfiler::measure ("parse", [&]
+    {
+        for (auto& m : StructuralParser::parseTopLevelDeclarations (allocator, code, *topLevelNamespace))
+            SanityCheckPass::runPreResolution (m);
+    });
 
     ResolutionPass::run (allocator, *topLevelNamespace, true);
 
-    ASTUtilities::mergeDuplicateNamespaces (*topLevelNamespace);
-    SanityCheckPass::runDuplicateNameChecker (*topLevelNamespace);
+    CompileProfiler::measure ("merge namespaces", [&] { ASTUtilities::mergeDuplicateNamespaces (*topLevelNamespace); });
+    CompileProfiler::measure ("duplicate name check", [&] { SanityCheckPass::runDuplicateNameChecker (*topLevelNamespace); });
 }
 
 //==============================================================================
@@ -244,26 +367,32 @@ Program Compiler::link (CompileMessageList& messageList, const BuildSettings& se
     try
     {
         SOUL_LOG_TIME_OF_SCOPE ("link time");
+        SOUL_PROFILE_PHASE ("link")
         CompileMessageHandler handler (messageList);
-        ASTUtilities::resolveHoistedEndpoints (allocator, *topLevelNamespace);
-        ASTUtilities::mergeDuplicateNamespaces (*topLevelNamespace);
-        ASTUtilities::removeModulesWithSpecialisationParams (*topLevelNamespace);
+
+        CompileProfiler::measure ("prepare modules", [&]
+        {
+            ASTUtilities::resolveHoistedEndpoints (allocator, *topLevelNamespace);
+            ASTUtilities::mergeDuplicateNamespaces (*topLevelNamespace);
+            ASTUtilities::removeModulesWithSpecialisationParams (*topLevelNamespace);
+        });
+
         ResolutionPass::run (allocator, *topLevelNamespace, false);
 
         compile (getSystemModule ("soul.complex"));
-        ConvertComplexPass::run (allocator, *topLevelNamespace);
+        CompileProfiler::measure ("convert complex", [&] { ConvertComplexPass::run (allocator, *topLevelNamespace); });
 
         ASTUtilities::connectAnyChildEndpointsNeedingToBeExposed (allocator, processorToRun);
 
         Program program;
         program.getStringDictionary() = allocator.stringDictionary;  // Bring the existing string dictionary along so that the handles match
-        compileAllModules (*topLevelNamespace, program, processorToRun);
-        heart::Utilities::inlineFunctionsThatUseAdvanceOrStreams<Optimisations> (program);
-        heart::Checker::sanityCheck (program, settings);
+        CompileProfiler::measure ("generate HEART", [&] { compileAllModules (*topLevelNamespace, program, processorToRun, settings); });
+        CompileProfiler::measure ("inline advance and stream functions", [&] { heart::Utilities::inlineFunctionsThatUseAdvanceOrStreams<Optimisations> (program); });
+        CompileProfiler::measure ("sanity check", [&] { heart::Checker::sanityCheck (program, settings); });
 
         if (settings.optimisationLevel != 0)
         {
-            Optimisations::removeUnusedObjects (program);
+            CompileProfiler::measure ("remove unused objects", [&] { Optimisations::removeUnusedObjects (program); });
         }
 
         reset();
@@ -271,9 +400,29 @@ Program Compiler::link (CompileMessageList& messageList, const BuildSettings& se
         SOUL_LOG (program.getMainProcessor().getReadableName() + ": linked HEART",
                   [&] { return program.toHEART(); });
 
-        heart::Checker::testHEARTRoundTrip (program);
-        Optimisations::optimiseFunctionBlocks (program);
-        Optimisations::removeUnusedVariables (program);
+        CompileProfiler::measure ("HEART verification", [&] { heart::Checker::testHEARTRoundTrip (program, heart::Checker::getVerificationMode (settings)); });
+        CompileProfiler::measure ("optimise function blocks", [&] { Optimisations::optimiseFunctionBlocks (program, settings); });
+
+        if (Optimisations::getOptimisationLevel (settings) >= 2)
+        {
+            CompileProfiler::measure ("inline functions", [&]
+            {
+                if (Optimisations::inlineFunctionsByCost (program))
+                {
+                    Optimisations::removeUnusedObjects (program);
+                    Optimisations::optimiseFunctionBlocks (program, settings);
+                }
+            });
+        }
+
+        CompileProfiler::measure ("SSA optimisations", [&] { SSAOptimisations::optimise (program, settings); });
+        CompileProfiler::measure ("loop optimisations", [&] { LoopOptimisations::optimise (program, settings); });
+        CompileProfiler::measure ("vectorise run loops", [&] { RunLoopVectorisation::vectorise (program, settings); });
+
+        if (settings.optimisationLevel != 0)
+            CompileProfiler::measure ("remove dead stores", [&] { Optimisations::removeDeadStores (program); });
+
+        CompileProfiler::measure ("remove unused variables", [&] { Optimisations::removeUnusedVariables (program, settings); });
 
         return program;
     }
@@ -294,7 +443,7 @@ static Module& createHEARTModule (Program& p, pool_ptr<AST::ModuleBase> module,
 }
 
 void Compiler::compileAllModules (const AST::Namespace& parentNamespace, Program& program,
-                                  AST::ProcessorBase& processorToRun)
+                                  AST::ProcessorBase& processorToRun, const BuildSettings& settings)
 {
     std::vector<pool_ref<AST::ModuleBase>> soulModules;
     ASTUtilities::findAllModulesToCompile (parentNamespace, soulModules);
@@ -305,7 +454,7 @@ void Compiler::compileAllModules (const AST::Namespace& parentNamespace, Program
     for (auto& m : soulModules)
         heartModules.push_back (createHEARTModule (program, m, m == processorToRun));
 
-    HEARTGenerator::build (soulModules, heartModules);
+    HEARTGenerator::build (program, soulModules, heartModules, Optimisations::getMinFunctionsPerThread (settings));
 }
 
 } // namespace soul
@@ -21,6 +21,8 @@
 namespace soul
 {
 
+class LinkerCache;
+
 //==============================================================================
 /**
     Compiles and links some source code to create a Program that can be
@@ -37,9 +39,12 @@ public:
 
     /** This static method runs a complete build and link for a BuildBundle, and returns
         the resulting program.
+        If a cache is provided, a program that was previously built from the same sources
+        and settings will be re-loaded from it rather than being compiled again.
     */
     static Program build (CompileMessageList& messageList,
-                          const BuildBundle& buildBundle);
+                          const BuildBundle& buildBundle,
+                          LinkerCache* cache = nullptr);
 
     /** Compiles a chunk of code which is expected to contain a list of top-level
         processor/graph/namespace decls, and these are added to the program.
@@ -64,11 +69,13 @@ private:
 
     void reset();
     void addDefaultBuiltInLibrary();
+    void compileBuiltInLibrary();
     void compile (CodeLocation);
     Program link (CompileMessageList&, const BuildSettings&, AST::ProcessorBase& processorToRun);
     AST::ProcessorBase& findMainProcessor (const BuildSettings&);
 
-    void compileAllModules (const AST::Namespace& parentNamespace, Program&, AST::ProcessorBase& processorToRun);
+    void compileAllModules (const AST::Namespace& parentNamespace, Program&, AST::ProcessorBase& processorToRun,
+                            const BuildSettings&);
 
     bool includeStandardLibrary;
 };
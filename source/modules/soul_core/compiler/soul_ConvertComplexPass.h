@@ -113,6 +113,10 @@ private:
     {
         m.isFullyResolved = false;
 
+        // the transformations may rewrite any function bodies, so they all need re-resolving
+        for (auto& f : m.getFunctions())
+            f->isFullyResolved = false;
+
         if (auto n = cast<AST::Namespace> (m))
             for (auto& childModule : n->getSubModules())
                 resetResolutionFlag (childModule);
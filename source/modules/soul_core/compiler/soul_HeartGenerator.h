@@ -27,27 +27,50 @@ namespace soul
 */
 struct HEARTGenerator  : public ASTVisitor
 {
-    static void build (choc::span<pool_ref<AST::ModuleBase>> sourceModules,
+    static void build (Program& program,
+                       choc::span<pool_ref<AST::ModuleBase>> sourceModules,
                        choc::span<pool_ref<Module>> targetModules,
+                       size_t minFunctionsPerThread = Optimisations::defaultMinFunctionsPerThread,
                        uint32_t maxNestedExpressionDepth = 255)
     {
         for (auto& m : sourceModules)
             SanityCheckPass::runPreHEARTGenChecks (m);
 
         std::vector<HEARTGenerator> generators;
+        generators.reserve (sourceModules.size());
 
         for (size_t i = 0; i < sourceModules.size(); ++i)
             generators.push_back ({ sourceModules[i], targetModules[i], maxNestedExpressionDepth });
 
         for (size_t i = 0; i < sourceModules.size(); ++i)
             generators[i].visitObject (sourceModules[i]);
+
+        // Once all the modules' functions, structs and state have been declared, each function
+        // body only refers to those, so the bodies can be generated on multiple threads
+        struct FunctionToGenerate
+        {
+            const HEARTGenerator& moduleGenerator;
+            pool_ref<AST::Function> function;
+        };
+
+        std::vector<FunctionToGenerate> functions;
+
+        for (auto& g : generators)
+            for (auto& f : g.functionsToGenerate)
+                functions.push_back ({ g, f });
+
+        Optimisations::forEachItemInParallel (program, functions, minFunctionsPerThread,
+                                              [] (FunctionToGenerate& item, heart::Allocator& allocator)
+        {
+            HEARTGenerator (item.moduleGenerator, allocator).generateFunction (item.function);
+        });
     }
 
 private:
     using super = ASTVisitor;
 
     HEARTGenerator (AST::ModuleBase& source, Module& targetModule, uint32_t maxDepth)
-        : module (targetModule), builder (targetModule), maxExpressionDepth (maxDepth)
+        : module (targetModule), allocator (targetModule.allocator), builder (targetModule), maxExpressionDepth (maxDepth)
     {
         auto path = source.getFullyQualifiedPath();
         module.shortName = path.getLastPart().toString();
@@ -74,9 +97,20 @@ private:
                 addExternalVariable (v);
     }
 
+    /// Creates a generator for one of another generator's functions, which allocates
+    /// its objects with a different allocator
+    HEARTGenerator (const HEARTGenerator& moduleGenerator, heart::Allocator& a)
+        : sourceGraph (moduleGenerator.sourceGraph), sourceProcessor (moduleGenerator.sourceProcessor),
+          module (moduleGenerator.module), allocator (a), builder (module, a),
+          maxExpressionDepth (moduleGenerator.maxExpressionDepth)
+    {
+    }
+
     pool_ptr<const AST::Graph> sourceGraph;
     pool_ptr<const AST::Processor> sourceProcessor;
     Module& module;
+    heart::Allocator& allocator;
+    std::vector<pool_ref<AST::Function>> functionsToGenerate;
 
     uint32_t loopIndex = 0, ifIndex = 0;
     bool parsingStateVariables = false;
@@ -90,7 +124,7 @@ private:
     //==============================================================================
     Identifier convertIdentifier (Identifier i)
     {
-        return module.allocator.get (i);
+        return allocator.get (i);
     }
 
     static std::string getOriginalModulePath (IdentifierPath path)
@@ -105,9 +139,9 @@ private:
                                                 heart::Variable::Role role,
                                                 bool canBeReference)
     {
-        auto& av = module.allocate<heart::Variable> (v.context.location,
-                                                     canBeReference ? v.getType() : v.getType().removeReferenceIfPresent(),
-                                                     convertIdentifier (v.name), role);
+        auto& av = allocator.allocate<heart::Variable> (v.context.location,
+                                                        canBeReference ? v.getType() : v.getType().removeReferenceIfPresent(),
+                                                        convertIdentifier (v.name), role);
         v.generatedVariable = av;
 
         if (role == heart::Variable::Role::state && v.initialValue != nullptr)
@@ -170,7 +204,7 @@ private:
         super::visit (p);
         parsingStateVariables = false;
 
-        generateFunctions (p.functions);
+        addFunctionsToGenerate (p.functions);
     }
 
     void visit (AST::Graph& g) override
@@ -190,7 +224,7 @@ private:
         for (auto& s : n.structures)  visitObject (s);
         for (auto& u : n.usings)      visitObject (u);
 
-        generateFunctions (n.functions);
+        addFunctionsToGenerate (n.functions);
     }
 
     //==============================================================================
@@ -200,7 +234,7 @@ private:
 
         if (e.isInput)
         {
-            auto& i = module.allocate<heart::InputDeclaration> (e.context.location);
+            auto& i = allocator.allocate<heart::InputDeclaration> (e.context.location);
             i.name = convertIdentifier (e.name);
             i.index = (uint32_t) module.inputs.size();
             i.endpointType = details.endpointType;
@@ -216,7 +250,7 @@ private:
         }
         else
         {
-            auto& o = module.allocate<heart::OutputDeclaration> (e.context.location);
+            auto& o = allocator.allocate<heart::OutputDeclaration> (e.context.location);
             o.name = convertIdentifier (e.name);
             o.index = (uint32_t) module.outputs.size();
             o.endpointType = details.endpointType;
@@ -234,7 +268,7 @@ private:
 
     void visit (AST::Connection& conn) override
     {
-        auto& c = module.allocate<heart::Connection> (conn.context.location);
+        auto& c = allocator.allocate<heart::Connection> (conn.context.location);
         module.connections.push_back (c);
 
         c.source.processor      = getOrAddProcessorInstance (conn.getSourceProcessor());
@@ -311,7 +345,7 @@ private:
             {
                 auto& targetProcessor = sourceGraph->findSingleMatchingProcessor (i);
 
-                auto& p = module.allocate<heart::ProcessorInstance> (CodeLocation{});
+                auto& p = allocator.allocate<heart::ProcessorInstance> (CodeLocation{});
                 p.instanceName = instanceName;
                 p.sourceName = targetProcessor.getFullyQualifiedPath().toString();
                 p.arraySize = getProcessorArraySize (i->arraySize).value_or (1);
@@ -367,10 +401,10 @@ private:
         {
             auto name = heart::getEventFunctionName (nameRoot, f.parameters[0]->getType());
             SOUL_ASSERT (module.functions.find (name) == nullptr);
-            return module.allocator.get (name);
+            return allocator.get (name);
         }
 
-        return module.allocator.get (addSuffixToMakeUnique (nameRoot,
+        return allocator.get (addSuffixToMakeUnique (nameRoot,
                                                             [this] (const std::string& name)
                                                             {
                                                                 return module.functions.find (name) != nullptr;
@@ -383,17 +417,21 @@ private:
             module.structs.add (s->getStruct());
     }
 
-    void generateFunctions (choc::span<pool_ref<AST::Function>> functions)
+    void addFunctionsToGenerate (choc::span<pool_ref<AST::Function>> functions)
     {
         for (auto& f : functions)
+        {
             if (! f->isGeneric())
-                generateFunction (f);
+            {
+                f->getGeneratedFunction().returnType = f->returnType->resolveAsType();
+                functionsToGenerate.push_back (f);
+            }
+        }
     }
 
     void generateFunction (AST::Function& f)
     {
         auto& af = f.getGeneratedFunction();
-        af.returnType = f.returnType->resolveAsType();
 
         ifIndex = 0;
         loopIndex = 0;
@@ -419,7 +457,7 @@ private:
             {
                 // This will fail if the function isn't void but some blocks terminate without returning a value,
                 // however, we'll make sure they're not unreachable before flagging this as an error
-                Optimisations::optimiseFunctionBlocks (af, module.allocator);
+                Optimisations::optimiseFunctionBlocks (af, allocator);
 
                 if (! builder.checkFunctionBlocksForTermination())
                     f.context.throwError (Errors::notAllControlPathsReturnAValue (f.name));
@@ -451,7 +489,7 @@ private:
         if (b.isFunctionMainBlock())
             builder.beginBlock (builder.createNewBlock());
 
-        for (auto& s : b.statements)
+        for (auto& s : b.getStatements())
         {
             builder.ensureBlockIsReady();
             expressionDepth = 0;
@@ -512,7 +550,7 @@ private:
     heart::Expression& evaluateAsConstantExpression (AST::Expression& e)
     {
         if (auto c = e.getAsConstant())
-            return module.allocator.allocate<heart::Constant> (c->context.location, c->value);
+            return allocator.allocate<heart::Constant> (c->context.location, c->value);
 
         if (auto v = cast<AST::VariableRef> (e))
         {
@@ -552,7 +590,7 @@ private:
             if (module.isNamespace())
                 pp->context.throwError (Errors::processorPropertyUsedOutsideDecl());
 
-            return module.allocator.allocate<heart::ProcessorProperty> (pp->context.location, pp->property);
+            return allocator.allocate<heart::ProcessorProperty> (pp->context.location, pp->property);
         }
 
         if (auto c = cast<AST::TypeCast> (e))
@@ -582,7 +620,7 @@ private:
         if (++expressionDepth < maxExpressionDepth)
         {
             if (auto c = e.getAsConstant())
-                return module.allocator.allocate<heart::Constant> (c->context.location, c->value);
+                return allocator.allocate<heart::Constant> (c->context.location, c->value);
 
             if (auto v = cast<AST::VariableRef> (e))
             {
@@ -664,7 +702,7 @@ private:
                 if (module.isNamespace())
                     pp->context.throwError (Errors::processorPropertyUsedOutsideDecl());
 
-                return module.allocator.allocate<heart::ProcessorProperty> (pp->context.location, pp->property);
+                return allocator.allocate<heart::ProcessorProperty> (pp->context.location, pp->property);
             }
         }
 
@@ -700,7 +738,7 @@ private:
         auto constValue = resolved.getAsConstant();
 
         if (constValue.isValid() && TypeRules::canSilentlyCastTo (targetType, constValue))
-            return module.allocate<heart::Constant> (e.context.location, constValue.castToTypeExpectingSuccess (targetType));
+            return allocator.allocate<heart::Constant> (e.context.location, constValue.castToTypeExpectingSuccess (targetType));
 
         if (! TypeRules::canSilentlyCastTo (targetType, resolvedType))
             e.context.throwError (Errors::expectedExpressionOfType (targetType.getDescription()));
@@ -710,7 +748,7 @@ private:
 
     heart::AggregateInitialiserList& createAggregateInitialiserList (const AST::Context& context, const Type& targetType, AST::CommaSeparatedList& list)
     {
-        auto& result = module.allocator.allocate<heart::AggregateInitialiserList> (context.location, targetType);
+        auto& result = allocator.allocate<heart::AggregateInitialiserList> (context.location, targetType);
         uint32_t index = 0;
 
         for (auto& item : AST::CommaSeparatedList::getAsExpressionList (list))
@@ -743,14 +781,14 @@ private:
             auto range = subscript.getResolvedSliceRange();
             SOUL_ASSERT (arrayOrVectorType.isValidArrayOrVectorRange (range.start, range.end));
 
-            auto& result = builder.module.allocate<heart::ArrayElement> (subscript.context.location, source, range.start, range.end);
+            auto& result = builder.allocator.allocate<heart::ArrayElement> (subscript.context.location, source, range.start, range.end);
             result.suppressWrapWarning = subscript.suppressWrapWarning;
             result.isRangeTrusted = true;
             return result;
         }
 
         auto& index = evaluateAsExpression (*subscript.startIndex);
-        auto& result = builder.module.allocate<heart::ArrayElement> (subscript.context.location, source, index);
+        auto& result = builder.allocator.allocate<heart::ArrayElement> (subscript.context.location, source, index);
         result.suppressWrapWarning = subscript.suppressWrapWarning;
         result.optimiseDynamicIndexIfPossible();
         return result;
@@ -903,10 +941,10 @@ private:
         auto& falseBlock  = builder.createBlock ("@ternary_false_", labelIndex);
         auto& endBlock    = builder.createBlock ("@ternary_end_", labelIndex);
 
-        auto& paramVar = module.allocate<heart::Variable> (t.context.location,
-                                                           targetVar.getType().removeReferenceIfPresent(),
-                                                           module.allocator.get ("_T" + std::to_string (labelIndex)),
-                                                           heart::Variable::Role::parameter);
+        auto& paramVar = allocator.allocate<heart::Variable> (t.context.location,
+                                                              targetVar.getType().removeReferenceIfPresent(),
+                                                              allocator.get ("_T" + std::to_string (labelIndex)),
+                                                              heart::Variable::Role::parameter);
 
         endBlock.addParameter (paramVar);
 
@@ -965,8 +1003,8 @@ private:
         SOUL_ASSERT (call.targetFunction.generatedFunction != nullptr);
         SOUL_ASSERT (call.targetFunction.parameters.size() == numArgs);
 
-        auto& fc = module.allocate<heart::FunctionCall> (call.context.location, targetVariable,
-                                                         call.targetFunction.generatedFunction);
+        auto& fc = allocator.allocate<heart::FunctionCall> (call.context.location, targetVariable,
+                                                            call.targetFunction.generatedFunction);
 
         for (size_t i = 0; i < numArgs; ++i)
         {
@@ -1110,7 +1148,7 @@ private:
 
         auto& oldValue = builder.createRegisterVariable (type);
         builder.addAssignment (oldValue, dest);
-        auto& one = module.allocator.allocate<heart::Constant> (p.context.location, Value::createInt32 (1).castToTypeExpectingSuccess (type));
+        auto& one = allocator.allocate<heart::Constant> (p.context.location, Value::createInt32 (1).castToTypeExpectingSuccess (type));
         auto& incrementedValue = builder.createBinaryOp (p.context.location, oldValue, one, op);
 
         if (resultDestVar == nullptr)
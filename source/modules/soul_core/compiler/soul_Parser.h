@@ -93,16 +93,13 @@ struct StructuralParser   : public SOULTokeniser
         auto oldNumModules = static_cast<int> (parentNamespace.subModules.size());
         p.parseTopLevelDecls (parentNamespace);
 
-        if (oldNumModules == 0)
-            return parentNamespace.subModules;
-
-        auto newModules = parentNamespace.subModules;
-        newModules.erase (newModules.begin(), newModules.begin() + oldNumModules);
-        return newModules;
+        return std::vector<pool_ref<AST::ModuleBase>> (parentNamespace.subModules.begin() + oldNumModules,
+                                                       parentNamespace.subModules.end());
     }
 
     static AST::Function& cloneFunction (AST::Allocator& allocator,
-                                         const AST::Function& functionToClone)
+                                         const AST::Function& functionToClone,
+                                         Identifier newName)
     {
         auto parentModule = functionToClone.getParentScope()->getAsModule();
         SOUL_ASSERT (parentModule != nullptr);
@@ -116,7 +113,11 @@ struct StructuralParser   : public SOULTokeniser
         p.parseFunctionOrStateVariable();
         SOUL_ASSERT (functionList->size() == oldSize + 1);
         ignoreUnused (oldSize);
-        return functionList->back();
+
+        auto& newFunction = functionList->back().get();
+        newFunction.name = newName;
+        functionList->invalidateIndex();
+        return newFunction;
     }
 
     [[noreturn]] void throwError (const CompileMessage& message) const override
@@ -124,6 +125,28 @@ struct StructuralParser   : public SOULTokeniser
         getContext().throwError (message);
     }
 
+    static AST::ModuleBase& cloneModuleWithNewName (AST::Allocator& allocator,
+                                                    AST::Namespace& parentNamespace,
+                                                    AST::ModuleBase& itemToClone,
+                                                    const std::string& newName)
+    {
+        StructuralParser p (allocator, itemToClone.context.location, parentNamespace);
+
+        pool_ptr<AST::ModuleBase> clonedModule;
+
+        if (itemToClone.isProcessor())  clonedModule = p.parseProcessorDecl (itemToClone.processorKeywordLocation, parentNamespace);
+        if (itemToClone.isGraph())      clonedModule = p.parseGraphDecl     (itemToClone.processorKeywordLocation, parentNamespace);
+        if (itemToClone.isNamespace())  clonedModule = p.parseNamespaceDecl (itemToClone.processorKeywordLocation, parentNamespace);
+
+        SOUL_ASSERT (clonedModule != nullptr);
+
+        clonedModule->name = allocator.identifiers.get (newName);
+        clonedModule->originalModule = itemToClone;
+        parentNamespace.subModules.invalidateIndex();
+
+        return *clonedModule;
+    }
+
 private:
     AST::Allocator& allocator;
     pool_ptr<AST::ModuleBase> module;
@@ -244,27 +267,6 @@ private:
         return newModule;
     }
 
-    static AST::ModuleBase& cloneModuleWithNewName (AST::Allocator& allocator,
-                                                    AST::Namespace& parentNamespace,
-                                                    AST::ModuleBase& itemToClone,
-                                                    const std::string& newName)
-    {
-        StructuralParser p (allocator, itemToClone.context.location, parentNamespace);
-
-        pool_ptr<AST::ModuleBase> clonedModule;
-
-        if (itemToClone.isProcessor())  clonedModule = p.parseProcessorDecl (itemToClone.processorKeywordLocation, parentNamespace);
-        if (itemToClone.isGraph())      clonedModule = p.parseGraphDecl     (itemToClone.processorKeywordLocation, parentNamespace);
-        if (itemToClone.isNamespace())  clonedModule = p.parseNamespaceDecl (itemToClone.processorKeywordLocation, parentNamespace);
-
-        SOUL_ASSERT (clonedModule != nullptr);
-
-        clonedModule->name = allocator.identifiers.get (newName);
-        clonedModule->originalModule = itemToClone;
-
-        return *clonedModule;
-    }
-
     pool_ptr<AST::Expression> parseSpecialisationArgs()
     {
         if (! matchIf (Operator::openParen))
@@ -1487,7 +1489,9 @@ private:
 
         auto property = heart::ProcessorProperty::getPropertyFromName (propertyName.toString());
 
-        if (property == heart::ProcessorProperty::Property::none)
+        // framesAvailable is only for use in HEART code that the compiler generates
+        if (property == heart::ProcessorProperty::Property::none
+             || property == heart::ProcessorProperty::Property::framesAvailable)
             propertyName.context.throwError (Errors::unknownProperty());
 
         if (! (module->isProcessor() || module->isGraph()))
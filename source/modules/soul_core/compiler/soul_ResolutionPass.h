@@ -60,6 +60,28 @@ private:
         }
     };
 
+    /// The amount of work that one pass did during an iteration. This is logged, and the
+    /// function counts are also added to the CompileProfiler counters.
+    struct PassStats
+    {
+        const char* name;
+        size_t numFunctionsVisited, numFunctionsSkipped, numReplaced, numFailures;
+    };
+
+    /// Rather than re-sweeping every function on each iteration, the passes keep track of which
+    /// functions they changed or failed to resolve. Any function which survives a complete iteration
+    /// untouched gets marked as fully resolved, and is skipped by the error-ignoring passes after that.
+    struct FunctionActivity
+    {
+        size_t firstPassIndex;
+        bool changed;
+    };
+
+    std::unordered_map<AST::Function*, FunctionActivity> functionActivity;
+    std::vector<PassStats> passStats;
+    size_t iterationNumber = 0;
+    bool useCountsNeedRebuilding = true;
+
     RunStats run (bool ignoreTypeAndConstantErrors)
     {
         RunStats runStats;
@@ -75,26 +97,41 @@ private:
 
         for (;;)
         {
+            CompileProfiler::ScopedPhase iterationPhase ("resolution iteration", [this]
+            {
+                return module.getFullyQualifiedDisplayPath().toString() + ", iteration " + std::to_string (iterationNumber + 1);
+            });
+
             runStats.clear();
+            startIteration();
 
             tryPass<QualifiedIdentifierResolver> (runStats, true);
             tryPass<TypeResolver> (runStats, true);
             tryPass<ProcessorInstanceResolver> (runStats, true);
             tryPass<NamespaceAliasResolver> (runStats, true);
             tryPass<OperatorResolver> (runStats, true);
-            rebuildVariableUseCounts (module);
+            updateVariableUseCounts();
             tryPass<FunctionResolver> (runStats, true);
             tryPass<ConstantFolder> (runStats, true);
 
-            rebuildVariableUseCounts (module);
+            updateVariableUseCounts();
 
             if (runStats.numReplaced == 0)
                 tryPass<GenericFunctionResolver> (runStats, true);
 
+            endIteration();
+
             // Can't use a range-based-for here because the array will change during the loop
             for (size_t i = 0; i < module.getSubModules().size(); ++i)
-                runStats.add (ResolutionPass (allocator, module.getSubModules()[i])
-                                .run (ignoreTypeAndConstantErrors));
+            {
+                auto subModuleStats = ResolutionPass (allocator, module.getSubModules()[i])
+                                        .run (ignoreTypeAndConstantErrors);
+
+                if (subModuleStats.numReplaced != 0)
+                    useCountsNeedRebuilding = true;
+
+                runStats.add (subModuleStats);
+            }
 
             if (runStats.numFailures == 0)
                 break;
@@ -116,7 +153,7 @@ private:
             }
         }
 
-        SanityCheckPass::runPostResolutionChecks (module);
+        CompileProfiler::measure ("post-resolution checks", [this] { SanityCheckPass::runPostResolutionChecks (module); });
 
         module.isFullyResolved = true;
         return runStats;
@@ -125,10 +162,67 @@ private:
     template <typename PassType>
     void tryPass (RunStats& runStats, bool ignoreErrors)
     {
+        SOUL_PROFILE_PHASE (PassType::getPassName())
         PassType pass (*this, ignoreErrors);
         pass.performPass();
         runStats.numFailures += pass.numFails;
         runStats.numReplaced += pass.itemsReplaced;
+
+        if (pass.itemsReplaced != 0)
+            useCountsNeedRebuilding = true;
+
+        CompileProfiler::addToCounter (CompileProfiler::Counter::resolutionFunctionsVisited, static_cast<int64_t> (pass.numFunctionsVisited));
+        CompileProfiler::addToCounter (CompileProfiler::Counter::resolutionFunctionsSkipped, static_cast<int64_t> (pass.numFunctionsSkipped));
+
+        passStats.push_back ({ PassType::getPassName(), pass.numFunctionsVisited, pass.numFunctionsSkipped,
+                               pass.itemsReplaced, pass.numFails });
+    }
+
+    void startIteration()
+    {
+        functionActivity.clear();
+        passStats.clear();
+        ++iterationNumber;
+        CompileProfiler::addToCounter (CompileProfiler::Counter::resolutionIterations);
+    }
+
+    void endIteration()
+    {
+        // A function that was already there when the iteration began will have been seen by
+        // every pass, so if none of them found anything to do, there's nothing more to resolve
+        for (auto& f : functionActivity)
+            if (f.second.firstPassIndex == 0 && ! f.second.changed)
+                f.first->isFullyResolved = true;
+
+        SOUL_LOG ("resolution pass: " + module.getFullyQualifiedDisplayPath().toString()
+                     + ", iteration " + std::to_string (iterationNumber),
+                  [this]
+                  {
+                      std::string desc;
+
+                      for (auto& p : passStats)
+                          desc += std::string (p.name) + ": " + std::to_string (p.numFunctionsVisited) + " functions visited, "
+                                    + std::to_string (p.numFunctionsSkipped) + " skipped, "
+                                    + std::to_string (p.numReplaced) + " replaced, "
+                                    + std::to_string (p.numFailures) + " unresolved\n";
+
+                      return desc;
+                  });
+    }
+
+    void noteFunctionVisited (AST::Function& f, bool changed)
+    {
+        auto& activity = functionActivity.emplace (std::addressof (f), FunctionActivity { passStats.size(), false }).first->second;
+        activity.changed = activity.changed || changed;
+    }
+
+    void updateVariableUseCounts()
+    {
+        if (useCountsNeedRebuilding)
+        {
+            rebuildVariableUseCounts (module);
+            useCountsNeedRebuilding = false;
+        }
     }
 
     //==============================================================================
@@ -183,6 +277,28 @@ private:
             return RewritingASTVisitor::visit (i);
         }
 
+        AST::Function& visit (AST::Function& f) override
+        {
+            if (f.isGeneric())
+                return RewritingASTVisitor::visit (f);
+
+            if (f.isFullyResolved && ignoreErrors)
+            {
+                ++numFunctionsSkipped;
+                return f;
+            }
+
+            auto oldNumFails = numFails;
+            auto oldItemsReplaced = itemsReplaced;
+            RewritingASTVisitor::visit (f);
+            ++numFunctionsVisited;
+
+            if (ignoreErrors)
+                owner.noteFunctionVisited (f, numFails != oldNumFails || itemsReplaced != oldItemsReplaced);
+
+            return f;
+        }
+
         bool failIfNotResolved (AST::Expression& e)
         {
             if (e.isResolved())
@@ -195,7 +311,7 @@ private:
         ResolutionPass& owner;
         AST::Allocator& allocator;
         AST::ModuleBase& module;
-        size_t numFails = 0;
+        size_t numFails = 0, numFunctionsVisited = 0, numFunctionsSkipped = 0;
         const bool ignoreErrors;
     };
 
@@ -730,11 +846,11 @@ private:
         {
             auto oldStatement = currentStatement;
 
-            for (auto& s : b.statements)
+            b.replaceStatements ([this] (pool_ref<AST::Statement>& s)
             {
                 currentStatement = s;
                 replaceStatement (s);
-            }
+            });
 
             currentStatement = oldStatement;
             return b;
@@ -2730,8 +2846,8 @@ private:
                     if (f->originalGenericFunction == genericFunction && getIDStringForFunction (f) == callerSignatureID)
                         return f;
 
-                auto& newFunction = StructuralParser::cloneFunction (allocator, genericFunction);
-                newFunction.name = allocator.get ("_" + genericFunction.name.toString() + heart::getGenericSpecialisationNameTag());
+                auto& newFunction = StructuralParser::cloneFunction (allocator, genericFunction,
+                                                                     allocator.get ("_" + genericFunction.name.toString() + heart::getGenericSpecialisationNameTag()));
                 newFunction.originalGenericFunction = genericFunction;
                 applyGenericFunctionTypes (newFunction, resolvedTypes);
 
@@ -583,7 +583,7 @@ private:
             super::visit (b);
             soul::DuplicateNameChecker duplicateNameChecker;
 
-            for (auto& s : b.statements)
+            for (auto& s : b.getStatements())
                 if (auto v = cast<AST::VariableDeclaration> (s))
                     duplicateNameChecker.check (v->name, v->context);
         }
@@ -599,7 +599,7 @@ private:
             if (f.block != nullptr)
             {
                 // Ensure top level block variables do not duplicate parameter names
-                for (auto& s : f.block->statements)
+                for (auto& s : f.block->getStatements())
                     if (auto v = cast<AST::VariableDeclaration> (s))
                         duplicateNameChecker.check (v->name, v->context);
             }
@@ -23,7 +23,7 @@ namespace soul
 
 //==============================================================================
 /// A ref-counted holder for a source code string.
-struct SourceCodeText  final : public RefCountedObject
+struct SourceCodeText  final : public ThreadSafeRefCountedObject
 {
     using Ptr = RefCountedPtr<SourceCodeText>;
 
@@ -0,0 +1,164 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+
+namespace soul
+{
+
+static thread_local CompileProfiler* currentProfiler = nullptr;
+
+CompileProfiler::CompileProfiler()  : previousProfiler (currentProfiler)
+{
+    currentProfiler = this;
+    ++numActiveProfilers;
+}
+
+CompileProfiler::~CompileProfiler()
+{
+    SOUL_ASSERT (currentProfiler == this);
+    currentProfiler = previousProfiler;
+    --numActiveProfilers;
+}
+
+CompileProfiler* CompileProfiler::getCurrent() noexcept
+{
+    return currentProfiler;
+}
+
+const char* CompileProfiler::getCounterName (Counter c)
+{
+    switch (c)
+    {
+        case Counter::tokens:                      return "tokens";
+        case Counter::astObjects:                  return "AST objects";
+        case Counter::heartObjects:                return "HEART objects";
+        case Counter::bytesAllocated:              return "bytes allocated";
+        case Counter::resolutionIterations:        return "resolution iterations";
+        case Counter::resolutionFunctionsVisited:  return "resolution functions visited";
+        case Counter::resolutionFunctionsSkipped:  return "resolution functions skipped";
+        case Counter::numCounters:
+        default:                                   SOUL_ASSERT_FALSE; return "";
+    }
+}
+
+double CompileProfiler::getMicrosecondsSinceStart() const
+{
+    return std::chrono::duration<double, std::micro> (clock::now() - startTime).count();
+}
+
+size_t CompileProfiler::startPhase (const char* name, std::string detail)
+{
+    Phase p;
+    p.name = name;
+    p.detail = std::move (detail);
+    p.depth = currentDepth++;
+    p.counterDeltas = counters;
+    p.startMicroseconds = getMicrosecondsSinceStart();
+    phases.push_back (std::move (p));
+    return phases.size() - 1;
+}
+
+void CompileProfiler::endPhase (size_t phaseIndex)
+{
+    auto& p = phases[phaseIndex];
+    p.durationMicroseconds = getMicrosecondsSinceStart() - p.startMicroseconds;
+    p.countersAtEnd = counters;
+
+    for (size_t i = 0; i < numCounters; ++i)
+        p.counterDeltas[i] = counters[i] - p.counterDeltas[i];
+
+    SOUL_ASSERT (currentDepth > 0);
+    --currentDepth;
+}
+
+choc::value::Value CompileProfiler::toChromeTrace() const
+{
+    auto events = choc::value::createEmptyArray();
+
+    for (auto& p : phases)
+    {
+        auto args = choc::value::createObject ({});
+
+        if (! p.detail.empty())
+            args.addMember ("detail", p.detail);
+
+        for (size_t i = 0; i < numCounters; ++i)
+            if (p.counterDeltas[i] != 0)
+                args.addMember (getCounterName (static_cast<Counter> (i)), p.counterDeltas[i]);
+
+        events.addArrayElement (choc::value::createObject ({},
+                                                           "name", std::string (p.name),
+                                                           "ph", "X",
+                                                           "ts", p.startMicroseconds,
+                                                           "dur", p.durationMicroseconds,
+                                                           "pid", 1,
+                                                           "tid", 1,
+                                                           "args", args));
+
+        auto totals = choc::value::createObject ({});
+
+        for (size_t i = 0; i < numCounters; ++i)
+            totals.addMember (getCounterName (static_cast<Counter> (i)), p.countersAtEnd[i]);
+
+        events.addArrayElement (choc::value::createObject ({},
+                                                           "name", "counters",
+                                                           "ph", "C",
+                                                           "ts", p.startMicroseconds + p.durationMicroseconds,
+                                                           "pid", 1,
+                                                           "args", totals));
+    }
+
+    return choc::value::createObject ({},
+                                      "traceEvents", events,
+                                      "displayTimeUnit", "ms");
+}
+
+std::string CompileProfiler::toChromeTraceJSON() const
+{
+    return choc::json::toString (toChromeTrace());
+}
+
+std::string CompileProfiler::getSummary() const
+{
+    std::ostringstream out;
+
+    for (auto& p : phases)
+    {
+        out << std::string (p.depth * 2, ' ') << p.name;
+
+        if (! p.detail.empty())
+            out << " (" << p.detail << ")";
+
+        out << ": " << choc::text::getDurationDescription (std::chrono::duration<double, std::micro> (p.durationMicroseconds));
+
+        for (size_t i = 0; i < numCounters; ++i)
+            if (p.counterDeltas[i] != 0)
+                out << ", " << getCounterName (static_cast<Counter> (i)) << ": " << p.counterDeltas[i];
+
+        out << std::endl;
+    }
+
+    return out.str();
+}
+
+} // namespace soul
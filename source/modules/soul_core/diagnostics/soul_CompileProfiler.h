@@ -0,0 +1,174 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Records a timeline of the phases that the compiler goes through, along with some
+    counters for the amount of work that each phase does.
+
+    While a CompileProfiler exists, any compilation that happens on the same thread will
+    add its phases to it, so to profile a build, just create one on the stack before calling
+    Compiler::build(). If profilers are nested, the innermost one receives the results.
+
+    The results can be exported in the Chrome trace event format, which can be viewed
+    with chrome://tracing or Perfetto.
+*/
+class CompileProfiler  final
+{
+public:
+    CompileProfiler();
+    ~CompileProfiler();
+
+    CompileProfiler (const CompileProfiler&) = delete;
+    CompileProfiler& operator= (const CompileProfiler&) = delete;
+
+    enum class Counter
+    {
+        tokens,
+        astObjects,
+        heartObjects,
+        bytesAllocated,
+        resolutionIterations,
+        resolutionFunctionsVisited,
+        resolutionFunctionsSkipped,
+        numCounters
+    };
+
+    static constexpr size_t numCounters = static_cast<size_t> (Counter::numCounters);
+    using CounterValues = std::array<int64_t, numCounters>;
+
+    struct Phase
+    {
+        const char* name;
+        std::string detail;
+        uint32_t depth = 0;
+        double startMicroseconds = 0, durationMicroseconds = 0;
+        CounterValues counterDeltas {}, countersAtEnd {};
+    };
+
+    //==============================================================================
+    /** Marks the start and end of a phase, if there's a profiler active on this thread. */
+    struct ScopedPhase
+    {
+        ScopedPhase (const char* name)  : ScopedPhase (name, [] { return std::string(); }) {}
+
+        /// The detail function is only called if a profiler is active.
+        template <typename GetDetailFn>
+        ScopedPhase (const char* name, GetDetailFn&& getDetail)  : profiler (getCurrentIfAnyActive())
+        {
+            if (profiler != nullptr)
+                phaseIndex = profiler->startPhase (name, getDetail());
+        }
+
+        ~ScopedPhase()
+        {
+            if (profiler != nullptr)
+                profiler->endPhase (phaseIndex);
+        }
+
+        ScopedPhase (const ScopedPhase&) = delete;
+
+    private:
+        CompileProfiler* const profiler;
+        size_t phaseIndex = 0;
+    };
+
+    /** Calls a function, recording the time it takes as a phase with the given name. */
+    template <typename Function>
+    static auto measure (const char* name, Function&& fn)
+    {
+        ScopedPhase phase (name);
+        return fn();
+    }
+
+    /** Returns the profiler that's active on the current thread, or nullptr. */
+    static CompileProfiler* getCurrent() noexcept;
+
+    /** Returns the profiler that's active on the current thread, or nullptr.
+        This is the one to use in hot code: when no profilers exist on any thread, it just
+        checks a global count, and doesn't need to look up the thread-local pointer.
+    */
+    static CompileProfiler* getCurrentIfAnyActive() noexcept
+    {
+        return numActiveProfilers.load (std::memory_order_relaxed) != 0 ? getCurrent() : nullptr;
+    }
+
+    /** Adds to one of the counters of this thread's profiler, if there is one. */
+    static void addToCounter (Counter counter, int64_t amount = 1) noexcept
+    {
+        if (auto p = getCurrentIfAnyActive())
+            p->counters[static_cast<size_t> (counter)] += amount;
+    }
+
+    /** Counts a newly-allocated AST or HEART object. */
+    static void countAllocation (Counter objectCounter, size_t size) noexcept
+    {
+        if (auto p = getCurrentIfAnyActive())
+        {
+            p->counters[static_cast<size_t> (objectCounter)]++;
+            p->counters[static_cast<size_t> (Counter::bytesAllocated)] += static_cast<int64_t> (size);
+        }
+    }
+
+    //==============================================================================
+    static const char* getCounterName (Counter);
+    int64_t getCounter (Counter c) const            { return counters[static_cast<size_t> (c)]; }
+
+    /** Returns the phases in the order in which they started. */
+    const std::vector<Phase>& getPhases() const     { return phases; }
+
+    /** Returns the timeline as a Chrome trace object. */
+    choc::value::Value toChromeTrace() const;
+
+    /** Returns the timeline as Chrome trace JSON. */
+    std::string toChromeTraceJSON() const;
+
+    /** Returns a readable, indented list of the phases and their timings. */
+    std::string getSummary() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static inline std::atomic<uint32_t> numActiveProfilers { 0 };
+
+    CompileProfiler* const previousProfiler;
+    const clock::time_point startTime = clock::now();
+    std::vector<Phase> phases;
+    CounterValues counters {};
+    uint32_t currentDepth = 0;
+
+    size_t startPhase (const char* name, std::string detail);
+    void endPhase (size_t phaseIndex);
+    double getMicrosecondsSinceStart() const;
+};
+
+#define SOUL_PROFILE_JOIN_INNER(a, b)  a ## b
+#define SOUL_PROFILE_JOIN(a, b)        SOUL_PROFILE_JOIN_INNER(a, b)
+
+#define SOUL_PROFILE_PHASE(name) \
+    const soul::CompileProfiler::ScopedPhase SOUL_PROFILE_JOIN (profilePhase_, __LINE__) (name);
+
+#define SOUL_PROFILE_PHASE_WITH_DETAIL(name, getDetail) \
+    const soul::CompileProfiler::ScopedPhase SOUL_PROFILE_JOIN (profilePhase_, __LINE__) (name, getDetail);
+
+} // namespace soul
@@ -76,6 +76,7 @@ namespace soul
     X(processorSpecialisationNotAllowed,    "Processor specialisations may only be used in graphs") \
     X(namespaceSpecialisationNotAllowed,    "Namespace specialisations may only be used in namespaces") \
     X(wrongAPIVersion,                      "Cannot parse code that was generated by a later version of the API") \
+    X(needsLaterHEARTVersion,               "This feature requires HEART format version $0$ or later") \
     X(semicolonAfterBrace,                  "A brace-enclosed declaration should not be followed by a semicolon") \
     X(nameInUse,                            "The name $Q0$ is already in use") \
     X(invalidEndpointName,                  "The name $Q0$ is not a valid endpoint name") \
@@ -288,6 +289,7 @@ namespace soul
     X(ratioMustBePowerOf2,                  "Clock ratio must be a power of 2") \
     X(unsupportedSincClockRatio,            "Clock ratio not supported by sinc interpolator") \
     X(codeCacheConsistencyFail,             "Code cache consistency failure") \
+    X(invalidBinaryHEART,                   "Invalid or incompatible binary HEART data") \
     X(cannotAssignToDynamicElement,         "Cannot assign to an element of a dynamic array") \
     X(unresolvedExternal,                   "Failed to resolve external variable $Q0$") \
     X(cannotConvertExternalType,            "Cannot convert value for external from $Q0$ to $Q1$") \
@@ -319,6 +321,7 @@ namespace soul
     X(unsupportedBlockSize,                 "Unsupported block size") \
     X(unsupportedSampleRate,                "Unsupported sample rate") \
     X(unsupportedOptimisationLevel,         "Unsupported optimisation level") \
+    X(unknownHEARTVerificationMode,         "Unknown heartVerification mode $Q0$ - expected 'off', 'sampled' or 'full'") \
     X(unsupportedNumChannels,               "Unsupported number of channels") \
 
 #define SOUL_ERRORS_RUNTIME(X) \
@@ -331,6 +334,9 @@ namespace soul
     X(cannotReadFile,                       "Failed to read from file $Q0$") \
     X(cannotWriteFile,                      "Failed to write to file $Q0$") \
     X(cannotLoadLibrary,                    "Cannot load library $Q0$") \
+    X(insecureBuildFolder,                  "The folder $Q0$ can be modified by other users, so libraries can't be safely built there") \
+    X(multiFrameStreamAccessNotSupported,   "This performer cannot run code which accesses multiple stream frames at once") \
+    X(nativeCompilationFailed,              "Failed to compile the generated C++: $0$") \
     X(processTookTooLong,                   "Processing took too long") \
 
 
@@ -0,0 +1,205 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+
+namespace soul
+{
+
+RenderProfiler::RenderProfiler (uint32_t maxNumPendingBlocks)
+{
+    pendingBlocks.reset (maxNumPendingBlocks);
+}
+
+void RenderProfiler::endBlock() noexcept
+{
+    if (! isMeasuringBlock)
+        return;
+
+    isMeasuringBlock = false;
+    auto& block = currentBlock;
+    block.totalMicroseconds = getMicroseconds (clock::now() - blockStartTime);
+
+    auto rate = sampleRate.load (std::memory_order_relaxed);
+
+    if (rate > 0)
+        block.xrun = block.totalMicroseconds > block.numFrames * 1.0e6 / rate;
+
+    updateTotals (block, ! pendingBlocks.push (block));
+}
+
+void RenderProfiler::updateTotals (const BlockStats& block, bool wasDropped) noexcept
+{
+    // Only the render thread writes these, so plain loads and stores are enough,
+    // and avoid needing compare-exchange loops
+    auto add = [] (auto& total, auto amount)  { total.store (total.load (std::memory_order_relaxed) + amount, std::memory_order_relaxed); };
+
+    auto sequence = totalsSequence.load (std::memory_order_relaxed);
+    totalsSequence.store (sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    auto generation = requestedGeneration.load (std::memory_order_acquire);
+
+    if (totals.generation.load (std::memory_order_relaxed) != generation)
+    {
+        for (auto& h : totals.histogram)
+            h.store (0, std::memory_order_relaxed);
+
+        totals.numBlocks.store (0, std::memory_order_relaxed);
+        totals.numChunks.store (0, std::memory_order_relaxed);
+        totals.numXRuns.store (0, std::memory_order_relaxed);
+        totals.numRecordsDropped.store (0, std::memory_order_relaxed);
+        totals.totalMicroseconds.store (0, std::memory_order_relaxed);
+        totals.worstMicroseconds.store (0, std::memory_order_relaxed);
+        totals.generation.store (generation, std::memory_order_relaxed);
+    }
+
+    add (totals.totalMicroseconds, block.totalMicroseconds);
+
+    if (block.totalMicroseconds > totals.worstMicroseconds.load (std::memory_order_relaxed))
+        totals.worstMicroseconds.store (block.totalMicroseconds, std::memory_order_relaxed);
+
+    add (totals.histogram[getBucketIndex (block.totalMicroseconds)], 1u);
+    add (totals.numChunks, block.numChunks);
+    add (totals.numBlocks, 1u);
+
+    if (block.xrun)
+        add (totals.numXRuns, 1u);
+
+    if (wasDropped)
+        add (totals.numRecordsDropped, 1u);
+
+    totalsSequence.store (sequence + 2, std::memory_order_release);
+}
+
+uint32_t RenderProfiler::getBucketIndex (double microseconds) noexcept
+{
+    if (microseconds <= 1.0)
+        return 0;
+
+    auto index = static_cast<uint32_t> (std::ceil (std::log2 (microseconds) * bucketsPerOctave));
+    return std::min (index, numBuckets - 1);
+}
+
+double RenderProfiler::getBucketUpperLimit (uint32_t bucketIndex) noexcept
+{
+    return std::exp2 (bucketIndex / static_cast<double> (bucketsPerOctave));
+}
+
+RenderProfiler::Summary RenderProfiler::getSummary() const
+{
+    Summary s;
+    std::array<uint64_t, numBuckets> counts;
+    double totalTime;
+    uint32_t generation;
+
+    // Keep copying until we get a set of totals that the render thread didn't change while we read it
+    for (;;)
+    {
+        auto sequence = totalsSequence.load (std::memory_order_acquire);
+
+        if ((sequence & 1) == 0)
+        {
+            s.numBlocks = totals.numBlocks.load (std::memory_order_relaxed);
+            s.numChunks = totals.numChunks.load (std::memory_order_relaxed);
+            s.numXRuns = totals.numXRuns.load (std::memory_order_relaxed);
+            s.numRecordsDropped = totals.numRecordsDropped.load (std::memory_order_relaxed);
+            s.worstMicroseconds = totals.worstMicroseconds.load (std::memory_order_relaxed);
+            totalTime = totals.totalMicroseconds.load (std::memory_order_relaxed);
+            generation = totals.generation.load (std::memory_order_relaxed);
+
+            for (uint32_t i = 0; i < numBuckets; ++i)
+                counts[i] = totals.histogram[i].load (std::memory_order_relaxed);
+
+            std::atomic_thread_fence (std::memory_order_acquire);
+
+            if (totalsSequence.load (std::memory_order_relaxed) == sequence)
+                break;
+        }
+
+        std::this_thread::yield();
+    }
+
+    // A reset has been asked for, but the render thread hasn't got round to it yet
+    if (generation != requestedGeneration.load (std::memory_order_acquire) || s.numBlocks == 0)
+        return {};
+
+    s.averageMicroseconds = totalTime / static_cast<double> (s.numBlocks);
+    uint64_t total = s.numBlocks;
+
+    auto getPercentile = [&] (double proportion)
+    {
+        auto target = static_cast<uint64_t> (std::ceil (proportion * static_cast<double> (total)));
+        uint64_t count = 0;
+
+        for (uint32_t i = 0; i < numBuckets; ++i)
+        {
+            count += counts[i];
+
+            if (count >= target)
+                return std::min (getBucketUpperLimit (i), s.worstMicroseconds);
+        }
+
+        return s.worstMicroseconds;
+    };
+
+    s.percentile50 = getPercentile (0.5);
+    s.percentile95 = getPercentile (0.95);
+    s.percentile99 = getPercentile (0.99);
+    return s;
+}
+
+void RenderProfiler::resetSummary()
+{
+    requestedGeneration.fetch_add (1, std::memory_order_release);
+}
+
+const char* RenderProfiler::getStageName (Stage stage)
+{
+    switch (stage)
+    {
+        case Stage::prepare:            return "prepare";
+        case Stage::inputDelivery:      return "input delivery";
+        case Stage::advance:            return "advance";
+        case Stage::outputCollection:   return "output collection";
+        case Stage::numStages:
+        default:                        SOUL_ASSERT_FALSE; return "";
+    }
+}
+
+std::string RenderProfiler::Summary::toString() const
+{
+    auto formatTime = [] (double microseconds)
+    {
+        return choc::text::getDurationDescription (std::chrono::duration<double, std::micro> (microseconds));
+    };
+
+    return std::to_string (numBlocks) + " blocks, " + std::to_string (numChunks) + " chunks, "
+             + std::to_string (numXRuns) + " xruns, average " + formatTime (averageMicroseconds)
+             + ", 50%: " + formatTime (percentile50)
+             + ", 95%: " + formatTime (percentile95)
+             + ", 99%: " + formatTime (percentile99)
+             + ", worst: " + formatTime (worstMicroseconds)
+             + (numRecordsDropped != 0 ? ", " + std::to_string (numRecordsDropped) + " records dropped" : std::string());
+}
+
+} // namespace soul
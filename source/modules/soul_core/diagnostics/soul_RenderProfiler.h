@@ -0,0 +1,194 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Lock-free timing instrumentation for a real-time render loop.
+
+    The render thread brackets each block with beginBlock() and endBlock(), and times its
+    stages with a ScopedStage. At the end of each block, a BlockStats record is pushed
+    into a wait-free FIFO which a non-real-time thread can drain with readBlockStats(),
+    and the block's time is added to a histogram from which getSummary() can calculate
+    worst-case and percentile figures at any time.
+
+    Nothing is measured unless setEnabled (true) has been called, so a disabled profiler
+    costs one atomic load per block.
+*/
+struct RenderProfiler
+{
+    RenderProfiler (uint32_t maxNumPendingBlocks = 4096);
+
+    using clock = std::chrono::steady_clock;
+
+    enum class Stage
+    {
+        prepare,
+        inputDelivery,
+        advance,
+        outputCollection,
+        numStages
+    };
+
+    static constexpr size_t numStages = static_cast<size_t> (Stage::numStages);
+
+    struct BlockStats
+    {
+        uint64_t startFrame = 0;
+        uint32_t numFrames = 0;
+        uint32_t numChunks = 0;   // the number of times the block was split, e.g. at event boundaries
+        double totalMicroseconds = 0;
+        std::array<double, numStages> stageMicroseconds {};
+        bool xrun = false;        // true if rendering the block took longer than the block lasts
+    };
+
+    /** Turns measurement on or off. Can be called from any thread. */
+    void setEnabled (bool shouldBeEnabled)              { enabled = shouldBeEnabled; }
+    bool isEnabled() const noexcept                     { return enabled; }
+
+    /** Sets the rate used to work out each block's real-time deadline. Can be called from any thread. */
+    void setSampleRate (double newSampleRate)           { sampleRate = newSampleRate; }
+
+    //==============================================================================
+    /** Called by the render thread at the start of a block. */
+    void beginBlock (uint64_t startFrame, uint32_t numFrames) noexcept
+    {
+        isMeasuringBlock = enabled.load (std::memory_order_relaxed);
+
+        if (isMeasuringBlock)
+        {
+            currentBlock = {};
+            currentBlock.startFrame = startFrame;
+            currentBlock.numFrames = numFrames;
+            blockStartTime = clock::now();
+        }
+    }
+
+    /** Called by the render thread each time it starts rendering a chunk of the current block. */
+    void beginChunk() noexcept
+    {
+        if (isMeasuringBlock)
+            ++currentBlock.numChunks;
+    }
+
+    /** Called by the render thread at the end of a block. */
+    void endBlock() noexcept;
+
+    /** Measures the time that the render thread spends in one stage of a block. */
+    struct ScopedStage
+    {
+        ScopedStage (RenderProfiler* p, Stage s) noexcept
+            : profiler (p != nullptr && p->isMeasuringBlock ? p : nullptr), stage (s)
+        {
+            if (profiler != nullptr)
+                start = clock::now();
+        }
+
+        ~ScopedStage()
+        {
+            if (profiler != nullptr)
+                profiler->currentBlock.stageMicroseconds[static_cast<size_t> (stage)] += getMicroseconds (clock::now() - start);
+        }
+
+        ScopedStage (const ScopedStage&) = delete;
+
+    private:
+        RenderProfiler* const profiler;
+        const Stage stage;
+        clock::time_point start;
+    };
+
+    //==============================================================================
+    /** Calls a function for each block record that the render thread has added since the
+        last call. This must only be called by one (non-real-time) thread at a time.
+    */
+    template <typename HandleBlockFn>
+    void readBlockStats (HandleBlockFn&& handleBlock)
+    {
+        BlockStats stats;
+
+        while (pendingBlocks.pop (stats))
+            handleBlock (stats);
+    }
+
+    struct Summary
+    {
+        uint64_t numBlocks = 0, numChunks = 0, numXRuns = 0, numRecordsDropped = 0;
+        double averageMicroseconds = 0, worstMicroseconds = 0;
+        double percentile50 = 0, percentile95 = 0, percentile99 = 0;
+
+        std::string toString() const;
+    };
+
+    /** Returns statistics for all the blocks measured since the last call to resetSummary().
+        Can be called from any thread, and always sees the totals as they were between two
+        blocks. The percentiles are approximate, as the block times are rounded up to the
+        edges of the histogram's logarithmically-spaced buckets.
+    */
+    Summary getSummary() const;
+
+    /** Clears the totals that getSummary() returns. Can be called from any thread.
+        The render thread does the actual clearing at the end of its next block, so the
+        new totals start at a block boundary, and until then getSummary() returns an empty
+        summary.
+    */
+    void resetSummary();
+
+    static const char* getStageName (Stage);
+
+private:
+    //==============================================================================
+    static double getMicroseconds (clock::duration d) noexcept   { return std::chrono::duration<double, std::micro> (d).count(); }
+
+    // Block times are counted in buckets that are an eighth of an octave wide, starting at 1uS
+    static constexpr uint32_t bucketsPerOctave = 8, numBuckets = bucketsPerOctave * 24;
+    static uint32_t getBucketIndex (double microseconds) noexcept;
+    static double getBucketUpperLimit (uint32_t bucketIndex) noexcept;
+
+    std::atomic<bool> enabled { false };
+    std::atomic<double> sampleRate { 0 };
+
+    // only touched by the render thread
+    bool isMeasuringBlock = false;
+    BlockStats currentBlock;
+    clock::time_point blockStartTime;
+
+    choc::fifo::SingleReaderSingleWriterFIFO<BlockStats> pendingBlocks;
+
+    // Only the render thread writes to the totals. It makes the sequence number odd while it's
+    // updating them, so that a reader can tell when it needs to retry, and a copy is always a
+    // complete set. The fields are atomics so that the readers' racing reads are well-defined.
+    struct Totals
+    {
+        std::array<std::atomic<uint64_t>, numBuckets> histogram {};
+        std::atomic<uint64_t> numBlocks { 0 }, numChunks { 0 }, numXRuns { 0 }, numRecordsDropped { 0 };
+        std::atomic<double> totalMicroseconds { 0 }, worstMicroseconds { 0 };
+        std::atomic<uint32_t> generation { 0 };
+    };
+
+    Totals totals;
+    std::atomic<uint32_t> totalsSequence { 0 }, requestedGeneration { 0 };
+
+    void updateTotals (const BlockStats&, bool wasDropped) noexcept;
+};
+
+} // namespace soul
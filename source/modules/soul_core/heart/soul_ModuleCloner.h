@@ -397,22 +397,28 @@ struct ModuleCloner
 
     heart::ReadStream& clone (const heart::ReadStream& old)
     {
-        return newModule.allocate<heart::ReadStream> (old.location,
-                                                      cloneExpression (*old.target),
-                                                      getRemappedInput (old.source));
+        auto& r = newModule.allocate<heart::ReadStream> (old.location,
+                                                         cloneExpression (*old.target),
+                                                         getRemappedInput (old.source));
+        r.numFrames = old.numFrames;
+        return r;
     }
 
     heart::WriteStream& clone (const heart::WriteStream& old)
     {
-        return newModule.allocate<heart::WriteStream> (old.location,
-                                                       getRemappedOutput (old.target),
-                                                       cloneExpressionPtr (old.element),
-                                                       cloneExpression (old.value));
+        auto& w = newModule.allocate<heart::WriteStream> (old.location,
+                                                          getRemappedOutput (old.target),
+                                                          cloneExpressionPtr (old.element),
+                                                          cloneExpression (old.value));
+        w.numFrames = old.numFrames;
+        return w;
     }
 
-    heart::AdvanceClock& clone (const heart::AdvanceClock& a)
+    heart::AdvanceClock& clone (const heart::AdvanceClock& old)
     {
-        return newModule.allocate<heart::AdvanceClock> (a.location);
+        auto& a = newModule.allocate<heart::AdvanceClock> (old.location);
+        a.numFrames = old.numFrames;
+        return a;
     }
 
     void clone (heart::Function& f, const heart::Function& old)
@@ -294,10 +294,34 @@ Program Program::createFromHEART (CompileMessageList& messageList, CodeLocation
     return {};
 }
 
+Program Program::createFromBinary (CompileMessageList& messageList, const void* data, size_t size, bool runSanityCheck)
+{
+    try
+    {
+        CompileMessageHandler handler (messageList);
+        auto program = heart::BinaryFormat::read (data, size);
+
+        for (auto& m : program.getModules())
+        {
+            m->rebuildBlockPredecessors();
+            m->rebuildVariableUseCounts();
+        }
+
+        if (runSanityCheck)
+            heart::Checker::sanityCheck (program);
+
+        return program;
+    }
+    catch (AbortCompilationException) {}
+
+    return {};
+}
+
 Program Program::clone() const                                                          { return pimpl->clone(); }
 bool Program::isEmpty() const                                                           { return getModules().empty(); }
 Program::operator bool() const                                                          { return ! isEmpty(); }
 std::string Program::toHEART() const                                                    { return heart::Printer::getDump (*this); }
+std::vector<uint8_t> Program::toBinary() const                                          { return heart::BinaryFormat::write (*this); }
 const std::vector<pool_ref<Module>>& Program::getModules() const                        { return pimpl->modules; }
 void Program::removeModule (Module& module)                                             { return pimpl->removeModule (module); }
 
@@ -55,6 +55,19 @@ public:
     */
     static Program createFromHEART (CompileMessageList&, CodeLocation heartCode, bool runSanityCheck);
 
+    /** Creates a compact binary form of this program, which is much quicker to reload than HEART code.
+        The data is specific to the HEART version and platform that created it, so is only suitable
+        for use as a local cache.
+        @see createFromBinary()
+    */
+    std::vector<uint8_t> toBinary() const;
+
+    /** Converts a block of data that was created by toBinary() back to a Program.
+        The data is copied, so doesn't need to remain valid after this call returns.
+        @see toBinary()
+    */
+    static Program createFromBinary (CompileMessageList&, const void* data, size_t size, bool runSanityCheck);
+
     //==============================================================================
     /** Return true if the program contains no modules. */
     bool isEmpty() const;
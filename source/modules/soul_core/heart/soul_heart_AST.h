@@ -59,6 +59,11 @@ struct heart
         X(ReturnVoid) \
         X(ReturnValue) \
 
+    #define SOUL_HEART_ALL_TYPES(X) \
+        SOUL_HEART_OBJECTS (X) \
+        SOUL_HEART_STATEMENTS (X) \
+        SOUL_HEART_TERMINATORS (X)
+
     struct Object;
     struct Statement;
     struct VariableOrValue;
@@ -66,13 +71,29 @@ struct heart
     struct Terminator;
 
     #define SOUL_PREDECLARE_TYPE(Type)     struct Type;
-    SOUL_HEART_OBJECTS (SOUL_PREDECLARE_TYPE)
-    SOUL_HEART_STATEMENTS (SOUL_PREDECLARE_TYPE)
-    SOUL_HEART_TERMINATORS (SOUL_PREDECLARE_TYPE)
+    SOUL_HEART_ALL_TYPES (SOUL_PREDECLARE_TYPE)
     #undef SOUL_PREDECLARE_TYPE
 
+    enum class ObjectType  : uint8_t
+    {
+        #define SOUL_DECLARE_ENUM(Type)    Type,
+        SOUL_HEART_ALL_TYPES (SOUL_DECLARE_ENUM)
+        #undef SOUL_DECLARE_ENUM
+        unknown
+    };
+
+    template <typename Type>
+    static constexpr ObjectType getObjectType()
+    {
+        #define SOUL_GET_OBJECT_TYPE(T)    if constexpr (std::is_same<Type, T>::value) return ObjectType::T; else
+        SOUL_HEART_ALL_TYPES (SOUL_GET_OBJECT_TYPE)
+        #undef SOUL_GET_OBJECT_TYPE
+        return ObjectType::unknown;
+    }
+
     struct Parser;
     struct Printer;
+    struct BinaryFormat;
     struct Checker;
     struct Utilities;
 
@@ -99,7 +120,19 @@ struct heart
         Allocator (Allocator&&) = default;
 
         template <typename Type, typename... Args>
-        Type& allocate (Args&&... args)                       { return pool.allocate<Type> (std::forward<Args> (args)...); }
+        Type& allocate (Args&&... args)
+        {
+            auto& o = pool.allocate<Type> (std::forward<Args> (args)...);
+
+            if constexpr (std::is_base_of<Object, Type>::value)
+            {
+                CompileProfiler::countAllocation (CompileProfiler::Counter::heartObjects, sizeof (Type));
+                static_assert (getObjectType<Type>() != ObjectType::unknown, "All heart::Object classes must be listed in SOUL_HEART_ALL_TYPES");
+                o.objectType = getObjectType<Type>();
+            }
+
+            return o;
+        }
 
         template <typename ValueType>
         Constant& allocateConstant (ValueType value)          { return allocate<heart::Constant> (CodeLocation(), value); }
@@ -109,8 +142,21 @@ struct heart
         template <typename Type>
         Identifier get (const Type& newString)                { return identifiers.get (newString); }
 
+        /// Takes ownership of everything that another allocator has created, so that objects
+        /// which it allocated (e.g. on a worker thread) will live as long as this one does.
+        /// Any identifiers it created are also added to this allocator's pool, so that later
+        /// lookups of the same names return the same identifiers.
+        void adopt (Allocator&& other)
+        {
+            identifiers.addStringsFrom (other.identifiers);
+            adoptedAllocators.push_back (std::make_unique<Allocator> (std::move (other)));
+        }
+
         choc::memory::Pool pool;
         Identifier::Pool identifiers;
+
+    private:
+        std::vector<std::unique_ptr<Allocator>> adoptedAllocators;
     };
 
     //==============================================================================
@@ -121,7 +167,30 @@ struct heart
         Object (const Object&) = delete;
         virtual ~Object() {}
 
+        /// Allows soul::cast() to use the objectType rather than a dynamic_cast
+        using CastRootType = Object;
+
+        template <typename TargetType>
+        static TargetType* castTo (Object& o) noexcept
+        {
+            switch (o.objectType)
+            {
+                #define SOUL_CAST_TO_TARGET(Type) \
+                    case ObjectType::Type: \
+                        if constexpr (std::is_base_of<TargetType, Type>::value) return static_cast<Type*> (std::addressof (o)); \
+                        else return nullptr;
+
+                SOUL_HEART_ALL_TYPES (SOUL_CAST_TO_TARGET)
+                #undef SOUL_CAST_TO_TARGET
+
+                case ObjectType::unknown:
+                default:
+                    SOUL_ASSERT_FALSE;
+            }
+        }
+
         CodeLocation location;
+        ObjectType objectType = ObjectType::unknown; // this gets set by the Allocator
     };
 
     //==============================================================================
@@ -278,6 +347,8 @@ struct heart
         ClockMultiplier (const ClockMultiplier& c) : multiplier (c.multiplier), divider (c.divider) {}
 
         bool hasValue() const         { return multiplier.has_value() || divider.has_value(); }
+        std::optional<int64_t> getMultiplier() const    { return multiplier; }
+        std::optional<int64_t> getDivider() const       { return divider; }
         double getRatio() const       { return static_cast<double> (multiplier.value_or (1)) / static_cast<double> (divider.value_or (1)); }
 
         std::string toString() const
@@ -1305,6 +1376,10 @@ struct heart
 
         pool_ref<InputDeclaration> source;
         pool_ptr<Expression> element;
+
+        /** If this is more than 1, the statement reads this many consecutive frames from the
+            current position into a vector, rather than reading a single frame. */
+        uint32_t numFrames = 1;
     };
 
     struct WriteStream  : public Statement
@@ -1334,6 +1409,10 @@ struct heart
         pool_ref<OutputDeclaration> target;
         pool_ptr<Expression> element;
         pool_ref<Expression> value;
+
+        /** If this is more than 1, the value is a vector whose elements are written to
+            this many consecutive frames, starting at the current one. */
+        uint32_t numFrames = 1;
     };
 
     //==============================================================================
@@ -1346,7 +1425,8 @@ struct heart
             frequency,
             id,
             session,
-            latency
+            latency,
+            framesAvailable
         };
 
         ProcessorProperty (CodeLocation l, Property prop)
@@ -1371,6 +1451,7 @@ struct heart
             if (name == "id")         return Property::id;
             if (name == "session")    return Property::session;
             if (name == "latency")    return Property::latency;
+            if (name == "framesAvailable")  return Property::framesAvailable;
 
             return Property::none;
         }
@@ -1382,6 +1463,7 @@ struct heart
             if (p == Property::id)         return "id";
             if (p == Property::session)    return "session";
             if (p == Property::latency)    return "latency";
+            if (p == Property::framesAvailable)  return "framesAvailable";
 
             SOUL_ASSERT_FALSE;
             return "";
@@ -1389,12 +1471,20 @@ struct heart
 
         static Type getPropertyType (Property p)
         {
-            if (p == Property::id || p == Property::session || p == Property::latency)
+            if (p == Property::id || p == Property::session || p == Property::latency || p == Property::framesAvailable)
                 return PrimitiveType::int32;
 
             return Type::getFrequencyType();
         }
 
+        /** The framesAvailable property is only used by code that the compiler generates, and is
+            the number of frames, starting at the current one, which the run() function can process
+            before the end of the block being rendered or the next incoming event. Unlike the other
+            properties, it changes between frames, so it mustn't be treated as a constant.
+        */
+        static bool canChangeBetweenFrames (Property p)     { return p == Property::framesAvailable; }
+        bool canChangeBetweenFrames() const                 { return canChangeBetweenFrames (property); }
+
         const char* getPropertyName() const
         {
             return getPropertyName (property);
@@ -1408,6 +1498,10 @@ struct heart
     {
         AdvanceClock (CodeLocation l) : Statement (std::move (l)) {}
         bool mayHaveSideEffects() const override    { return true; }
+
+        /** The number of frames to move forward, which can only be more than 1 after
+            a check of the framesAvailable property. */
+        uint32_t numFrames = 1;
     };
 };
 
@@ -0,0 +1,1529 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Converts a Program to and from a compact binary form.
+
+    This holds the same information as the HEART text that the Printer emits, but
+    can be loaded in a single pass without any tokenising or name lookup, so it's a
+    better fit for things like caching compiled programs. The reader works on any
+    contiguous block of memory (e.g. a memory-mapped file) and copies everything it
+    needs out of it, so the data doesn't need to outlive the resulting Program.
+
+    To keep it smaller than the text, names and types are pooled: each one is written in
+    full the first time it's used, and after that it's referred to by a variable-length
+    index. Numbers inside constants are stored the same way, and only the string literals
+    that the program's values actually refer to are kept.
+
+    The data is only intended for local caches: it's tied to the HEART format version,
+    the byte order and the pointer size of the machine that wrote it, and the reader
+    rejects anything that doesn't match.
+*/
+struct heart::BinaryFormat
+{
+    static std::vector<uint8_t> write (const Program& program)
+    {
+        Writer w (program);
+        w.writeProgram();
+        return std::move (w.data);
+    }
+
+    /** Fails with an Errors::invalidBinaryHEART() error if the data isn't valid. */
+    static Program read (const void* data, size_t size)
+    {
+        Reader r (data, size);
+        return r.readProgram();
+    }
+
+private:
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+
+    // Bump this whenever the layout changes without a change to the HEART format version
+    static constexpr int64_t formatRevision = 3;
+
+    static std::string getMagicNumber()      { return std::string (getHEARTFormatVersionPrefix()) + "BIN"; }
+
+    enum class ModuleType : uint8_t
+    {
+        processor,
+        graph,
+        namespace_
+    };
+
+    enum class TypeCategory : uint8_t
+    {
+        invalid,
+        primitive,
+        vector,
+        array,
+        wrap,
+        clamp,
+        structure,
+        stringLiteral
+    };
+
+    enum class ExpressionTag : uint8_t
+    {
+        newVariable,
+        localVariable,
+        stateVariable,
+        constant,
+        aggregate,
+        arrayElement,
+        structElement,
+        typeCast,
+        unaryOperator,
+        binaryOperator,
+        pureFunctionCall,
+        processorProperty
+    };
+
+    enum class StatementTag : uint8_t
+    {
+        #define SOUL_DECLARE_STATEMENT_TAG(Type)   Type,
+        SOUL_HEART_STATEMENTS (SOUL_DECLARE_STATEMENT_TAG)
+        SOUL_HEART_TERMINATORS (SOUL_DECLARE_STATEMENT_TAG)
+        #undef SOUL_DECLARE_STATEMENT_TAG
+        none
+    };
+
+    static bool isAggregate (const Type& type)
+    {
+        return type.isStruct() || type.isFixedSizeArray() || type.isVector();
+    }
+
+    //==============================================================================
+    struct Writer
+    {
+        Writer (const Program& p) : program (p) {}
+
+        const Program& program;
+        std::vector<uint8_t> data;
+
+        std::unordered_map<const Structure*, size_t> structIndexes;
+        std::unordered_map<const heart::Function*, size_t> functionIndexes;
+        std::unordered_map<const heart::Variable*, size_t> stateVariableIndexes, localVariableIndexes;
+        std::unordered_map<const heart::InputDeclaration*, size_t> inputIndexes;
+        std::unordered_map<const heart::OutputDeclaration*, size_t> outputIndexes;
+        std::unordered_map<const heart::ProcessorInstance*, size_t> processorInstanceIndexes;
+        std::unordered_map<const heart::Block*, size_t> blockIndexes;
+        std::unordered_map<std::string, size_t> stringIndexes, typeIndexes;
+        std::unordered_set<uint32_t> stringLiteralHandles;
+
+        void writeProgram()
+        {
+            createGlobalIndexes();
+            writeModulesAndConstants();
+
+            // The string literals can't be written until all the values that use them have been seen
+            auto body = std::move (data);
+            data = {};
+
+            writeText (getMagicNumber());
+            writeInt (getHEARTFormatVersion());
+            writeInt (formatRevision);
+            writeByte (static_cast<uint8_t> (sizeof (void*)));
+            writeRaw (std::addressof (byteOrderMark), sizeof (byteOrderMark));
+            writeStringLiterals();
+            writeRaw (body.data(), body.size());
+        }
+
+        void writeModulesAndConstants()
+        {
+            auto& modules = program.getModules();
+            writeUInt (modules.size());
+
+            for (auto& m : modules)  writeModuleDeclaration (m);
+            for (auto& m : modules)  writeStructMembersAndReturnTypes (m);
+            for (auto& m : modules)  writeModuleProperties (m);
+            for (auto& m : modules)  writeFunctions (m);
+
+            auto& constants = program.getConstantTable();
+            writeUInt (constants.size());
+
+            for (auto& item : constants)
+            {
+                writeInt (item.handle);
+                writeValue (*item.value);
+            }
+        }
+
+        void createGlobalIndexes()
+        {
+            for (auto& m : program.getModules())
+            {
+                for (auto& s : m->structs.get())
+                    structIndexes[s.get()] = structIndexes.size();
+
+                for (auto& f : m->functions.get())
+                    functionIndexes[f.getPointer()] = functionIndexes.size();
+
+                for (auto& v : m->stateVariables.get())
+                    stateVariableIndexes[v.getPointer()] = stateVariableIndexes.size();
+            }
+        }
+
+        //==============================================================================
+        void writeModuleDeclaration (const Module& m)
+        {
+            writeByte (static_cast<uint8_t> (m.isProcessor() ? ModuleType::processor
+                                                             : (m.isGraph() ? ModuleType::graph : ModuleType::namespace_)));
+            writeString (m.shortName);
+            writeString (m.fullName);
+            writeString (m.originalFullName);
+
+            writeUInt (m.structs.size());
+
+            for (auto& s : m.structs.get())
+                writeString (s->getName());
+
+            writeUInt (m.functions.size());
+
+            for (auto& f : m.functions.get())
+            {
+                writeString (f->name.toString());
+                writeBool (f->functionType.isEvent());
+            }
+        }
+
+        void writeStructMembersAndReturnTypes (const Module& m)
+        {
+            for (auto& s : m.structs.get())
+            {
+                writeUInt (s->getNumMembers());
+
+                for (auto& member : s->getMembers())
+                {
+                    writeType (member.type);
+                    writeString (member.name);
+                }
+            }
+
+            for (auto& f : m.functions.get())
+                writeType (f->returnType);
+        }
+
+        void writeModuleProperties (const Module& m)
+        {
+            writeAnnotation (m.annotation);
+            writeDouble (m.sampleRate);
+            writeUInt (m.latency);
+
+            writeUInt (m.inputs.size());
+
+            for (auto& i : m.inputs)
+                writeIODeclaration (i);
+
+            writeUInt (m.outputs.size());
+
+            for (auto& o : m.outputs)
+                writeIODeclaration (o);
+
+            writeUInt (m.processorInstances.size());
+            processorInstanceIndexes.clear();
+
+            for (auto& p : m.processorInstances)
+            {
+                processorInstanceIndexes[p.getPointer()] = processorInstanceIndexes.size();
+                writeString (p->instanceName);
+                writeString (p->sourceName);
+                writeUInt (p->arraySize);
+                writeOptionalInt (p->clockMultiplier.getMultiplier());
+                writeOptionalInt (p->clockMultiplier.getDivider());
+            }
+
+            writeUInt (m.connections.size());
+
+            for (auto& c : m.connections)
+            {
+                writeByte (static_cast<uint8_t> (c->interpolationType));
+                writeEndpointReference (c->source);
+                writeEndpointReference (c->dest);
+                writeOptionalInt (c->delayLength);
+            }
+
+            writeUInt (m.stateVariables.size());
+
+            for (auto& v : m.stateVariables.get())
+                writeVariableProperties (v);
+        }
+
+        void writeIODeclaration (const heart::IODeclaration& io)
+        {
+            writeString (io.name.toString());
+            writeUInt (io.index);
+            writeByte (static_cast<uint8_t> (io.endpointType));
+            writeUInt (io.dataTypes.size());
+
+            for (auto& t : io.dataTypes)
+                writeType (t);
+
+            writeOptionalInt (io.arraySize);
+            writeAnnotation (io.annotation);
+        }
+
+        void writeEndpointReference (const heart::EndpointReference& e)
+        {
+            if (e.processor != nullptr)
+                writeUInt (getIndex (processorInstanceIndexes, e.processor.get()) + 1);
+            else
+                writeUInt (0);
+
+            writeString (e.endpointName);
+            writeOptionalInt (e.endpointIndex);
+        }
+
+        //==============================================================================
+        void writeFunctions (const Module& m)
+        {
+            inputIndexes.clear();
+            outputIndexes.clear();
+
+            for (auto& i : m.inputs)   inputIndexes[i.getPointer()] = inputIndexes.size();
+            for (auto& o : m.outputs)  outputIndexes[o.getPointer()] = outputIndexes.size();
+
+            localVariableIndexes.clear();
+
+            for (auto& v : m.stateVariables.get())
+                writeOptionalExpression (v->initialValue);
+
+            for (auto& f : m.functions.get())
+                writeFunction (f);
+        }
+
+        void writeFunction (const heart::Function& f)
+        {
+            localVariableIndexes.clear();
+            blockIndexes.clear();
+
+            writeByte (static_cast<uint8_t> (f.functionType.type));
+            writeByte (static_cast<uint8_t> (f.intrinsicType));
+            writeBool (f.isExported);
+            writeBool (f.hasNoBody);
+            writeUInt (f.localVariableStackSize);
+            writeAnnotation (f.annotation);
+
+            writeUInt (f.parameters.size());
+
+            for (auto& p : f.parameters)
+                writeExpression (p);
+
+            writeOptionalExpression (f.stateParameter);
+            writeOptionalExpression (f.ioParameter);
+
+            writeUInt (f.blocks.size());
+
+            for (auto& b : f.blocks)
+            {
+                blockIndexes[b.getPointer()] = blockIndexes.size();
+                writeString (b->name.toString());
+            }
+
+            for (auto& b : f.blocks)
+            {
+                writeBool (b->doNotOptimiseAway);
+                writeUInt (b->parameters.size());
+
+                for (auto& p : b->parameters)
+                    writeExpression (p);
+
+                writeUInt (static_cast<size_t> (std::distance (b->statements.begin(), b->statements.end())));
+
+                for (auto s : b->statements)
+                    writeStatement (*s);
+
+                if (b->terminator != nullptr)
+                    writeTerminator (*b->terminator);
+                else
+                    writeByte (static_cast<uint8_t> (StatementTag::none));
+            }
+        }
+
+        void writeStatement (heart::Statement& s)
+        {
+            if (auto a = cast<heart::AssignFromValue> (s))
+            {
+                writeTag (StatementTag::AssignFromValue);
+                writeExpression (*a->target);
+                writeExpression (a->source);
+                return;
+            }
+
+            if (auto fc = cast<heart::FunctionCall> (s))
+            {
+                writeTag (StatementTag::FunctionCall);
+                writeOptionalExpression (fc->target);
+                writeUInt (getIndex (functionIndexes, std::addressof (fc->getFunction())));
+                writeExpressionList (fc->arguments);
+                return;
+            }
+
+            if (auto r = cast<heart::ReadStream> (s))
+            {
+                writeTag (StatementTag::ReadStream);
+                writeExpression (*r->target);
+                writeUInt (getIndex (inputIndexes, r->source.getPointer()));
+                writeOptionalExpression (r->element);
+                writeUInt (r->numFrames);
+                return;
+            }
+
+            if (auto w = cast<heart::WriteStream> (s))
+            {
+                writeTag (StatementTag::WriteStream);
+                writeUInt (getIndex (outputIndexes, w->target.getPointer()));
+                writeOptionalExpression (w->element);
+                writeExpression (w->value);
+                writeUInt (w->numFrames);
+                return;
+            }
+
+            auto a = cast<heart::AdvanceClock> (s);
+            SOUL_ASSERT (a != nullptr);
+            writeTag (StatementTag::AdvanceClock);
+            writeUInt (a->numFrames);
+        }
+
+        void writeTerminator (heart::Terminator& t)
+        {
+            if (auto b = cast<heart::Branch> (t))
+            {
+                writeTag (StatementTag::Branch);
+                writeUInt (getIndex (blockIndexes, b->target.getPointer()));
+                writeExpressionList (b->targetArgs);
+                return;
+            }
+
+            if (auto b = cast<heart::BranchIf> (t))
+            {
+                writeTag (StatementTag::BranchIf);
+                writeExpression (b->condition);
+                writeUInt (getIndex (blockIndexes, b->targets[0].getPointer()));
+                writeUInt (getIndex (blockIndexes, b->targets[1].getPointer()));
+                writeExpressionList (b->targetArgs[0]);
+                writeExpressionList (b->targetArgs[1]);
+                return;
+            }
+
+            if (auto r = cast<heart::ReturnValue> (t))
+            {
+                writeTag (StatementTag::ReturnValue);
+                writeExpression (r->returnValue);
+                return;
+            }
+
+            SOUL_ASSERT (cast<heart::ReturnVoid> (t) != nullptr);
+            writeTag (StatementTag::ReturnVoid);
+        }
+
+        //==============================================================================
+        void writeExpression (heart::Expression& e)
+        {
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto state = stateVariableIndexes.find (v.get());
+
+                if (state != stateVariableIndexes.end())
+                {
+                    writeTag (ExpressionTag::stateVariable);
+                    writeUInt (state->second);
+                    return;
+                }
+
+                auto local = localVariableIndexes.find (v.get());
+
+                if (local != localVariableIndexes.end())
+                {
+                    writeTag (ExpressionTag::localVariable);
+                    writeUInt (local->second);
+                    return;
+                }
+
+                // Locals are defined the first time they're encountered, wherever that happens to be
+                localVariableIndexes[v.get()] = localVariableIndexes.size();
+                writeTag (ExpressionTag::newVariable);
+                writeVariableProperties (*v);
+                writeOptionalExpression (v->initialValue);
+                return;
+            }
+
+            if (auto c = cast<heart::Constant> (e))
+            {
+                writeTag (ExpressionTag::constant);
+                writeValue (c->value);
+                return;
+            }
+
+            if (auto l = cast<heart::AggregateInitialiserList> (e))
+            {
+                writeTag (ExpressionTag::aggregate);
+                writeType (l->type);
+                writeExpressionList (l->items);
+                return;
+            }
+
+            if (auto a = cast<heart::ArrayElement> (e))
+            {
+                writeTag (ExpressionTag::arrayElement);
+                writeExpression (a->parent);
+                writeOptionalExpression (a->dynamicIndex);
+                writeUInt (a->fixedStartIndex);
+                writeUInt (a->fixedEndIndex);
+                writeBool (a->isRangeTrusted);
+                writeBool (a->suppressWrapWarning);
+                return;
+            }
+
+            if (auto s = cast<heart::StructElement> (e))
+            {
+                writeTag (ExpressionTag::structElement);
+                writeExpression (s->parent);
+                writeString (s->memberName);
+                return;
+            }
+
+            if (auto t = cast<heart::TypeCast> (e))
+            {
+                writeTag (ExpressionTag::typeCast);
+                writeExpression (t->source);
+                writeType (t->destType);
+                return;
+            }
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                writeTag (ExpressionTag::unaryOperator);
+                writeByte (static_cast<uint8_t> (u->operation));
+                writeExpression (u->source);
+                return;
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                writeTag (ExpressionTag::binaryOperator);
+                writeByte (static_cast<uint8_t> (b->operation));
+                writeExpression (b->lhs);
+                writeExpression (b->rhs);
+                return;
+            }
+
+            if (auto fc = cast<heart::PureFunctionCall> (e))
+            {
+                writeTag (ExpressionTag::pureFunctionCall);
+                writeUInt (getIndex (functionIndexes, std::addressof (fc->function)));
+                writeExpressionList (fc->arguments);
+                return;
+            }
+
+            auto pp = cast<heart::ProcessorProperty> (e);
+            SOUL_ASSERT (pp != nullptr);
+            writeTag (ExpressionTag::processorProperty);
+            writeByte (static_cast<uint8_t> (pp->property));
+        }
+
+        void writeOptionalExpression (pool_ptr<heart::Expression> e)
+        {
+            writeBool (e != nullptr);
+
+            if (e != nullptr)
+                writeExpression (*e);
+        }
+
+        void writeOptionalExpression (pool_ptr<heart::Variable> v)
+        {
+            writeOptionalExpression (pool_ptr<heart::Expression> (v));
+        }
+
+        template <typename ListType>
+        void writeExpressionList (const ListType& list)
+        {
+            writeUInt (list.size());
+
+            for (auto& e : list)
+                writeExpression (e);
+        }
+
+        void writeVariableProperties (const heart::Variable& v)
+        {
+            writeType (v.type);
+            writeString (v.name.isValid() ? v.name.toString() : std::string());
+            writeByte (static_cast<uint8_t> (v.role));
+            writeInt (v.externalHandle);
+            writeAnnotation (v.annotation);
+        }
+
+        //==============================================================================
+        void writeType (const Type& t)
+        {
+            auto key = t.getDescription ([this] (const Structure& s) { return "#" + std::to_string (getIndex (structIndexes, std::addressof (s))); });
+            auto existing = typeIndexes.find (key);
+
+            if (existing != typeIndexes.end())
+            {
+                writeUInt (existing->second + 1);
+                return;
+            }
+
+            writeUInt (0);
+            writeTypeDefinition (t);
+
+            // This is added after the definition, because an array's element type gets its index first
+            typeIndexes[key] = typeIndexes.size();
+        }
+
+        void writeTypeDefinition (const Type& t)
+        {
+            writeByte (static_cast<uint8_t> ((t.isConst() ? 1 : 0) | (t.isReference() ? 2 : 0)));
+
+            if (t.isStruct())
+            {
+                writeTag (TypeCategory::structure);
+                writeUInt (getIndex (structIndexes, t.getStruct().get()));
+            }
+            else if (t.isArray())
+            {
+                writeTag (TypeCategory::array);
+                writeUInt (t.isUnsizedArray() ? 0 : t.getArraySize());
+                writeType (t.getArrayElementType());
+            }
+            else if (t.isVector())
+            {
+                writeTag (TypeCategory::vector);
+                writeByte (static_cast<uint8_t> (t.getVectorElementType().type));
+                writeUInt (t.getVectorSize());
+            }
+            else if (t.isBoundedInt())
+            {
+                writeTag (t.isWrapped() ? TypeCategory::wrap : TypeCategory::clamp);
+                writeUInt (static_cast<uint64_t> (t.getBoundedIntLimit()));
+            }
+            else if (t.isStringLiteral())
+            {
+                writeTag (TypeCategory::stringLiteral);
+            }
+            else if (t.isPrimitive())
+            {
+                writeTag (TypeCategory::primitive);
+                writeByte (static_cast<uint8_t> (t.getPrimitiveType().type));
+            }
+            else
+            {
+                writeTag (TypeCategory::invalid);
+            }
+        }
+
+        /// String literals are written as handles into the program's dictionary, unless a
+        /// dictionary is given, in which case their text is written instead.
+        void writeValue (const Value& v, const StringDictionary* dictionaryToInline = nullptr)
+        {
+            writeType (v.getType());
+
+            if (! v.isValid())
+                return;
+
+            auto packedData = static_cast<const uint8_t*> (v.getPackedData());
+
+            // Aggregates are often zero-initialised, and that's worth storing as a single flag
+            if (isAggregate (v.getType()))
+            {
+                auto isZero = std::all_of (packedData, packedData + v.getPackedDataSize(), [] (uint8_t n) { return n == 0; });
+                writeBool (isZero);
+
+                if (isZero)
+                    return;
+            }
+
+            writeValueData (v.getType(), packedData, dictionaryToInline);
+        }
+
+        void writeValueData (const Type& type, const uint8_t* source, const StringDictionary* dictionaryToInline)
+        {
+            if (type.isStruct())
+            {
+                for (auto& m : type.getStructRef().getMembers())
+                {
+                    writeValueData (m.type, source, dictionaryToInline);
+                    source += m.type.getPackedSizeInBytes();
+                }
+            }
+            else if (type.isFixedSizeArray() || type.isVector())
+            {
+                auto elementType = type.isVector() ? Type (type.getVectorElementType()) : type.getArrayElementType();
+                auto elementSize = elementType.getPackedSizeInBytes();
+
+                for (auto i = type.getArrayOrVectorSize(); i != 0; --i)
+                {
+                    writeValueData (elementType, source, dictionaryToInline);
+                    source += elementSize;
+                }
+            }
+            else if (type.isStringLiteral())
+            {
+                auto handle = readPackedData<StringDictionary::Handle> (source);
+
+                if (dictionaryToInline != nullptr)
+                {
+                    writeString (std::string (dictionaryToInline->getStringForHandle (handle)));
+                }
+                else
+                {
+                    if (handle != StringDictionary::Handle())
+                        stringLiteralHandles.insert (handle.handle);
+
+                    writeUInt (handle.handle);
+                }
+            }
+            else if (type.isUnsizedArray())
+            {
+                writeInt (readPackedData<ConstantTable::Handle> (source));
+            }
+            else if (type.isInteger32())
+            {
+                writeInt (readPackedData<int32_t> (source));
+            }
+            else if (type.isInteger64())
+            {
+                writeInt (readPackedData<int64_t> (source));
+            }
+            else
+            {
+                writeRaw (source, static_cast<size_t> (type.getPackedSizeInBytes()));
+            }
+        }
+
+        template <typename Type>
+        static Type readPackedData (const uint8_t* source)
+        {
+            Type n;
+            std::memcpy (std::addressof (n), source, sizeof (n));
+            return n;
+        }
+
+        void writeAnnotation (const Annotation& a)
+        {
+            auto names = a.getNames();
+            writeUInt (names.size());
+
+            for (auto& name : names)
+            {
+                writeString (name);
+                writeValue (a.getValue (name), std::addressof (a.getDictionary()));
+            }
+        }
+
+        void writeStringLiterals()
+        {
+            std::vector<uint32_t> handles (stringLiteralHandles.begin(), stringLiteralHandles.end());
+            std::sort (handles.begin(), handles.end());
+            writeUInt (handles.size());
+            StringDictionary::Handle lastHandle;
+
+            for (auto handle : handles)
+            {
+                writeUInt (handle - lastHandle.handle);
+                lastHandle.handle = handle;
+                writeText (std::string (program.getStringDictionary().getStringForHandle (lastHandle)));
+            }
+        }
+
+        //==============================================================================
+        template <typename MapType, typename KeyType>
+        static size_t getIndex (const MapType& map, KeyType key)
+        {
+            auto i = map.find (key);
+            SOUL_ASSERT (i != map.end());
+            return i->second;
+        }
+
+        template <typename TagType>
+        void writeTag (TagType tag)                   { writeByte (static_cast<uint8_t> (tag)); }
+
+        void writeByte (uint8_t n)                    { data.push_back (n); }
+        void writeBool (bool b)                       { writeByte (b ? 1 : 0); }
+        void writeInt (int64_t n)                     { writeUInt ((static_cast<uint64_t> (n) << 1) ^ static_cast<uint64_t> (n >> 63)); }
+        void writeDouble (double n)                   { writeRaw (std::addressof (n), sizeof (n)); }
+
+        void writeUInt (uint64_t n)
+        {
+            while (n >= 0x80)
+            {
+                writeByte (static_cast<uint8_t> (n | 0x80));
+                n >>= 7;
+            }
+
+            writeByte (static_cast<uint8_t> (n));
+        }
+
+        template <typename IntType>
+        void writeOptionalInt (const std::optional<IntType>& n)
+        {
+            writeBool (n.has_value());
+
+            if (n.has_value())
+                writeInt (static_cast<int64_t> (*n));
+        }
+
+        void writeString (const std::string& s)
+        {
+            auto existing = stringIndexes.find (s);
+
+            if (existing != stringIndexes.end())
+            {
+                writeUInt (existing->second + 1);
+                return;
+            }
+
+            stringIndexes[s] = stringIndexes.size();
+            writeUInt (0);
+            writeText (s);
+        }
+
+        void writeText (const std::string& s)
+        {
+            writeUInt (s.length());
+            writeRaw (s.data(), s.length());
+        }
+
+        void writeRaw (const void* source, size_t size)
+        {
+            auto start = static_cast<const uint8_t*> (source);
+            data.insert (data.end(), start, start + size);
+        }
+    };
+
+    //==============================================================================
+    struct Reader
+    {
+        Reader (const void* source, size_t size)
+            : data (static_cast<const uint8_t*> (source)), end (data + size)
+        {
+        }
+
+        const uint8_t* data;
+        const uint8_t* const end;
+
+        Program program;
+        std::vector<StructurePtr> structs;
+        std::vector<pool_ref<heart::Function>> functions;
+        std::vector<pool_ref<heart::Variable>> stateVariables, localVariables;
+        std::vector<pool_ref<heart::InputDeclaration>> inputs;
+        std::vector<pool_ref<heart::OutputDeclaration>> outputs;
+        std::vector<pool_ref<heart::Block>> blocks;
+        std::vector<std::string> strings;
+        std::vector<Type> types;
+
+        Program readProgram()
+        {
+            check (readText() == getMagicNumber());
+            check (readInt() == getHEARTFormatVersion());
+            check (readInt() == formatRevision);
+            check (readByte() == sizeof (void*));
+
+            uint32_t order;
+            std::memcpy (std::addressof (order), readBytes (sizeof (order)), sizeof (order));
+            check (order == byteOrderMark);
+
+            readStringLiterals();
+
+            std::vector<pool_ref<Module>> modules;
+
+            for (auto num = readUInt(); num != 0; --num)
+                modules.push_back (readModuleDeclaration());
+
+            for (auto& m : modules)  readStructMembersAndReturnTypes (m);
+            for (auto& m : modules)  readModuleProperties (m);
+            for (auto& m : modules)  readFunctions (m);
+
+            auto& constants = program.getConstantTable();
+
+            auto numConstants = readUInt();
+
+            for (auto num = numConstants; num != 0; --num)
+            {
+                auto handle = readInt();
+                check (handle > 0 && (uint64_t) handle <= numConstants);
+                constants.addItem ({ handle, std::make_unique<Value> (readValue()) });
+            }
+
+            check (data == end);
+            return program;
+        }
+
+        void readStringLiterals()
+        {
+            StringDictionary::Handle handle;
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto nextHandle = handle.handle + readUInt();
+                check (nextHandle <= std::numeric_limits<uint32_t>::max());
+                handle.handle = static_cast<uint32_t> (nextHandle);
+                check (program.getStringDictionary().addItem (handle, readText()));
+            }
+        }
+
+        //==============================================================================
+        Module& readModuleDeclaration()
+        {
+            auto type = static_cast<ModuleType> (readByte());
+            check (type == ModuleType::processor || type == ModuleType::graph || type == ModuleType::namespace_);
+
+            auto& m = type == ModuleType::processor ? program.addProcessor()
+                                                    : (type == ModuleType::graph ? program.addGraph() : program.addNamespace());
+            m.shortName = readString();
+            m.fullName = readString();
+            m.originalFullName = readString();
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto name = readString();
+                check (m.structs.find (name) == nullptr);
+                structs.push_back (m.structs.add (std::move (name)));
+            }
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto name = readString();
+                auto isEvent = readBool();
+                check (m.functions.find (name) == nullptr && ! (isEvent && heart::isReservedFunctionName (name)));
+                functions.push_back (m.functions.add (std::move (name), isEvent));
+            }
+
+            return m;
+        }
+
+        void readStructMembersAndReturnTypes (Module& m)
+        {
+            for (auto& s : m.structs.get())
+            {
+                for (auto num = readUInt(); num != 0; --num)
+                {
+                    auto type = readType();
+                    auto name = readString();
+                    check (! s->hasMemberWithName (name));
+                    s->addMember (std::move (type), std::move (name));
+                }
+            }
+
+            for (auto& f : m.functions.get())
+                f->returnType = readType();
+        }
+
+        void readModuleProperties (Module& m)
+        {
+            m.annotation = readAnnotation();
+            m.sampleRate = readDouble();
+            m.latency = static_cast<uint32_t> (readUInt());
+
+            for (auto num = readUInt(); num != 0; --num)
+                m.inputs.push_back (readIODeclaration<heart::InputDeclaration> (m));
+
+            for (auto num = readUInt(); num != 0; --num)
+                m.outputs.push_back (readIODeclaration<heart::OutputDeclaration> (m));
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto& p = m.allocate<heart::ProcessorInstance> (CodeLocation());
+                p.instanceName = readString();
+                p.sourceName = readString();
+                p.arraySize = static_cast<uint32_t> (readUInt());
+
+                if (auto multiplier = readOptionalInt<int64_t>())
+                    p.clockMultiplier.setMultiplier (CodeLocation(), Value::createInt64 (*multiplier));
+
+                if (auto divider = readOptionalInt<int64_t>())
+                {
+                    check (! p.clockMultiplier.hasValue());
+                    p.clockMultiplier.setDivider (CodeLocation(), Value::createInt64 (*divider));
+                }
+
+                m.processorInstances.push_back (p);
+            }
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto& c = m.allocate<heart::Connection> (CodeLocation());
+                c.interpolationType = static_cast<InterpolationType> (readByte());
+                readEndpointReference (m, c.source);
+                readEndpointReference (m, c.dest);
+                c.delayLength = readOptionalInt<int64_t>();
+                m.connections.push_back (c);
+            }
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto& v = readVariableProperties();
+                stateVariables.push_back (v);
+                m.stateVariables.add (v);
+            }
+        }
+
+        template <typename IODeclarationType>
+        IODeclarationType& readIODeclaration (Module& m)
+        {
+            auto& io = m.allocate<IODeclarationType> (CodeLocation());
+            io.name = m.allocator.get (readString());
+            io.index = static_cast<uint32_t> (readUInt());
+            io.endpointType = static_cast<EndpointType> (readByte());
+
+            for (auto num = readUInt(); num != 0; --num)
+                io.dataTypes.push_back (readType());
+
+            io.arraySize = readOptionalInt<uint32_t>();
+            io.annotation = readAnnotation();
+            return io;
+        }
+
+        void readEndpointReference (Module& m, heart::EndpointReference& e)
+        {
+            if (auto processorIndex = readUInt())
+                e.processor = getItem (m.processorInstances, processorIndex - 1);
+
+            e.endpointName = readString();
+            e.endpointIndex = readOptionalInt<size_t>();
+        }
+
+        //==============================================================================
+        void readFunctions (Module& m)
+        {
+            inputs = m.inputs;
+            outputs = m.outputs;
+            localVariables.clear();
+
+            for (auto& v : m.stateVariables.get())
+                v->initialValue = readOptionalExpression();
+
+            for (auto& f : m.functions.get())
+                readFunction (f);
+        }
+
+        void readFunction (heart::Function& f)
+        {
+            localVariables.clear();
+            blocks.clear();
+
+            f.functionType.type = static_cast<heart::FunctionType::Type> (readByte());
+            f.intrinsicType = static_cast<IntrinsicType> (readByte());
+            f.isExported = readBool();
+            f.hasNoBody = readBool();
+            f.localVariableStackSize = readUInt();
+            f.annotation = readAnnotation();
+
+            for (auto num = readUInt(); num != 0; --num)
+                f.parameters.push_back (readVariable());
+
+            if (readBool())  f.stateParameter = readVariable();
+            if (readBool())  f.ioParameter = readVariable();
+
+            for (auto num = readUInt(); num != 0; --num)
+            {
+                auto name = readString();
+                check (! name.empty() && name[0] == '@');
+                auto& b = program.getAllocator().allocate<heart::Block> (program.getAllocator().get (name));
+                blocks.push_back (b);
+                f.blocks.push_back (b);
+            }
+
+            for (auto& b : f.blocks)
+            {
+                b->doNotOptimiseAway = readBool();
+
+                for (auto num = readUInt(); num != 0; --num)
+                    b->parameters.push_back (readVariable());
+
+                LinkedList<heart::Statement>::Iterator last;
+
+                for (auto num = readUInt(); num != 0; --num)
+                    last = b->statements.insertAfter (last, readStatement());
+
+                b->terminator = readTerminator();
+            }
+        }
+
+        heart::Statement& readStatement()
+        {
+            auto& allocator = program.getAllocator();
+
+            switch (static_cast<StatementTag> (readByte()))
+            {
+                case StatementTag::AssignFromValue:
+                {
+                    auto& target = readExpression();
+                    return allocator.allocate<heart::AssignFromValue> (CodeLocation(), target, readExpression());
+                }
+
+                case StatementTag::FunctionCall:
+                {
+                    auto target = readOptionalExpression();
+                    auto& fc = allocator.allocate<heart::FunctionCall> (CodeLocation(), target, getItem (functions, readUInt()));
+                    readExpressionList (fc.arguments);
+                    return fc;
+                }
+
+                case StatementTag::ReadStream:
+                {
+                    auto& target = readExpression();
+                    auto& r = allocator.allocate<heart::ReadStream> (CodeLocation(), target, getItem (inputs, readUInt()));
+                    r.element = readOptionalExpression();
+                    r.numFrames = readFrameCount();
+                    return r;
+                }
+
+                case StatementTag::WriteStream:
+                {
+                    auto& output = getItem (outputs, readUInt());
+                    auto element = readOptionalExpression();
+                    auto& w = allocator.allocate<heart::WriteStream> (CodeLocation(), output, element, readExpression());
+                    w.numFrames = readFrameCount();
+                    return w;
+                }
+
+                case StatementTag::AdvanceClock:
+                {
+                    auto& a = allocator.allocate<heart::AdvanceClock> (CodeLocation());
+                    a.numFrames = readFrameCount();
+                    return a;
+                }
+
+                default:
+                    break;
+            }
+
+            throwInvalidData();
+        }
+
+        pool_ptr<heart::Terminator> readTerminator()
+        {
+            auto& allocator = program.getAllocator();
+
+            switch (static_cast<StatementTag> (readByte()))
+            {
+                case StatementTag::Branch:
+                {
+                    auto& b = allocator.allocate<heart::Branch> (getItem (blocks, readUInt()));
+                    readExpressionList (b.targetArgs);
+                    return b;
+                }
+
+                case StatementTag::BranchIf:
+                {
+                    auto& condition = readExpression();
+                    auto& trueBlock = getItem (blocks, readUInt());
+                    auto& falseBlock = getItem (blocks, readUInt());
+                    check (trueBlock != falseBlock);
+                    auto& b = allocator.allocate<heart::BranchIf> (condition, trueBlock, falseBlock);
+                    readExpressionList (b.targetArgs[0]);
+                    readExpressionList (b.targetArgs[1]);
+                    return b;
+                }
+
+                case StatementTag::ReturnVoid:    return allocator.allocate<heart::ReturnVoid>();
+                case StatementTag::ReturnValue:   return allocator.allocate<heart::ReturnValue> (readExpression());
+                case StatementTag::none:          return {};
+
+                default:
+                    break;
+            }
+
+            throwInvalidData();
+        }
+
+        //==============================================================================
+        heart::Expression& readExpression()
+        {
+            auto& allocator = program.getAllocator();
+
+            switch (static_cast<ExpressionTag> (readByte()))
+            {
+                case ExpressionTag::newVariable:
+                {
+                    auto& v = readVariableProperties();
+                    localVariables.push_back (v);
+                    v.initialValue = readOptionalExpression();
+                    return v;
+                }
+
+                case ExpressionTag::localVariable:  return getItem (localVariables, readUInt());
+                case ExpressionTag::stateVariable:  return getItem (stateVariables, readUInt());
+                case ExpressionTag::constant:       return allocator.allocate<heart::Constant> (CodeLocation(), readValue());
+
+                case ExpressionTag::aggregate:
+                {
+                    auto& l = allocator.allocate<heart::AggregateInitialiserList> (CodeLocation(), readType());
+                    readExpressionList (l.items);
+                    return l;
+                }
+
+                case ExpressionTag::arrayElement:
+                {
+                    auto& parent = readExpression();
+                    check (parent.getType().isArrayOrVector());
+                    auto dynamicIndex = readOptionalExpression();
+                    auto start = static_cast<size_t> (readUInt());
+                    auto& a = allocator.allocate<heart::ArrayElement> (CodeLocation(), parent, start, static_cast<size_t> (readUInt()));
+                    a.dynamicIndex = dynamicIndex;
+                    a.isRangeTrusted = readBool();
+                    a.suppressWrapWarning = readBool();
+                    return a;
+                }
+
+                case ExpressionTag::structElement:
+                {
+                    auto& parent = readExpression();
+                    auto member = readString();
+                    check (parent.getType().isStruct() && parent.getType().getStructRef().hasMemberWithName (member));
+                    return allocator.allocate<heart::StructElement> (CodeLocation(), parent, std::move (member));
+                }
+
+                case ExpressionTag::typeCast:
+                {
+                    auto& source = readExpression();
+                    return allocator.allocate<heart::TypeCast> (CodeLocation(), source, readType());
+                }
+
+                case ExpressionTag::unaryOperator:
+                {
+                    auto op = static_cast<UnaryOp::Op> (readByte());
+                    return allocator.allocate<heart::UnaryOperator> (CodeLocation(), readExpression(), op);
+                }
+
+                case ExpressionTag::binaryOperator:
+                {
+                    auto op = static_cast<BinaryOp::Op> (readByte());
+                    auto& lhs = readExpression();
+                    return allocator.allocate<heart::BinaryOperator> (CodeLocation(), lhs, readExpression(), op);
+                }
+
+                case ExpressionTag::pureFunctionCall:
+                {
+                    auto& fc = allocator.allocate<heart::PureFunctionCall> (CodeLocation(), getItem (functions, readUInt()));
+                    readExpressionList (fc.arguments);
+                    return fc;
+                }
+
+                case ExpressionTag::processorProperty:
+                {
+                    auto property = static_cast<heart::ProcessorProperty::Property> (readByte());
+                    check (property > heart::ProcessorProperty::Property::none && property <= heart::ProcessorProperty::Property::framesAvailable);
+                    return allocator.allocate<heart::ProcessorProperty> (CodeLocation(), property);
+                }
+
+                default:
+                    break;
+            }
+
+            throwInvalidData();
+        }
+
+        pool_ptr<heart::Expression> readOptionalExpression()
+        {
+            if (readBool())
+                return readExpression();
+
+            return {};
+        }
+
+        heart::Variable& readVariable()
+        {
+            auto v = cast<heart::Variable> (readExpression());
+            check (v != nullptr);
+            return *v;
+        }
+
+        template <typename ListType>
+        void readExpressionList (ListType& list)
+        {
+            for (auto num = readUInt(); num != 0; --num)
+                list.push_back (readExpression());
+        }
+
+        heart::Variable& readVariableProperties()
+        {
+            auto& allocator = program.getAllocator();
+            auto type = readType();
+            auto name = readString();
+            auto role = static_cast<heart::Variable::Role> (readByte());
+            check (role <= heart::Variable::Role::external);
+
+            auto& v = name.empty() ? allocator.allocate<heart::Variable> (CodeLocation(), std::move (type), role)
+                                   : allocator.allocate<heart::Variable> (CodeLocation(), std::move (type), allocator.get (name), role);
+            v.externalHandle = static_cast<ConstantTable::Handle> (readInt());
+            v.annotation = readAnnotation();
+            return v;
+        }
+
+        //==============================================================================
+        Type readType()
+        {
+            if (auto index = readUInt())
+                return getItem (types, index - 1);
+
+            auto type = readTypeDefinition();
+            types.push_back (type);
+            return type;
+        }
+
+        Type readTypeDefinition()
+        {
+            auto flags = readByte();
+            auto type = readTypeWithoutFlags();
+            return type.isValid() ? type.withConstAndRefFlags ((flags & 1) != 0, (flags & 2) != 0) : type;
+        }
+
+        Type readTypeWithoutFlags()
+        {
+            auto category = static_cast<TypeCategory> (readByte());
+
+            switch (category)
+            {
+                case TypeCategory::invalid:         return {};
+                case TypeCategory::primitive:       return readPrimitiveType();
+                case TypeCategory::stringLiteral:   return Type::createStringLiteral();
+                case TypeCategory::structure:       return Type::createStruct (*getItem (structs, readUInt()));
+
+                case TypeCategory::vector:
+                {
+                    auto elementType = readPrimitiveType();
+                    auto size = readUInt();
+                    check (elementType.canBeVectorElementType() && Type::isLegalVectorSize (static_cast<int64_t> (size)));
+                    return Type::createVector (elementType, static_cast<Type::ArraySize> (size));
+                }
+
+                case TypeCategory::array:
+                {
+                    auto size = readUInt();
+                    auto elementType = readType();
+                    check (elementType.canBeArrayElementType() && size <= Type::maxArraySize);
+                    return elementType.createArray (static_cast<Type::ArraySize> (size));
+                }
+
+                case TypeCategory::wrap:
+                case TypeCategory::clamp:
+                {
+                    auto limit = readUInt();
+                    check (Type::isLegalBoundedIntSize (limit));
+                    return category == TypeCategory::wrap ? Type::createWrappedInt (static_cast<Type::BoundedIntSize> (limit))
+                                  : Type::createClampedInt (static_cast<Type::BoundedIntSize> (limit));
+                }
+
+                default:
+                    break;
+            }
+
+            throwInvalidData();
+        }
+
+        PrimitiveType readPrimitiveType()
+        {
+            auto type = static_cast<PrimitiveType::Primitive> (readByte());
+            check (type > PrimitiveType::invalid && type <= PrimitiveType::bool_);
+            return type;
+        }
+
+        Value readValue (StringDictionary* inlinedDictionary = nullptr)
+        {
+            auto type = readType();
+
+            if (! type.isValid())
+                return {};
+
+            auto value = Value::zeroInitialiser (type);
+
+            if (! (isAggregate (type) && readBool()))
+                readValueData (type, static_cast<uint8_t*> (value.getPackedData()), inlinedDictionary);
+
+            return value;
+        }
+
+        void readValueData (const Type& type, uint8_t* dest, StringDictionary* inlinedDictionary)
+        {
+            if (type.isStruct())
+            {
+                for (auto& m : type.getStructRef().getMembers())
+                {
+                    readValueData (m.type, dest, inlinedDictionary);
+                    dest += m.type.getPackedSizeInBytes();
+                }
+            }
+            else if (type.isFixedSizeArray() || type.isVector())
+            {
+                auto elementType = type.isVector() ? Type (type.getVectorElementType()) : type.getArrayElementType();
+                auto elementSize = elementType.getPackedSizeInBytes();
+
+                for (auto i = type.getArrayOrVectorSize(); i != 0; --i)
+                {
+                    readValueData (elementType, dest, inlinedDictionary);
+                    dest += elementSize;
+                }
+            }
+            else if (type.isStringLiteral())
+            {
+                StringDictionary::Handle handle;
+
+                if (inlinedDictionary != nullptr)
+                {
+                    handle = inlinedDictionary->getHandleForString (readString());
+                }
+                else
+                {
+                    auto n = readUInt();
+                    handle.handle = static_cast<uint32_t> (n);
+                    check (n == handle.handle && (n == 0 || program.getStringDictionary().contains (handle)));
+                }
+
+                writePackedData (dest, handle);
+            }
+            else if (type.isUnsizedArray())
+            {
+                writePackedData (dest, static_cast<ConstantTable::Handle> (readInt()));
+            }
+            else if (type.isInteger32())
+            {
+                writePackedData (dest, static_cast<int32_t> (readInt()));
+            }
+            else if (type.isInteger64())
+            {
+                writePackedData (dest, readInt());
+            }
+            else
+            {
+                auto size = static_cast<size_t> (type.getPackedSizeInBytes());
+                std::memcpy (dest, readBytes (size), size);
+            }
+        }
+
+        template <typename Type>
+        static void writePackedData (uint8_t* dest, Type n)
+        {
+            std::memcpy (dest, std::addressof (n), sizeof (n));
+        }
+
+        Annotation readAnnotation()
+        {
+            Annotation a;
+            auto numProperties = readUInt();
+
+            if (numProperties != 0)
+            {
+                StringDictionary dictionary;
+
+                for (; numProperties != 0; --numProperties)
+                {
+                    auto name = readString();
+                    a.set (name, readValue (std::addressof (dictionary)), dictionary);
+                }
+            }
+
+            return a;
+        }
+
+        //==============================================================================
+        [[noreturn]] static void throwInvalidData()      { CodeLocation().throwError (Errors::invalidBinaryHEART()); }
+
+        static void check (bool ok)
+        {
+            if (! ok)
+                throwInvalidData();
+        }
+
+        template <typename ItemType>
+        static ItemType& getItem (std::vector<ItemType>& items, uint64_t index)
+        {
+            check (index < items.size());
+            return items[static_cast<size_t> (index)];
+        }
+
+        const uint8_t* readBytes (size_t num)
+        {
+            check (num <= static_cast<size_t> (end - data));
+            auto start = data;
+            data += num;
+            return start;
+        }
+
+        uint8_t readByte()                    { return *readBytes (1); }
+        bool readBool()                       { return readByte() != 0; }
+
+        int64_t readInt()
+        {
+            auto n = readUInt();
+            return static_cast<int64_t> (n >> 1) ^ -static_cast<int64_t> (n & 1);
+        }
+
+        uint64_t readUInt()
+        {
+            uint64_t result = 0;
+
+            for (int shift = 0; ; shift += 7)
+            {
+                check (shift < 64);
+                auto byte = readByte();
+                result |= static_cast<uint64_t> (byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0)
+                    return result;
+            }
+        }
+
+        uint32_t readFrameCount()
+        {
+            auto n = readUInt();
+            check (n >= 1 && Type::isLegalVectorSize (static_cast<int64_t> (n)));
+            return static_cast<uint32_t> (n);
+        }
+
+        template <typename IntType>
+        std::optional<IntType> readOptionalInt()
+        {
+            if (readBool())
+                return static_cast<IntType> (readInt());
+
+            return {};
+        }
+
+        double readDouble()
+        {
+            double n;
+            std::memcpy (std::addressof (n), readBytes (sizeof (n)), sizeof (n));
+            return n;
+        }
+
+        std::string readString()
+        {
+            if (auto index = readUInt())
+                return getItem (strings, index - 1);
+
+            strings.push_back (readText());
+            return strings.back();
+        }
+
+        std::string readText()
+        {
+            auto length = static_cast<size_t> (readUInt());
+            return std::string (reinterpret_cast<const char*> (readBytes (length)), length);
+        }
+    };
+};
+
+} // namespace soul
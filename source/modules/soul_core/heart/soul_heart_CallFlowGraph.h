@@ -88,6 +88,304 @@ struct CallFlowGraph
         return results;
     }
 
+    /** Works out the size of a function's local variables, if it's not already been calculated,
+        and stores it in its localVariableStackSize member.
+    */
+    static void calculateLocalVariableStackSize (heart::Function& f)
+    {
+        if (f.localVariableStackSize == 0)
+        {
+            uint64_t total = 0;
+
+            for (auto& v : f.getAllLocalVariables())
+                total += getAlignedSize<stackItemAlignment> (v->getType().getPackedSizeInBytes());
+
+            f.localVariableStackSize = total;
+        }
+    }
+
+    //==============================================================================
+    /** Calculates the dominator tree of a function's blocks.
+
+        Only the blocks that can be reached from the function's first block are included,
+        and they're indexed in reverse post-order. The function's block predecessor lists
+        must be up to date before this is created.
+    */
+    struct DominatorTree
+    {
+        DominatorTree (const heart::Function& f)
+        {
+            if (f.blocks.empty())
+                return;
+
+            findReversePostOrder (f.blocks.front());
+
+            auto numBlocks = blocks.size();
+            immediateDominators.resize (numBlocks, noBlock);
+            immediateDominators[0] = 0;
+
+            // This is the iterative algorithm from Cooper, Harvey & Kennedy's "A Simple, Fast Dominance Algorithm"
+            for (bool anyChanged = true; anyChanged;)
+            {
+                anyChanged = false;
+
+                for (uint32_t i = 1; i < numBlocks; ++i)
+                {
+                    auto newDominator = noBlock;
+
+                    for (auto& pred : blocks[i]->predecessors)
+                    {
+                        auto p = getIndex (pred);
+
+                        if (p == noBlock || immediateDominators[p] == noBlock)
+                            continue;
+
+                        newDominator = newDominator == noBlock ? p : intersect (p, newDominator);
+                    }
+
+                    if (immediateDominators[i] != newDominator)
+                    {
+                        immediateDominators[i] = newDominator;
+                        anyChanged = true;
+                    }
+                }
+            }
+
+            children.resize (numBlocks);
+
+            for (uint32_t i = 1; i < numBlocks; ++i)
+                children[immediateDominators[i]].push_back (i);
+
+            numberTreeNodes();
+        }
+
+        static constexpr uint32_t noBlock = std::numeric_limits<uint32_t>::max();
+
+        /** The reachable blocks, in reverse post-order. */
+        std::vector<pool_ref<heart::Block>> blocks;
+
+        size_t size() const                                     { return blocks.size(); }
+        heart::Block& getBlock (uint32_t index) const           { return blocks[index]; }
+
+        /** Returns the reverse post-order index of a block, or noBlock if it's unreachable. */
+        uint32_t getIndex (const heart::Block& b) const
+        {
+            auto i = blockIndexes.find (std::addressof (b));
+            return i != blockIndexes.end() ? i->second : noBlock;
+        }
+
+        bool isReachable (const heart::Block& b) const          { return getIndex (b) != noBlock; }
+
+        /** Returns the index of a block's immediate dominator. The first block is its own dominator. */
+        uint32_t getImmediateDominator (uint32_t index) const   { return immediateDominators[index]; }
+
+        const std::vector<uint32_t>& getChildren (uint32_t index) const   { return children[index]; }
+
+        /** Returns true if every path from the first block to b passes through a. A block dominates itself. */
+        bool dominates (uint32_t a, uint32_t b) const
+        {
+            return preOrderNumbers[a] <= preOrderNumbers[b] && postOrderNumbers[b] <= postOrderNumbers[a];
+        }
+
+        bool dominates (const heart::Block& a, const heart::Block& b) const
+        {
+            auto ia = getIndex (a), ib = getIndex (b);
+            return ia != noBlock && ib != noBlock && dominates (ia, ib);
+        }
+
+        /** Returns the dominance frontier of each block, indexed in the same order as the blocks. */
+        std::vector<std::vector<uint32_t>> getDominanceFrontiers() const
+        {
+            std::vector<std::vector<uint32_t>> frontiers (blocks.size());
+
+            for (uint32_t i = 0; i < blocks.size(); ++i)
+            {
+                auto numReachablePredecessors = 0;
+
+                for (auto& pred : blocks[i]->predecessors)
+                    if (isReachable (pred))
+                        ++numReachablePredecessors;
+
+                if (numReachablePredecessors < 2)
+                    continue;
+
+                for (auto& pred : blocks[i]->predecessors)
+                {
+                    for (auto runner = getIndex (pred);
+                         runner != noBlock && runner != immediateDominators[i];
+                         runner = (runner == 0 ? noBlock : immediateDominators[runner]))
+                    {
+                        appendIfNotPresent (frontiers[runner], i);
+                    }
+                }
+            }
+
+            return frontiers;
+        }
+
+        /** A natural loop: the header block which dominates it, and the indexes of all the
+            blocks which can reach a back-edge to the header without passing through it.
+        */
+        struct Loop
+        {
+            uint32_t header;
+            std::vector<uint32_t> blocks;   // sorted, and including the header
+
+            bool contains (uint32_t block) const    { return std::binary_search (blocks.begin(), blocks.end(), block); }
+        };
+
+        /** Finds the natural loops in the function. Back-edges to the same header are merged into
+            a single loop, and the list is ordered so that inner loops come before any loops which
+            enclose them.
+        */
+        std::vector<Loop> getLoops() const
+        {
+            std::vector<Loop> loops;
+            std::vector<uint32_t> loopHeaderForBlock (blocks.size(), noBlock), workList;
+
+            for (uint32_t header = 0; header < blocks.size(); ++header)
+            {
+                for (auto& pred : blocks[header]->predecessors)
+                {
+                    auto p = getIndex (pred);
+
+                    if (p != noBlock && dominates (header, p))
+                        workList.push_back (p);
+                }
+
+                if (workList.empty())
+                    continue;
+
+                Loop loop { header, { header } };
+                loopHeaderForBlock[header] = header;
+
+                while (! workList.empty())
+                {
+                    auto b = workList.back();
+                    workList.pop_back();
+
+                    if (loopHeaderForBlock[b] == header)
+                        continue;
+
+                    loopHeaderForBlock[b] = header;
+                    loop.blocks.push_back (b);
+
+                    for (auto& pred : blocks[b]->predecessors)
+                    {
+                        auto p = getIndex (pred);
+
+                        if (p != noBlock)
+                            workList.push_back (p);
+                    }
+                }
+
+                std::sort (loop.blocks.begin(), loop.blocks.end());
+                loops.push_back (std::move (loop));
+            }
+
+            // A loop which encloses another must contain more blocks than it
+            std::stable_sort (loops.begin(), loops.end(), [] (const Loop& a, const Loop& b) { return a.blocks.size() < b.blocks.size(); });
+            return loops;
+        }
+
+        /** Returns the number of natural loops that each block is nested inside, indexed in the
+            same order as the blocks.
+        */
+        std::vector<uint32_t> getLoopDepths() const
+        {
+            std::vector<uint32_t> depths (blocks.size(), 0);
+
+            for (auto& loop : getLoops())
+                for (auto b : loop.blocks)
+                    ++depths[b];
+
+            return depths;
+        }
+
+    private:
+        std::unordered_map<const heart::Block*, uint32_t> blockIndexes;
+        std::vector<uint32_t> immediateDominators, preOrderNumbers, postOrderNumbers;
+        std::vector<std::vector<uint32_t>> children;
+
+        void findReversePostOrder (heart::Block& entry)
+        {
+            struct StackItem
+            {
+                heart::Block& block;
+                size_t nextDestination;
+            };
+
+            std::vector<StackItem> stack;
+            std::unordered_set<const heart::Block*> visited;
+            visited.insert (std::addressof (entry));
+            stack.push_back ({ entry, 0 });
+
+            while (! stack.empty())
+            {
+                auto& top = stack.back();
+                auto destinations = top.block.terminator->getDestinationBlocks();
+
+                if (top.nextDestination < destinations.size())
+                {
+                    auto& next = destinations[top.nextDestination++].get();
+
+                    if (visited.insert (std::addressof (next)).second)
+                        stack.push_back ({ next, 0 });
+                }
+                else
+                {
+                    blocks.push_back (top.block);
+                    stack.pop_back();
+                }
+            }
+
+            std::reverse (blocks.begin(), blocks.end());
+
+            for (uint32_t i = 0; i < blocks.size(); ++i)
+                blockIndexes[blocks[i].getPointer()] = i;
+        }
+
+        uint32_t intersect (uint32_t b1, uint32_t b2) const
+        {
+            while (b1 != b2)
+            {
+                while (b1 > b2)  b1 = immediateDominators[b1];
+                while (b2 > b1)  b2 = immediateDominators[b2];
+            }
+
+            return b1;
+        }
+
+        void numberTreeNodes()
+        {
+            preOrderNumbers.resize (blocks.size());
+            postOrderNumbers.resize (blocks.size());
+            uint32_t preOrder = 0, postOrder = 0;
+
+            std::vector<std::pair<uint32_t, size_t>> stack;
+            stack.push_back ({ 0, 0 });
+            preOrderNumbers[0] = preOrder++;
+
+            while (! stack.empty())
+            {
+                auto& top = stack.back();
+                auto& childList = children[top.first];
+
+                if (top.second < childList.size())
+                {
+                    auto child = childList[top.second++];
+                    preOrderNumbers[child] = preOrder++;
+                    stack.push_back ({ child, 0 });
+                }
+                else
+                {
+                    postOrderNumbers[top.first] = postOrder++;
+                    stack.pop_back();
+                }
+            }
+        }
+    };
+
 private:
     //==============================================================================
     static void resetVisitedFlags (const heart::Function& f)
@@ -330,19 +628,6 @@ private:
                 if (auto call = cast<heart::FunctionCall> (*s))
                     iterateCallSequences (call->getFunction(), results, std::addressof (newPrevious), stackSize);
     }
-
-    static void calculateLocalVariableStackSize (heart::Function& f)
-    {
-        if (f.localVariableStackSize == 0)
-        {
-            uint64_t total = 0;
-
-            for (auto& v : f.getAllLocalVariables())
-                total += getAlignedSize<stackItemAlignment> (v->getType().getPackedSizeInBytes());
-
-            f.localVariableStackSize = total;
-        }
-    }
 };
 
 } // namespace soul
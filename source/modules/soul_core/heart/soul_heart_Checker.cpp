@@ -18,6 +18,21 @@
    CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+/** The default amount of HEART verification done after linking: 0 = off, 1 = sampled, 2 = full.
+    Setting the older SOUL_TEST_HEART_ROUNDTRIP flag forces either full checking or none.
+*/
+#ifndef SOUL_HEART_VERIFICATION_MODE
+ #if ! SOUL_ENABLE_ASSERTIONS
+  #define SOUL_HEART_VERIFICATION_MODE 0
+ #elif defined (SOUL_TEST_HEART_ROUNDTRIP)
+  #define SOUL_HEART_VERIFICATION_MODE (SOUL_TEST_HEART_ROUNDTRIP ? 2 : 0)
+ #elif SOUL_DEBUG
+  #define SOUL_HEART_VERIFICATION_MODE 1
+ #else
+  #define SOUL_HEART_VERIFICATION_MODE 0
+ #endif
+#endif
+
 namespace soul
 {
 
@@ -57,7 +72,7 @@ struct heart::Checker::Impl
 
                 for (auto& i : m->inputs)
                 {
-                    auto& name = i->name.toString();
+                    auto name = i->name.toString();
 
                     if (! appendIfNotPresent (ioNames, name))
                         i->location.throwError (Errors::nameInUse (name));
@@ -71,7 +86,7 @@ struct heart::Checker::Impl
 
                 for (auto& o : m->outputs)
                 {
-                    auto& name = o->name.toString();
+                    auto name = o->name.toString();
 
                     if (! appendIfNotPresent (ioNames, name))
                         o->location.throwError (Errors::nameInUse (name));
@@ -324,6 +339,9 @@ struct heart::Checker::Impl
                             if (! f->functionType.isRun())
                                 s->location.throwError (Errors::streamsCanOnlyBeUsedInRun());
 
+                            if (r->numFrames != 1 && ! canAccessMultipleFrames (r->source, r->element, r->target->getType(), r->numFrames))
+                                s->location.throwError (Errors::wrongTypeForEndpoint());
+
                             if (r->element)
                             {
                                 if (! r->source->arraySize.has_value())
@@ -345,7 +363,12 @@ struct heart::Checker::Impl
                             if (! (f->functionType.isRun() || w->target->isEventEndpoint()))
                                 s->location.throwError (Errors::streamsCanOnlyBeUsedInRun());
 
-                            if (! w->element)
+                            if (w->numFrames != 1)
+                            {
+                                if (! (f->functionType.isRun() && canAccessMultipleFrames (w->target, w->element, w->value->getType(), w->numFrames)))
+                                    s->location.throwError (Errors::wrongTypeForEndpoint());
+                            }
+                            else if (! w->element)
                             {
                                 if (! w->target->canHandleType (w->value->getType()))
                                     s->location.throwError (Errors::wrongTypeForEndpoint());
@@ -371,6 +394,22 @@ struct heart::Checker::Impl
         }
     }
 
+    /** Reads and writes of more than one frame at a time move a vector of values to or from
+        a stream with a primitive type.
+    */
+    static bool canAccessMultipleFrames (const heart::IODeclaration& endpoint, pool_ptr<heart::Expression> element,
+                                         const Type& valueType, uint32_t numFrames)
+    {
+        if (! endpoint.isStreamEndpoint() || endpoint.arraySize.has_value() || element != nullptr)
+            return false;
+
+        auto frameType = endpoint.getSingleDataType();
+
+        return frameType.isPrimitive()
+                && numFrames > 1 && Type::isLegalVectorSize (numFrames)
+                && valueType.removeConstIfPresent().isIdentical (Type::createVector (frameType.getPrimitiveType(), numFrames));
+    }
+
     static void checkFunctionReturnTypes (const Program& program)
     {
         for (auto& m : program.getModules())
@@ -434,16 +473,472 @@ struct heart::Checker::Impl
                 heart::Utilities::CycleDetector (m).checkAndThrowErrorIfCycleFound();
     }
 
-    static void testHEARTRoundTrip (const Program& program)
+    static void testHEARTRoundTrip (const Program& program, VerificationMode mode)
     {
-        ignoreUnused (program);
+        if (mode == VerificationMode::off)
+            return;
+
+        if (mode == VerificationMode::sampled)
+        {
+            // Only one build in every few gets checked, and nothing is cloned for the others
+            static std::atomic<uint32_t> buildCount { 0 };
+
+            if (buildCount++ % verificationSampleInterval != 0)
+                return;
+
+            checkAssertion (isStructurallyIdentical (program, program.clone()),
+                            "Cloned HEART differs from the original", __FUNCTION__, __LINE__);
+            return;
+        }
+
+        checkAssertion (isStructurallyIdentical (program, program.clone()),
+                        "Cloned HEART differs from the original", __FUNCTION__, __LINE__);
 
-       #if SOUL_ENABLE_ASSERTIONS && (SOUL_TEST_HEART_ROUNDTRIP || (SOUL_DEBUG && ! defined (SOUL_TEST_HEART_ROUNDTRIP)))
         auto dump = program.toHEART();
-        SOUL_ASSERT (dump == program.clone().toHEART());
         auto roundTrip = heart::Parser::parse (CodeLocation::createFromString ("internal test dump", dump)).toHEART();
-        SOUL_ASSERT (dump == roundTrip);
-       #endif
+        checkAssertion (dump == roundTrip, "HEART round-trip failed", __FUNCTION__, __LINE__);
+    }
+
+    static constexpr uint32_t verificationSampleInterval = 4;
+
+    //==============================================================================
+    struct StructuralComparison
+    {
+        bool compare (const Program& p1, const Program& p2)
+        {
+            auto& modules1 = p1.getModules();
+            auto& modules2 = p2.getModules();
+
+            if (modules1.size() != modules2.size())
+                return false;
+
+            // Everything that can be referenced from another module needs to be paired up before any bodies are compared
+            for (size_t i = 0; i < modules1.size(); ++i)
+                if (! mapReferenceableObjects (modules1[i], modules2[i]))
+                    return false;
+
+            for (size_t i = 0; i < modules1.size(); ++i)
+                if (! compareModules (modules1[i], modules2[i]))
+                    return false;
+
+            return true;
+        }
+
+    private:
+        std::unordered_map<const heart::Object*, const heart::Object*> objectMappings;
+        std::unordered_map<const Structure*, const Structure*> structMappings;
+
+        bool matches (const heart::Object& o1, const heart::Object& o2)
+        {
+            auto& mapping = objectMappings[std::addressof (o1)];
+
+            if (mapping == nullptr)
+            {
+                mapping = std::addressof (o2);
+                return true;
+            }
+
+            return mapping == std::addressof (o2);
+        }
+
+        bool isAlreadyMapped (const heart::Object& o1) const
+        {
+            return objectMappings.find (std::addressof (o1)) != objectMappings.end();
+        }
+
+        static bool matches (Identifier i1, Identifier i2)
+        {
+            if (i1 == i2)
+                return true;
+
+            // A clone whose identifiers come from a different pool will have different pointers
+            return i1.isValid() && i2.isValid() && std::string_view (i1) == std::string_view (i2);
+        }
+
+        bool mapReferenceableObjects (const Module& m1, const Module& m2)
+        {
+            if (m1.structs.size() != m2.structs.size()
+                 || m1.functions.size() != m2.functions.size()
+                 || m1.inputs.size() != m2.inputs.size()
+                 || m1.outputs.size() != m2.outputs.size()
+                 || m1.processorInstances.size() != m2.processorInstances.size())
+                return false;
+
+            for (size_t i = 0; i < m1.structs.size(); ++i)
+                structMappings[m1.structs.get()[i].get()] = m2.structs.get()[i].get();
+
+            for (size_t i = 0; i < m1.functions.size(); ++i)
+                matches (m1.functions.at (i), m2.functions.at (i));
+
+            for (size_t i = 0; i < m1.inputs.size(); ++i)
+                matches (m1.inputs[i], m2.inputs[i]);
+
+            for (size_t i = 0; i < m1.outputs.size(); ++i)
+                matches (m1.outputs[i], m2.outputs[i]);
+
+            for (size_t i = 0; i < m1.processorInstances.size(); ++i)
+                matches (m1.processorInstances[i], m2.processorInstances[i]);
+
+            return true;
+        }
+
+        bool compareModules (const Module& m1, const Module& m2)
+        {
+            if (m1.shortName != m2.shortName
+                 || m1.fullName != m2.fullName
+                 || m1.originalFullName != m2.originalFullName
+                 || m1.isProcessor() != m2.isProcessor()
+                 || m1.isGraph() != m2.isGraph()
+                 || m1.latency != m2.latency
+                 || m1.connections.size() != m2.connections.size()
+                 || m1.stateVariables.size() != m2.stateVariables.size())
+                return false;
+
+            for (size_t i = 0; i < m1.structs.size(); ++i)
+                if (! compareStructs (*m1.structs.get()[i], *m2.structs.get()[i]))
+                    return false;
+
+            for (size_t i = 0; i < m1.inputs.size(); ++i)
+                if (! compareIO (m1.inputs[i], m2.inputs[i]))
+                    return false;
+
+            for (size_t i = 0; i < m1.outputs.size(); ++i)
+                if (! compareIO (m1.outputs[i], m2.outputs[i]))
+                    return false;
+
+            for (size_t i = 0; i < m1.processorInstances.size(); ++i)
+                if (! compareProcessorInstances (m1.processorInstances[i], m2.processorInstances[i]))
+                    return false;
+
+            for (size_t i = 0; i < m1.connections.size(); ++i)
+                if (! compareConnections (m1.connections[i], m2.connections[i]))
+                    return false;
+
+            for (size_t i = 0; i < m1.stateVariables.size(); ++i)
+                if (! compareVariables (m1.stateVariables.get()[i], m2.stateVariables.get()[i]))
+                    return false;
+
+            for (size_t i = 0; i < m1.functions.size(); ++i)
+                if (! compareFunctions (m1.functions.at (i), m2.functions.at (i)))
+                    return false;
+
+            return true;
+        }
+
+        bool compareStructs (const Structure& s1, const Structure& s2)
+        {
+            if (s1.getName() != s2.getName() || s1.getNumMembers() != s2.getNumMembers())
+                return false;
+
+            for (size_t i = 0; i < s1.getNumMembers(); ++i)
+                if (s1.getMemberName (i) != s2.getMemberName (i)
+                     || ! compareTypes (s1.getMemberType (i), s2.getMemberType (i)))
+                    return false;
+
+            return true;
+        }
+
+        bool compareTypes (const Type& t1, const Type& t2)
+        {
+            if (t1.isStruct())
+                return t2.isStruct()
+                        && t1.isConst() == t2.isConst()
+                        && t1.isReference() == t2.isReference()
+                        && structMappings[t1.getStruct().get()] == t2.getStruct().get();
+
+            if (t1.isArray())
+                return t2.isArray()
+                        && t1.isConst() == t2.isConst()
+                        && t1.isReference() == t2.isReference()
+                        && t1.isUnsizedArray() == t2.isUnsizedArray()
+                        && (t1.isUnsizedArray() || t1.getArraySize() == t2.getArraySize())
+                        && compareTypes (t1.getArrayElementType(), t2.getArrayElementType());
+
+            return t1.isIdentical (t2);
+        }
+
+        bool compareTypeLists (choc::span<Type> types1, choc::span<Type> types2)
+        {
+            if (types1.size() != types2.size())
+                return false;
+
+            for (size_t i = 0; i < types1.size(); ++i)
+                if (! compareTypes (types1[i], types2[i]))
+                    return false;
+
+            return true;
+        }
+
+        bool compareValues (const Value& v1, const Value& v2)
+        {
+            return compareTypes (v1.getType(), v2.getType())
+                    && v1.cloneWithEquivalentType (v2.getType()) == v2;
+        }
+
+        bool compareIO (const heart::IODeclaration& io1, const heart::IODeclaration& io2)
+        {
+            return matches (io1.name, io2.name)
+                    && io1.index == io2.index
+                    && io1.endpointType == io2.endpointType
+                    && io1.arraySize == io2.arraySize
+                    && compareTypeLists (io1.dataTypes, io2.dataTypes)
+                    && io1.annotation.toJSON() == io2.annotation.toJSON();
+        }
+
+        bool compareProcessorInstances (const heart::ProcessorInstance& p1, const heart::ProcessorInstance& p2)
+        {
+            return p1.instanceName == p2.instanceName
+                    && p1.sourceName == p2.sourceName
+                    && p1.arraySize == p2.arraySize
+                    && p1.clockMultiplier.toString() == p2.clockMultiplier.toString();
+        }
+
+        bool compareEndpoints (const heart::EndpointReference& e1, const heart::EndpointReference& e2)
+        {
+            if (e1.processor == nullptr)
+                return e2.processor == nullptr && e1.endpointName == e2.endpointName && e1.endpointIndex == e2.endpointIndex;
+
+            return e2.processor != nullptr
+                    && matches (*e1.processor, *e2.processor)
+                    && e1.endpointName == e2.endpointName
+                    && e1.endpointIndex == e2.endpointIndex;
+        }
+
+        bool compareConnections (const heart::Connection& c1, const heart::Connection& c2)
+        {
+            return c1.interpolationType == c2.interpolationType
+                    && c1.delayLength == c2.delayLength
+                    && compareEndpoints (c1.source, c2.source)
+                    && compareEndpoints (c1.dest, c2.dest);
+        }
+
+        bool compareVariables (const heart::Variable& v1, const heart::Variable& v2)
+        {
+            // Once a pair of variables has been seen, later references only need to agree with that pairing
+            if (isAlreadyMapped (v1))
+                return matches (v1, v2);
+
+            matches (v1, v2);
+
+            return v1.role == v2.role
+                    && v1.externalHandle == v2.externalHandle
+                    && matches (v1.name, v2.name)
+                    && compareTypes (v1.type, v2.type)
+                    && compareExpressionPtrs (v1.initialValue, v2.initialValue)
+                    && v1.annotation.toJSON() == v2.annotation.toJSON();
+        }
+
+        bool compareFunctions (const heart::Function& f1, const heart::Function& f2)
+        {
+            if (! (matches (f1.name, f2.name)
+                    && f1.functionType == f2.functionType
+                    && f1.intrinsicType == f2.intrinsicType
+                    && f1.isExported == f2.isExported
+                    && f1.hasNoBody == f2.hasNoBody
+                    && f1.parameters.size() == f2.parameters.size()
+                    && f1.blocks.size() == f2.blocks.size()
+                    && compareTypes (f1.returnType, f2.returnType)
+                    && f1.annotation.toJSON() == f2.annotation.toJSON()))
+                return false;
+
+            for (size_t i = 0; i < f1.parameters.size(); ++i)
+                if (! compareVariables (f1.parameters[i], f2.parameters[i]))
+                    return false;
+
+            for (size_t i = 0; i < f1.blocks.size(); ++i)
+                if (! matches (f1.blocks[i], f2.blocks[i]))
+                    return false;
+
+            for (size_t i = 0; i < f1.blocks.size(); ++i)
+                if (! compareBlocks (f1.blocks[i], f2.blocks[i]))
+                    return false;
+
+            return true;
+        }
+
+        bool compareBlocks (const heart::Block& b1, const heart::Block& b2)
+        {
+            if (! matches (b1.name, b2.name) || b1.parameters.size() != b2.parameters.size())
+                return false;
+
+            for (size_t i = 0; i < b1.parameters.size(); ++i)
+                if (! compareVariables (b1.parameters[i], b2.parameters[i]))
+                    return false;
+
+            auto s2 = b2.statements.begin();
+
+            for (auto s1 : b1.statements)
+            {
+                if (s2 == b2.statements.end() || ! compareStatements (*s1, **s2))
+                    return false;
+
+                ++s2;
+            }
+
+            if (s2 != b2.statements.end())
+                return false;
+
+            if (b1.terminator == nullptr || b2.terminator == nullptr)
+                return b1.terminator == b2.terminator;
+
+            return compareTerminators (*b1.terminator, *b2.terminator);
+        }
+
+        bool compareExpressionLists (choc::span<pool_ref<heart::Expression>> list1, choc::span<pool_ref<heart::Expression>> list2)
+        {
+            if (list1.size() != list2.size())
+                return false;
+
+            for (size_t i = 0; i < list1.size(); ++i)
+                if (! compareExpressions (list1[i], list2[i]))
+                    return false;
+
+            return true;
+        }
+
+        bool compareExpressionPtrs (pool_ptr<heart::Expression> e1, pool_ptr<heart::Expression> e2)
+        {
+            if (e1 == nullptr || e2 == nullptr)
+                return e1 == e2;
+
+            return compareExpressions (*e1, *e2);
+        }
+
+        bool compareExpressions (const heart::Expression& e1, const heart::Expression& e2)
+        {
+            if (e1.objectType != e2.objectType)
+                return false;
+
+            if (auto c = cast<const heart::Constant> (e1))
+                return compareValues (c->value, cast<const heart::Constant> (e2)->value);
+
+            if (auto b = cast<const heart::BinaryOperator> (e1))
+            {
+                auto& b2 = *cast<const heart::BinaryOperator> (e2);
+                return b->operation == b2.operation && compareExpressions (b->lhs, b2.lhs) && compareExpressions (b->rhs, b2.rhs);
+            }
+
+            if (auto u = cast<const heart::UnaryOperator> (e1))
+            {
+                auto& u2 = *cast<const heart::UnaryOperator> (e2);
+                return u->operation == u2.operation && compareExpressions (u->source, u2.source);
+            }
+
+            if (auto t = cast<const heart::TypeCast> (e1))
+            {
+                auto& t2 = *cast<const heart::TypeCast> (e2);
+                return compareTypes (t->destType, t2.destType) && compareExpressions (t->source, t2.source);
+            }
+
+            if (auto f = cast<const heart::PureFunctionCall> (e1))
+            {
+                auto& f2 = *cast<const heart::PureFunctionCall> (e2);
+                return matches (f->function, f2.function) && compareExpressionLists (f->arguments, f2.arguments);
+            }
+
+            if (auto v = cast<const heart::Variable> (e1))
+                return compareVariables (*v, *cast<const heart::Variable> (e2));
+
+            if (auto a = cast<const heart::ArrayElement> (e1))
+            {
+                auto& a2 = *cast<const heart::ArrayElement> (e2);
+                return a->fixedStartIndex == a2.fixedStartIndex
+                        && a->fixedEndIndex == a2.fixedEndIndex
+                        && a->suppressWrapWarning == a2.suppressWrapWarning
+                        && a->isRangeTrusted == a2.isRangeTrusted
+                        && compareExpressions (a->parent, a2.parent)
+                        && compareExpressionPtrs (a->dynamicIndex, a2.dynamicIndex);
+            }
+
+            if (auto s = cast<const heart::StructElement> (e1))
+            {
+                auto& s2 = *cast<const heart::StructElement> (e2);
+                return s->memberName == s2.memberName && compareExpressions (s->parent, s2.parent);
+            }
+
+            if (auto l = cast<const heart::AggregateInitialiserList> (e1))
+            {
+                auto& l2 = *cast<const heart::AggregateInitialiserList> (e2);
+                return compareTypes (l->type, l2.type) && compareExpressionLists (l->items, l2.items);
+            }
+
+            if (auto p = cast<const heart::ProcessorProperty> (e1))
+                return p->property == cast<const heart::ProcessorProperty> (e2)->property;
+
+            return false;
+        }
+
+        bool compareStatements (const heart::Statement& s1, const heart::Statement& s2)
+        {
+            if (s1.objectType != s2.objectType)
+                return false;
+
+            if (auto a = cast<const heart::AssignFromValue> (s1))
+            {
+                auto& a2 = *cast<const heart::AssignFromValue> (s2);
+                return compareExpressionPtrs (a->target, a2.target) && compareExpressions (a->source, a2.source);
+            }
+
+            if (auto f = cast<const heart::FunctionCall> (s1))
+            {
+                auto& f2 = *cast<const heart::FunctionCall> (s2);
+                return matches (f->getFunction(), f2.getFunction())
+                        && compareExpressionPtrs (f->target, f2.target)
+                        && compareExpressionLists (f->arguments, f2.arguments);
+            }
+
+            if (auto r = cast<const heart::ReadStream> (s1))
+            {
+                auto& r2 = *cast<const heart::ReadStream> (s2);
+                return matches (r->source, r2.source) && r->numFrames == r2.numFrames
+                        && compareExpressionPtrs (r->target, r2.target);
+            }
+
+            if (auto w = cast<const heart::WriteStream> (s1))
+            {
+                auto& w2 = *cast<const heart::WriteStream> (s2);
+                return matches (w->target, w2.target) && w->numFrames == w2.numFrames
+                        && compareExpressionPtrs (w->element, w2.element)
+                        && compareExpressions (w->value, w2.value);
+            }
+
+            if (auto a = cast<const heart::AdvanceClock> (s1))
+                return a->numFrames == cast<const heart::AdvanceClock> (s2)->numFrames;
+
+            return false;
+        }
+
+        bool compareTerminators (const heart::Terminator& t1, const heart::Terminator& t2)
+        {
+            if (t1.objectType != t2.objectType)
+                return false;
+
+            if (auto b = cast<const heart::Branch> (t1))
+            {
+                auto& b2 = *cast<const heart::Branch> (t2);
+                return matches (b->target, b2.target) && compareExpressionLists (b->targetArgs, b2.targetArgs);
+            }
+
+            if (auto b = cast<const heart::BranchIf> (t1))
+            {
+                auto& b2 = *cast<const heart::BranchIf> (t2);
+                return matches (b->targets[0], b2.targets[0])
+                        && matches (b->targets[1], b2.targets[1])
+                        && compareExpressions (b->condition, b2.condition)
+                        && compareExpressionLists (b->targetArgs[0], b2.targetArgs[0])
+                        && compareExpressionLists (b->targetArgs[1], b2.targetArgs[1]);
+            }
+
+            if (auto r = cast<const heart::ReturnValue> (t1))
+                return compareExpressions (r->returnValue, cast<const heart::ReturnValue> (t2)->returnValue);
+
+            return is_type<const heart::ReturnVoid> (t1);
+        }
+    };
+
+    static bool isStructurallyIdentical (const Program& original, const Program& clone)
+    {
+        return StructuralComparison().compare (original, clone);
     }
 };
 
@@ -452,9 +947,37 @@ void heart::Checker::sanityCheck (const Program& program, const BuildSettings se
     heart::Checker::Impl::sanityCheck (program, settings, isFlattened);
 }
 
-void heart::Checker::testHEARTRoundTrip (const Program& program)
+heart::Checker::VerificationMode heart::Checker::getVerificationMode (const BuildSettings& settings)
+{
+    if (settings.customSettings.isObject() && settings.customSettings.hasObjectMember ("heartVerification"))
+    {
+        auto setting = settings.customSettings["heartVerification"];
+        auto mode = setting.isString() ? std::string (setting.getString()) : choc::json::toString (setting);
+
+        if (mode == "off")      return VerificationMode::off;
+        if (mode == "sampled")  return VerificationMode::sampled;
+        if (mode == "full")     return VerificationMode::full;
+
+        CodeLocation().throwError (Errors::unknownHEARTVerificationMode (mode));
+    }
+
+   #if SOUL_HEART_VERIFICATION_MODE == 2
+    return VerificationMode::full;
+   #elif SOUL_HEART_VERIFICATION_MODE == 1
+    return VerificationMode::sampled;
+   #else
+    return VerificationMode::off;
+   #endif
+}
+
+void heart::Checker::testHEARTRoundTrip (const Program& program, VerificationMode mode)
+{
+    heart::Checker::Impl::testHEARTRoundTrip (program, mode);
+}
+
+bool heart::Checker::isStructurallyIdentical (const Program& original, const Program& clone)
 {
-    heart::Checker::Impl::testHEARTRoundTrip (program);
+    return heart::Checker::Impl::isStructurallyIdentical (original, clone);
 }
 
 }
@@ -24,7 +24,33 @@ namespace soul
 struct heart::Checker
 {
     static void sanityCheck (const Program& program, const BuildSettings settings = {}, bool isFlattened = false);
-    static void testHEARTRoundTrip (const Program& program);
+
+    /** Controls how much self-checking is done on each linked program.
+        - off:      no checks are done
+        - sampled:  one in every few programs is structurally compared against a clone, which is
+                    cheap enough to leave switched on in debug builds
+        - full:     every function is compared against a clone, and the program is also printed and
+                    re-parsed to make sure that the HEART text round-trips exactly
+    */
+    enum class VerificationMode
+    {
+        off,
+        sampled,
+        full
+    };
+
+    /** Returns the mode to use for a build. This is the build-time default (see SOUL_HEART_VERIFICATION_MODE),
+        unless the settings contain a "heartVerification" custom setting of "off", "sampled" or "full".
+        Any other value for that setting is reported as an error.
+    */
+    static VerificationMode getVerificationMode (const BuildSettings&);
+
+    static void testHEARTRoundTrip (const Program& program, VerificationMode);
+
+    /** Compares two programs object-by-object without printing them, returning false if any
+        difference is found.
+    */
+    static bool isStructurallyIdentical (const Program& original, const Program& clone);
 
     struct Impl;
 };
@@ -57,7 +57,7 @@ heart::PureFunctionCall& BlockBuilder::createMinInt32 (heart::Expression& a, hea
         builder.addReturn (paramB);
     });
 
-    auto& call = module.allocate<heart::PureFunctionCall> (a.location, function);
+    auto& call = allocator.allocate<heart::PureFunctionCall> (a.location, function);
     call.arguments.push_back (a, b);
     return call;
 }
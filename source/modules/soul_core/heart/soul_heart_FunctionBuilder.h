@@ -27,9 +27,13 @@ namespace soul
 */
 struct BlockBuilder
 {
-    BlockBuilder (Module& m) : module (m) {}
+    BlockBuilder (Module& m) : BlockBuilder (m, m.allocator) {}
 
-    BlockBuilder (Module& m, heart::Block& block) : module (m), currentBlock (block)
+    /// Creates a builder which allocates its objects with a different allocator to the module's
+    /// one, e.g. so that it can build a function on a worker thread.
+    BlockBuilder (Module& m, heart::Allocator& a) : module (m), allocator (a) {}
+
+    BlockBuilder (Module& m, heart::Block& block) : module (m), allocator (m.allocator), currentBlock (block)
     {
         lastStatementInCurrentBlock = block.statements.getLast();
     }
@@ -37,10 +41,10 @@ struct BlockBuilder
     virtual ~BlockBuilder() {}
 
     template <typename StringType>
-    Identifier createIdentifier (StringType&& name)                     { return module.allocator.get (name); }
+    Identifier createIdentifier (StringType&& name)                     { return allocator.get (name); }
     Identifier createIdentifier (const char* prefix, uint32_t index)    { return createIdentifier (prefix + std::to_string (index)); }
 
-    heart::Constant& createConstant (Value v)                   { return module.allocator.allocateConstant (std::move (v)); }
+    heart::Constant& createConstant (Value v)                   { return allocator.allocateConstant (std::move (v)); }
 
     template <typename IntType>
     heart::Constant& createConstantInt32 (IntType intValue)     { return createConstant (Value::createInt32 (intValue)); }
@@ -48,7 +52,7 @@ struct BlockBuilder
     template <typename IntType>
     heart::Constant& createConstantInt64 (IntType intValue)     { return createConstant (Value::createInt64 (intValue)); }
 
-    heart::Constant& createZeroInitialiser (const Type& type)   { return module.allocator.allocateZeroInitialiser (type); }
+    heart::Constant& createZeroInitialiser (const Type& type)   { return allocator.allocateZeroInitialiser (type); }
 
     template <typename StringType>
     static heart::Variable& createVariable (Module& m, Type type, StringType&& name, heart::Variable::Role role)
@@ -59,7 +63,7 @@ struct BlockBuilder
     template <typename StringType>
     heart::Variable& createVariable (Type type, StringType&& name, heart::Variable::Role role)
     {
-        return createVariable (module, std::move (type), std::move (name), role);
+        return allocator.allocate<heart::Variable> (CodeLocation(), std::move (type), allocator.get (name), role);
     }
 
     heart::Variable& createRegisterVariable (Type type)
@@ -98,12 +102,12 @@ struct BlockBuilder
 
     heart::StructElement& createStructElement (heart::Expression& parent, std::string memberName)
     {
-        return module.allocate<heart::StructElement> (parent.location, parent, std::move (memberName));
+        return allocator.allocate<heart::StructElement> (parent.location, parent, std::move (memberName));
     }
 
     heart::ArrayElement& createFixedArrayElement (heart::Expression& parent, size_t index)
     {
-        return module.allocate<heart::ArrayElement> (parent.location, parent, index);
+        return allocator.allocate<heart::ArrayElement> (parent.location, parent, index);
     }
 
     heart::Expression& createFixedArrayElementIfNotPrimitive (heart::Expression& parent, size_t index)
@@ -117,7 +121,7 @@ struct BlockBuilder
 
     heart::ArrayElement& createFixedArraySlice (CodeLocation l, heart::Expression& parent, size_t start, size_t end)
     {
-        return module.allocate<heart::ArrayElement> (std::move (l), parent, start, end);
+        return allocator.allocate<heart::ArrayElement> (std::move (l), parent, start, end);
     }
 
     heart::ArrayElement& createTrustedDynamicSubElement (heart::Expression& parent, heart::Expression& index)
@@ -128,7 +132,7 @@ struct BlockBuilder
     heart::ArrayElement& createDynamicSubElement (CodeLocation l, heart::Expression& parent, heart::Expression& index,
                                                   bool isTrusted, bool suppressWrapWarning)
     {
-        auto& s = module.allocate<heart::ArrayElement> (std::move (l), parent, index);
+        auto& s = allocator.allocate<heart::ArrayElement> (std::move (l), parent, index);
         s.isRangeTrusted = isTrusted;
         s.suppressWrapWarning = suppressWrapWarning;
         return s;
@@ -136,12 +140,15 @@ struct BlockBuilder
 
     heart::Expression& createCast (CodeLocation l, heart::Expression& source, const Type& destType)
     {
-        return module.allocate<heart::TypeCast> (std::move (l), source, destType);
+        return allocator.allocate<heart::TypeCast> (std::move (l), source, destType);
     }
 
     heart::Expression& createCastIfNeeded (heart::Expression& source, const Type& destType)
     {
-        return createCastIfNeeded (module, source, destType);
+        if (destType.isIdentical (source.getType()))
+            return source;
+
+        return allocator.allocate<heart::TypeCast> (source.location, source, destType);
     }
 
     static heart::Expression& createCastIfNeeded (Module& m, heart::Expression& source, const Type& destType)
@@ -154,12 +161,12 @@ struct BlockBuilder
 
     heart::Expression& createUnaryOp (CodeLocation l, heart::Expression& source, UnaryOp::Op op)
     {
-        return module.allocate<heart::UnaryOperator> (std::move (l), source, op);
+        return allocator.allocate<heart::UnaryOperator> (std::move (l), source, op);
     }
 
     heart::Expression& createBinaryOp (CodeLocation l, heart::Expression& lhs, heart::Expression& rhs, BinaryOp::Op op)
     {
-        return module.allocate<heart::BinaryOperator> (std::move (l), lhs, rhs, op);
+        return allocator.allocate<heart::BinaryOperator> (std::move (l), lhs, rhs, op);
     }
 
     heart::Expression& createAdd (heart::Expression& lhs, heart::Expression& rhs)
@@ -189,7 +196,7 @@ struct BlockBuilder
     }
 
     template <typename Type, typename... Args>
-    void createStatement (Args&&... args)   { addStatement (module.allocate<Type> (std::forward<Args> (args)...)); }
+    void createStatement (Args&&... args)   { addStatement (allocator.allocate<Type> (std::forward<Args> (args)...)); }
 
     void addAssignment (heart::Expression& dest, heart::Expression& source)
     {
@@ -260,7 +267,7 @@ struct BlockBuilder
 
     void addFunctionCall (pool_ptr<heart::Expression> dest, heart::Function& function, std::initializer_list<pool_ref<heart::Expression>> args)
     {
-        auto& call = module.allocate<heart::FunctionCall> (CodeLocation(), dest, function);
+        auto& call = allocator.allocate<heart::FunctionCall> (CodeLocation(), dest, function);
         call.arguments.reserve (args.size());
 
         for (auto& a : args)
@@ -272,7 +279,7 @@ struct BlockBuilder
 
     void addFunctionCall (pool_ptr<heart::Expression> dest, heart::Function& function, heart::FunctionCall::ArgListType&& args)
     {
-        auto& call = module.allocate<heart::FunctionCall> (CodeLocation(), dest, function);
+        auto& call = allocator.allocate<heart::FunctionCall> (CodeLocation(), dest, function);
         call.arguments = std::move (args);
         SOUL_ASSERT (call.arguments.size() == function.parameters.size());
         addStatement (call);
@@ -283,21 +290,34 @@ struct BlockBuilder
 
     static heart::PureFunctionCall& createWrapInt32 (Module& m, heart::Expression& n, heart::Expression& range);
 
-    void addReadStream (CodeLocation l, heart::Expression& dest, heart::InputDeclaration& src)
+    void addReadStream (CodeLocation l, heart::Expression& dest, heart::InputDeclaration& src, uint32_t numFrames = 1)
     {
         auto sourceType = src.getSingleDataType();
 
+        if (numFrames > 1)
+            sourceType = Type::createVector (sourceType.getPrimitiveType(), numFrames);
+
         if (dest.getType().isIdentical (sourceType))
-            return createStatement<heart::ReadStream> (std::move (l), dest, src);
+            return addStatement (createReadStream (std::move (l), dest, src, numFrames));
 
         auto& temp = createRegisterVariable (sourceType);
-        createStatement<heart::ReadStream> (l, temp, src);
+        addStatement (createReadStream (l, temp, src, numFrames));
         addAssignment (dest, createCast (l, temp, dest.getType()));
     }
 
-    void addWriteStream (CodeLocation l, heart::OutputDeclaration& output, pool_ptr<heart::Expression> element, heart::Expression& value)
+    heart::ReadStream& createReadStream (CodeLocation l, heart::Expression& dest, heart::InputDeclaration& src, uint32_t numFrames)
+    {
+        auto& r = allocator.allocate<heart::ReadStream> (std::move (l), dest, src);
+        r.numFrames = numFrames;
+        return r;
+    }
+
+    void addWriteStream (CodeLocation l, heart::OutputDeclaration& output, pool_ptr<heart::Expression> element,
+                         heart::Expression& value, uint32_t numFrames = 1)
     {
-        createStatement<heart::WriteStream> (std::move (l), output, element, value);
+        auto& w = allocator.allocate<heart::WriteStream> (std::move (l), output, element, value);
+        w.numFrames = numFrames;
+        addStatement (w);
     }
 
     void setTerminator (heart::Terminator& t)
@@ -307,26 +327,27 @@ struct BlockBuilder
 
     void setReturnTerminator()
     {
-        setTerminator (module.allocate<heart::ReturnVoid>());
+        setTerminator (allocator.allocate<heart::ReturnVoid>());
     }
 
     void setReturnTerminator (heart::Expression& value)
     {
-        setTerminator (module.allocate<heart::ReturnValue> (value));
+        setTerminator (allocator.allocate<heart::ReturnValue> (value));
     }
 
     void setBranchTerminator (heart::Block& target)
     {
-        setTerminator (module.allocate<heart::Branch> (target));
+        setTerminator (allocator.allocate<heart::Branch> (target));
     }
 
     void setBranchIfTerminator (heart::Expression& condition, heart::Block& trueBranch, heart::Block& falseBranch)
     {
         SOUL_ASSERT (std::addressof (trueBranch) != std::addressof (falseBranch));
-        setTerminator (module.allocate<heart::BranchIf> (condition, trueBranch, falseBranch));
+        setTerminator (allocator.allocate<heart::BranchIf> (condition, trueBranch, falseBranch));
     }
 
     Module& module;
+    heart::Allocator& allocator;
     pool_ptr<heart::Block> currentBlock;
     LinkedList<heart::Statement>::Iterator lastStatementInCurrentBlock;
 };
@@ -339,6 +360,7 @@ struct BlockBuilder
 struct FunctionBuilder  : public BlockBuilder
 {
     FunctionBuilder (Module& m) : BlockBuilder (m) {}
+    FunctionBuilder (Module& m, heart::Allocator& a) : BlockBuilder (m, a) {}
 
     ~FunctionBuilder() override
     {
@@ -429,11 +451,11 @@ struct FunctionBuilder  : public BlockBuilder
                     if (! currentFunction->returnType.isVoid())
                         return false;
 
-                    b->terminator = module.allocate<heart::ReturnVoid>();
+                    b->terminator = allocator.allocate<heart::ReturnVoid>();
                 }
                 else
                 {
-                    b->terminator = module.allocate<heart::Branch> (blocks[i + 1]);
+                    b->terminator = allocator.allocate<heart::Branch> (blocks[i + 1]);
                 }
             }
         }
@@ -448,7 +470,7 @@ struct FunctionBuilder  : public BlockBuilder
 
     heart::Variable& addParameter (const std::string& name, const Type& type)
     {
-        auto& v = createVariable (module, type, name, heart::Variable::Role::parameter);
+        auto& v = createVariable (type, name, heart::Variable::Role::parameter);
         addParameter (v);
         return v;
     }
@@ -462,7 +484,7 @@ struct FunctionBuilder  : public BlockBuilder
 
     [[nodiscard]] heart::Block& createBlock (Identifier name)
     {
-        return module.allocate<heart::Block> (name);
+        return allocator.allocate<heart::Block> (name);
     }
 
     [[nodiscard]] heart::Block& createBlock (const char* prefix, uint32_t index)
@@ -472,7 +494,7 @@ struct FunctionBuilder  : public BlockBuilder
 
     [[nodiscard]] heart::Block& createBlock (std::string_view name)
     {
-        return createBlock (module.allocator.get (name));
+        return createBlock (allocator.get (name));
     }
 
     [[nodiscard]] heart::Block& createNewBlock()
@@ -522,22 +544,22 @@ struct FunctionBuilder  : public BlockBuilder
 
     void addReturn()
     {
-        addTerminatorStatement (module.allocate<heart::ReturnVoid>(), nullptr);
+        addTerminatorStatement (allocator.allocate<heart::ReturnVoid>(), nullptr);
     }
 
     void addReturn (heart::Expression& value)
     {
-        addTerminatorStatement (module.allocate<heart::ReturnValue> (value), nullptr);
+        addTerminatorStatement (allocator.allocate<heart::ReturnValue> (value), nullptr);
     }
 
     void addBranch (heart::Block& target, pool_ptr<heart::Block> subsequentBlock)
     {
-        addTerminatorStatement (module.allocate<heart::Branch> (target), subsequentBlock);
+        addTerminatorStatement (allocator.allocate<heart::Branch> (target), subsequentBlock);
     }
 
     void addBranch (heart::Block& target, heart::Branch::ArgListType&& targetArgs, pool_ptr<heart::Block> subsequentBlock)
     {
-        auto& branch = module.allocate<heart::Branch> (target);
+        auto& branch = allocator.allocate<heart::Branch> (target);
 
         branch.targetArgs = std::move (targetArgs);
 
@@ -546,7 +568,7 @@ struct FunctionBuilder  : public BlockBuilder
 
     void addBranch (heart::Block& target, std::initializer_list<pool_ref<heart::Expression>> targetArgs, pool_ptr<heart::Block> subsequentBlock)
     {
-        auto& branch = module.allocate<heart::Branch> (target);
+        auto& branch = allocator.allocate<heart::Branch> (target);
 
         for (auto& a : targetArgs)
             branch.targetArgs.push_back (a);
@@ -559,7 +581,7 @@ struct FunctionBuilder  : public BlockBuilder
                       heart::Block& falseBranch,
                       pool_ptr<heart::Block> subsequentBlock)
     {
-        addTerminatorStatement (module.allocate<heart::BranchIf> (condition, trueBranch, falseBranch),
+        addTerminatorStatement (allocator.allocate<heart::BranchIf> (condition, trueBranch, falseBranch),
                                 subsequentBlock);
     }
 
@@ -570,7 +592,7 @@ struct FunctionBuilder  : public BlockBuilder
                       std::initializer_list<pool_ref<heart::Expression>> falseBranchArgs,
                       pool_ptr<heart::Block> subsequentBlock)
     {
-        auto& branchIf = module.allocate<heart::BranchIf> (condition, trueBranch, falseBranch);
+        auto& branchIf = allocator.allocate<heart::BranchIf> (condition, trueBranch, falseBranch);
 
         for (auto& a : trueBranchArgs)
             branchIf.targetArgs[0].push_back (a);
@@ -588,7 +610,7 @@ struct FunctionBuilder  : public BlockBuilder
                       heart::BranchIf::ArgListType&& falseBranchArgs,
                       pool_ptr<heart::Block> subsequentBlock)
     {
-        auto& branchIf = module.allocate<heart::BranchIf> (condition, trueBranch, falseBranch);
+        auto& branchIf = allocator.allocate<heart::BranchIf> (condition, trueBranch, falseBranch);
 
         branchIf.targetArgs[0] = std::move (trueBranchArgs);
         branchIf.targetArgs[1] = std::move (falseBranchArgs);
@@ -597,9 +619,11 @@ struct FunctionBuilder  : public BlockBuilder
     }
 
 
-    void addAdvance (CodeLocation l)
+    void addAdvance (CodeLocation l, uint32_t numFrames = 1)
     {
-        createStatement<heart::AdvanceClock> (std::move (l));
+        auto& a = allocator.allocate<heart::AdvanceClock> (std::move (l));
+        a.numFrames = numFrames;
+        addStatement (a);
     }
 
     void createIfElse (const std::string& blockNamePrefix,
@@ -607,9 +631,9 @@ struct FunctionBuilder  : public BlockBuilder
                        const std::function<void(FunctionBuilder&)>& createTrueBranch,
                        const std::function<void(FunctionBuilder&)>& createFalseBranch)
     {
-        auto& conditionTrueBlock   = createBlock (module.allocator.get (blockNamePrefix + "_true"));
-        auto& conditionFalseBlock  = createBlock (module.allocator.get (blockNamePrefix + "_false"));
-        auto& continueBlock        = createBlock (module.allocator.get (blockNamePrefix + "_continue"));
+        auto& conditionTrueBlock   = createBlock (allocator.get (blockNamePrefix + "_true"));
+        auto& conditionFalseBlock  = createBlock (allocator.get (blockNamePrefix + "_false"));
+        auto& continueBlock        = createBlock (allocator.get (blockNamePrefix + "_continue"));
 
         addBranchIf (condition, conditionTrueBlock, conditionFalseBlock, conditionTrueBlock);
         createTrueBranch (*this);
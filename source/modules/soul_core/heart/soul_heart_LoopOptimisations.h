@@ -0,0 +1,1246 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Optimisations which work on the natural loops that CallFlowGraph::DominatorTree finds.
+
+    Loop-invariant code motion moves calculations whose operands can't change while a loop
+    is running into a preheader block, so that they're only done once each time the loop is
+    entered. A run() loop can't do that for values which depend on state that an event handler
+    writes, because events are delivered during its advance() call, so those values are kept
+    in a new state variable instead, which the handlers update after they've changed it.
+    These cached values aren't part of the processor's state: a performer leaves them out of
+    getState(), and after setState() it calls the module's cached value update function to
+    recalculate them from the restored state.
+
+    Strength reduction of array indexes looks for counted loops whose counter gets cast to a
+    wrap or clamp type to index an array. Where the loop's bounds prove that the cast can't
+    change the value, the array is indexed by the counter directly, and the index is trusted.
+
+    These passes only run at optimisation level 2 and above.
+*/
+struct LoopOptimisations
+{
+    static void optimise (Program& program, const BuildSettings& settings)
+    {
+        if (Optimisations::getOptimisationLevel (settings) < 2)
+            return;
+
+        StateVariableWrites writes (program);
+        auto& allocator = program.getAllocator();
+
+        for (auto& m : program.getModules())
+        {
+            // Hoisting can add a function to the module, so this iterates a copy of the list
+            auto functions = std::vector<pool_ref<heart::Function>> (m->functions.get().begin(), m->functions.get().end());
+
+            for (auto& f : functions)
+            {
+                if (f->hasNoBody || f->blocks.empty())
+                    continue;
+
+                auto changed = hoistLoopInvariants (m, f, writes, allocator);
+                changed = reduceIndexStrength (f) || changed;
+
+                if (changed)
+                {
+                    SSAOptimisations::propagateCopies (f);
+                    Optimisations::optimiseFunctionBlocks (f, allocator);
+                }
+            }
+        }
+    }
+
+    /** The name of the function that a module uses to recalculate its cached values. */
+    static constexpr const char* cachedValueUpdateFunctionName = "_updateCachedValues";
+
+    /** Returns true if this is a state variable that holds a cached loop-invariant value,
+        which performers shouldn't treat as part of a processor's state.
+    */
+    static bool isCachedValue (const heart::Variable& v)
+    {
+        return v.isState() && v.annotation.getBool ("cached_value");
+    }
+
+    //==============================================================================
+    /** Keeps track of which functions write to each state variable, so that the
+        loop optimisations can tell which state a loop can rely on being unchanged.
+    */
+    struct StateVariableWrites
+    {
+        StateVariableWrites (Program& program)
+        {
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions.get())
+                {
+                    auto& info = functions[f.getPointer()];
+                    info.module = m.getPointer();
+
+                    for (auto& b : f->blocks)
+                    {
+                        for (auto s : b->statements)
+                        {
+                            if (is_type<heart::AdvanceClock> (*s))
+                                info.advances = true;
+
+                            if (auto call = cast<heart::FunctionCall> (*s))
+                                if (call->function != nullptr)
+                                    appendIfNotPresent (info.callees, call->function.get());
+
+                            forEachVariableWritten (*s, [&] (heart::Variable& v)
+                            {
+                                if (v.isState())
+                                    addWriter (v, f);
+                            });
+                        }
+                    }
+                }
+            }
+        }
+
+        const std::vector<heart::Function*>& getWriters (const heart::Variable& v) const
+        {
+            static const std::vector<heart::Function*> none;
+            auto i = writers.find (std::addressof (v));
+            return i != writers.end() ? i->second : none;
+        }
+
+        void addWriter (heart::Variable& v, heart::Function& f)
+        {
+            appendIfNotPresent (writers[std::addressof (v)], std::addressof (f));
+            functions[std::addressof (f)].stateWritten.insert (std::addressof (v));
+        }
+
+        const Module* getModule (const heart::Function& f) const
+        {
+            auto i = functions.find (std::addressof (f));
+            return i != functions.end() ? i->second.module : nullptr;
+        }
+
+        /** Returns true if this function, or any function that it calls, may write to the variable. */
+        bool mayWrite (const heart::Function& f, const heart::Variable& v) const
+        {
+            return isTrueForFunctionOrCallees (f, [&] (const FunctionInfo& info)
+            {
+                return info.stateWritten.find (std::addressof (v)) != info.stateWritten.end();
+            });
+        }
+
+        /** Returns true if this function, or any function that it calls, contains an advance() call. */
+        bool mayAdvance (const heart::Function& f) const
+        {
+            return isTrueForFunctionOrCallees (f, [] (const FunctionInfo& info) { return info.advances; });
+        }
+
+    private:
+        struct FunctionInfo
+        {
+            const Module* module = nullptr;
+            std::vector<const heart::Function*> callees;
+            std::unordered_set<const heart::Variable*> stateWritten;
+            bool advances = false;
+        };
+
+        std::unordered_map<const heart::Function*, FunctionInfo> functions;
+        std::unordered_map<const heart::Variable*, std::vector<heart::Function*>> writers;
+
+        template <typename Predicate>
+        bool isTrueForFunctionOrCallees (const heart::Function& f, Predicate&& predicate) const
+        {
+            std::vector<const heart::Function*> toVisit { std::addressof (f) };
+            std::unordered_set<const heart::Function*> visited;
+
+            while (! toVisit.empty())
+            {
+                auto next = toVisit.back();
+                toVisit.pop_back();
+
+                if (! visited.insert (next).second)
+                    continue;
+
+                auto i = functions.find (next);
+
+                if (i != functions.end())
+                {
+                    if (predicate (i->second))
+                        return true;
+
+                    appendVector (toVisit, i->second.callees);
+                }
+            }
+
+            return false;
+        }
+    };
+
+    //==============================================================================
+    /** Moves loop-invariant calculations out of the loops in a function, returning true
+        if anything was changed.
+    */
+    static bool hoistLoopInvariants (Module& module, heart::Function& f, StateVariableWrites& writes, heart::Allocator& allocator)
+    {
+        std::vector<pool_ref<heart::Block>> loopHeaders;
+
+        {
+            SSAForm ssa (f);
+
+            if (! ssa.isValid)
+                return false;
+
+            for (auto& loop : ssa.dominators.getLoops())
+                loopHeaders.push_back (ssa.dominators.getBlock (loop.header));
+        }
+
+        bool changed = false;
+
+        // Inner loops go first, and each one can create a preheader, so the SSA form is rebuilt each time
+        for (auto& header : loopHeaders)
+        {
+            SSAForm ssa (f);
+
+            if (! ssa.isValid)
+                break;
+
+            for (auto& loop : ssa.dominators.getLoops())
+            {
+                if (header == ssa.dominators.getBlock (loop.header))
+                {
+                    changed = InvariantHoister (module, ssa, loop, writes, allocator).perform() || changed;
+                    break;
+                }
+            }
+        }
+
+        return changed;
+    }
+
+    /** Finds array indexes in counted loops which can be replaced by the loop counter, and
+        marks any that provably stay in range as trusted. Returns true if anything was changed.
+    */
+    static bool reduceIndexStrength (heart::Function& f)
+    {
+        SSAForm ssa (f);
+
+        if (! ssa.isValid)
+            return false;
+
+        bool changed = false;
+
+        for (auto& loop : ssa.dominators.getLoops())
+            changed = InductionVariables (ssa, loop).trustArrayIndexes() || changed;
+
+        return changed;
+    }
+
+private:
+    using Loop = CallFlowGraph::DominatorTree::Loop;
+
+    template <typename Handler>
+    static void forEachVariableWritten (heart::Statement& s, Handler&& handler)
+    {
+        s.visitExpressions ([&] (pool_ref<heart::Expression>& e, AccessType mode)
+        {
+            if (mode != AccessType::read)
+                if (auto v = e->getRootVariable())
+                    handler (*v);
+        });
+
+        // Taking a reference to part of a variable allows it to be modified later
+        if (auto a = cast<heart::AssignFromValue> (s))
+            if (a->target != nullptr && a->target->getType().isReference())
+                if (auto v = a->source->getRootVariable())
+                    handler (*v);
+    }
+
+    //==============================================================================
+    struct InvariantHoister
+    {
+        InvariantHoister (Module& m, SSAForm& s, const Loop& l, StateVariableWrites& w, heart::Allocator& a)
+            : module (m), ssa (s), loop (l), writes (w), allocator (a)
+        {
+        }
+
+        bool perform()
+        {
+            if (! canCreatePreheader())
+                return false;
+
+            findLoopProperties();
+
+            for (auto blockIndex : loop.blocks)
+            {
+                auto& block = ssa.dominators.getBlock (blockIndex);
+
+                for (auto s : block.statements)
+                    hoistFromStatement (block, *s);
+
+                hoistFromTerminator (*block.terminator);
+            }
+
+            return preheader != nullptr;
+        }
+
+    private:
+        enum class Invariance
+        {
+            variant,
+            invariant,          // can't change while the loop runs, but may depend on local variables
+            stateOnly,          // can't change while the loop runs, and only depends on state and constants
+            eventDependent      // only depends on state and constants, but may be changed by the writer functions
+        };
+
+        struct Classification
+        {
+            Invariance invariance = Invariance::variant;
+            std::vector<heart::Function*> writers;
+        };
+
+        struct HoistedValue
+        {
+            heart::Variable& holder;
+            Classification classification;
+        };
+
+        Module& module;
+        SSAForm& ssa;
+        const Loop& loop;
+        StateVariableWrites& writes;
+        heart::Allocator& allocator;
+
+        pool_ptr<heart::Block> preheader;
+        std::unordered_map<uint32_t, HoistedValue> hoistedValues;
+        std::unordered_map<const heart::Variable*, Classification> stateClassifications;
+        std::unordered_set<const heart::Variable*> variablesWritten;
+        std::vector<const heart::Function*> functionsCalled;
+        bool loopMayAdvance = false, loopWritesThroughReferences = false;
+
+        //==============================================================================
+        bool isInLoop (const heart::Block& b) const
+        {
+            auto index = ssa.dominators.getIndex (b);
+            return index != CallFlowGraph::DominatorTree::noBlock && loop.contains (index);
+        }
+
+        bool canCreatePreheader() const
+        {
+            auto& header = ssa.dominators.getBlock (loop.header);
+
+            if (! header.parameters.empty())
+                return false;
+
+            for (auto& pred : header.predecessors)
+                if (! isInLoop (pred) && pred->terminator->isParameterised())
+                    return false;
+
+            return true;
+        }
+
+        heart::Block& getPreheader()
+        {
+            if (preheader != nullptr)
+                return *preheader;
+
+            auto& f = ssa.function;
+            auto& header = ssa.dominators.getBlock (loop.header);
+            std::vector<pool_ref<heart::Block>> entryBlocks;
+
+            for (auto& pred : header.predecessors)
+                if (! isInLoop (pred))
+                    entryBlocks.push_back (pred);
+
+            if (entryBlocks.size() == 1 && is_type<heart::Branch> (*entryBlocks.front()->terminator))
+            {
+                preheader = entryBlocks.front();
+                return *preheader;
+            }
+
+            auto& newBlock = allocator.allocate<heart::Block> (createUniqueBlockName (f));
+            newBlock.terminator = allocator.allocate<heart::Branch> (header);
+
+            for (auto& b : entryBlocks)
+            {
+                if (auto branch = cast<heart::Branch> (b->terminator))
+                {
+                    branch->target = newBlock;
+                }
+                else if (auto branchIf = cast<heart::BranchIf> (b->terminator))
+                {
+                    for (auto& target : branchIf->targets)
+                        if (target == header)
+                            target = newBlock;
+                }
+            }
+
+            auto headerPosition = std::find_if (f.blocks.begin(), f.blocks.end(),
+                                                [&] (pool_ref<heart::Block> b) { return b == header; });
+            f.blocks.insert (headerPosition, newBlock);
+            f.rebuildBlockPredecessors();
+
+            preheader = newBlock;
+            return newBlock;
+        }
+
+        Identifier createUniqueBlockName (const heart::Function& f) const
+        {
+            for (uint32_t i = 0;; ++i)
+            {
+                auto name = "@preheader_" + std::to_string (i);
+
+                if (std::none_of (f.blocks.begin(), f.blocks.end(), [&] (pool_ref<heart::Block> b) { return b->name == name; }))
+                    return allocator.get (name);
+            }
+        }
+
+        void findLoopProperties()
+        {
+            for (auto blockIndex : loop.blocks)
+            {
+                for (auto s : ssa.dominators.getBlock (blockIndex).statements)
+                {
+                    if (is_type<heart::AdvanceClock> (*s))
+                        loopMayAdvance = true;
+
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                    {
+                        auto& fn = call->getFunction();
+
+                        if (! fn.functionType.isIntrinsic())
+                        {
+                            appendIfNotPresent (functionsCalled, std::addressof (fn));
+
+                            if (writes.mayAdvance (fn))
+                                loopMayAdvance = true;
+                        }
+                    }
+
+                    forEachVariableWritten (*s, [this] (heart::Variable& v)
+                    {
+                        if (! ssa.isTracked (v))
+                        {
+                            variablesWritten.insert (std::addressof (v));
+
+                            if (v.type.isReference())
+                                loopWritesThroughReferences = true;
+                        }
+                    });
+                }
+            }
+        }
+
+        //==============================================================================
+        static Classification combine (Classification a, const Classification& b)
+        {
+            if (a.invariance == Invariance::variant || b.invariance == Invariance::variant)
+                return {};
+
+            if (a.invariance == Invariance::stateOnly)
+                return b;
+
+            if (b.invariance == Invariance::stateOnly)
+                return a;
+
+            if (a.invariance != b.invariance)
+                return {};
+
+            for (auto w : b.writers)
+                appendIfNotPresent (a.writers, w);
+
+            return a;
+        }
+
+        static Classification createClassification (Invariance invariance)
+        {
+            Classification c;
+            c.invariance = invariance;
+            return c;
+        }
+
+        Classification classify (heart::Expression& e, const heart::Object& owner)
+        {
+            if (auto v = cast<heart::Variable> (e))
+                return classifyVariable (*v, owner);
+
+            if (is_type<heart::Constant> (e))
+                return createClassification (Invariance::stateOnly);
+
+            if (auto p = cast<heart::ProcessorProperty> (e))
+                return p->canChangeBetweenFrames() ? Classification() : createClassification (Invariance::stateOnly);
+
+            if (auto a = cast<heart::ArrayElement> (e))
+            {
+                auto result = classify (a->parent, owner);
+
+                if (a->isDynamic())
+                {
+                    // A trusted index may only be in range on the paths where the loop actually reads it
+                    if (a->isRangeTrusted)
+                        return {};
+
+                    result = combine (result, classify (*a->dynamicIndex, owner));
+                }
+
+                return result;
+            }
+
+            if (auto s = cast<heart::StructElement> (e))
+                return classify (s->parent, owner);
+
+            if (auto c = cast<heart::TypeCast> (e))
+                return classify (c->source, owner);
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+                return classify (u->source, owner);
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                if (mightFail (*b))
+                    return {};
+
+                return combine (classify (b->lhs, owner), classify (b->rhs, owner));
+            }
+
+            if (auto call = cast<heart::PureFunctionCall> (e))
+            {
+                if (call->function.mayHaveSideEffects())
+                    return {};
+
+                auto result = createClassification (Invariance::stateOnly);
+
+                for (auto& arg : call->arguments)
+                    result = combine (result, classify (arg, owner));
+
+                return result;
+            }
+
+            return {};
+        }
+
+        Classification classifyVariable (heart::Variable& v, const heart::Object& owner)
+        {
+            if (ssa.isTracked (v))
+            {
+                auto value = ssa.getValueRead (owner, v);
+
+                if (value == SSAForm::noValue)
+                    return {};
+
+                auto hoisted = hoistedValues.find (value);
+
+                if (hoisted != hoistedValues.end())
+                    return hoisted->second.classification;
+
+                auto& definition = ssa.definitions[value];
+
+                if (definition.type == SSAForm::DefinitionType::entry)
+                    return v.isParameter() ? createClassification (Invariance::invariant) : Classification();
+
+                return loop.contains (definition.block) ? Classification() : createClassification (Invariance::invariant);
+            }
+
+            if (v.isExternal())
+                return createClassification (Invariance::stateOnly);
+
+            if (v.isState())
+                return classifyStateVariable (v);
+
+            if (loopWritesThroughReferences || variablesWritten.find (std::addressof (v)) != variablesWritten.end())
+                return {};
+
+            // A reference could point at anything that the loop's function calls might modify
+            if (v.type.isReference() && (loopMayAdvance || ! functionsCalled.empty()))
+                return {};
+
+            return createClassification (Invariance::invariant);
+        }
+
+        Classification classifyStateVariable (heart::Variable& v)
+        {
+            auto existing = stateClassifications.find (std::addressof (v));
+
+            if (existing != stateClassifications.end())
+                return existing->second;
+
+            auto result = findStateVariableClassification (v);
+            stateClassifications[std::addressof (v)] = result;
+            return result;
+        }
+
+        Classification findStateVariableClassification (heart::Variable& v) const
+        {
+            if (loopWritesThroughReferences || variablesWritten.find (std::addressof (v)) != variablesWritten.end())
+                return {};
+
+            for (auto f : functionsCalled)
+                if (writes.mayWrite (*f, v))
+                    return {};
+
+            if (! loopMayAdvance)
+                return createClassification (Invariance::stateOnly);
+
+            // Any function other than this one and the init functions may be an event handler, which
+            // could be called during advance(). The value can be cached if it's possible to update it
+            // at the end of each of those functions.
+            auto result = createClassification (Invariance::stateOnly);
+
+            for (auto w : writes.getWriters (v))
+            {
+                if (w == std::addressof (ssa.function) || w->functionType.isSystemInit() || w->functionType.isUserInit())
+                    continue;
+
+                if (w->functionType.isRun() || writes.mayAdvance (*w) || writes.getModule (*w) != std::addressof (module))
+                    return {};
+
+                result.invariance = Invariance::eventDependent;
+                result.writers.push_back (w);
+            }
+
+            return result;
+        }
+
+        static bool mightFail (const heart::BinaryOperator& b)
+        {
+            if (b.operation != BinaryOp::Op::divide && b.operation != BinaryOp::Op::modulo)
+                return false;
+
+            auto& type = b.lhs->getType();
+
+            if (type.isFloatingPoint() || (type.isVector() && type.getVectorElementType().isFloatingPoint()))
+                return false;
+
+            auto divisor = b.rhs->getAsConstant();
+            return ! (divisor.isValid() && divisor.getType().isPrimitive() && ! divisor.isZero());
+        }
+
+        static bool isWorthHoisting (heart::Expression& e)
+        {
+            auto& type = e.getType();
+
+            if (! (type.isPrimitive() || type.isVector()) || type.isStringLiteral())
+                return false;
+
+            return performsCalculation (e);
+        }
+
+        static bool performsCalculation (heart::Expression& e)
+        {
+            if (is_type<heart::BinaryOperator> (e) || is_type<heart::UnaryOperator> (e) || is_type<heart::PureFunctionCall> (e))
+                return true;
+
+            if (auto c = cast<heart::TypeCast> (e))
+                return ! c->source->getType().isEqual (c->destType, Type::ignoreConst) || performsCalculation (c->source);
+
+            if (auto a = cast<heart::ArrayElement> (e))
+                return performsCalculation (a->parent) || (a->isDynamic() && performsCalculation (*a->dynamicIndex));
+
+            if (auto s = cast<heart::StructElement> (e))
+                return performsCalculation (s->parent);
+
+            return false;
+        }
+
+        //==============================================================================
+        void hoistFromStatement (heart::Block& block, heart::Statement& s)
+        {
+            if (auto a = cast<heart::AssignFromValue> (s))
+            {
+                if (auto hoisted = hoistFrom (a->source, *a))
+                    recordHoistedValue (*a, *hoisted);
+                else if (auto copied = getHoistedValue (a->source, *a))
+                    recordHoistedValue (*a, *copied);
+
+                return;
+            }
+
+            if (auto call = cast<heart::FunctionCall> (s))
+            {
+                if (hoistCall (block, *call))
+                    return;
+
+                auto& parameters = call->getFunction().parameters;
+
+                for (size_t i = 0; i < call->arguments.size(); ++i)
+                    if (i < parameters.size() && ! parameters[i]->type.isReference())
+                        hoistFrom (call->arguments[i], *call);
+
+                return;
+            }
+
+            if (auto w = cast<heart::WriteStream> (s))
+                hoistFrom (w->value, *w);
+        }
+
+        void hoistFromTerminator (heart::Terminator& t)
+        {
+            if (auto branchIf = cast<heart::BranchIf> (t))
+                hoistFrom (branchIf->condition, t);
+            else if (auto ret = cast<heart::ReturnValue> (t))
+                hoistFrom (ret->returnValue, t);
+        }
+
+        std::optional<HoistedValue> hoistFrom (pool_ref<heart::Expression>& e, const heart::Object& owner)
+        {
+            auto classification = classify (e, owner);
+
+            if (classification.invariance != Invariance::variant && isWorthHoisting (e))
+            {
+                substituteHoistedValues (e, owner);
+                auto& source = e.get();
+                auto hoisted = createHolder (source.getType(), classification);
+                getPreheader().statements.append (allocator.allocate<heart::AssignFromValue> (source.location, hoisted.holder, source));
+
+                if (hoisted.classification.invariance == Invariance::eventDependent)
+                    updateAfterWrites (hoisted, [&] () -> heart::Statement&
+                    {
+                        return allocator.allocate<heart::AssignFromValue> (source.location, hoisted.holder,
+                                                                           heart::Utilities::cloneExpression (allocator, source));
+                    });
+
+                e = hoisted.holder;
+                return hoisted;
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                hoistFrom (b->lhs, owner);
+                hoistFrom (b->rhs, owner);
+            }
+            else if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                hoistFrom (u->source, owner);
+            }
+            else if (auto c = cast<heart::TypeCast> (e))
+            {
+                hoistFrom (c->source, owner);
+            }
+            else if (auto call = cast<heart::PureFunctionCall> (e))
+            {
+                for (size_t i = 0; i < call->arguments.size(); ++i)
+                    hoistFrom (call->arguments[i], owner);
+            }
+            else if (auto a = cast<heart::ArrayElement> (e))
+            {
+                if (a->isDynamic())
+                {
+                    auto index = a->dynamicIndex.getAsPoolRef();
+                    hoistFrom (index, owner);
+                    a->dynamicIndex = index;
+                }
+
+                hoistFrom (a->parent, owner);
+            }
+            else if (auto s = cast<heart::StructElement> (e))
+            {
+                hoistFrom (s->parent, owner);
+            }
+
+            return {};
+        }
+
+        bool hoistCall (heart::Block& block, heart::FunctionCall& call)
+        {
+            auto& fn = call.getFunction();
+            auto target = cast<heart::Variable> (call.target);
+
+            if (! fn.functionType.isIntrinsic() || target == nullptr || ! ssa.isTracked (*target))
+                return false;
+
+            auto classification = createClassification (Invariance::stateOnly);
+
+            for (size_t i = 0; i < call.arguments.size(); ++i)
+            {
+                if (i >= fn.parameters.size() || fn.parameters[i]->type.isReference())
+                    return false;
+
+                classification = combine (classification, classify (call.arguments[i], call));
+            }
+
+            if (classification.invariance == Invariance::variant)
+                return false;
+
+            for (auto& arg : call.arguments)
+                substituteHoistedValues (arg, call);
+
+            auto hoisted = createHolder (target->type, classification);
+            auto& hoistedCall = allocator.allocate<heart::FunctionCall> (call.location, hoisted.holder, fn);
+            hoistedCall.arguments = call.arguments;
+            getPreheader().statements.append (hoistedCall);
+
+            if (hoisted.classification.invariance == Invariance::eventDependent)
+                updateAfterWrites (hoisted, [&] () -> heart::Statement&
+                {
+                    auto& newCall = allocator.allocate<heart::FunctionCall> (call.location, hoisted.holder, fn);
+
+                    for (auto& arg : call.arguments)
+                        newCall.arguments.push_back (heart::Utilities::cloneExpression (allocator, arg));
+
+                    return newCall;
+                });
+
+            auto& replacement = allocator.allocate<heart::AssignFromValue> (call.location, *target, hoisted.holder);
+            block.statements.replaceAfter (block.statements.getPredecessor (call), replacement);
+            recordHoistedValue (call, hoisted);
+            return true;
+        }
+
+        HoistedValue createHolder (const Type& type, const Classification& classification)
+        {
+            if (classification.invariance == Invariance::eventDependent)
+                return { createStateVariable (type.removeConstIfPresent()), classification };
+
+            return { allocator.allocate<heart::Variable> (CodeLocation(), type.removeConstIfPresent(), heart::Variable::Role::constant),
+                     createClassification (Invariance::invariant) };
+        }
+
+        heart::Variable& createStateVariable (Type type)
+        {
+            for (uint32_t i = 0;; ++i)
+            {
+                auto name = "_invariant_" + std::to_string (i);
+
+                if (module.stateVariables.find (name) == nullptr)
+                {
+                    auto& v = allocator.allocate<heart::Variable> (CodeLocation(), std::move (type), allocator.get (name),
+                                                                   heart::Variable::Role::state);
+                    v.annotation.set ("cached_value", true);
+                    module.stateVariables.add (v);
+                    return v;
+                }
+            }
+        }
+
+        /** Adds a statement to update a cached value at the end of every function which might
+            change one of the state variables it depends on.
+        */
+        template <typename CreateStatementFn>
+        void updateAfterWrites (const HoistedValue& hoisted, CreateStatementFn&& createStatement)
+        {
+            for (auto w : hoisted.classification.writers)
+            {
+                for (auto& b : w->blocks)
+                    if (b->terminator != nullptr && b->terminator->isReturn())
+                        b->statements.append (createStatement());
+
+                writes.addWriter (hoisted.holder, *w);
+            }
+
+            getCachedValueUpdateFunction().blocks.front()->statements.append (createStatement());
+        }
+
+        heart::Function& getCachedValueUpdateFunction()
+        {
+            if (auto f = module.functions.find (cachedValueUpdateFunctionName))
+                return *f;
+
+            auto& f = FunctionBuilder::createFunction (module, cachedValueUpdateFunctionName, PrimitiveType::void_,
+                                                       [] (FunctionBuilder& builder) { builder.addReturn(); });
+            f.annotation.set ("do_not_optimise", true);
+            return f;
+        }
+
+        void recordHoistedValue (const heart::Statement& s, const HoistedValue& hoisted)
+        {
+            auto value = ssa.getValueWritten (s);
+
+            if (value != SSAForm::noValue)
+                hoistedValues.insert ({ value, hoisted });
+        }
+
+        std::optional<HoistedValue> getHoistedValue (heart::Expression& e, const heart::Object& owner) const
+        {
+            if (auto v = cast<heart::Variable> (e))
+            {
+                if (ssa.isTracked (*v))
+                {
+                    auto hoisted = hoistedValues.find (ssa.getValueRead (owner, *v));
+
+                    if (hoisted != hoistedValues.end())
+                        return hoisted->second;
+                }
+            }
+
+            return {};
+        }
+
+        /** Replaces reads of values that have already been moved out of the loop with the
+            variables that now hold them, as the originals won't be set in the preheader.
+        */
+        void substituteHoistedValues (pool_ref<heart::Expression>& e, const heart::Object& owner)
+        {
+            if (auto hoisted = getHoistedValue (e, owner))
+            {
+                e = hoisted->holder;
+            }
+            else if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                substituteHoistedValues (b->lhs, owner);
+                substituteHoistedValues (b->rhs, owner);
+            }
+            else if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                substituteHoistedValues (u->source, owner);
+            }
+            else if (auto c = cast<heart::TypeCast> (e))
+            {
+                substituteHoistedValues (c->source, owner);
+            }
+            else if (auto call = cast<heart::PureFunctionCall> (e))
+            {
+                for (size_t i = 0; i < call->arguments.size(); ++i)
+                    substituteHoistedValues (call->arguments[i], owner);
+            }
+            else if (auto a = cast<heart::ArrayElement> (e))
+            {
+                if (a->isDynamic())
+                {
+                    auto index = a->dynamicIndex.getAsPoolRef();
+                    substituteHoistedValues (index, owner);
+                    a->dynamicIndex = index;
+                }
+
+                substituteHoistedValues (a->parent, owner);
+            }
+            else if (auto s = cast<heart::StructElement> (e))
+            {
+                substituteHoistedValues (s->parent, owner);
+            }
+        }
+    };
+
+    //==============================================================================
+    struct InductionVariables
+    {
+        InductionVariables (SSAForm& s, const Loop& l)  : ssa (s), dominators (s.dominators), loop (l)
+        {
+            auto& header = dominators.getBlock (loop.header);
+            auto branch = cast<heart::BranchIf> (header.terminator);
+
+            if (branch == nullptr || ! branch->isConditional() || ! header.parameters.empty())
+                return;
+
+            // The loop must be entered through the true branch of its header, and left through the false one
+            bodyBlock = dominators.getIndex (branch->targets[0]);
+            auto exitBlock = dominators.getIndex (branch->targets[1]);
+
+            if (bodyBlock == CallFlowGraph::DominatorTree::noBlock || ! loop.contains (bodyBlock)
+                 || (exitBlock != CallFlowGraph::DominatorTree::noBlock && loop.contains (exitBlock))
+                 || branch->targets[0]->predecessors.size() != 1)
+                return;
+
+            if (auto comparison = cast<heart::BinaryOperator> (branch->condition))
+                addCountedVariable (*comparison, *branch);
+        }
+
+        bool trustArrayIndexes()
+        {
+            if (variables.empty())
+                return false;
+
+            bool changed = false;
+
+            for (auto blockIndex : loop.blocks)
+            {
+                if (! dominators.dominates (bodyBlock, blockIndex))
+                    continue;
+
+                auto& block = dominators.getBlock (blockIndex);
+
+                for (auto s : block.statements)
+                {
+                    s->visitExpressions ([&] (pool_ref<heart::Expression>& e, AccessType)
+                    {
+                        if (auto a = cast<heart::ArrayElement> (e))
+                            changed = trustIndex (*a, block, *s) || changed;
+                    });
+                }
+
+                block.terminator->visitExpressions ([&] (pool_ref<heart::Expression>& e, AccessType)
+                {
+                    if (auto a = cast<heart::ArrayElement> (e))
+                        changed = trustIndex (*a, block, *block.terminator) || changed;
+                });
+            }
+
+            return changed;
+        }
+
+    private:
+        /** A counter which starts at a constant and goes up by a constant amount each time
+            around the loop, which the loop's header compares against a constant limit.
+            In the blocks that the header's true branch dominates, it holds a value between
+            minValue and maxValue.
+        */
+        struct InductionVariable
+        {
+            heart::Variable& variable;
+            uint32_t phi;
+            int64_t minValue, maxValue;
+        };
+
+        struct ResolvedIndex
+        {
+            const InductionVariable* inductionVariable;
+            const heart::Object* counterReader;
+        };
+
+        SSAForm& ssa;
+        const CallFlowGraph::DominatorTree& dominators;
+        const Loop& loop;
+        uint32_t bodyBlock = CallFlowGraph::DominatorTree::noBlock;
+        std::vector<InductionVariable> variables;
+
+        static constexpr int maxCopyChainLength = 4;
+
+        void addCountedVariable (heart::BinaryOperator& comparison, heart::BranchIf& branch)
+        {
+            pool_ptr<heart::Expression> counter, limit;
+            int64_t limitOffset = 0;
+
+            switch (comparison.operation)
+            {
+                case BinaryOp::Op::lessThan:            counter = comparison.lhs; limit = comparison.rhs; limitOffset = -1; break;
+                case BinaryOp::Op::lessThanOrEqual:     counter = comparison.lhs; limit = comparison.rhs; break;
+                case BinaryOp::Op::greaterThan:         counter = comparison.rhs; limit = comparison.lhs; limitOffset = -1; break;
+                case BinaryOp::Op::greaterThanOrEqual:  counter = comparison.rhs; limit = comparison.lhs; break;
+                default: return;
+            }
+
+            auto variable = cast<heart::Variable> (counter);
+            auto limitValue = limit->getAsConstant();
+
+            if (variable == nullptr || ! ssa.isTracked (*variable) || ! limitValue.isValid()
+                 || ! (variable->type.isInteger32() || variable->type.isInteger64()) || ! limitValue.getType().isPrimitiveInteger())
+                return;
+
+            auto phi = ssa.getValueRead (branch, *variable);
+
+            if (phi == SSAForm::noValue || ssa.definitions[phi].type != SSAForm::DefinitionType::phi
+                 || ssa.definitions[phi].block != loop.header)
+                return;
+
+            auto maxValue = limitValue.getAsInt64() + limitOffset;
+            auto minValue = std::numeric_limits<int64_t>::max();
+            int64_t maxStep = 0;
+            auto& predecessors = dominators.getBlock (loop.header).predecessors;
+            auto& operands = ssa.definitions[phi].phiOperands;
+
+            for (size_t i = 0; i < predecessors.size(); ++i)
+            {
+                auto pred = dominators.getIndex (predecessors[i]);
+
+                if (pred == CallFlowGraph::DominatorTree::noBlock)
+                    continue;
+
+                if (loop.contains (pred))
+                {
+                    if (operands[i] == phi)
+                        continue;
+
+                    auto step = getIncrement (operands[i], phi);
+
+                    if (step <= 0)
+                        return;
+
+                    maxStep = std::max (maxStep, step);
+                }
+                else
+                {
+                    auto initialValue = ssa.getAssignedExpression (operands[i]);
+
+                    if (initialValue == nullptr)
+                        return;
+
+                    auto constant = initialValue->getAsConstant();
+
+                    if (! (constant.isValid() && constant.getType().isPrimitiveInteger()))
+                        return;
+
+                    minValue = std::min (minValue, constant.getAsInt64());
+                }
+            }
+
+            // The increment mustn't be able to overflow once the counter has passed the test
+            auto typeLimit = variable->type.isInteger32() ? (int64_t) std::numeric_limits<int32_t>::max()
+                                                          : std::numeric_limits<int64_t>::max();
+
+            if (minValue > maxValue || maxValue > typeLimit - maxStep)
+                return;
+
+            variables.push_back ({ *variable, phi, minValue, maxValue });
+        }
+
+        /** If the value is the loop's phi plus a positive constant, this returns the constant. */
+        int64_t getIncrement (uint32_t value, uint32_t phi) const
+        {
+            auto& definition = ssa.definitions[value];
+
+            if (definition.type != SSAForm::DefinitionType::statement || ! dominators.dominates (bodyBlock, definition.block))
+                return 0;
+
+            if (auto sum = cast<heart::BinaryOperator> (ssa.getAssignedExpression (value)))
+            {
+                if (sum->operation == BinaryOp::Op::add)
+                {
+                    auto& statement = *definition.statement;
+
+                    for (auto [counter, step] : { std::make_pair (sum->lhs, sum->rhs), std::make_pair (sum->rhs, sum->lhs) })
+                    {
+                        auto stepValue = step->getAsConstant();
+
+                        if (stepValue.isValid() && stepValue.getType().isPrimitiveInteger()
+                             && findValueSource (counter, statement, 0) == phi)
+                            return stepValue.getAsInt64();
+                    }
+                }
+            }
+
+            return 0;
+        }
+
+        /** Follows a chain of copies, returning the value that the expression originally came from. */
+        uint32_t findValueSource (heart::Expression& e, const heart::Object& owner, int depth) const
+        {
+            auto v = cast<heart::Variable> (e);
+
+            if (v == nullptr || ! ssa.isTracked (*v))
+                return SSAForm::noValue;
+
+            auto value = ssa.getValueRead (owner, *v);
+
+            if (value != SSAForm::noValue && depth < maxCopyChainLength)
+            {
+                auto& definition = ssa.definitions[value];
+
+                if (auto source = cast<heart::Variable> (ssa.getAssignedExpression (value)))
+                    if (ssa.isTracked (*source))
+                        return findValueSource (*source, *definition.statement, depth + 1);
+            }
+
+            return value;
+        }
+
+        std::optional<ResolvedIndex> resolveIndex (heart::Expression& e, const heart::Object& owner, int depth) const
+        {
+            if (depth > maxCopyChainLength)
+                return {};
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                if (! ssa.isTracked (*v))
+                    return {};
+
+                auto value = ssa.getValueRead (owner, *v);
+
+                if (value == SSAForm::noValue)
+                    return {};
+
+                for (auto& iv : variables)
+                    if (iv.phi == value)
+                        return ResolvedIndex { std::addressof (iv), std::addressof (owner) };
+
+                auto& definition = ssa.definitions[value];
+
+                if (auto source = ssa.getAssignedExpression (value))
+                    if (dominators.dominates (bodyBlock, definition.block))
+                        return resolveIndex (*source, *definition.statement, depth + 1);
+
+                return {};
+            }
+
+            if (auto c = cast<heart::TypeCast> (e))
+                if (auto resolved = resolveIndex (c->source, owner, depth + 1))
+                    if (castCannotChangeValue (c->destType, *resolved->inductionVariable))
+                        return resolved;
+
+            return {};
+        }
+
+        static bool castCannotChangeValue (const Type& destType, const InductionVariable& iv)
+        {
+            if (destType.isBoundedInt())
+                return iv.minValue >= 0 && iv.maxValue < (int64_t) destType.getBoundedIntLimit();
+
+            if (destType.isInteger32())
+                return iv.minValue >= std::numeric_limits<int32_t>::min() && iv.maxValue <= std::numeric_limits<int32_t>::max();
+
+            return destType.isInteger64();
+        }
+
+        bool trustIndex (heart::ArrayElement& a, heart::Block& block, const heart::Object& owner) const
+        {
+            if (! a.isDynamic() || a.isRangeTrusted)
+                return false;
+
+            auto& arrayType = a.parent->getType();
+
+            if (! (arrayType.isFixedSizeArray() || arrayType.isVector()))
+                return false;
+
+            auto resolved = resolveIndex (*a.dynamicIndex, owner, 0);
+
+            if (! resolved)
+                return false;
+
+            auto& iv = *resolved->inductionVariable;
+
+            if (iv.minValue < 0 || iv.maxValue >= (int64_t) arrayType.getArrayOrVectorSize())
+                return false;
+
+            a.isRangeTrusted = true;
+
+            if (counterIsUnchanged (iv, block, *resolved->counterReader, owner))
+                a.dynamicIndex = iv.variable;
+
+            return true;
+        }
+
+        /** Checks that the loop counter still holds the same value at the point where the
+            index is used as it did when it was read to calculate the index.
+        */
+        static bool counterIsUnchanged (const InductionVariable& iv, heart::Block& block,
+                                        const heart::Object& counterReader, const heart::Object& indexUser)
+        {
+            if (std::addressof (counterReader) == std::addressof (indexUser))
+                return true;
+
+            bool isBetween = false;
+
+            for (auto s : block.statements)
+            {
+                if (s == std::addressof (counterReader))
+                    isBetween = true;
+
+                if (s == std::addressof (indexUser))
+                    return isBetween;
+
+                if (isBetween && s->writesVariable (iv.variable))
+                    return false;
+            }
+
+            return isBetween && std::addressof (indexUser) == block.terminator.get();
+        }
+    };
+};
+
+} // namespace soul
@@ -27,6 +27,14 @@ namespace soul
 */
 struct Optimisations
 {
+    /// The level that's used when BuildSettings::optimisationLevel is left at its default of -1
+    static constexpr int defaultOptimisationLevel = 2;
+
+    static int getOptimisationLevel (const BuildSettings& settings)
+    {
+        return settings.optimisationLevel < 0 ? defaultOptimisationLevel : settings.optimisationLevel;
+    }
+
     static void removeUnusedObjects (Program& program)
     {
         auto& mainModule = program.getMainProcessor();
@@ -42,25 +50,18 @@ struct Optimisations
         while (objectsRemoved);
     }
 
-    static void removeUnusedVariables (Program& program)
+    static void removeUnusedVariables (Program& program, const BuildSettings& settings)
     {
-        for (auto& m : program.getModules())
-        {
-            m->rebuildVariableUseCounts();
-
-            for (auto f : m->functions.get())
-                removeDuplicateConstants (f);
-
-            m->rebuildVariableUseCounts();
-
-            for (auto f : m->functions.get())
-                convertWriteOnceVariablesToConstants (f);
-
-            m->rebuildVariableUseCounts();
+        // Each function only looks at and modifies its own local variables here, so they can all run in parallel
+        forEachFunctionInParallel (program, settings, [] (heart::Function& f, heart::Allocator&) { LocalVariableCleanup (f).perform(); });
+    }
 
-            for (auto f : m->functions.get())
-                removeUnusedVariables (f);
-        }
+    /** Removes assignments to state variables and struct members whose values are never read
+        anywhere in the program, and then removes any state variables that are no longer used.
+    */
+    static void removeDeadStores (Program& program)
+    {
+        DeadStoreElimination (program).perform();
     }
 
     static bool removeUnusedFunctions (Program& program, Module& mainModule, bool isFlattened)
@@ -202,11 +203,12 @@ struct Optimisations
         return results;
     }
 
-    static void optimiseFunctionBlocks (Program& program)
+    static void optimiseFunctionBlocks (Program& program, const BuildSettings& settings)
     {
-        for (auto& m : program.getModules())
-            for (auto f : m->functions.get())
-                optimiseFunctionBlocks (f, program.getAllocator());
+        forEachFunctionInParallel (program, settings, [] (heart::Function& f, heart::Allocator& allocator)
+        {
+            optimiseFunctionBlocks (f, allocator);
+        });
     }
 
     static void optimiseFunctionBlocks (heart::Function& f, heart::Allocator& allocator)
@@ -252,32 +254,191 @@ struct Optimisations
         return true;
     }
 
+    /** Inlines any calls where a simple cost model suggests that it's worth it.
+
+        Functions are visited so that callees are dealt with before their callers. Each call
+        is weighed by comparing the size of the target function with the cost of making the
+        call, and the size allowed grows with the depth of the loops that the call is inside.
+        Recursive functions, intrinsics and functions with large stack frames are left alone.
+        Returns true if anything was inlined.
+    */
+    static bool inlineFunctionsByCost (Program& program)
+    {
+        InliningCandidates candidates (program);
+        bool anyInlined = false;
+
+        for (auto& f : candidates.functionsInCallOrder)
+        {
+            if (f->hasNoBody)
+                continue;
+
+            for (uint32_t numInlined = 0; numInlined < maxInlinedCallsPerFunction;)
+            {
+                auto calls = candidates.findCallsToInline (f, maxInlinedCallsPerFunction - numInlined);
+
+                if (calls.empty())
+                    break;
+
+                // Inlining a call splits its block and inserts the new blocks after it, so going
+                // backwards leaves the blocks that hold the earlier calls where they were
+                for (auto call = calls.rbegin(); call != calls.rend(); ++call)
+                    makeFunctionCallInline (program, f, call->blockIndex, *call->call);
+
+                numInlined += static_cast<uint32_t> (calls.size());
+                f->localVariableStackSize = 0;
+                anyInlined = true;
+
+                // The calls that an inlined function makes may now be inside loops that make them
+                // worth inlining too, but otherwise there's nothing new to look at
+                if (! candidates.anyMakeCalls (calls))
+                    break;
+            }
+        }
+
+        return anyInlined;
+    }
+
     static void garbageCollectStringDictionary (Program& program)
     {
-        std::vector<StringDictionary::Handle> handlesUsed;
+        std::unordered_set<uint32_t> handlesUsed;
 
         for (auto& m : program.getModules())
             for (auto f : m->functions.get())
                 f->visitExpressions ([&] (pool_ref<heart::Expression>& e, AccessType)
                                      {
                                          if (auto c = cast<heart::Constant> (e))
-                                         {
-                                             const auto& type = c->value.getType();
+                                             if (c->value.getType().isStringLiteral())
+                                                 handlesUsed.insert (c->value.getStringLiteral().handle);
+                                     });
 
-                                             if (type.isStringLiteral())
-                                             {
-                                                 auto handle = c->value.getStringLiteral();
+        program.getStringDictionary().removeIf ([&] (const StringDictionary::Item& item) { return handlesUsed.find (item.handle.handle) == handlesUsed.end(); });
+    }
 
-                                                 if (! contains (handlesUsed, handle))
-                                                     handlesUsed.push_back (handle);
-                                             }
-                                         }
-                                     });
+    //==============================================================================
+    /// Below this number of functions per thread, it's quicker to do the work on the calling thread
+    static constexpr size_t defaultMinFunctionsPerThread = 32;
 
-        removeIf (program.getStringDictionary().strings,
-                  [&] (const StringDictionary::Item& item) { return ! contains (handlesUsed, item.handle); });
+    /// The name of an integer BuildSettings::customSettings member which overrides defaultMinFunctionsPerThread
+    static constexpr const char* minFunctionsPerThreadSettingName = "minFunctionsPerThread";
+
+    static size_t getMinFunctionsPerThread (const BuildSettings& settings)
+    {
+        if (settings.customSettings.isObject() && settings.customSettings.hasObjectMember (minFunctionsPerThreadSettingName))
+            return (size_t) std::max<int64_t> (1, settings.customSettings[minFunctionsPerThreadSettingName].getWithDefault<int64_t> (defaultMinFunctionsPerThread));
+
+        return defaultMinFunctionsPerThread;
     }
 
+    /** Calls fn (heart::Function&, heart::Allocator&) for every function in the program,
+        spreading the work across multiple threads if there are enough functions. The
+        function must only modify the function it's given, and must allocate any new
+        objects with the allocator it's given, because each thread has its own one.
+        Any messages that the function emits are passed on to the caller's handler.
+    */
+    template <typename PerFunctionFn>
+    static void forEachFunctionInParallel (Program& program, const BuildSettings& settings, PerFunctionFn&& fn)
+    {
+        std::vector<pool_ref<heart::Function>> functions;
+
+        for (auto& m : program.getModules())
+            for (auto f : m->functions.get())
+                functions.push_back (f);
+
+        forEachItemInParallel (program, functions, getMinFunctionsPerThread (settings),
+                               [&] (heart::Function& f, heart::Allocator& allocator) { fn (f, allocator); });
+    }
+
+    /** Calls fn (item, heart::Allocator&) for each item in a list, with the same threading
+        rules as forEachFunctionInParallel(). The worker allocators share the program's
+        identifiers, and are adopted by the program's allocator when the work is done.
+        If any items fail, the error that's reported is the one for the earliest item in
+        the list, so that it's the same error that a single thread would have stopped at.
+    */
+    template <typename ItemType, typename PerItemFn>
+    static void forEachItemInParallel (Program& program, std::vector<ItemType>& items,
+                                       size_t minItemsPerThread, PerItemFn&& fn)
+    {
+        // Always allow at least two threads, so that a low minItemsPerThread can test the threaded path on any machine
+        auto numThreads = std::min (items.size() / std::max ((size_t) 1, minItemsPerThread),
+                                    (size_t) std::max (2u, std::thread::hardware_concurrency()));
+
+        if (numThreads <= 1)
+        {
+            for (auto& item : items)
+                fn (item, program.getAllocator());
+
+            return;
+        }
+
+        static constexpr auto noFailure = std::numeric_limits<size_t>::max();
+
+        struct Worker
+        {
+            heart::Allocator allocator;
+            CompileMessageList messages;
+            size_t failedItem = std::numeric_limits<size_t>::max();
+        };
+
+        std::vector<Worker> workers (numThreads);
+        std::vector<std::future<void>> futures;
+        std::atomic<size_t> nextItem { 0 }, firstFailedItem { noFailure };
+
+        // This freezes the program's identifiers, so has to happen before any threads start
+        for (auto& worker : workers)
+            worker.allocator.identifiers.setParent (program.getAllocator().identifiers);
+
+        for (auto& worker : workers)
+        {
+            futures.push_back (std::async (std::launch::async, [&]
+            {
+                CompileMessageHandler handler (worker.messages);
+
+                for (auto i = nextItem++; i < items.size() && i < firstFailedItem; i = nextItem++)
+                {
+                    try
+                    {
+                        fn (items[i], worker.allocator);
+                    }
+                    catch (AbortCompilationException)
+                    {
+                        worker.failedItem = i;
+
+                        for (auto failed = firstFailedItem.load(); i < failed;)
+                            if (firstFailedItem.compare_exchange_weak (failed, i))
+                                break;
+
+                        return;
+                    }
+                }
+            }));
+        }
+
+        for (auto& f : futures)
+            f.get();
+
+        CompileMessageGroup messages;
+
+        for (auto& worker : workers)
+        {
+            if (firstFailedItem == noFailure)
+            {
+                for (auto& m : worker.messages.messages)
+                    messages.messages.push_back (m);
+            }
+            else if (worker.failedItem == firstFailedItem)
+            {
+                messages.messages = worker.messages.messages;
+            }
+
+            program.getAllocator().adopt (std::move (worker.allocator));
+        }
+
+        if (firstFailedItem != noFailure)
+            throwError (messages);
+
+        if (! messages.messages.empty())
+            emitMessage (messages);
+    }
 
 private:
     static bool eliminateEmptyAndUnreachableBlocks (heart::Function& f, heart::Allocator& allocator)
@@ -452,76 +613,584 @@ private:
     }
 
     //==============================================================================
-    static bool findAndReplaceFirstDuplicateConstant (heart::Function& f)
+    /** Collects the reads and assignments of every local variable in a function in a single
+        sweep, and then uses them to remove duplicate constants, turn variables that are only
+        written once into constants, and remove assignments whose values are never read.
+        Removing an assignment updates the read counts of the variables it used, so chains of
+        dead assignments are removed without having to re-scan the function.
+    */
+    struct LocalVariableCleanup
     {
-        for (auto b : f.blocks)
+        LocalVariableCleanup (heart::Function& f)  : function (f) {}
+
+        void perform()
         {
-            LinkedList<heart::Statement>::Iterator last;
+            findUsesAndAssignments();
+            replaceDuplicateConstants();
+            convertWriteOnceVariablesToConstants();
+            removeUnusedAssignments();
+
+            if (! statementsToRemove.empty())
+                for (auto b : function.blocks)
+                    b->statements.removeMatches ([this] (heart::Statement& s) { return statementsToRemove.find (std::addressof (s)) != statementsToRemove.end(); });
+        }
 
-            for (auto s : b->statements)
+    private:
+        struct Uses
+        {
+            uint32_t numReads = 0, numWrites = 0;
+            std::vector<pool_ref<heart::Assignment>> assignments;
+            pool_ptr<heart::Variable> duplicateOf;
+            pool_ptr<heart::Statement> duplicateAssignment;
+        };
+
+        heart::Function& function;
+        std::unordered_map<heart::Variable*, Uses> uses;
+        std::unordered_set<const heart::Statement*> statementsToRemove;
+
+        static pool_ptr<heart::Variable> getLocalVariable (heart::Expression& e)
+        {
+            if (auto v = cast<heart::Variable> (e))
+                if (v->isFunctionLocal())
+                    return v;
+
+            return {};
+        }
+
+        void findUsesAndAssignments()
+        {
+            auto countAccess = [this] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (auto v = getLocalVariable (value))
+                {
+                    auto& u = uses[v.get()];
+                    if (mode != AccessType::write) ++u.numReads;
+                    if (mode != AccessType::read)  ++u.numWrites;
+                }
+            };
+
+            for (auto b : function.blocks)
+            {
+                for (auto s : b->statements)
+                {
+                    s->visitExpressions (countAccess);
+
+                    if (auto a = cast<heart::Assignment> (*s))
+                        addAssignment (*a);
+                }
+
+                b->terminator->visitExpressions (countAccess);
+            }
+
+            // The first assignment to a reference-typed local binds it, but any other write goes
+            // through it to its referent, so has to count as a use that keeps the binding alive
+            for (auto& u : uses)
+                if (u.first->type.isReference() && u.second.numWrites > 1)
+                    u.second.numReads += u.second.numWrites - 1;
+        }
+
+        void addAssignment (heart::Assignment& a)
+        {
+            if (a.target == nullptr)
+                return;
+
+            auto target = a.target->getRootVariable();
+
+            if (target == nullptr || ! target->isFunctionLocal())
+                return;
+
+            auto& u = uses[target.get()];
+            u.assignments.push_back (a);
+
+            // If one constant is just a copy of another, all its reads can use the original instead
+            if (target->isConstant() && a.target == target)
+            {
+                if (auto assignment = cast<heart::AssignFromValue> (a))
+                {
+                    if (auto source = getLocalVariable (assignment->source))
+                    {
+                        if (source->isConstant())
+                        {
+                            u.duplicateOf = source;
+                            u.duplicateAssignment = a;
+                        }
+                    }
+                }
+            }
+        }
+
+        heart::Variable& getOriginal (heart::Variable& v)
+        {
+            auto original = std::addressof (v);
+
+            while (auto next = uses[original].duplicateOf)
+                original = next.get();
+
+            return *original;
+        }
+
+        void replaceDuplicateConstants()
+        {
+            bool anyDuplicates = false;
+
+            for (auto& u : uses)
             {
-                if (auto a = cast<heart::AssignFromValue> (*s))
+                if (auto source = u.second.duplicateOf)
                 {
-                    if (auto target = cast<heart::Variable> (a->target))
+                    statementsToRemove.insert (u.second.duplicateAssignment.get());
+                    --uses[source.get()].numReads;
+                    anyDuplicates = true;
+                }
+            }
+
+            if (! anyDuplicates)
+                return;
+
+            auto replaceRead = [this] (pool_ref<heart::Expression>& value, AccessType mode)
+            {
+                if (mode == AccessType::read)
+                {
+                    if (auto v = getLocalVariable (value))
                     {
-                        if (target->isConstant())
+                        if (uses[v.get()].duplicateOf != nullptr)
                         {
-                            if (auto source = cast<heart::Variable> (a->source))
+                            auto& original = getOriginal (*v);
+                            --uses[v.get()].numReads;
+                            ++uses[std::addressof (original)].numReads;
+                            value = original;
+                        }
+                    }
+                }
+            };
+
+            for (auto b : function.blocks)
+            {
+                for (auto s : b->statements)
+                    if (statementsToRemove.find (std::addressof (*s)) == statementsToRemove.end())
+                        s->visitExpressions (replaceRead);
+
+                b->terminator->visitExpressions (replaceRead);
+            }
+        }
+
+        void convertWriteOnceVariablesToConstants()
+        {
+            for (auto& u : uses)
+            {
+                auto& v = *u.first;
+
+                if (v.isMutableLocal() && u.second.numWrites == 1)
+                    for (auto& a : u.second.assignments)
+                        if (a->target == v)
+                            v.role = heart::Variable::Role::constant;
+            }
+        }
+
+        void removeUnusedAssignments()
+        {
+            std::vector<heart::Variable*> unusedVariables;
+
+            for (auto& u : uses)
+                if (u.second.numReads == 0 && ! u.second.assignments.empty())
+                    unusedVariables.push_back (u.first);
+
+            while (! unusedVariables.empty())
+            {
+                auto& u = uses[unusedVariables.back()];
+                unusedVariables.pop_back();
+
+                for (auto& a : u.assignments)
+                {
+                    if (auto assignment = cast<heart::AssignFromValue> (a))
+                    {
+                        if (! assignment->source->mayHaveSideEffects()
+                             && statementsToRemove.insert (a.getPointer()).second)
+                        {
+                            a->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType mode)
                             {
-                                if (source->isConstant())
-                                {
-                                    b->statements.removeNext (last);
-
-                                    f.visitExpressions ([target, source] (pool_ref<heart::Expression>& value, AccessType mode)
-                                    {
-                                        if (value == target && mode == AccessType::read)
-                                            value = *source;
-                                    });
-
-                                    return true;
-                                }
-                            }
+                                if (mode != AccessType::write)
+                                    if (auto v = getLocalVariable (value))
+                                        if (--uses[v.get()].numReads == 0)
+                                            unusedVariables.push_back (v.get());
+                            });
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    //==============================================================================
+    /** Finds the state variables and struct members that are never read, so that any values
+        assigned to them can be thrown away. A read of a whole struct (e.g. copying it, passing
+        it to a function or writing it to a stream) counts as a read of all its members.
+    */
+    struct DeadStoreElimination
+    {
+        DeadStoreElimination (Program& p)  : program (p) {}
+
+        void perform()
+        {
+            countReads();
+
+            if (removeStores())
+                removeUnusedStateVariables();
+        }
+
+    private:
+        Program& program;
+        std::unordered_map<const Structure*, int64_t> wholeStructReads;
+
+        void countReads()
+        {
+            for (auto& m : program.getModules())
+            {
+                for (auto& v : m->stateVariables.get())
+                    v->readWriteCount.reset();
+
+                for (auto& s : m->structs.get())
+                    for (auto& member : s->getMembers())
+                        member.readWriteCount.reset();
+            }
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions.get())
+                {
+                    f->visitExpressions ([this] (pool_ref<heart::Expression>& value, AccessType mode)
+                    {
+                        if (auto v = cast<heart::Variable> (value))
+                            if (v->isState())
+                                v->readWriteCount.increment (mode);
+
+                        if (mode == AccessType::write)
+                            return;
+
+                        addWholeStructReads (value->getType(), 1);
+
+                        // The parent of an element has already been visited as a read, but only
+                        // part of it is being read, so that read is taken back here
+                        if (auto s = cast<heart::StructElement> (value))
+                        {
+                            s->getStruct().getMemberWithName (s->memberName).readWriteCount.increment (mode);
+                            addWholeStructReads (s->parent->getType(), -1);
+                        }
+                        else if (auto a = cast<heart::ArrayElement> (value))
+                        {
+                            addWholeStructReads (a->parent->getType(), -1);
                         }
+                    });
+                }
+            }
+        }
+
+        void addWholeStructReads (const Type& type, int64_t delta)
+        {
+            if (type.isStruct())
+            {
+                auto& s = type.getStructRef();
+                wholeStructReads[std::addressof (s)] += delta;
+
+                for (auto& m : s.getMembers())
+                    addWholeStructReads (m.type, delta);
+            }
+            else if (type.isArray())
+            {
+                addWholeStructReads (type.getArrayElementType(), delta);
+            }
+        }
+
+        bool isNeverRead (heart::StructElement& s) const
+        {
+            auto& structure = s.getStruct();
+
+            if (structure.getMemberWithName (s.memberName).readWriteCount.numReads != 0)
+                return false;
+
+            auto wholeReads = wholeStructReads.find (std::addressof (structure));
+            return wholeReads == wholeStructReads.end() || wholeReads->second == 0;
+        }
+
+        bool isNeverRead (heart::Expression& target) const
+        {
+            if (auto v = cast<heart::Variable> (target))
+                return v->role == heart::Variable::Role::state && v->readWriteCount.numReads == 0;
+
+            if (auto s = cast<heart::StructElement> (target))
+                return isNeverRead (*s) || isNeverRead (s->parent);
+
+            if (auto a = cast<heart::ArrayElement> (target))
+                return isNeverRead (a->parent);
+
+            return false;
+        }
+
+        bool isDeadStore (heart::Statement& s) const
+        {
+            if (auto a = cast<heart::AssignFromValue> (s))
+                return ! (a->source->mayHaveSideEffects() || a->target->mayHaveSideEffects())
+                         && isNeverRead (*a->target);
+
+            return false;
+        }
+
+        bool removeStores()
+        {
+            bool anyRemoved = false;
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions.get())
+                {
+                    for (auto b : f->blocks)
+                    {
+                        b->statements.removeMatches ([&] (heart::Statement& s)
+                        {
+                            if (! isDeadStore (s))
+                                return false;
+
+                            anyRemoved = true;
+                            return true;
+                        });
                     }
                 }
+            }
 
-                last = *s;
+            return anyRemoved;
+        }
+
+        void removeUnusedStateVariables()
+        {
+            std::unordered_set<const heart::Variable*> usedVariables;
+
+            for (auto& m : program.getModules())
+            {
+                for (auto& f : m->functions.get())
+                {
+                    f->visitExpressions ([&] (pool_ref<heart::Expression>& value, AccessType)
+                    {
+                        if (auto v = cast<heart::Variable> (value))
+                            if (v->isState())
+                                usedVariables.insert (v.get());
+                    });
+                }
             }
+
+            for (auto& m : program.getModules())
+                m->stateVariables.removeIf ([&] (heart::Variable& v)
+                {
+                    return v.role == heart::Variable::Role::state
+                            && usedVariables.find (std::addressof (v)) == usedVariables.end();
+                });
         }
+    };
+
+    //==============================================================================
+    /// A function whose cost is less than this (scaled up for calls inside loops) will be inlined
+    static constexpr uint32_t inliningCostThreshold = 24;
+    /// The number of levels of loop nesting that can double the inlining threshold
+    static constexpr uint32_t maxLoopDepthForInlining = 3;
+    /// An estimate of the cost of making a call, on top of one per argument
+    static constexpr uint32_t functionCallCost = 4;
+    /// Inlining stops once a function's cost reaches this size
+    static constexpr uint32_t maxInlinedFunctionCost = 4000;
+    static constexpr uint32_t maxInlinedCallsPerFunction = 256;
+    /// Functions with more local variable space than this are never inlined
+    static constexpr uint64_t maxInlinedStackSize = 1024;
+    /// Inlining stops once the function's own locals reach this size
+    static constexpr uint64_t maxStackSizeAfterInlining = 16 * 1024;
+
+    static uint32_t getInliningCost (heart::Function& f)
+    {
+        uint32_t cost = 0;
+
+        auto countExpression = [&] (pool_ref<heart::Expression>& e, AccessType)
+        {
+            if (! (is_type<heart::Variable> (e) || is_type<heart::Constant> (e)))
+                ++cost;
+        };
+
+        for (auto& b : f.blocks)
+        {
+            cost += 1 + (uint32_t) b->parameters.size();
 
-        return false;
+            for (auto s : b->statements)
+            {
+                if (auto call = cast<heart::FunctionCall> (*s))
+                    cost += getCallCost (*call);
+                else
+                    ++cost;
+
+                s->visitExpressions (countExpression);
+            }
+
+            b->terminator->visitExpressions (countExpression);
+        }
+
+        return cost;
     }
 
-    static void removeDuplicateConstants (heart::Function& f)
+    static uint32_t getCallCost (const heart::FunctionCall& call)
     {
-        while (findAndReplaceFirstDuplicateConstant (f))
-        {}
+        return functionCallCost + (uint32_t) call.arguments.size() + (call.target != nullptr ? 1u : 0u);
     }
 
-    static void removeUnusedVariables (heart::Function& f)
+    struct InliningCandidates
     {
-        for (auto b : f.blocks)
+        InliningCandidates (Program& p)  : program (p)
         {
-            b->statements.removeMatches ([] (heart::Statement& s)
+            for (auto& m : program.getModules())
+                for (auto& f : m->functions.get())
+                    visit (f);
+        }
+
+        struct CallSite
+        {
+            size_t blockIndex = 0;
+            pool_ptr<heart::FunctionCall> call;
+        };
+
+        /** Finds up to maxCalls calls in a function that are worth inlining, in the order they
+            appear. The function is only analysed once: each call that gets chosen adds the target's
+            cost and stack size to the running totals that the later calls are checked against.
+        */
+        std::vector<CallSite> findCallsToInline (heart::Function& f, uint32_t maxCalls)
+        {
+            f.rebuildBlockPredecessors();
+            CallFlowGraph::DominatorTree dominators (f);
+            auto loopDepths = dominators.getLoopDepths();
+            auto functionCost = getInliningCost (f);
+            CallFlowGraph::calculateLocalVariableStackSize (f);
+            auto stackSize = f.localVariableStackSize;
+            std::vector<CallSite> calls;
+
+            for (size_t i = 0; i < f.blocks.size(); ++i)
             {
-                if (auto a = cast<heart::AssignFromValue> (s))
-                    if (auto rootVariable = a->target->getRootVariable())
-                        return rootVariable->readWriteCount.numReads == 0 && rootVariable->isFunctionLocal() && ! a->source->mayHaveSideEffects();
+                auto blockIndex = dominators.getIndex (f.blocks[i]);
+
+                if (blockIndex == CallFlowGraph::DominatorTree::noBlock)
+                    continue;
+
+                for (auto s : f.blocks[i]->statements)
+                {
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                    {
+                        if (! canInline (f, *call))
+                            continue;
+
+                        auto& target = getTargetInfo (call->getFunction());
+
+                        if (stackSize + target.stackSize > maxStackSizeAfterInlining
+                             || ! isWorthInlining (*call, target.cost, loopDepths[blockIndex], functionCost))
+                            continue;
+
+                        calls.push_back ({ i, call });
+                        functionCost += target.cost;
+                        stackSize += target.stackSize;
+
+                        if (calls.size() == maxCalls)
+                            return calls;
+                    }
+                }
+            }
+
+            return calls;
+        }
+
+        bool anyMakeCalls (const std::vector<CallSite>& calls)
+        {
+            return std::any_of (calls.begin(), calls.end(), [this] (const CallSite& c) { return getTargetInfo (c.call->getFunction()).makesCalls; });
+        }
+
+        std::vector<pool_ref<heart::Function>> functionsInCallOrder;
+
+    private:
+        struct TargetInfo
+        {
+            uint32_t cost = 0;
+            uint64_t stackSize = 0;
+            bool makesCalls = false;
+        };
+
+        Program& program;
+        std::unordered_set<const heart::Function*> visitedFunctions, recursiveFunctions;
+        std::vector<pool_ref<heart::Function>> callStack;
+        std::unordered_map<const heart::Function*, TargetInfo> targetInfo;
+
+        /// Callees are finished before their callers, so their sizes only need measuring once
+        const TargetInfo& getTargetInfo (heart::Function& target)
+        {
+            auto found = targetInfo.find (std::addressof (target));
 
+            if (found != targetInfo.end())
+                return found->second;
+
+            CallFlowGraph::calculateLocalVariableStackSize (target);
+            bool makesCalls = false;
+
+            for (auto& b : target.blocks)
+                for (auto s : b->statements)
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                        makesCalls = makesCalls || call->getFunction().intrinsicType == IntrinsicType::none;
+
+            return targetInfo[std::addressof (target)] = { getInliningCost (target), target.localVariableStackSize, makesCalls };
+        }
+
+        void visit (heart::Function& f)
+        {
+            for (size_t i = 0; i < callStack.size(); ++i)
+            {
+                if (callStack[i] == f)
+                {
+                    for (size_t j = i; j < callStack.size(); ++j)
+                        recursiveFunctions.insert (callStack[j].getPointer());
+
+                    return;
+                }
+            }
+
+            if (! visitedFunctions.insert (std::addressof (f)).second)
+                return;
+
+            callStack.push_back (f);
+
+            for (auto& b : f.blocks)
+                for (auto s : b->statements)
+                    if (auto call = cast<heart::FunctionCall> (*s))
+                        visit (call->getFunction());
+
+            callStack.pop_back();
+            functionsInCallOrder.push_back (f);
+        }
+
+        bool canInline (heart::Function& parent, heart::FunctionCall& call)
+        {
+            auto& target = call.getFunction();
+
+            if (std::addressof (target) == std::addressof (parent)
+                 || recursiveFunctions.find (std::addressof (target)) != recursiveFunctions.end()
+                 || recursiveFunctions.find (std::addressof (parent)) != recursiveFunctions.end()
+                 || target.intrinsicType != IntrinsicType::none
+                 || ! heart::Utilities::canFunctionBeInlined (program, parent, call))
                 return false;
-            });
+
+            for (size_t i = 0; i < call.arguments.size(); ++i)
+                if (target.parameters[i]->type.isReference() && ! Inliner::canSubstituteReferenceArgument (call.arguments[i]))
+                    return false;
+
+            return getTargetInfo (target).stackSize <= maxInlinedStackSize;
         }
-    }
 
-    static void convertWriteOnceVariablesToConstants (heart::Function& f)
-    {
-        f.visitStatements<heart::Assignment> ([] (heart::Assignment& a)
+        static bool isWorthInlining (const heart::FunctionCall& call, uint32_t targetCost, uint32_t loopDepth, uint32_t parentCost)
         {
-            if (auto target = cast<heart::Variable> (a.target))
-                if (target->readWriteCount.numWrites == 1 && target->isMutableLocal())
-                    target->role = heart::Variable::Role::constant;
-        });
-    }
+            // If the call costs as much as the code it runs, inlining can only make things smaller
+            if (targetCost <= getCallCost (call))
+                return true;
+
+            return targetCost <= (inliningCostThreshold << std::min (loopDepth, maxLoopDepthForInlining))
+                    && parentCost + targetCost <= maxInlinedFunctionCost;
+        }
+    };
 
     struct Inliner
     {
@@ -550,7 +1219,8 @@ private:
                                                                module.allocator.get (inlinedFnName + "_retval"),
                                                                heart::Variable::Role::mutableLocal);
 
-                postBlock.statements.insertFront (module.allocate<heart::AssignFromValue> (call.location, *call.target, *returnValueVar));
+                if (call.target != nullptr)
+                    postBlock.statements.insertFront (module.allocate<heart::AssignFromValue> (call.location, *call.target, *returnValueVar));
             }
 
             {
@@ -559,6 +1229,15 @@ private:
                 for (size_t i = 0; i < targetFunction.parameters.size(); ++i)
                 {
                     auto& param = targetFunction.parameters[i].get();
+
+                    // A reference to a plain variable or fixed element can just be replaced by the
+                    // argument itself, which avoids creating a local reference variable
+                    if (param.type.isReference() && canSubstituteReferenceArgument (call.arguments[i]))
+                    {
+                        substitutedReferences[param] = call.arguments[i];
+                        continue;
+                    }
+
                     auto newParamName = inlinedFnName + "_param_" + makeSafeIdentifierName (param.name);
                     auto& localParamVar = builder.createMutableLocalVariable (param.type, newParamName);
                     builder.addAssignment (localParamVar, call.arguments[i]);
@@ -589,6 +1268,9 @@ private:
 
         void cloneBlock (heart::Block& target, const heart::Block& source)
         {
+            for (auto& p : source.parameters)
+                target.addParameter (getRemappedVariable (p));
+
             LinkedList<heart::Statement>::Iterator last;
 
             for (auto s : source.statements)
@@ -621,14 +1303,25 @@ private:
 
         heart::Branch& clone (const heart::Branch& old)
         {
-            return module.allocate<heart::Branch> (*remappedBlocks[old.target]);
+            auto& b = module.allocate<heart::Branch> (*remappedBlocks[old.target]);
+
+            for (auto& arg : old.targetArgs)
+                b.targetArgs.push_back (cloneExpression (arg));
+
+            return b;
         }
 
         heart::BranchIf& clone (const heart::BranchIf& old)
         {
-            return module.allocate<heart::BranchIf> (cloneExpression (old.condition),
-                                                     *remappedBlocks[old.targets[0]],
-                                                     *remappedBlocks[old.targets[1]]);
+            auto& b = module.allocate<heart::BranchIf> (cloneExpression (old.condition),
+                                                        *remappedBlocks[old.targets[0]],
+                                                        *remappedBlocks[old.targets[1]]);
+
+            for (int i = 0; i < 2; ++i)
+                for (auto& arg : old.targetArgs[i])
+                    b.targetArgs[i].push_back (cloneExpression (arg));
+
+            return b;
         }
 
         heart::Terminator& clone (const heart::ReturnVoid&)    { return module.allocate<heart::Branch> (*postCallResumeBlock); }
@@ -663,19 +1356,25 @@ private:
 
         heart::ReadStream& clone (const heart::ReadStream& old)
         {
-            return module.allocate<heart::ReadStream> (old.location, cloneExpression (*old.target), old.source);
+            auto& r = module.allocate<heart::ReadStream> (old.location, cloneExpression (*old.target), old.source);
+            r.numFrames = old.numFrames;
+            return r;
         }
 
         heart::WriteStream& clone (const heart::WriteStream& old)
         {
-            return module.allocate<heart::WriteStream> (old.location, old.target,
-                                                        cloneExpressionPtr (old.element),
-                                                        cloneExpression (old.value));
+            auto& w = module.allocate<heart::WriteStream> (old.location, old.target,
+                                                           cloneExpressionPtr (old.element),
+                                                           cloneExpression (old.value));
+            w.numFrames = old.numFrames;
+            return w;
         }
 
-        heart::AdvanceClock& clone (const heart::AdvanceClock& a)
+        heart::AdvanceClock& clone (const heart::AdvanceClock& old)
         {
-            return module.allocate<heart::AdvanceClock> (a.location);
+            auto& a = module.allocate<heart::AdvanceClock> (old.location);
+            a.numFrames = old.numFrames;
+            return a;
         }
 
         heart::Expression& cloneExpression (heart::Expression& old)
@@ -699,7 +1398,14 @@ private:
                 return clone (*f);
 
             if (auto v = cast<heart::Variable> (old))
+            {
+                auto substitute = substitutedReferences.find (*v);
+
+                if (substitute != substitutedReferences.end())
+                    return copyReferenceArgument (*substitute->second);
+
                 return getRemappedVariable (*v);
+            }
 
             if (auto s = cast<heart::ArrayElement> (old))
                 return cloneArrayElement (*s);
@@ -707,6 +1413,16 @@ private:
             if (auto s = cast<heart::StructElement> (old))
                 return cloneStructElement (*s);
 
+            if (auto list = cast<heart::AggregateInitialiserList> (old))
+            {
+                auto& l = module.allocate<heart::AggregateInitialiserList> (list->location, list->type);
+
+                for (auto& item : list->items)
+                    l.items.push_back (cloneExpression (item));
+
+                return l;
+            }
+
             auto pp = cast<heart::ProcessorProperty> (old);
             return module.allocate<heart::ProcessorProperty> (pp->location, pp->property);
         }
@@ -740,6 +1456,38 @@ private:
             return old;
         }
 
+        static bool canSubstituteReferenceArgument (heart::Expression& e)
+        {
+            if (is_type<heart::Variable> (e))
+                return true;
+
+            if (auto a = cast<heart::ArrayElement> (e))
+                return ! a->isDynamic() && canSubstituteReferenceArgument (a->parent);
+
+            if (auto s = cast<heart::StructElement> (e))
+                return canSubstituteReferenceArgument (s->parent);
+
+            return false;
+        }
+
+        /** Copies an argument from the calling function, so its variables aren't remapped */
+        heart::Expression& copyReferenceArgument (heart::Expression& e)
+        {
+            if (auto a = cast<heart::ArrayElement> (e))
+            {
+                auto& element = module.allocate<heart::ArrayElement> (a->location, copyReferenceArgument (a->parent),
+                                                                      a->fixedStartIndex, a->fixedEndIndex);
+                element.suppressWrapWarning = a->suppressWrapWarning;
+                element.isRangeTrusted = a->isRangeTrusted;
+                return element;
+            }
+
+            if (auto s = cast<heart::StructElement> (e))
+                return module.allocate<heart::StructElement> (s->location, copyReferenceArgument (s->parent), s->memberName);
+
+            return e;
+        }
+
         heart::ArrayElement& cloneArrayElement (const heart::ArrayElement& old)
         {
             auto& s = module.allocate<heart::ArrayElement> (old.location,
@@ -769,6 +1517,7 @@ private:
         std::vector<pool_ref<heart::Block>> newBlocks;
         std::unordered_map<pool_ref<heart::Block>, pool_ptr<heart::Block>> remappedBlocks;
         std::unordered_map<pool_ref<heart::Variable>, pool_ptr<heart::Variable>> remappedVariables;
+        std::unordered_map<pool_ref<heart::Variable>, pool_ptr<heart::Expression>> substitutedReferences;
         pool_ptr<heart::Block> postCallResumeBlock;
         pool_ptr<heart::Variable> returnValueVar;
     };
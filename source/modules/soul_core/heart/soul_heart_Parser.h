@@ -156,6 +156,10 @@ private:
 
     Program program;
     pool_ptr<Module> module;
+    int64_t formatMinorVersion = 0;
+
+    /// The first minor version of the format which supports multi-frame stream access and processor.framesAvailable
+    static constexpr int64_t firstMinorVersionWithMultiFrameAccess = 1;
 
     //==============================================================================
     Parser (const CodeLocation& text)  { initialise (text); }
@@ -880,8 +884,9 @@ private:
             if (! state.function.functionType.isRun())
                 location.throwError (Errors::advanceCannotBeCalledHere());
 
+            auto numFrames = parseOptionalFrameCount();
             expectSemicolon();
-            builder.addAdvance (location);
+            builder.addAdvance (location, numFrames);
             return true;
         }
 
@@ -1103,7 +1108,9 @@ private:
         if (src == nullptr)
             throwError (Errors::cannotFindInput (name));
 
-        builder.addReadStream (location, *target.create (state, builder, src->getSingleDataType()), *src);
+        auto numFrames = parseOptionalFrameCount();
+        auto type = numFrames > 1 ? getMultipleFrameType (*src, numFrames) : src->getSingleDataType();
+        builder.addReadStream (location, *target.create (state, builder, type), *src, numFrames);
         expectSemicolon();
     }
 
@@ -1124,13 +1131,44 @@ private:
             expect (HEARTOperator::closeBracket);
         }
 
-        auto& value = parseExpression (state);
+        auto numFrames = parseOptionalFrameCount();
+        auto& value = numFrames > 1 ? parseExpression (state, getMultipleFrameType (*target, numFrames))
+                                    : parseExpression (state);
 
-        builder.addWriteStream (writeStreamLocation, *target, index, value);
+        builder.addWriteStream (writeStreamLocation, *target, index, value, numFrames);
         expectSemicolon();
         return true;
     }
 
+    uint32_t parseOptionalFrameCount()
+    {
+        auto errorPos = location;
+
+        if (! matchIf ("frames"))
+            return 1;
+
+        if (formatMinorVersion < firstMinorVersionWithMultiFrameAccess)
+            errorPos.throwError (Errors::needsLaterHEARTVersion (getMultiFrameAccessVersionString()));
+
+        errorPos = location;
+        auto numFrames = parseInt32();
+
+        if (numFrames < 1 || ! Type::isLegalVectorSize (numFrames))
+            errorPos.throwError (Errors::illegalVectorSize());
+
+        return static_cast<uint32_t> (numFrames);
+    }
+
+    Type getMultipleFrameType (const heart::IODeclaration& endpoint, uint32_t numFrames)
+    {
+        auto frameType = endpoint.getSingleDataType();
+
+        if (! (endpoint.isStreamEndpoint() && frameType.isPrimitive()) || endpoint.arraySize.has_value())
+            throwError (Errors::wrongTypeForEndpoint());
+
+        return Type::createVector (frameType.getPrimitiveType(), numFrames);
+    }
+
     void parseLatency()
     {
         expect (HEARTOperator::dot);
@@ -1485,6 +1523,9 @@ private:
         if (property == heart::ProcessorProperty::Property::none)
             pos.throwError (Errors::unknownProperty());
 
+        if (heart::ProcessorProperty::canChangeBetweenFrames (property) && formatMinorVersion < firstMinorVersionWithMultiFrameAccess)
+            pos.throwError (Errors::needsLaterHEARTVersion (getMultiFrameAccessVersionString()));
+
         if (module->isNamespace())
             pos.throwError (Errors::processorPropertyUsedOutsideDecl());
 
@@ -1771,17 +1812,39 @@ private:
         expect (HEARTOperator::hash);
         expect (getHEARTFormatVersionPrefix());
 
-        if (! matches (Token::literalInt32))
+        if (! (matches (Token::literalInt32) || matches (Token::literalFloat64)))
             errorContext.throwError (Errors::expectedVersionNumber());
 
         errorContext = location;
-        auto version = parseLiteralInt();
+        int64_t version = 0, minorVersion = 0;
 
-        if (version <= 0)
+        if (matches (Token::literalFloat64))
+        {
+            // A minor version is written as e.g. "1.1", which the tokeniser reads as a
+            // floating-point number, so the two parts are read from the original text
+            char* end = nullptr;
+            version = std::strtoll (location.location.data(), &end, 10);
+            minorVersion = *end == '.' ? std::strtoll (end + 1, nullptr, 10) : -1;
+            skip();
+        }
+        else
+        {
+            version = parseLiteralInt();
+        }
+
+        if (version <= 0 || minorVersion < 0)
             errorContext.throwError (Errors::expectedVersionNumber());
 
-        if (version > getHEARTFormatVersion())
+        if (version > getHEARTFormatVersion()
+             || (version == getHEARTFormatVersion() && minorVersion > getHEARTFormatMinorVersion()))
             errorContext.throwError (Errors::wrongAPIVersion());
+
+        formatMinorVersion = minorVersion;
+    }
+
+    static std::string getMultiFrameAccessVersionString()
+    {
+        return std::to_string (getHEARTFormatVersion()) + "." + std::to_string (firstMinorVersionWithMultiFrameAccess);
     }
 
     uint32_t parseVersionElement()
@@ -26,7 +26,14 @@ struct heart::Printer
 {
     static void print (const Program& p, choc::text::CodePrinter& out)
     {
-        out << '#' << getHEARTFormatVersionPrefix() << ' ' << getHEARTFormatVersion() << blankLine;
+        out << '#' << getHEARTFormatVersionPrefix() << ' ' << getHEARTFormatVersion();
+
+        // Only programs that need the newer features are marked with the minor version, so that
+        // everything else can still be read by older parsers
+        if (heart::Utilities::usesMultiFrameStreamAccess (p))
+            out << '.' << getHEARTFormatMinorVersion();
+
+        out << blankLine;
 
         for (auto& module : p.getModules())
             PrinterStream (module, out).printAll();
@@ -641,6 +648,7 @@ private:
             out << getAssignmentRole (*r.target);
             printExpression (*r.target);
             out << " = read " << r.source->name.toString();
+            printFrameCount (r.numFrames);
         }
 
         void printDescription (const heart::WriteStream& w)
@@ -654,13 +662,21 @@ private:
                 out << ']';
             }
 
+            printFrameCount (w.numFrames);
             out << ' ';
             printExpression (w.value);
         }
 
-        void printDescription (const heart::AdvanceClock&) const
+        void printDescription (const heart::AdvanceClock& a) const
         {
             out << "advance";
+            printFrameCount (a.numFrames);
+        }
+
+        void printFrameCount (uint32_t numFrames) const
+        {
+            if (numFrames != 1)
+                out << " frames " << numFrames;
         }
     };
 };
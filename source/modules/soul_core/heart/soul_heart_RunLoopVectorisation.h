@@ -0,0 +1,439 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Rewrites the main loop of a processor's run() function so that it can process a
+    block of frames at a time.
+
+    Many processors (e.g. soul::gain::DynamicGain or soul::mixers::DynamicMix) have a run()
+    loop which reads some streams, does some arithmetic on the values and writes the results,
+    without anything being carried over from one frame to the next. For a loop like that,
+    this adds a second copy in which each value becomes a vector holding one element per
+    frame, and which reads, writes and advances by a whole block of frames at a time.
+
+    Before each pass round the loop, the processor.framesAvailable property is checked to
+    decide which copy to use: the block version is only used when there are no events to
+    deliver during the frames that it covers, and otherwise the original loop runs as normal.
+
+    The multi-frame reads, writes and advances and the processor.framesAvailable property that
+    this generates can only be run by some back-ends (currently just the interpreter, as the
+    C++ generator doesn't handle them yet), so it's off unless the BuildSettings enable it
+    (see settingName). When enabled, it runs at optimisation level 2 and above, after the
+    other optimisations. Programs which it changes are printed as HEART format version 1.1.
+*/
+struct RunLoopVectorisation
+{
+    /** The number of frames that each pass through a vectorised loop handles. */
+    static constexpr uint32_t framesPerBlock = 8;
+
+    /** The name of a boolean BuildSettings::customSettings member which turns this pass on.
+        Only set it if the performer that will run the program returns true from
+        PerformerFactory::supportsRunLoopVectorisation().
+    */
+    static constexpr const char* settingName = "vectoriseRunLoops";
+
+    static bool isEnabled (const BuildSettings& settings)
+    {
+        return Optimisations::getOptimisationLevel (settings) >= 2
+                && settings.customSettings.isObject()
+                && settings.customSettings.hasObjectMember (settingName)
+                && settings.customSettings[settingName].getWithDefault<bool> (false);
+    }
+
+    static void vectorise (Program& program, const BuildSettings& settings)
+    {
+        if (! isEnabled (settings))
+            return;
+
+        for (auto& m : program.getModules())
+            if (m->isProcessor())
+                if (auto run = m->functions.findRunFunction())
+                    vectorise (m, *run, framesPerBlock);
+    }
+
+    /** Adds a vectorised version of the run() function's loop if possible, returning
+        true if the function was changed.
+    */
+    static bool vectorise (Module& module, heart::Function& run, uint32_t numFrames)
+    {
+        auto loop = findFrameLoop (run);
+
+        if (loop == nullptr)
+            return false;
+
+        LegalityCheck legality (*loop);
+
+        if (! legality.isLegal())
+            return false;
+
+        Vectoriser (module, run, *loop, legality, numFrames).perform();
+        return true;
+    }
+
+    //==============================================================================
+    /** Checks whether the statements in a loop can be run for several frames at once.
+
+        For this to work, the loop must only read and write streams of primitive values, and
+        do arithmetic on them. Any local variables that it writes must be written before they're
+        read in each pass, so that no values get carried over from one frame to the next. It can
+        read other variables and state, as the runtime won't deliver any events to change them
+        during a block, but it can't write to them or call any functions.
+    */
+    struct LegalityCheck
+    {
+        LegalityCheck (const heart::Block& loop)
+        {
+            for (auto s : loop.statements)
+                if (auto a = cast<heart::Assignment> (*s))
+                    if (auto v = cast<heart::Variable> (a->target))
+                        frameVariables.insert (v.get());
+
+            legal = checkStatements (loop);
+        }
+
+        bool isLegal() const                                        { return legal; }
+
+        /** Returns true if this variable holds a different value for each frame. */
+        bool isFrameVariable (const heart::Variable& v) const       { return frameVariables.find (std::addressof (v)) != frameVariables.end(); }
+
+        /** Returns true if the expression will have the same value for every frame in a block. */
+        bool isInvariant (heart::Expression& e) const
+        {
+            if (is_type<heart::Constant> (e))
+                return true;
+
+            if (auto v = cast<heart::Variable> (e))
+                return ! (isFrameVariable (*v) || v->type.isReference());
+
+            if (auto p = cast<heart::ProcessorProperty> (e))
+                return ! p->canChangeBetweenFrames();
+
+            if (auto a = cast<heart::ArrayElement> (e))
+                return isInvariant (a->parent) && (! a->isDynamic() || isInvariant (*a->dynamicIndex));
+
+            if (auto s = cast<heart::StructElement> (e))
+                return isInvariant (s->parent);
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+                return isInvariant (b->lhs) && isInvariant (b->rhs);
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+                return isInvariant (u->source);
+
+            if (auto c = cast<heart::TypeCast> (e))
+                return isInvariant (c->source);
+
+            if (auto call = cast<heart::PureFunctionCall> (e))
+            {
+                if (call->function.mayHaveSideEffects())
+                    return false;
+
+                for (auto& arg : call->arguments)
+                    if (! isInvariant (arg))
+                        return false;
+
+                return true;
+            }
+
+            return false;
+        }
+
+        static bool isVectorisableType (const Type& type)
+        {
+            auto t = type.removeConstIfPresent();
+            return t.isPrimitive() && (t.isFloatingPoint() || t.isInteger32() || t.isInteger64());
+        }
+
+        static bool isVectorisableStream (const heart::IODeclaration& endpoint)
+        {
+            return endpoint.isStreamEndpoint() && ! endpoint.arraySize.has_value()
+                    && isVectorisableType (endpoint.getSingleDataType());
+        }
+
+    private:
+        std::unordered_set<const heart::Variable*> frameVariables, variablesWritten;
+        bool legal = false;
+
+        static bool isSameType (const Type& a, const Type& b)
+        {
+            return a.removeConstIfPresent().isIdentical (b.removeConstIfPresent());
+        }
+
+        static bool isLocal (const heart::Variable& v)
+        {
+            return (v.isMutableLocal() || v.isConstant()) && ! v.type.isReference();
+        }
+
+        bool checkStatements (const heart::Block& loop)
+        {
+            auto lastStatement = *loop.statements.getLast();
+            bool writesStream = false;
+
+            for (auto s : loop.statements)
+            {
+                if (s == lastStatement)
+                    return writesStream && is_type<heart::AdvanceClock> (*s);
+
+                if (auto r = cast<heart::ReadStream> (*s))
+                {
+                    auto target = cast<heart::Variable> (r->target);
+
+                    if (r->numFrames != 1 || r->element != nullptr || ! isVectorisableStream (r->source)
+                         || target == nullptr || ! isLocal (*target)
+                         || ! isSameType (target->type, r->source->getSingleDataType()))
+                        return false;
+
+                    variablesWritten.insert (target.get());
+                    continue;
+                }
+
+                if (auto a = cast<heart::AssignFromValue> (*s))
+                {
+                    auto target = cast<heart::Variable> (a->target);
+
+                    if (target == nullptr || ! isLocal (*target) || ! isVectorisableType (target->type)
+                         || ! isSameType (target->type, a->source->getType()) || ! canVectorise (a->source))
+                        return false;
+
+                    variablesWritten.insert (target.get());
+                    continue;
+                }
+
+                if (auto w = cast<heart::WriteStream> (*s))
+                {
+                    if (w->numFrames != 1 || w->element != nullptr || ! isVectorisableStream (w->target)
+                         || ! isSameType (w->value->getType(), w->target->getSingleDataType()) || ! canVectorise (w->value))
+                        return false;
+
+                    writesStream = true;
+                    continue;
+                }
+
+                return false;
+            }
+
+            return false;
+        }
+
+        bool canVectorise (heart::Expression& e) const
+        {
+            if (! isVectorisableType (e.getType()))
+                return false;
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                // A variable that's read before it's written would carry a value over from the previous frame
+                if (isFrameVariable (*v))
+                    return variablesWritten.find (v.get()) != variablesWritten.end();
+
+                return isInvariant (e);
+            }
+
+            if (isInvariant (e))
+                return true;
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+                return isSameType (b->lhs->getType(), e.getType()) && isSameType (b->rhs->getType(), e.getType())
+                        && canVectorise (b->lhs) && canVectorise (b->rhs);
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+                return isSameType (u->source->getType(), e.getType()) && canVectorise (u->source);
+
+            if (auto c = cast<heart::TypeCast> (e))
+                return canVectorise (c->source);
+
+            return false;
+        }
+    };
+
+private:
+    //==============================================================================
+    /** Finds a block which loops back to itself, and which finishes with the function's only
+        advance() call, as that's the shape of a typical run() loop once it's been optimised.
+    */
+    static pool_ptr<heart::Block> findFrameLoop (heart::Function& run)
+    {
+        pool_ptr<heart::Block> loop;
+
+        for (auto& b : run.blocks)
+        {
+            if (! heart::Utilities::doesBlockCallAdvance (b))
+                continue;
+
+            if (loop != nullptr)
+                return {};
+
+            loop = b;
+        }
+
+        if (loop == nullptr || ! loop->parameters.empty() || loop->statements.empty())
+            return {};
+
+        auto branch = cast<heart::Branch> (loop->terminator);
+
+        if (branch == nullptr || branch->target != *loop || ! branch->targetArgs.empty())
+            return {};
+
+        auto advance = cast<heart::AdvanceClock> (**loop->statements.getLast());
+
+        if (advance == nullptr || advance->numFrames != 1)
+            return {};
+
+        for (auto s : loop->statements)
+            if (s != advance.get() && is_type<heart::AdvanceClock> (*s))
+                return {};
+
+        return loop;
+    }
+
+    //==============================================================================
+    struct Vectoriser
+    {
+        Vectoriser (Module& m, heart::Function& f, heart::Block& l, const LegalityCheck& c, uint32_t n)
+            : module (m), run (f), loop (l), legality (c), numFrames (n)
+        {
+        }
+
+        void perform()
+        {
+            auto loopIndex = static_cast<size_t> (std::distance (run.blocks.begin(),
+                                                                 std::find_if (run.blocks.begin(), run.blocks.end(),
+                                                                               [this] (pool_ref<heart::Block> b) { return b == loop; })));
+            auto& check = heart::Utilities::insertBlock (module, run, loopIndex, createUniqueBlockName ("@frame_block_check"));
+            auto& block = heart::Utilities::insertBlock (module, run, loopIndex + 1, createUniqueBlockName ("@frame_block"));
+
+            for (auto& b : run.blocks)
+                if (b->terminator != nullptr)
+                    heart::Utilities::replaceBlockDestination (b, loop, check);
+
+            auto& framesAvailable = module.allocate<heart::ProcessorProperty> (loop.location, heart::ProcessorProperty::Property::framesAvailable);
+            auto& blockSize = module.allocator.allocateConstant (Value::createInt32 (numFrames));
+            auto& condition = module.allocate<heart::BinaryOperator> (loop.location, framesAvailable, blockSize, BinaryOp::Op::greaterThanOrEqual);
+            check.terminator = module.allocate<heart::BranchIf> (condition, block, loop);
+
+            for (auto s : loop.statements)
+                if (auto statement = createVectorisedStatement (*s))
+                    block.statements.append (*statement);
+
+            block.terminator = module.allocate<heart::Branch> (check);
+            run.rebuildBlockPredecessors();
+        }
+
+    private:
+        Module& module;
+        heart::Function& run;
+        heart::Block& loop;
+        const LegalityCheck& legality;
+        const uint32_t numFrames;
+        std::unordered_map<const heart::Variable*, pool_ref<heart::Variable>> blockVariables;
+
+        std::string createUniqueBlockName (const std::string& root) const
+        {
+            for (uint32_t i = 0;; ++i)
+            {
+                auto name = root + "_" + std::to_string (i);
+
+                if (heart::Utilities::findBlock (run, name) == nullptr)
+                    return name;
+            }
+        }
+
+        Type getBlockType (const Type& frameType) const
+        {
+            return Type::createVector (frameType.removeConstIfPresent().getPrimitiveType(), numFrames);
+        }
+
+        heart::Variable& getBlockVariable (heart::Variable& v)
+        {
+            auto existing = blockVariables.find (std::addressof (v));
+
+            if (existing != blockVariables.end())
+                return existing->second;
+
+            auto& newVariable = module.allocate<heart::Variable> (v.location, getBlockType (v.type), v.name, v.role);
+            blockVariables.insert ({ std::addressof (v), newVariable });
+            return newVariable;
+        }
+
+        pool_ptr<heart::Statement> createVectorisedStatement (heart::Statement& s)
+        {
+            if (auto r = cast<heart::ReadStream> (s))
+            {
+                auto& read = module.allocate<heart::ReadStream> (r->location, getBlockVariable (*cast<heart::Variable> (r->target)), r->source);
+                read.numFrames = numFrames;
+                return read;
+            }
+
+            if (auto a = cast<heart::AssignFromValue> (s))
+                return module.allocate<heart::AssignFromValue> (a->location, getBlockVariable (*cast<heart::Variable> (a->target)),
+                                                                createVectorisedExpression (a->source));
+
+            if (auto w = cast<heart::WriteStream> (s))
+            {
+                auto& write = module.allocate<heart::WriteStream> (w->location, w->target, nullptr, createVectorisedExpression (w->value));
+                write.numFrames = numFrames;
+                return write;
+            }
+
+            auto& advance = module.allocate<heart::AdvanceClock> (s.location);
+            advance.numFrames = numFrames;
+            return advance;
+        }
+
+        heart::Expression& createVectorisedExpression (heart::Expression& e)
+        {
+            auto blockType = getBlockType (e.getType());
+
+            if (auto v = cast<heart::Variable> (e))
+                if (legality.isFrameVariable (*v))
+                    return getBlockVariable (*v);
+
+            if (legality.isInvariant (e))
+            {
+                auto constant = e.getAsConstant();
+
+                if (constant.isValid())
+                {
+                    std::vector<Value> elements (numFrames, constant.castToTypeExpectingSuccess (e.getType().removeConstIfPresent()));
+                    return module.allocator.allocateConstant (Value::createArrayOrVector (blockType, elements));
+                }
+
+                return module.allocate<heart::TypeCast> (e.location, heart::Utilities::cloneExpression (module.allocator, e), blockType);
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+                return module.allocate<heart::BinaryOperator> (b->location, createVectorisedExpression (b->lhs),
+                                                               createVectorisedExpression (b->rhs), b->operation);
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+                return module.allocate<heart::UnaryOperator> (u->location, createVectorisedExpression (u->source), u->operation);
+
+            auto c = cast<heart::TypeCast> (e);
+            SOUL_ASSERT (c != nullptr);
+            return module.allocate<heart::TypeCast> (c->location, createVectorisedExpression (c->source), blockType);
+        }
+    };
+};
+
+} // namespace soul
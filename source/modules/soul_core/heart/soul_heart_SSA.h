@@ -0,0 +1,488 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    A static single assignment view of a heart::Function.
+
+    Rather than rewriting the function, this builds a side-table in which each definition
+    of a local variable gets its own numbered value. Phi values are placed at the iterated
+    dominance frontiers of the blocks that write each variable, and each statement or
+    terminator that reads a variable is mapped onto the value that reaches it.
+
+    Only variables whose every write is a whole-variable assignment within the function are
+    tracked: anything that's partially written, passed by reference or lives outside the
+    function is left alone. The table is only valid until the function is next modified.
+*/
+struct SSAForm
+{
+    SSAForm (heart::Function& f)  : function (f), dominators (rebuildPredecessors (f))
+    {
+        // A branch back to the first block would need a phi for the values on entry to the function
+        if (dominators.size() == 0 || ! dominators.getBlock (0).predecessors.empty())
+            return;
+
+        findVariables();
+        placePhis();
+        renameVariables();
+        isValid = true;
+    }
+
+    static constexpr uint32_t noValue = std::numeric_limits<uint32_t>::max();
+
+    enum class DefinitionType
+    {
+        entry,          // the value a variable holds when the function starts
+        phi,            // a merge of the values arriving from each of a block's predecessors
+        statement,      // an assignment to the whole variable
+        blockParameter  // a value passed in by a branch to a parameterised block
+    };
+
+    struct Definition
+    {
+        DefinitionType type;
+        heart::Variable& variable;
+        uint32_t block;                         // the index of the block in the dominator tree
+        pool_ptr<heart::Statement> statement;
+        std::vector<uint32_t> phiOperands;      // one per entry in the block's predecessor list
+    };
+
+    heart::Function& function;
+    CallFlowGraph::DominatorTree dominators;
+    std::vector<Definition> definitions;
+
+    /** This will be false if the function couldn't be converted. */
+    bool isValid = false;
+
+    bool isTracked (const heart::Variable& v) const     { return variableIndexes.find (std::addressof (v)) != variableIndexes.end(); }
+
+    /** Returns the value of a variable that a statement or terminator reads, or noValue if it isn't tracked. */
+    uint32_t getValueRead (const heart::Object& statementOrTerminator, const heart::Variable& v) const
+    {
+        auto reads = valuesRead.find (std::addressof (statementOrTerminator));
+
+        if (reads != valuesRead.end())
+            for (auto& r : reads->second)
+                if (r.variable == std::addressof (v))
+                    return r.value;
+
+        return noValue;
+    }
+
+    /** Returns the value that a statement assigns to a tracked variable, or noValue. */
+    uint32_t getValueWritten (const heart::Statement& s) const
+    {
+        auto i = valuesWritten.find (std::addressof (s));
+        return i != valuesWritten.end() ? i->second : noValue;
+    }
+
+    const std::vector<uint32_t>& getPhis (uint32_t blockIndex) const         { return blockPhis[blockIndex]; }
+    const std::vector<uint32_t>& getParameterValues (uint32_t blockIndex) const   { return blockParameterValues[blockIndex]; }
+
+    /** Returns true if every read of this variable sees the same value, and returns that value. */
+    uint32_t getOnlyValue (const heart::Variable& v) const
+    {
+        auto i = variableIndexes.find (std::addressof (v));
+
+        if (i == variableIndexes.end())
+            return noValue;
+
+        auto& info = variables[i->second];
+
+        if (info.numPhis != 0 || info.numDefinitions != 1 || info.hasUninitialisedRead)
+            return noValue;
+
+        return info.onlyDefinition;
+    }
+
+    /** Returns the expression that a statement assigns to its target if it's a plain
+        AssignFromValue of a whole tracked variable, or nullptr.
+    */
+    pool_ptr<heart::Expression> getAssignedExpression (uint32_t value) const
+    {
+        auto& d = definitions[value];
+
+        if (d.type == DefinitionType::statement)
+            if (auto a = cast<heart::AssignFromValue> (d.statement))
+                return a->source;
+
+        return {};
+    }
+
+private:
+    struct VariableInfo
+    {
+        heart::Variable& variable;
+        std::vector<uint32_t> blocksWritten;
+        uint32_t numPhis = 0, numDefinitions = 0, onlyDefinition = noValue, entryDefinition = noValue;
+        bool isFunctionParameter = false, hasUninitialisedRead = false;
+    };
+
+    struct ValueRead
+    {
+        const heart::Variable* variable;
+        uint32_t value;
+    };
+
+    std::vector<VariableInfo> variables;
+    std::unordered_map<const heart::Variable*, uint32_t> variableIndexes;
+    std::unordered_map<const heart::Object*, ArrayWithPreallocation<ValueRead, 4>> valuesRead;
+    std::unordered_map<const heart::Statement*, uint32_t> valuesWritten;
+    std::vector<std::vector<uint32_t>> blockPhis, blockParameterValues;
+    std::unordered_set<const heart::Variable*> excludedVariables;
+
+    //==============================================================================
+    static const heart::Function& rebuildPredecessors (heart::Function& f)
+    {
+        f.rebuildBlockPredecessors();
+        return f;
+    }
+
+    static bool isCandidate (const heart::Variable& v)
+    {
+        if (v.type.isReference() || v.type.isVoid() || v.initialValue != nullptr)
+            return false;
+
+        return v.isFunctionLocal() || v.isParameter();
+    }
+
+    void addCandidate (heart::Variable& v)
+    {
+        if (isCandidate (v) && variableIndexes.find (std::addressof (v)) == variableIndexes.end())
+        {
+            variableIndexes[std::addressof (v)] = (uint32_t) variables.size();
+            variables.push_back ({ v, {} });
+        }
+    }
+
+    void exclude (pool_ptr<heart::Expression> e)
+    {
+        if (e != nullptr)
+            if (auto v = e->getRootVariable())
+                excludedVariables.insert (v.get());
+    }
+
+    void findVariables()
+    {
+        for (auto& p : function.parameters)
+            addCandidate (p);
+
+        for (auto& info : variables)
+            info.isFunctionParameter = true;
+
+        for (auto& b : dominators.blocks)
+        {
+            for (auto& p : b->parameters)
+                addCandidate (p);
+
+            for (auto s : b->statements)
+            {
+                if (auto a = cast<heart::Assignment> (*s))
+                {
+                    if (a->target != nullptr)
+                    {
+                        if (auto v = cast<heart::Variable> (a->target))
+                            addCandidate (*v);
+                        else
+                            exclude (a->target);
+                    }
+
+                    if (auto assign = cast<heart::AssignFromValue> (*s))
+                        if (a->target != nullptr && a->target->getType().isReference())
+                            exclude (assign->source);
+                }
+
+                if (auto call = cast<heart::FunctionCall> (*s))
+                {
+                    auto& params = call->getFunction().parameters;
+
+                    for (size_t i = 0; i < call->arguments.size(); ++i)
+                        if (i >= params.size() || params[i]->type.isReference())
+                            exclude (call->arguments[i]);
+                }
+
+                s->visitExpressions ([this] (pool_ref<heart::Expression>& e, AccessType)
+                {
+                    if (auto v = cast<heart::Variable> (e))
+                        addCandidate (*v);
+
+                    if (auto call = cast<heart::PureFunctionCall> (e))
+                        for (size_t i = 0; i < call->arguments.size(); ++i)
+                            if (i >= call->function.parameters.size() || call->function.parameters[i]->type.isReference())
+                                exclude (call->arguments[i]);
+                });
+            }
+
+            b->terminator->visitExpressions ([this] (pool_ref<heart::Expression>& e, AccessType)
+            {
+                if (auto v = cast<heart::Variable> (e))
+                    addCandidate (*v);
+            });
+        }
+
+        if (! excludedVariables.empty())
+        {
+            std::vector<VariableInfo> remaining;
+            variableIndexes.clear();
+
+            for (auto& info : variables)
+            {
+                if (excludedVariables.find (std::addressof (info.variable)) == excludedVariables.end())
+                {
+                    variableIndexes[std::addressof (info.variable)] = (uint32_t) remaining.size();
+                    remaining.push_back (std::move (info));
+                }
+            }
+
+            variables = std::move (remaining);
+        }
+    }
+
+    //==============================================================================
+    uint32_t addDefinition (DefinitionType type, heart::Variable& v, uint32_t block, pool_ptr<heart::Statement> statement)
+    {
+        auto index = (uint32_t) definitions.size();
+        definitions.push_back ({ type, v, block, statement, {} });
+
+        auto& info = variables[variableIndexes[std::addressof (v)]];
+
+        if (type == DefinitionType::phi)
+        {
+            ++info.numPhis;
+        }
+        else if (type != DefinitionType::entry || info.isFunctionParameter)
+        {
+            ++info.numDefinitions;
+            info.onlyDefinition = index;
+        }
+
+        return index;
+    }
+
+    void placePhis()
+    {
+        auto numBlocks = (uint32_t) dominators.size();
+        blockPhis.resize (numBlocks);
+        blockParameterValues.resize (numBlocks);
+
+        for (uint32_t i = 0; i < numBlocks; ++i)
+        {
+            auto& b = dominators.getBlock (i);
+
+            for (auto& p : b.parameters)
+                if (isTracked (p))
+                    variables[variableIndexes[p.getPointer()]].blocksWritten.push_back (i);
+
+            for (auto s : b.statements)
+                if (auto a = cast<heart::Assignment> (*s))
+                    if (auto v = cast<heart::Variable> (a->target))
+                        if (isTracked (*v))
+                            appendIfNotPresent (variables[variableIndexes[v.get()]].blocksWritten, i);
+        }
+
+        auto frontiers = dominators.getDominanceFrontiers();
+        std::vector<uint32_t> phiPlacedForVariable (numBlocks, noValue), queuedForVariable (numBlocks, noValue);
+
+        for (uint32_t varIndex = 0; varIndex < variables.size(); ++varIndex)
+        {
+            auto& info = variables[varIndex];
+            auto workList = info.blocksWritten;
+
+            for (auto b : workList)
+                queuedForVariable[b] = varIndex;
+
+            while (! workList.empty())
+            {
+                auto b = workList.back();
+                workList.pop_back();
+
+                for (auto frontierBlock : frontiers[b])
+                {
+                    if (phiPlacedForVariable[frontierBlock] != varIndex)
+                    {
+                        phiPlacedForVariable[frontierBlock] = varIndex;
+                        blockPhis[frontierBlock].push_back (addDefinition (DefinitionType::phi, info.variable, frontierBlock, {}));
+
+                        if (queuedForVariable[frontierBlock] != varIndex)
+                        {
+                            queuedForVariable[frontierBlock] = varIndex;
+                            workList.push_back (frontierBlock);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    //==============================================================================
+    void recordReads (const heart::Object& owner, const std::vector<std::vector<uint32_t>>& stacks,
+                      const std::function<void(heart::ExpressionVisitorFn)>& visitExpressions)
+    {
+        visitExpressions ([&] (pool_ref<heart::Expression>& e, AccessType mode)
+        {
+            if (mode == AccessType::write)
+                return;
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto index = variableIndexes.find (v.get());
+
+                if (index != variableIndexes.end())
+                {
+                    auto& reads = valuesRead[std::addressof (owner)];
+
+                    for (auto& r : reads)
+                        if (r.variable == v.get())
+                            return;
+
+                    reads.push_back ({ v.get(), stacks[index->second].back() });
+                }
+            }
+        });
+    }
+
+    void renameVariables()
+    {
+        std::vector<std::vector<uint32_t>> stacks (variables.size());
+
+        for (uint32_t i = 0; i < variables.size(); ++i)
+        {
+            variables[i].entryDefinition = addDefinition (DefinitionType::entry, variables[i].variable, 0, {});
+            stacks[i].push_back (variables[i].entryDefinition);
+        }
+
+        struct StackItem
+        {
+            uint32_t block;
+            bool isExit;
+        };
+
+        std::vector<StackItem> workStack { { 0, false } };
+        std::vector<std::vector<uint32_t>> variablesPushedInBlock (dominators.size());
+
+        while (! workStack.empty())
+        {
+            auto item = workStack.back();
+            workStack.pop_back();
+            auto& pushed = variablesPushedInBlock[item.block];
+
+            if (item.isExit)
+            {
+                for (auto v : pushed)
+                    stacks[v].pop_back();
+
+                continue;
+            }
+
+            auto pushDefinition = [&] (DefinitionType type, heart::Variable& v, pool_ptr<heart::Statement> s) -> uint32_t
+            {
+                auto varIndex = variableIndexes[std::addressof (v)];
+                auto def = addDefinition (type, v, item.block, s);
+                stacks[varIndex].push_back (def);
+                pushed.push_back (varIndex);
+                return def;
+            };
+
+            auto& block = dominators.getBlock (item.block);
+
+            for (auto phi : blockPhis[item.block])
+            {
+                auto varIndex = variableIndexes[std::addressof (definitions[phi].variable)];
+                stacks[varIndex].push_back (phi);
+                pushed.push_back (varIndex);
+            }
+
+            for (auto& p : block.parameters)
+            {
+                if (isTracked (p))
+                    blockParameterValues[item.block].push_back (pushDefinition (DefinitionType::blockParameter, p, {}));
+                else
+                    blockParameterValues[item.block].push_back (noValue);
+            }
+
+            for (auto s : block.statements)
+            {
+                recordReads (*s, stacks, [&] (heart::ExpressionVisitorFn fn) { s->visitExpressions (fn); });
+
+                if (auto a = cast<heart::Assignment> (*s))
+                    if (auto v = cast<heart::Variable> (a->target))
+                        if (isTracked (*v))
+                            valuesWritten[s] = pushDefinition (DefinitionType::statement, *v, *s);
+            }
+
+            recordReads (*block.terminator, stacks, [&] (heart::ExpressionVisitorFn fn) { block.terminator->visitExpressions (fn); });
+
+            for (auto& dest : block.terminator->getDestinationBlocks())
+            {
+                auto destIndex = dominators.getIndex (dest);
+                auto& preds = dest->predecessors;
+
+                for (auto phi : blockPhis[destIndex])
+                {
+                    auto& phiDef = definitions[phi];
+                    phiDef.phiOperands.resize (preds.size(), noValue);
+                    auto varIndex = variableIndexes[std::addressof (phiDef.variable)];
+
+                    for (size_t i = 0; i < preds.size(); ++i)
+                        if (preds[i] == block)
+                            phiDef.phiOperands[i] = stacks[varIndex].back();
+                }
+            }
+
+            workStack.push_back ({ item.block, true });
+
+            auto& children = dominators.getChildren (item.block);
+
+            for (auto i = children.size(); i > 0; --i)
+                workStack.push_back ({ children[i - 1], false });
+        }
+
+        // Any predecessors that can't be reached just pass in the entry value
+        for (auto& phis : blockPhis)
+        {
+            for (auto phi : phis)
+            {
+                auto& phiDef = definitions[phi];
+                auto& preds = dominators.getBlock (phiDef.block).predecessors;
+                phiDef.phiOperands.resize (preds.size(), noValue);
+
+                for (auto& operand : phiDef.phiOperands)
+                    if (operand == noValue)
+                        operand = variables[variableIndexes[std::addressof (phiDef.variable)]].entryDefinition;
+            }
+        }
+
+        for (auto& reads : valuesRead)
+        {
+            for (auto& r : reads.second)
+            {
+                auto& info = variables[variableIndexes[r.variable]];
+
+                if (definitions[r.value].type == DefinitionType::entry && ! info.isFunctionParameter)
+                    info.hasUninitialisedRead = true;
+            }
+        }
+    }
+};
+
+}
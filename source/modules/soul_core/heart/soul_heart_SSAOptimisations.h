@@ -0,0 +1,941 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+
+//==============================================================================
+/**
+    Optimisation passes which use an SSAForm of each function.
+
+    The passes that run depend on the optimisation level:
+     - level 1: sparse conditional constant propagation and copy propagation
+     - level 2: as level 1, plus global value numbering
+     - level 3: as level 2, but repeated until the passes stop finding anything to change
+
+    Level 0 disables them all, and -1 (the default) is treated as level 2.
+*/
+struct SSAOptimisations
+{
+    static constexpr int maxOptimisationRounds = 4;
+
+    static void optimise (Program& program, const BuildSettings& settings)
+    {
+        auto level = Optimisations::getOptimisationLevel (settings);
+
+        if (level == 0)
+            return;
+
+        auto maxRounds = level >= 3 ? maxOptimisationRounds : 1;
+
+        for (int round = 0; round < maxRounds; ++round)
+        {
+            std::atomic<bool> anyChanged { false };
+
+            Optimisations::forEachFunctionInParallel (program, settings, [&] (heart::Function& f, heart::Allocator& allocator)
+            {
+                if (optimise (f, allocator, level))
+                {
+                    Optimisations::optimiseFunctionBlocks (f, allocator);
+                    anyChanged = true;
+                }
+            });
+
+            if (! anyChanged)
+                break;
+        }
+    }
+
+    /** Runs the passes for the given level on a single function, returning true if anything changed. */
+    static bool optimise (heart::Function& f, heart::Allocator& allocator, int level)
+    {
+        if (f.hasNoBody || f.blocks.empty())
+            return false;
+
+        bool changed = false;
+
+        if (level >= 1)
+        {
+            changed = propagateConstants (f, allocator) || changed;
+            changed = propagateCopies (f) || changed;
+        }
+
+        if (level >= 2 && numberValues (f))
+        {
+            propagateCopies (f);
+            changed = true;
+        }
+
+        return changed;
+    }
+
+    //==============================================================================
+    /** Replaces reads of variables whose value is known to be constant, and turns any
+        conditional branches whose condition is constant into plain branches.
+    */
+    static bool propagateConstants (heart::Function& f, heart::Allocator& allocator)
+    {
+        SSAForm ssa (f);
+        return ssa.isValid && ConstantPropagation (ssa, allocator).perform();
+    }
+
+    /** Where a variable is a copy of another one which doesn't change, this replaces
+        reads of the copy with reads of the original.
+    */
+    static bool propagateCopies (heart::Function& f)
+    {
+        SSAForm ssa (f);
+
+        if (! ssa.isValid)
+            return false;
+
+        // These need to be found before anything is modified, as the chains of copies get shorter as it goes
+        std::vector<pool_ptr<heart::Variable>> originals;
+        originals.reserve (ssa.definitions.size());
+
+        for (uint32_t i = 0; i < ssa.definitions.size(); ++i)
+            originals.push_back (findOriginalOfCopy (ssa, i));
+
+        bool changed = false;
+
+        forEachReachableStatementAndTerminator (ssa, [&] (const heart::Object& owner, const ReplacementVisitor& visit)
+        {
+            changed = visit ([&] (heart::Variable& v, bool) -> pool_ptr<heart::Expression>
+            {
+                auto value = ssa.getValueRead (owner, v);
+
+                if (value == SSAForm::noValue)
+                    return {};
+
+                auto original = originals[value];
+
+                if (original == nullptr || original.get() == std::addressof (v) || ! original->type.isEqual (v.type, Type::ignoreConst))
+                    return {};
+
+                return original;
+            }) || changed;
+        });
+
+        return changed;
+    }
+
+    /** Finds assignments which calculate a value that's already held by a variable which
+        dominates them, and replaces their source with that variable.
+    */
+    static bool numberValues (heart::Function& f)
+    {
+        SSAForm ssa (f);
+        return ssa.isValid && ValueNumbering (ssa).perform();
+    }
+
+private:
+    //==============================================================================
+    using ReplacementFn = std::function<pool_ptr<heart::Expression>(heart::Variable&, bool canBeConstant)>;
+    using ReplacementVisitor = std::function<bool(const ReplacementFn&)>;
+
+    /** Calls the replacement function for each variable that an expression reads, and
+        substitutes any expression it returns. Variables which are used as the parent of
+        an array or struct element, or directly as an index, are passed with canBeConstant
+        = false: the back-ends range-check constant indexes rather than wrapping them.
+    */
+    static bool replaceReads (pool_ref<heart::Expression>& e, const ReplacementFn& replace, bool canBeConstant)
+    {
+        if (auto v = cast<heart::Variable> (e))
+        {
+            if (auto replacement = replace (*v, canBeConstant))
+            {
+                e = *replacement;
+                return true;
+            }
+
+            return false;
+        }
+
+        if (auto a = cast<heart::ArrayElement> (e))
+        {
+            auto changed = replaceReadsInIndex (a->dynamicIndex, replace);
+            return replaceReads (a->parent, replace, false) || changed;
+        }
+
+        if (auto s = cast<heart::StructElement> (e))
+            return replaceReads (s->parent, replace, false);
+
+        if (auto c = cast<heart::TypeCast> (e))
+            return replaceReads (c->source, replace, true);
+
+        if (auto u = cast<heart::UnaryOperator> (e))
+            return replaceReads (u->source, replace, true);
+
+        if (auto b = cast<heart::BinaryOperator> (e))
+        {
+            auto changed = replaceReads (b->lhs, replace, true);
+            return replaceReads (b->rhs, replace, true) || changed;
+        }
+
+        if (auto call = cast<heart::PureFunctionCall> (e))
+            return replaceReads (call->arguments, call->function.parameters, replace);
+
+        if (auto list = cast<heart::AggregateInitialiserList> (e))
+        {
+            bool changed = false;
+
+            for (auto& item : list->items)
+                changed = replaceReads (item, replace, true) || changed;
+
+            return changed;
+        }
+
+        return false;
+    }
+
+    static bool replaceReadsInIndex (pool_ptr<heart::Expression>& index, const ReplacementFn& replace)
+    {
+        if (index == nullptr)
+            return false;
+
+        auto ref = index.getAsPoolRef();
+        auto changed = replaceReads (ref, replace, false);
+        index = ref;
+        return changed;
+    }
+
+    template <typename ArgList, typename ParameterList>
+    static bool replaceReads (ArgList& arguments, const ParameterList& parameters, const ReplacementFn& replace)
+    {
+        bool changed = false;
+
+        for (size_t i = 0; i < arguments.size(); ++i)
+            if (i < parameters.size() && ! parameters[i]->type.isReference())
+                changed = replaceReads (arguments[i], replace, true) || changed;
+
+        return changed;
+    }
+
+    /** Replaces the reads within an assignment target, e.g. the index in x[i] = 0 */
+    static bool replaceReadsInTarget (heart::Expression& target, const ReplacementFn& replace)
+    {
+        if (auto a = cast<heart::ArrayElement> (target))
+        {
+            auto changed = replaceReadsInIndex (a->dynamicIndex, replace);
+            return replaceReadsInTarget (a->parent, replace) || changed;
+        }
+
+        if (auto s = cast<heart::StructElement> (target))
+            return replaceReadsInTarget (s->parent, replace);
+
+        return false;
+    }
+
+    static bool replaceReads (heart::Statement& s, const ReplacementFn& replace)
+    {
+        bool changed = false;
+
+        if (auto a = cast<heart::Assignment> (s))
+            if (a->target != nullptr)
+                changed = replaceReadsInTarget (*a->target, replace);
+
+        if (auto a = cast<heart::AssignFromValue> (s))
+            return replaceReads (a->source, replace, true) || changed;
+
+        if (auto call = cast<heart::FunctionCall> (s))
+            return replaceReads (call->arguments, call->getFunction().parameters, replace) || changed;
+
+        if (auto w = cast<heart::WriteStream> (s))
+        {
+            changed = replaceReadsInIndex (w->element, replace);
+            return replaceReads (w->value, replace, true) || changed;
+        }
+
+        return changed;
+    }
+
+    static bool replaceReads (heart::Terminator& t, const ReplacementFn& replace)
+    {
+        bool changed = false;
+
+        if (auto b = cast<heart::Branch> (t))
+            for (auto& arg : b->targetArgs)
+                changed = replaceReads (arg, replace, true) || changed;
+
+        if (auto b = cast<heart::BranchIf> (t))
+        {
+            changed = replaceReads (b->condition, replace, true);
+
+            for (auto& args : b->targetArgs)
+                for (auto& arg : args)
+                    changed = replaceReads (arg, replace, true) || changed;
+        }
+
+        if (auto r = cast<heart::ReturnValue> (t))
+            changed = replaceReads (r->returnValue, replace, true);
+
+        return changed;
+    }
+
+    template <typename VisitorFn>
+    static void forEachReachableStatementAndTerminator (SSAForm& ssa, VisitorFn&& visit)
+    {
+        for (auto& b : ssa.dominators.blocks)
+        {
+            for (auto s : b->statements)
+                visit (*s, [&] (const ReplacementFn& replace) { return replaceReads (*s, replace); });
+
+            auto& terminator = *b->terminator;
+            visit (terminator, [&] (const ReplacementFn& replace) { return replaceReads (terminator, replace); });
+        }
+    }
+
+    /** If a value is a copy of a variable which only ever holds one value, this returns
+        that variable, following any chain of copies back to the first one. The chain stops
+        at a block parameter, as that's only in scope inside its own block.
+    */
+    static pool_ptr<heart::Variable> findOriginalOfCopy (const SSAForm& ssa, uint32_t value)
+    {
+        pool_ptr<heart::Variable> original;
+
+        while (value != SSAForm::noValue)
+        {
+            auto source = cast<heart::Variable> (ssa.getAssignedExpression (value));
+
+            if (source == nullptr)
+                break;
+
+            auto sourceValue = ssa.getOnlyValue (*source);
+
+            if (sourceValue == SSAForm::noValue
+                 || ssa.definitions[sourceValue].type == SSAForm::DefinitionType::blockParameter
+                 || sourceValue != ssa.getValueRead (*ssa.definitions[value].statement, *source))
+                break;
+
+            original = source;
+            value = sourceValue;
+        }
+
+        return original;
+    }
+
+    // Vectors are left alone, as the operators can't fold them if they end up with constant operands
+    static bool canBeReplacedByConstant (const Value& value, const heart::Variable& v)
+    {
+        auto& type = value.getType();
+        return type.isPrimitive() && ! type.isStringLiteral() && type.isEqual (v.type, Type::ignoreConst);
+    }
+
+    //==============================================================================
+    struct ConstantPropagation
+    {
+        ConstantPropagation (SSAForm& s, heart::Allocator& a)
+            : ssa (s), allocator (a), values (s.definitions.size()),
+              blockIsExecutable (s.dominators.size(), false),
+              edgeIsExecutable (s.dominators.size()),
+              forceAllEdges (s.dominators.size(), false)
+        {
+            for (uint32_t i = 0; i < ssa.dominators.size(); ++i)
+                edgeIsExecutable[i].resize (ssa.dominators.getBlock (i).predecessors.size(), false);
+
+            for (uint32_t i = 0; i < ssa.definitions.size(); ++i)
+                if (ssa.definitions[i].type == SSAForm::DefinitionType::entry)
+                    values[i].state = LatticeValue::State::varying;
+        }
+
+        bool perform()
+        {
+            for (;;)
+            {
+                solve();
+
+                // If a condition still has no value, it can only depend on something which can't be
+                // resolved, so both paths have to be assumed to be possible
+                bool anyForced = false;
+
+                for (uint32_t i = 0; i < ssa.dominators.size(); ++i)
+                {
+                    if (blockIsExecutable[i] && ! forceAllEdges[i])
+                    {
+                        if (auto b = cast<heart::BranchIf> (ssa.dominators.getBlock (i).terminator))
+                        {
+                            if (evaluate (b->condition, *b).state == LatticeValue::State::unknown)
+                            {
+                                forceAllEdges[i] = true;
+                                anyForced = true;
+                            }
+                        }
+                    }
+                }
+
+                if (! anyForced)
+                    break;
+            }
+
+            return rewrite();
+        }
+
+    private:
+        struct LatticeValue
+        {
+            enum class State { unknown, constant, varying };
+
+            State state = State::unknown;
+            Value value;
+
+            static LatticeValue varying()                   { return { State::varying, {} }; }
+            static LatticeValue constant (Value v)          { return { State::constant, std::move (v) }; }
+
+            bool isConstant() const                         { return state == State::constant; }
+            bool isVarying() const                          { return state == State::varying; }
+
+            bool operator== (const LatticeValue& other) const
+            {
+                return state == other.state && (state != State::constant || value == other.value);
+            }
+
+            bool operator!= (const LatticeValue& other) const  { return ! operator== (other); }
+
+            LatticeValue meet (const LatticeValue& other) const
+            {
+                if (state == State::unknown)        return other;
+                if (other.state == State::unknown)  return *this;
+
+                if (isConstant() && other.isConstant() && value == other.value)
+                    return *this;
+
+                return varying();
+            }
+        };
+
+        SSAForm& ssa;
+        heart::Allocator& allocator;
+        std::vector<LatticeValue> values;
+        std::vector<bool> blockIsExecutable;
+        std::vector<std::vector<bool>> edgeIsExecutable;
+        std::vector<bool> forceAllEdges;
+
+        //==============================================================================
+        void solve()
+        {
+            blockIsExecutable[0] = true;
+
+            for (bool anyChanged = true; anyChanged;)
+            {
+                anyChanged = false;
+
+                for (uint32_t i = 0; i < ssa.dominators.size(); ++i)
+                    if (blockIsExecutable[i])
+                        anyChanged = visitBlock (i) || anyChanged;
+            }
+        }
+
+        bool update (uint32_t definition, const LatticeValue& newValue)
+        {
+            auto& current = values[definition];
+
+            // Values can only move down the lattice, so merge the new one with what's already known
+            auto merged = current.meet (newValue);
+
+            if (merged == current)
+                return false;
+
+            current = std::move (merged);
+            return true;
+        }
+
+        bool visitBlock (uint32_t blockIndex)
+        {
+            auto& block = ssa.dominators.getBlock (blockIndex);
+            auto& preds = block.predecessors;
+            bool changed = false;
+
+            for (auto phi : ssa.getPhis (blockIndex))
+            {
+                LatticeValue result;
+
+                for (size_t i = 0; i < preds.size(); ++i)
+                    if (edgeIsExecutable[blockIndex][i])
+                        result = result.meet (values[ssa.definitions[phi].phiOperands[i]]);
+
+                changed = update (phi, result) || changed;
+            }
+
+            auto& parameterValues = ssa.getParameterValues (blockIndex);
+
+            for (size_t paramIndex = 0; paramIndex < parameterValues.size(); ++paramIndex)
+            {
+                if (parameterValues[paramIndex] == SSAForm::noValue)
+                    continue;
+
+                LatticeValue result;
+
+                for (size_t i = 0; i < preds.size(); ++i)
+                    if (edgeIsExecutable[blockIndex][i])
+                        result = result.meet (evaluateBlockArgument (preds[i], block, paramIndex));
+
+                changed = update (parameterValues[paramIndex], result) || changed;
+            }
+
+            for (auto s : block.statements)
+            {
+                auto written = ssa.getValueWritten (*s);
+
+                if (written != SSAForm::noValue)
+                {
+                    auto result = LatticeValue::varying();
+
+                    if (auto a = cast<heart::AssignFromValue> (*s))
+                        result = evaluate (a->source, *s);
+
+                    if (result.isConstant() && ! canBeReplacedByConstant (result.value, ssa.definitions[written].variable))
+                        result = LatticeValue::varying();
+
+                    changed = update (written, result) || changed;
+                }
+            }
+
+            auto& terminator = *block.terminator;
+
+            if (auto b = cast<heart::BranchIf> (terminator))
+            {
+                auto condition = evaluate (b->condition, terminator);
+
+                if (forceAllEdges[blockIndex] || condition.isVarying())
+                {
+                    changed = markEdgeExecutable (block, b->targets[0]) || changed;
+                    changed = markEdgeExecutable (block, b->targets[1]) || changed;
+                }
+                else if (condition.isConstant())
+                {
+                    changed = markEdgeExecutable (block, b->targets[condition.value.getAsBool() ? 0 : 1]) || changed;
+                }
+            }
+            else
+            {
+                for (auto& dest : terminator.getDestinationBlocks())
+                    changed = markEdgeExecutable (block, dest) || changed;
+            }
+
+            return changed;
+        }
+
+        bool markEdgeExecutable (heart::Block& source, heart::Block& dest)
+        {
+            auto destIndex = ssa.dominators.getIndex (dest);
+            auto& preds = dest.predecessors;
+            bool changed = false;
+
+            for (size_t i = 0; i < preds.size(); ++i)
+            {
+                if (preds[i] == source && ! edgeIsExecutable[destIndex][i])
+                {
+                    edgeIsExecutable[destIndex][i] = true;
+                    changed = true;
+                }
+            }
+
+            if (! blockIsExecutable[destIndex])
+            {
+                blockIsExecutable[destIndex] = true;
+                changed = true;
+            }
+
+            return changed;
+        }
+
+        LatticeValue evaluateBlockArgument (heart::Block& source, heart::Block& dest, size_t paramIndex)
+        {
+            if (auto b = cast<heart::Branch> (source.terminator))
+                if (b->target == dest && paramIndex < b->targetArgs.size())
+                    return evaluate (b->targetArgs[paramIndex], *b);
+
+            return LatticeValue::varying();
+        }
+
+        LatticeValue evaluate (heart::Expression& e, const heart::Object& owner)
+        {
+            if (auto c = cast<heart::Constant> (e))
+                return LatticeValue::constant (c->value);
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto value = ssa.getValueRead (owner, *v);
+                return value != SSAForm::noValue ? values[value] : LatticeValue::varying();
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                auto lhs = evaluate (b->lhs, owner);
+                auto rhs = evaluate (b->rhs, owner);
+
+                if (lhs.isVarying() || rhs.isVarying())
+                    return LatticeValue::varying();
+
+                if (! (lhs.isConstant() && rhs.isConstant()))
+                    return {};
+
+                // Anything that would fail at runtime (e.g. a division by zero) is left alone
+                if (canBeFolded (lhs) && canBeFolded (rhs)
+                     && BinaryOp::apply (lhs.value, rhs.value, b->operation, [] (CompileMessage) {}))
+                    return checkType (std::move (lhs.value), e);
+
+                return LatticeValue::varying();
+            }
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                auto source = evaluate (u->source, owner);
+
+                if (source.isConstant())
+                {
+                    if (canBeFolded (source) && UnaryOp::apply (source.value, u->operation))
+                        return checkType (std::move (source.value), e);
+
+                    return LatticeValue::varying();
+                }
+
+                return source;
+            }
+
+            if (auto c = cast<heart::TypeCast> (e))
+            {
+                auto source = evaluate (c->source, owner);
+
+                if (source.isConstant())
+                    return canBeFolded (source) ? checkType (source.value.tryCastToType (c->destType), e)
+                                                : LatticeValue::varying();
+
+                return source;
+            }
+
+            return LatticeValue::varying();
+        }
+
+        /** The operators only know how to fold primitive values */
+        static bool canBeFolded (const LatticeValue& v)
+        {
+            return v.value.getType().isPrimitive();
+        }
+
+        static LatticeValue checkType (Value v, const heart::Expression& e)
+        {
+            if (v.isValid() && v.getType().isEqual (e.getType(), Type::ignoreConst))
+                return LatticeValue::constant (std::move (v));
+
+            return LatticeValue::varying();
+        }
+
+        //==============================================================================
+        bool rewrite()
+        {
+            bool changed = false;
+
+            for (uint32_t blockIndex = 0; blockIndex < ssa.dominators.size(); ++blockIndex)
+            {
+                if (! blockIsExecutable[blockIndex])
+                    continue;
+
+                auto& block = ssa.dominators.getBlock (blockIndex);
+
+                auto replaceWithConstant = [&] (const heart::Object& owner)
+                {
+                    return [this, &owner] (heart::Variable& v, bool canBeConstant) -> pool_ptr<heart::Expression>
+                    {
+                        if (canBeConstant)
+                        {
+                            auto value = ssa.getValueRead (owner, v);
+
+                            if (value != SSAForm::noValue && values[value].isConstant()
+                                 && canBeReplacedByConstant (values[value].value, v))
+                                return allocator.allocate<heart::Constant> (v.location, values[value].value);
+                        }
+
+                        return {};
+                    };
+                };
+
+                for (auto s : block.statements)
+                    changed = replaceReads (*s, replaceWithConstant (*s)) || changed;
+
+                auto& terminator = *block.terminator;
+
+                if (auto b = cast<heart::BranchIf> (terminator))
+                {
+                    if (! (b->isParameterised() || forceAllEdges[blockIndex]))
+                    {
+                        auto condition = evaluate (b->condition, terminator);
+
+                        if (condition.isConstant())
+                        {
+                            block.terminator = allocator.allocate<heart::Branch> (b->targets[condition.value.getAsBool() ? 0 : 1]);
+                            changed = true;
+                            continue;
+                        }
+                    }
+                }
+
+                changed = replaceReads (terminator, replaceWithConstant (terminator)) || changed;
+            }
+
+            return changed;
+        }
+    };
+
+    //==============================================================================
+    struct ValueNumbering
+    {
+        ValueNumbering (SSAForm& s) : ssa (s) {}
+
+        bool perform()
+        {
+            struct StackItem
+            {
+                uint32_t block;
+                bool isExit;
+            };
+
+            std::vector<StackItem> workStack { { 0, false } };
+            std::vector<std::vector<std::string>> keysAddedInBlock (ssa.dominators.size());
+            bool changed = false;
+
+            while (! workStack.empty())
+            {
+                auto item = workStack.back();
+                workStack.pop_back();
+
+                if (item.isExit)
+                {
+                    for (auto& key : keysAddedInBlock[item.block])
+                        availableValues.erase (key);
+
+                    continue;
+                }
+
+                changed = visitBlock (ssa.dominators.getBlock (item.block), keysAddedInBlock[item.block]) || changed;
+                workStack.push_back ({ item.block, true });
+
+                auto& children = ssa.dominators.getChildren (item.block);
+
+                for (auto i = children.size(); i > 0; --i)
+                    workStack.push_back ({ children[i - 1], false });
+            }
+
+            return changed;
+        }
+
+    private:
+        struct AvailableValue
+        {
+            heart::Variable& variable;
+            uint32_t value;
+        };
+
+        SSAForm& ssa;
+        std::unordered_map<std::string, AvailableValue> availableValues;
+
+        // Reads of anything that isn't tracked are only matched within a run of statements
+        // which can't have modified it, which is identified by this number
+        uint64_t memoryEpoch = 0;
+
+        bool visitBlock (heart::Block& block, std::vector<std::string>& keysAdded)
+        {
+            bool changed = false;
+            ++memoryEpoch;
+
+            for (auto s : block.statements)
+            {
+                auto a = cast<heart::AssignFromValue> (*s);
+                auto written = ssa.getValueWritten (*s);
+
+                if (a == nullptr || written == SSAForm::noValue || a->source->mayHaveSideEffects())
+                {
+                    ++memoryEpoch;
+                    continue;
+                }
+
+                if (is_type<heart::Variable> (a->source) || is_type<heart::Constant> (a->source))
+                    continue;
+
+                std::string key;
+
+                if (! appendKey (key, a->source, *s))
+                    continue;
+
+                auto& target = ssa.definitions[written].variable;
+                auto existing = availableValues.find (key);
+
+                if (existing != availableValues.end())
+                {
+                    auto& available = existing->second;
+
+                    if (ssa.getOnlyValue (available.variable) == available.value
+                         && available.variable.type.isEqual (target.type, Type::ignoreConst)
+                         && std::addressof (available.variable) != std::addressof (target))
+                    {
+                        a->source = available.variable;
+                        changed = true;
+                    }
+                }
+                else if (ssa.getOnlyValue (target) == written)
+                {
+                    availableValues.insert ({ key, { target, written } });
+                    keysAdded.push_back (std::move (key));
+                }
+            }
+
+            return changed;
+        }
+
+        bool appendKey (std::string& key, heart::Expression& e, const heart::Object& owner) const
+        {
+            if (auto c = cast<heart::Constant> (e))
+            {
+                auto& type = c->value.getType();
+
+                if (! type.isPrimitiveOrVector() || type.isStringLiteral())
+                    return false;
+
+                key += "c" + type.getDescription() + ":";
+                auto data = static_cast<const uint8_t*> (c->value.getPackedData());
+
+                for (size_t i = 0; i < c->value.getPackedDataSize(); ++i)
+                    key += choc::text::createHexString (data[i], 2);
+
+                return true;
+            }
+
+            if (auto v = cast<heart::Variable> (e))
+            {
+                auto value = ssa.getValueRead (owner, *v);
+
+                if (value != SSAForm::noValue)
+                    key += "v" + std::to_string (value);
+                else if (ssa.isTracked (*v))
+                    return false;
+                else
+                    key += "m" + std::to_string (reinterpret_cast<uintptr_t> (v.get())) + "@" + std::to_string (memoryEpoch);
+
+                return true;
+            }
+
+            if (auto b = cast<heart::BinaryOperator> (e))
+            {
+                key += "b" + std::to_string (static_cast<int> (b->operation)) + "(";
+
+                if (! appendKey (key, b->lhs, owner))
+                    return false;
+
+                key += ",";
+
+                if (! appendKey (key, b->rhs, owner))
+                    return false;
+
+                key += ")";
+                return true;
+            }
+
+            if (auto u = cast<heart::UnaryOperator> (e))
+            {
+                key += "u" + std::to_string (static_cast<int> (u->operation)) + "(";
+
+                if (! appendKey (key, u->source, owner))
+                    return false;
+
+                key += ")";
+                return true;
+            }
+
+            if (auto c = cast<heart::TypeCast> (e))
+            {
+                key += "t" + c->destType.getDescription() + "(";
+
+                if (! appendKey (key, c->source, owner))
+                    return false;
+
+                key += ")";
+                return true;
+            }
+
+            if (auto a = cast<heart::ArrayElement> (e))
+            {
+                key += "a(";
+
+                if (! appendKey (key, a->parent, owner))
+                    return false;
+
+                if (a->isDynamic())
+                {
+                    key += ",";
+
+                    if (! appendKey (key, *a->dynamicIndex, owner))
+                        return false;
+
+                    key += a->isRangeTrusted ? ",t" : ",w";
+                }
+                else
+                {
+                    key += "," + std::to_string (a->fixedStartIndex) + ":" + std::to_string (a->fixedEndIndex);
+                }
+
+                key += ")";
+                return true;
+            }
+
+            if (auto s = cast<heart::StructElement> (e))
+            {
+                key += "s(";
+
+                if (! appendKey (key, s->parent, owner))
+                    return false;
+
+                key += "," + s->memberName + ")";
+                return true;
+            }
+
+            if (auto call = cast<heart::PureFunctionCall> (e))
+            {
+                if (call->function.mayHaveSideEffects())
+                    return false;
+
+                key += "f" + std::to_string (reinterpret_cast<uintptr_t> (std::addressof (call->function))) + "(";
+
+                for (auto& arg : call->arguments)
+                {
+                    if (! appendKey (key, arg, owner))
+                        return false;
+
+                    key += ",";
+                }
+
+                key += ")";
+                return true;
+            }
+
+            if (auto p = cast<heart::ProcessorProperty> (e))
+            {
+                if (p->canChangeBetweenFrames())
+                    return false;
+
+                key += "p" + std::to_string (static_cast<int> (p->property));
+                return true;
+            }
+
+            return false;
+        }
+    };
+};
+
+}
@@ -169,6 +169,42 @@ struct heart::Utilities
         return false;
     }
 
+    /** Returns true if any function reads, writes or advances more than one frame at a time,
+        or uses the processor.framesAvailable property.
+    */
+    static bool usesMultiFrameStreamAccess (const Program& program)
+    {
+        for (auto& m : program.getModules())
+        {
+            for (auto& f : m->functions.get())
+            {
+                bool found = false;
+
+                f->visitExpressions ([&] (pool_ref<Expression>& value, AccessType)
+                {
+                    if (auto p = cast<ProcessorProperty> (value))
+                        if (p->canChangeBetweenFrames())
+                            found = true;
+                });
+
+                for (auto& b : f->blocks)
+                {
+                    for (auto s : b->statements)
+                    {
+                        if (auto r = cast<ReadStream> (*s))    found = found || r->numFrames != 1;
+                        if (auto w = cast<WriteStream> (*s))   found = found || w->numFrames != 1;
+                        if (auto a = cast<AdvanceClock> (*s))  found = found || a->numFrames != 1;
+                    }
+                }
+
+                if (found)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
     static bool canFunctionBeInlined (Program& program,
                                       Function& parentFunction,
                                       FunctionCall& call)
@@ -294,6 +330,48 @@ struct heart::Utilities
                 dest = newDest;
     }
 
+    /** Makes a copy of an expression tree. Variables, constants and processor properties
+        are shared rather than copied.
+    */
+    static Expression& cloneExpression (Allocator& allocator, Expression& e)
+    {
+        if (auto b = cast<BinaryOperator> (e))
+            return allocator.allocate<BinaryOperator> (b->location, cloneExpression (allocator, b->lhs),
+                                                       cloneExpression (allocator, b->rhs), b->operation);
+
+        if (auto u = cast<UnaryOperator> (e))
+            return allocator.allocate<UnaryOperator> (u->location, cloneExpression (allocator, u->source), u->operation);
+
+        if (auto c = cast<TypeCast> (e))
+            return allocator.allocate<TypeCast> (c->location, cloneExpression (allocator, c->source), c->destType);
+
+        if (auto a = cast<ArrayElement> (e))
+        {
+            auto& parent = cloneExpression (allocator, a->parent);
+            auto& element = a->isDynamic() ? allocator.allocate<ArrayElement> (a->location, parent, cloneExpression (allocator, *a->dynamicIndex))
+                                           : allocator.allocate<ArrayElement> (a->location, parent, a->fixedStartIndex, a->fixedEndIndex);
+            element.isRangeTrusted = a->isRangeTrusted;
+            element.suppressWrapWarning = a->suppressWrapWarning;
+            return element;
+        }
+
+        if (auto s = cast<StructElement> (e))
+            return allocator.allocate<StructElement> (s->location, cloneExpression (allocator, s->parent), s->memberName);
+
+        if (auto call = cast<PureFunctionCall> (e))
+        {
+            auto& newCall = allocator.allocate<PureFunctionCall> (call->location, call->function);
+
+            for (auto& arg : call->arguments)
+                newCall.arguments.push_back (cloneExpression (allocator, arg));
+
+            return newCall;
+        }
+
+        SOUL_ASSERT (is_type<Variable> (e) || is_type<Constant> (e) || is_type<ProcessorProperty> (e));
+        return e;
+    }
+
     static bool areAllTerminatorsUnconditional (choc::span<pool_ref<Block>> blocks)
     {
         for (auto b : blocks)
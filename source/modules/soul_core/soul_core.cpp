@@ -33,6 +33,8 @@
 #include <cctype>
 #include <cwctype>
 #include <future>
+#include <filesystem>
+#include <deque>
 
 #include "soul_core.h"
 
@@ -50,6 +52,29 @@
  #include <AvailabilityMacros.h>
 #endif
 
+#ifdef WIN32
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #include <windows.h>
+#else
+ #include <dlfcn.h>
+ #include <fcntl.h>
+ #include <pthread.h>
+ #include <spawn.h>
+ #include <unistd.h>
+ #include <sys/stat.h>
+ #include <sys/wait.h>
+
+ #ifdef __APPLE__
+  #include <crt_externs.h>
+  #include <mach/mach.h>
+  #define environ (*_NSGetEnviron())
+ #else
+  extern char** environ;
+ #endif
+#endif
+
 #define SOUL_INSIDE_CORE_CPP 1
 #define printf NO_PRINTFS_TODAY_THANKYOU
 
@@ -67,6 +92,7 @@
 #include "utilities/soul_MiscUtilities.cpp"
 #include "utilities/soul_AudioDataGeneration.cpp"
 #include "utilities/soul_AudioFiles.cpp"
+#include "utilities/soul_Resampler.cpp"
 #include "types/soul_Struct.cpp"
 #include "types/soul_StringDictionary.cpp"
 #include "types/soul_ConstantTable.cpp"
@@ -76,12 +102,14 @@
 #include "types/soul_EndpointType.cpp"
 #include "heart/soul_heart_Printer.h"
 #include "heart/soul_heart_Parser.h"
+#include "heart/soul_heart_BinaryFormat.h"
 #include "heart/soul_heart_Checker.cpp"
 #include "types/soul_Type.cpp"
 #include "compiler/soul_StandardLibrary.h"
 #include "compiler/soul_ASTVisitor.h"
 #include "compiler/soul_SanityCheckPass.h"
 #include "compiler/soul_Parser.h"
+#include "compiler/soul_ASTCloner.h"
 #include "compiler/soul_ResolutionPass.h"
 #include "compiler/soul_ConvertComplexPass.h"
 #include "compiler/soul_HeartGenerator.h"
@@ -92,10 +120,14 @@
 #include "heart/soul_Module.cpp"
 #include "heart/soul_Program.cpp"
 #include "venue/soul_RenderingVenue.cpp"
+#include "venue/soul_Interpreter.cpp"
+#include "venue/soul_TieredPerformer.cpp"
 #include "diagnostics/soul_CodeLocation.cpp"
 #include "diagnostics/soul_Logging.cpp"
 #include "diagnostics/soul_CompileMessageList.cpp"
 #include "diagnostics/soul_Timing.cpp"
+#include "diagnostics/soul_CompileProfiler.cpp"
+#include "diagnostics/soul_RenderProfiler.cpp"
 #include "venue/soul_Endpoints.cpp"
 #include "test/soul_TestFileParser.cpp"
 
@@ -106,6 +138,7 @@
 
 #include "code_generation/soul_CPPGenerator_resources.h"
 #include "code_generation/soul_CPPGenerator.cpp"
+#include "code_generation/soul_CPPPerformer.cpp"
 #include "code_generation/soul_JUCEProjectGenerator.cpp"
 #include "code_generation/soul_PatchGenerator.cpp"
 
@@ -28,6 +28,7 @@
   description:      Fundamental SOUL classes for compiling SOUL code into a Program object
   website:          https://soul.dev/
   license:          ISC
+  linuxLibs:        dl
 
  END_JUCE_MODULE_DECLARATION
 *******************************************************************************/
@@ -51,9 +52,12 @@
 #include <sstream>
 #include <array>
 #include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <functional>
 #include <mutex>
+#include <thread>
+#include <future>
 #include <memory>
 #include <cstring>
 #include <cmath>
@@ -78,6 +82,7 @@
 #include "../../../include/soul/3rdParty/choc/audio/choc_SampleBuffers.h"
 #include "../../../include/soul/3rdParty/choc/text/choc_CodePrinter.h"
 #include "../../../include/soul/3rdParty/choc/containers/choc_DirtyList.h"
+#include "../../../include/soul/3rdParty/choc/containers/choc_SingleReaderSingleWriterFIFO.h"
 #include "../../../include/soul/3rdParty/choc/containers/choc_VariableSizeFIFO.h"
 #include "../../../include/soul/3rdParty/choc/containers/choc_PoolAllocator.h"
 #include "../../../include/soul/common/soul_ProgramDefinitions.h"
@@ -90,6 +95,7 @@ namespace soul
 {
     static inline constexpr Version getLibraryVersion()                   { return { 1, 0, 0 }; }
     static inline constexpr int64_t getHEARTFormatVersion()               { return 1; }
+    static inline constexpr int64_t getHEARTFormatMinorVersion()          { return 1; }
     static inline constexpr const char* getHEARTFormatVersionPrefix()     { return "SOUL"; }
 
     struct Identifier;
@@ -115,6 +121,8 @@ namespace soul
 
 #include "diagnostics/soul_Logging.h"
 #include "diagnostics/soul_Timing.h"
+#include "diagnostics/soul_CompileProfiler.h"
+#include "diagnostics/soul_RenderProfiler.h"
 #include "diagnostics/soul_CodeLocation.h"
 #include "diagnostics/soul_CompileMessageList.h"
 #include "diagnostics/soul_Errors.h"
@@ -140,6 +148,10 @@ namespace soul
 #include "heart/soul_heart_FunctionBuilder.h"
 #include "heart/soul_heart_CallFlowGraph.h"
 #include "heart/soul_heart_Optimisations.h"
+#include "heart/soul_heart_SSA.h"
+#include "heart/soul_heart_SSAOptimisations.h"
+#include "heart/soul_heart_LoopOptimisations.h"
+#include "heart/soul_heart_RunLoopVectorisation.h"
 #include "heart/soul_heart_DelayCompensation.h"
 #include "heart/soul_heart_FunctionNames.h"
 
@@ -150,6 +162,8 @@ namespace soul
 #include "venue/soul_Performer.h"
 #include "venue/soul_Venue.h"
 #include "venue/soul_RenderingVenue.h"
+#include "venue/soul_Interpreter.h"
+#include "venue/soul_TieredPerformer.h"
 
 #include "utilities/soul_MultiEndpointFIFO.h"
 #include "utilities/soul_AudioDataGeneration.h"
@@ -164,4 +178,5 @@ namespace soul
 #include "documentation/soul_HTMLGeneration.h"
 
 #include "code_generation/soul_CPPGenerator.h"
+#include "code_generation/soul_CPPPerformer.h"
 #include "code_generation/soul_PatchGenerator.h"
@@ -61,6 +61,9 @@ struct TestFileParser::TestList
             log (padded (test.getTestNameAndLine(), 10) + getDescription (test.testResult)
                    + "   (" + choc::text::getDurationDescription (test.timeInSeconds) + ")");
 
+            if (! test.compileProfile.empty())
+                log (test.compileProfile);
+
             switch (test.testResult)
             {
                 case Result::OK:        ++testResults.numPasses;   break;
@@ -115,6 +118,14 @@ struct TestFileParser::TestList
                 {
                     currentTest = std::make_unique<CompileTest>();
                 }
+                else if (choc::text::startsWith (trimmedLine, "binary"))
+                {
+                    currentTest = std::make_unique<BinaryFormatTest>();
+                }
+                else if (choc::text::startsWith (trimmedLine, "heart"))
+                {
+                    currentTest = std::make_unique<HEARTTest>();
+                }
                 else if (choc::text::startsWith (trimmedLine, "function"))
                 {
                     currentTest = std::make_unique<FunctionTest> (choc::text::contains (trimmedLine, "ignoreWarnings"));
@@ -218,6 +229,10 @@ struct TestFileParser::TestList
             const ScopedTimer thisTestTime ({});
             struct FailedParse {};
             testResult = Result::failed;
+            std::optional<CompileProfiler> profiler;
+
+            if (globalOptions.profileCompilation)
+                profiler.emplace();
 
             try
             {
@@ -234,6 +249,9 @@ struct TestFileParser::TestList
             catch (FailedParse) {}
 
             timeInSeconds = thisTestTime.getElapsedSeconds();
+
+            if (profiler)
+                compileProfile = profiler->getSummary();
         }
 
         Program compile (TestOptions& options, bool useAbsoluteLineNumber)
@@ -249,6 +267,35 @@ struct TestFileParser::TestList
             return repeatedCharacter ('\n', initialPaddingLines) + choc::text::joinStrings (lines, {});
         }
 
+        /// Applies any JSON object of build settings that follows the given keyword in the section's
+        /// header line: "optimisationLevel" sets the optimisation level, and any other members are
+        /// added to the custom settings.
+        void applySettings (BuildSettings& settings, std::string_view keyword)
+        {
+            auto json = choc::text::trim (sectionHeaderLine.substr (sectionHeaderLine.find (keyword) + keyword.length()));
+
+            if (json.empty())
+                return;
+
+            auto parsed = choc::json::parse (json);
+
+            if (! parsed.isObject())
+                location.throwError (Errors::customRuntimeError ("Expected a JSON object of build settings"));
+
+            if (! settings.customSettings.isObject())
+                settings.customSettings = choc::value::createObject ({});
+
+            for (uint32_t i = 0; i < parsed.size(); ++i)
+            {
+                auto member = parsed.getObjectMemberAt (i);
+
+                if (std::string_view (member.name) == "optimisationLevel")
+                    settings.optimisationLevel = member.value.getWithDefault<int> (-1);
+                else
+                    settings.customSettings.addMember (member.name, member.value);
+            }
+        }
+
         std::string getTestNameAndLine() const
         {
             return "Test " + std::to_string (testNumber) + " (line " + std::to_string (startLineInFile) + ")";
@@ -273,6 +320,7 @@ struct TestFileParser::TestList
         CompileMessageList messageList;
         Result testResult;
         std::chrono::duration<double> timeInSeconds;
+        std::string compileProfile;
 
         bool isHeart() const
         {
@@ -605,6 +653,12 @@ processor TestFunctionCaller
             allowEmptyTests = true;
         }
 
+        Result run (TestOptions& options) override
+        {
+            applySettings (options.options.buildSettings, "processor");
+            return FunctionTest::run (options);
+        }
+
         std::string getTestProcessorName() override      { return "tests::test"; }
     };
 
@@ -699,7 +753,7 @@ processor TestFunctionCaller
     {
         Result run (TestOptions& options) override
         {
-            auto result = ProcessorTest::run (options);
+            auto result = FunctionTest::run (options);
 
             if (result != Result::OK)
                 return result;
@@ -724,6 +778,302 @@ processor TestFunctionCaller
         }
     };
 
+    //==============================================================================
+    /// Builds the code at each optimisation level, and checks that writing each program in the
+    /// binary form and reading it back produces an identical program, and that the binary form
+    /// is smaller than the HEART text. It also makes sure that the structural comparison notices
+    /// when a statement has been removed from a clone of each program.
+    struct BinaryFormatTest  : public CompileTest
+    {
+        Result run (TestOptions& options) override
+        {
+            auto originalSettings = options.options.buildSettings;
+
+            for (int level = 0; level <= 3; ++level)
+            {
+                options.options.buildSettings.optimisationLevel = level;
+                auto original = compile (options, true);
+                options.options.buildSettings = originalSettings;
+
+                if (options.messages.hasErrors())
+                    return Result::failed;
+
+                if (original.isEmpty())
+                    location.throwError (Errors::emptyProgram());
+
+                auto data = original.toBinary();
+                auto text = original.toHEART();
+                auto copy = Program::createFromBinary (options.messages, data.data(), data.size(), true);
+
+                if (options.messages.hasErrors())
+                    return Result::failed;
+
+                auto levelDescription = " at optimisation level " + std::to_string (level);
+
+                if (! (heart::Checker::isStructurallyIdentical (original, copy) && copy.toHEART() == text))
+                    location.throwError (Errors::customRuntimeError ("Binary HEART round-trip failed" + levelDescription));
+
+                if (heart::Parser::parse (CodeLocation::createFromString ("HEART", text)).toHEART() != text)
+                    location.throwError (Errors::customRuntimeError ("HEART text round-trip failed" + levelDescription));
+
+                if (data.size() >= text.length())
+                    location.throwError (Errors::customRuntimeError ("Binary HEART was " + std::to_string (data.size())
+                                                                       + " bytes, but the text was only " + std::to_string (text.length())
+                                                                       + levelDescription));
+
+                if (! isChangeToCloneDetected (original))
+                    location.throwError (Errors::customRuntimeError ("Structural comparison missed a change to a cloned program" + levelDescription));
+            }
+
+            return Result::OK;
+        }
+
+        static bool isChangeToCloneDetected (const Program& original)
+        {
+            auto changed = original.clone();
+
+            for (auto& m : changed.getModules())
+            {
+                for (auto& f : m->functions.get())
+                {
+                    for (auto& b : f->blocks)
+                    {
+                        if (! b->statements.empty())
+                        {
+                            b->statements.removeFront();
+                            return ! heart::Checker::isStructurallyIdentical (original, changed);
+                        }
+                    }
+                }
+            }
+
+            return true;
+        }
+    };
+
+    //==============================================================================
+    /// Compiles the code and checks the HEART that it produces, and the compile counters.
+    /// The header line can give a JSON object of settings for the build: "optimisationLevel"
+    /// sets the optimisation level, and any other members are added to the custom settings.
+    /// Each line in the code that begins with "//@" is one of these checks:
+    ///    //@ contains "text" [in function]
+    ///    //@ lacks "text" [in function]
+    ///    //@ count <N> "text" [in function]
+    ///    //@ counter "counter name" <, > or == <N>
+    ///    //@ error "text"
+    /// If a function name is given, only the HEART of functions with that name is searched.
+    /// An error check means that the build must fail with an error containing the text, and
+    /// it can only be combined with other error checks.
+    struct HEARTTest  : public CompileTest
+    {
+        Result run (TestOptions& options) override
+        {
+            applySettings (options.options.buildSettings, "heart");
+
+            std::vector<std::pair<CodeLocation, std::string>> checks;
+            bool expectsErrors = false;
+            auto lineLocation = location;
+
+            for (auto& line : lines)
+            {
+                auto check = choc::text::trim (line);
+
+                if (choc::text::startsWith (check, "//@"))
+                {
+                    checks.push_back ({ lineLocation, choc::text::trim (check.substr (3)) });
+                    expectsErrors = expectsErrors || choc::text::startsWith (checks.back().second, "error ");
+                }
+
+                lineLocation.location = choc::text::UTF8Pointer (lineLocation.location.data() + line.length());
+            }
+
+            // If the whole test is being profiled, share its profiler rather than hiding the build from it
+            std::optional<CompileProfiler> ownProfiler;
+
+            if (CompileProfiler::getCurrent() == nullptr)
+                ownProfiler.emplace();
+
+            auto& profiler = *CompileProfiler::getCurrent();
+            std::string heart, buildErrors;
+
+            if (expectsErrors)
+            {
+                CompileMessageList errors;
+                TestOptions buildOptions { errors, options.options };
+                compile (buildOptions, true);
+                buildErrors = errors.toString();
+            }
+            else
+            {
+                program = compile (options, true);
+
+                if (options.messages.hasErrors())
+                    return Result::failed;
+
+                if (program.isEmpty())
+                    location.throwError (Errors::emptyProgram());
+
+                heart = program.toHEART();
+            }
+
+            for (auto& check : checks)
+                runCheck (check.first, check.second, expectsErrors, heart, buildErrors, profiler);
+
+            return Result::OK;
+        }
+
+        static void runCheck (const CodeLocation& checkLocation, const std::string& check, bool expectsErrors,
+                              const std::string& heart, const std::string& buildErrors, const CompileProfiler& profiler)
+        {
+            auto fail = [&] (const std::string& reason)
+            {
+                checkLocation.throwError (Errors::customRuntimeError ("HEART check failed: " + check + "\n" + reason));
+            };
+
+            auto readWord = [] (std::string& text)
+            {
+                text = choc::text::trimStart (text);
+                auto end = std::min (text.find (' '), text.length());
+                auto word = text.substr (0, end);
+                text = text.substr (end);
+                return word;
+            };
+
+            auto readQuoted = [&] (std::string& text)
+            {
+                text = choc::text::trimStart (text);
+                auto end = text.find ('"', 1);
+
+                if (! choc::text::startsWith (text, "\"") || end == std::string::npos)
+                    fail ("Expected a quoted string");
+
+                auto quoted = text.substr (1, end - 1);
+                text = text.substr (end + 1);
+                return quoted;
+            };
+
+            auto readNumber = [&] (std::string& text)
+            {
+                auto word = readWord (text);
+
+                if (word.empty() || word.find_first_not_of ("0123456789") != std::string::npos)
+                    fail ("Expected a number");
+
+                return static_cast<int64_t> (std::stoll (word));
+            };
+
+            auto rest = check;
+            auto kind = readWord (rest);
+
+            if (kind == "error")
+            {
+                auto text = readQuoted (rest);
+
+                if (buildErrors.empty())
+                    fail ("The build succeeded");
+
+                if (buildErrors.find (text) == std::string::npos)
+                    fail ("The errors were:\n" + buildErrors);
+
+                return;
+            }
+
+            if (expectsErrors)
+                fail ("Only error checks can be used when the build is expected to fail");
+
+            if (kind == "counter")
+            {
+                auto name = readQuoted (rest);
+                auto comparison = readWord (rest);
+                auto target = readNumber (rest);
+
+                if (comparison != "<" && comparison != ">" && comparison != "==")
+                    fail ("Unknown comparison " + quoteName (comparison));
+
+                for (size_t i = 0; i < CompileProfiler::numCounters; ++i)
+                {
+                    auto counter = static_cast<CompileProfiler::Counter> (i);
+
+                    if (name == CompileProfiler::getCounterName (counter))
+                    {
+                        auto value = profiler.getCounter (counter);
+
+                        if (! (comparison == "<" ? value < target
+                                : comparison == ">" ? value > target
+                                                    : value == target))
+                            fail ("The counter was " + std::to_string (value));
+
+                        return;
+                    }
+                }
+
+                fail ("Unknown counter " + quoteName (name));
+            }
+
+            int64_t expectedCount = -1;
+
+            if (kind == "count")
+                expectedCount = readNumber (rest);
+            else if (kind != "contains" && kind != "lacks")
+                fail ("Unknown check " + quoteName (kind));
+
+            auto text = readQuoted (rest);
+            auto searchArea = heart;
+
+            if (readWord (rest) == "in")
+            {
+                auto functionName = readWord (rest);
+                searchArea = getFunctionsNamed (heart, functionName);
+
+                if (searchArea.empty())
+                    fail ("No function called " + quoteName (functionName));
+            }
+
+            int64_t count = 0;
+
+            for (auto pos = searchArea.find (text); pos != std::string::npos; pos = searchArea.find (text, pos + text.length()))
+                ++count;
+
+            if (kind == "contains" && count == 0)  fail ("The text wasn't found");
+            if (kind == "lacks" && count != 0)     fail ("The text was found " + std::to_string (count) + " times");
+
+            if (kind == "count" && count != expectedCount)
+                fail ("The text was found " + std::to_string (count) + " times");
+        }
+
+        /// Returns the HEART text of all the functions or event handlers with the given (unqualified) name
+        static std::string getFunctionsNamed (const std::string& heart, const std::string& name)
+        {
+            std::string result;
+            std::string closingLine;
+
+            for (auto& line : choc::text::splitIntoLines (heart, false))
+            {
+                if (! closingLine.empty())
+                {
+                    result += line + "\n";
+
+                    if (line == closingLine)
+                        closingLine.clear();
+
+                    continue;
+                }
+
+                auto trimmed = choc::text::trimStart (line);
+
+                if (choc::text::startsWith (trimmed, "function " + name + " ")
+                     || choc::text::startsWith (trimmed, "function " + name + "(")
+                     || choc::text::startsWith (trimmed, "event " + name + " "))
+                {
+                    closingLine = line.substr (0, line.length() - trimmed.length()) + "}";
+                    result += line + "\n";
+                }
+            }
+
+            return result;
+        }
+    };
+
     //==============================================================================
     struct DisabledTest  : public Test
     {
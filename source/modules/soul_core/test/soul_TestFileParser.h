@@ -28,6 +28,7 @@ public:
         size_t testToRun = 0;
         uint32_t numThreads = 0;    // 0 = leave it up to std::async to decide
         bool runDisabled = false;
+        bool profileCompilation = false;    // if true, each test logs a summary of its compile phases
     };
 
     //==============================================================================
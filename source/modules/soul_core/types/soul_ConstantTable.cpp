@@ -31,17 +31,21 @@ namespace soul
     const ConstantTable::Item* ConstantTable::end() const     { return items.end(); }
     size_t ConstantTable::size() const                        { return items.size(); }
 
+    size_t ConstantTable::ValuePointerHash::operator() (const Value* v) const                    { return v->getHash(); }
+    bool ConstantTable::ValuePointerEquals::operator() (const Value* v1, const Value* v2) const  { return *v1 == *v2; }
+
     ConstantTable::Handle ConstantTable::getHandleForValue (Value value)
     {
         if (! value.isValid())
             return 0;
 
-        for (auto& i : items)
-            if (value == *i.value)
-                return i.handle;
+        auto existing = handleForValue.find (std::addressof (value));
+
+        if (existing != handleForValue.end())
+            return existing->second;
 
-        auto handle = nextIndex++;
-        items.push_back ({ handle, std::make_unique<Value> (std::move (value)) });
+        auto handle = nextIndex;
+        addItem ({ handle, std::make_unique<Value> (std::move (value)) });
         return handle;
     }
 
@@ -50,9 +54,13 @@ namespace soul
         if (handle == 0)
             return {};
 
-        for (auto& i : items)
-            if (handle == i.handle)
-                return i.value.get();
+        if (handle > 0 && (size_t) handle < slotForHandle.size())
+        {
+            auto slot = slotForHandle[(size_t) handle];
+
+            if (slot != noSlot)
+                return items[slot].value.get();
+        }
 
         SOUL_ASSERT_FALSE;
         return {};
@@ -60,7 +68,14 @@ namespace soul
 
     void ConstantTable::addItem (Item i)
     {
+        SOUL_ASSERT (i.handle > 0 && i.value != nullptr);
         nextIndex = std::max (nextIndex, i.handle + 1);
+
+        if (slotForHandle.size() <= (size_t) i.handle)
+            slotForHandle.resize ((size_t) i.handle + 1, noSlot);
+
+        slotForHandle[(size_t) i.handle] = (uint32_t) items.size();
+        handleForValue.emplace (i.value.get(), i.handle);
         items.push_back (std::move (i));
     }
 }
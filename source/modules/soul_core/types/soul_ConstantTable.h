@@ -22,7 +22,10 @@ namespace soul
 {
 
 //==============================================================================
-/** A set of constant Value objects which are mapped to numeric handles. */
+/** A set of constant Value objects which are mapped to numeric handles.
+    Values are indexed by a hash of their content, so adding a value which is already
+    in the table doesn't need to compare it against every other item.
+*/
 class ConstantTable
 {
 public:
@@ -53,8 +56,15 @@ public:
     void addItem (Item);
 
 private:
+    struct ValuePointerHash    { size_t operator() (const Value*) const; };
+    struct ValuePointerEquals  { bool operator() (const Value*, const Value*) const; };
+
     ArrayWithPreallocation<Item, 32> items;
+    std::unordered_map<const Value*, Handle, ValuePointerHash, ValuePointerEquals> handleForValue;
+    std::vector<uint32_t> slotForHandle;
     Handle nextIndex = 1;
+
+    static constexpr uint32_t noSlot = ~0u;
 };
 
 
@@ -27,30 +27,77 @@ namespace soul
     StringDictionary::StringDictionary() = default;
     StringDictionary::~StringDictionary() = default;
 
+    const StringDictionary::Item* StringDictionary::begin() const   { return strings.data(); }
+    const StringDictionary::Item* StringDictionary::end() const     { return strings.data() + strings.size(); }
+    size_t StringDictionary::size() const                           { return strings.size(); }
+    bool StringDictionary::empty() const                            { return strings.empty(); }
+
     StringDictionary::Handle StringDictionary::getHandleForString (std::string_view text)
     {
         if (text.empty())
             return {};
 
-        for (auto& s : strings)
-            if (s.text == text)
-                return s.handle;
+        auto newSlot = (uint32_t) strings.size();
+        auto inserted = slotForString.emplace (std::string (text), newSlot);
+
+        if (! inserted.second)
+            return strings[inserted.first->second].handle;
 
         auto handle = StringDictionary::Handle { nextIndex++ };
         strings.push_back ({ handle, std::string (text) });
+        slotForHandle.resize (handle.handle + 1, noSlot);
+        slotForHandle[handle.handle] = newSlot;
         return handle;
     }
 
+    bool StringDictionary::addItem (Handle handle, std::string_view text)
+    {
+        if (text.empty() || handle.handle < nextIndex)
+            return false;
+
+        auto newSlot = (uint32_t) strings.size();
+
+        if (! slotForString.emplace (std::string (text), newSlot).second)
+            return false;
+
+        nextIndex = handle.handle + 1;
+        strings.push_back ({ handle, std::string (text) });
+        slotForHandle.resize (handle.handle + 1, noSlot);
+        slotForHandle[handle.handle] = newSlot;
+        return true;
+    }
+
+    bool StringDictionary::contains (Handle handle) const
+    {
+        return handle.handle < slotForHandle.size() && slotForHandle[handle.handle] != noSlot;
+    }
+
     std::string_view StringDictionary::getStringForHandle (Handle handle) const
     {
         if (handle == Handle())
             return {};
 
-        for (auto& s : strings)
-            if (s.handle == handle)
-                return s.text;
+        if (handle.handle < slotForHandle.size())
+        {
+            auto slot = slotForHandle[handle.handle];
+
+            if (slot != noSlot)
+                return strings[slot].text;
+        }
 
         SOUL_ASSERT_FALSE;
         return {};
     }
+
+    void StringDictionary::rebuildIndexes()
+    {
+        slotForString.clear();
+        std::fill (slotForHandle.begin(), slotForHandle.end(), noSlot);
+
+        for (uint32_t i = 0; i < (uint32_t) strings.size(); ++i)
+        {
+            slotForString[strings[i].text] = i;
+            slotForHandle[strings[i].handle.handle] = i;
+        }
+    }
 }
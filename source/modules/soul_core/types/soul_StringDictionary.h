@@ -22,7 +22,10 @@ namespace soul
 {
 
 //==============================================================================
-/** Holds a map of strings to integer handles. */
+/** Holds a map of strings to integer handles.
+    Lookups in both directions are hashed, and a string's handle never changes
+    while it remains in the dictionary.
+*/
 class StringDictionary  : public choc::value::StringDictionary
 {
 public:
@@ -38,10 +41,39 @@ public:
         std::string text;
     };
 
-    std::vector<Item> strings;
+    /** Adds a string with a particular handle, e.g. when reloading a dictionary whose handles
+        need to stay the same. Returns false if the string is empty or already present, or if
+        the handle isn't higher than those of all the existing strings.
+    */
+    bool addItem (Handle, std::string_view);
+
+    /** Returns true if the handle refers to one of the strings in the dictionary. */
+    bool contains (Handle) const;
+
+    const Item* begin() const;
+    const Item* end() const;
+    size_t size() const;
+    bool empty() const;
+
+    /** Removes any items for which the predicate returns true. The handles of the
+        remaining items are unchanged.
+    */
+    template <typename Predicate>
+    void removeIf (Predicate&& shouldRemove)
+    {
+        if (soul::removeIf (strings, shouldRemove))
+            rebuildIndexes();
+    }
 
 private:
+    std::vector<Item> strings;
+    std::unordered_map<std::string, uint32_t> slotForString;
+    std::vector<uint32_t> slotForHandle;
     uint32_t nextIndex = 1;
+
+    static constexpr uint32_t noSlot = ~0u;
+
+    void rebuildIndexes();
 };
 
 
@@ -23,9 +23,11 @@ namespace soul
 
 //==============================================================================
 /** Represents a structure.
+    The reference count is atomic because Types which refer to a structure get copied
+    by the compiler's worker threads.
     @see Type::createStruct()
 */
-class Structure   : public RefCountedObject
+class Structure   : public ThreadSafeRefCountedObject
 {
 public:
     Structure (std::string name, void* backlinkToASTObject);
@@ -657,6 +657,22 @@ bool Value::operator== (const Value& other) const
 
 bool Value::operator!= (const Value& other) const       { return ! operator== (other); }
 
+size_t Value::getHash() const
+{
+    if (! type.isValid())
+        return 0;
+
+    auto typeBits = (size_t) ((type.isPrimitive() ? 1 : 0)
+                                | (type.isVector() ? 2 : 0)
+                                | (type.isArray() ? 4 : 0)
+                                | (type.isStruct() ? 8 : 0)
+                                | (type.isStringLiteral() ? 16 : 0));
+
+    auto contentHash = std::hash<std::string_view>() (std::string_view (reinterpret_cast<const char*> (allocatedData.data()),
+                                                                          allocatedData.size()));
+    return contentHash ^ (typeBits + (size_t) 0x9e3779b9u + (contentHash << 6) + (contentHash >> 2));
+}
+
 Value Value::cloneWithEquivalentType (Type newType) const
 {
     SOUL_ASSERT (newType.hasIdenticalLayout (type));
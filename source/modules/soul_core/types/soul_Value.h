@@ -167,6 +167,9 @@ struct Value  final
     bool operator== (const Value&) const;
     bool operator!= (const Value&) const;
 
+    /** Returns a hash of the type and content, which will be the same for any two values that compare as equal. */
+    size_t getHash() const;
+
     /** Copies the value from the source value - this is only valid if the type are identical. */
     void copyValue (const Value& source);
 
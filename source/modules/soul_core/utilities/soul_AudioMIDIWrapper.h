@@ -111,57 +111,54 @@ struct AudioInputList
     {
         mappings.clear();
         totalNumChannels = 0;
-        scratchBuffer.resize ({ 1, maxBlockSize });
     }
 
     template <typename PerformerOrSession>
     void connectEndpoint (PerformerOrSession& p, EndpointID endpointID, choc::buffer::ChannelRange channels)
     {
-        mappings.push_back ({ p.getEndpointHandle (endpointID), channels });
+        mappings.push_back ({ p.getEndpointHandle (endpointID), channels, {} });
 
-        if (channels.size() > scratchBuffer.getNumChannels())
-            scratchBuffer.resize ({ channels.size(), maxBlockSize });
+        if (channels.size() > 1)
+            mappings.back().interleaved.resize ({ channels.size(), maxBlockSize });
 
         totalNumChannels = std::max (totalNumChannels, channels.end);
     }
 
-    bool addToFIFO (MultiEndpointFIFO& fifo, uint64_t time, choc::buffer::ChannelArrayView<const float> inputChannels)
+    /** Passes a block of the host's input channels straight to the audio input endpoints,
+        without going via a FIFO. Single-channel endpoints are given a view onto the caller's
+        data, and multi-channel ones only need their frames interleaving.
+    */
+    template <typename PerformerOrSession>
+    void setInputFrames (PerformerOrSession& p, choc::buffer::ChannelArrayView<const float> inputChannels)
     {
         auto numFrames = inputChannels.getNumFrames();
+        SOUL_ASSERT (numFrames <= maxBlockSize);
 
         for (auto& mapping : mappings)
         {
             if (mapping.channels.size() == 1)
             {
                 auto channel = inputChannels.getChannel (mapping.channels.start);
-
-                if (! fifo.addInputData (mapping.endpoint, time,
-                                         choc::value::createArrayView (const_cast<float*> (channel.data.data), numFrames)))
-                    return false;
+                p.setNextInputStreamFrames (mapping.endpoint, choc::value::createArrayView (const_cast<float*> (channel.data.data), numFrames));
             }
             else
             {
-                copy (scratchBuffer.getStart (numFrames), inputChannels.getChannelRange (mapping.channels));
-
-                if (! fifo.addInputData (mapping.endpoint, time,
-                                         choc::value::create2DArrayView (scratchBuffer.getView().data.data,
-                                                                         numFrames, mapping.channels.size())))
-                    return false;
+                copy (mapping.interleaved.getStart (numFrames), inputChannels.getChannelRange (mapping.channels));
+                p.setNextInputStreamFrames (mapping.endpoint, choc::value::create2DArrayView (mapping.interleaved.getView().data.data,
+                                                                                              numFrames, mapping.channels.size()));
             }
         }
-
-        return true;
     }
 
     struct InputMapping
     {
         EndpointHandle endpoint;
         choc::buffer::ChannelRange channels;
+        choc::buffer::InterleavedBuffer<float> interleaved;
     };
 
     std::vector<InputMapping> mappings;
     uint32_t maxBlockSize = 0, totalNumChannels = 0;
-    choc::buffer::InterleavedBuffer<float> scratchBuffer;
 };
 
 //==============================================================================
@@ -699,7 +696,8 @@ struct AudioMIDIWrapper
 
         SOUL_ASSERT (input.getNumFrames() == numFrames && maxBlockSize != 0);
 
-        success &= audioInputList.addToFIFO (inputFIFO, totalFramesRendered, input);
+        renderProfiler.beginBlock (totalFramesRendered, numFrames);
+
         success &= midiInputList.addToFIFO (inputFIFO, totalFramesRendered, midiIn);
         success &= parameterList.addToFIFO (inputFIFO, totalFramesRendered);
         success &= timelineEventEndpointList.addToFIFO (inputFIFO, totalFramesRendered);
@@ -707,31 +705,62 @@ struct AudioMIDIWrapper
 
         success &= inputFIFO.prepareForReading (totalFramesRendered, numFrames);
 
+        // If the performer can dispatch events mid-block, we only need to split the block
+        // where stream or value changes happen
+        auto splitAtEvents = ! performer.supportsTimestampedInputEvents();
+
         for (;;)
         {
-            auto numFramesToDo = inputFIFO.getNumFramesInNextChunk (maxBlockSize);
+            auto numFramesToDo = inputFIFO.getNumFramesInNextChunk (maxBlockSize, splitAtEvents);
 
             if (numFramesToDo == 0)
                 break;
 
-            performer.prepare (numFramesToDo);
-            inputFIFO.processNextChunk ([&] (EndpointHandle endpoint, uint64_t /*itemStart*/, const choc::value::ValueView& value)
-                                        {
-                                            deliverValueToEndpoint (endpoint, value);
-                                        });
-            performer.advance();
-            audioOutputList.handleOutputData (performer, output.getFrameRange ({ framesDone, output.size.numFrames }));
-            midiOutputList.handleOutputData (performer, framesDone, midiOut);
-            success &= eventOutputList.postOutputEvents (performer, totalFramesRendered + framesDone);
+            auto chunkStart = totalFramesRendered + framesDone;
+
+            renderProfiler.beginChunk();
+
+            {
+                RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::prepare);
+                performer.prepare (numFramesToDo);
+            }
+
+            {
+                RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::inputDelivery);
+                audioInputList.setInputFrames (performer, input.getFrameRange ({ framesDone, framesDone + numFramesToDo }));
+                inputFIFO.processNextChunk ([&] (EndpointHandle endpoint, uint64_t itemStart, const choc::value::ValueView& value)
+                                            {
+                                                deliverValueToEndpoint (endpoint, itemStart > chunkStart ? static_cast<uint32_t> (itemStart - chunkStart) : 0, value);
+                                            });
+            }
+
+            {
+                RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::advance);
+                performer.advance();
+            }
+
+            {
+                RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::outputCollection);
+                audioOutputList.handleOutputData (performer, output.getFrameRange ({ framesDone, output.size.numFrames }));
+                midiOutputList.handleOutputData (performer, framesDone, midiOut);
+                success &= eventOutputList.postOutputEvents (performer, totalFramesRendered + framesDone);
+            }
+
             framesDone += numFramesToDo;
         }
 
         inputFIFO.finishReading();
         totalFramesRendered += framesDone;
 
+        renderProfiler.endBlock();
+
         return success;
     }
 
+    /// Measures each internal block that render() performs. It's disabled until its
+    /// setEnabled() method is called, and needs to be told the sample rate to spot xruns.
+    RenderProfiler& getRenderProfiler()              { return renderProfiler; }
+
     uint32_t getExpectedNumInputChannels() const     { return audioInputList.totalNumChannels; }
     uint32_t getExpectedNumOutputChannels() const    { return audioOutputList.totalNumChannels; }
 
@@ -754,6 +783,7 @@ struct AudioMIDIWrapper
 private:
     //==============================================================================
     MultiEndpointFIFO inputFIFO;
+    RenderProfiler renderProfiler;
 
     AudioInputList   audioInputList;
     MIDIInputList    midiInputList;
@@ -793,7 +823,7 @@ private:
         return success;
     }
 
-    void deliverValueToEndpoint (EndpointHandle endpoint, const choc::value::ValueView& value)
+    void deliverValueToEndpoint (EndpointHandle endpoint, uint32_t frameOffset, const choc::value::ValueView& value)
     {
         switch (endpoint.getType())
         {
@@ -804,7 +834,11 @@ private:
                 break;
 
             case EndpointType::event:
-                performer.addInputEvent (endpoint, value);
+                if (frameOffset != 0)
+                    performer.addInputEventAtFrame (endpoint, frameOffset, value);
+                else
+                    performer.addInputEvent (endpoint, value);
+
                 break;
 
             case EndpointType::value:
@@ -30,58 +30,61 @@ struct Identifier  final
     Identifier& operator= (const Identifier&) = default;
 
     bool isValid() const noexcept                                   { return name != nullptr; }
-    operator const std::string&() const                             { SOUL_ASSERT (isValid()); return *name; }
-    operator std::string_view() const                               { SOUL_ASSERT (isValid()); return std::string_view (*name); }
-    const std::string& toString() const                             { SOUL_ASSERT (isValid()); return *name; }
+    operator std::string() const                                    { return toString(); }
+    operator std::string_view() const                               { SOUL_ASSERT (isValid()); return *name; }
+    std::string toString() const                                    { SOUL_ASSERT (isValid()); return std::string (*name); }
     size_t length() const                                           { SOUL_ASSERT (isValid()); return name->length(); }
-    std::string toStringWithFallback (const std::string& fallback) const  { return isValid() ? *name : fallback; }
+    std::string toStringWithFallback (const std::string& fallback) const  { return isValid() ? toString() : fallback; }
 
     bool operator== (const Identifier& other) const noexcept        { return name == other.name; }
     bool operator!= (const Identifier& other) const noexcept        { return name != other.name; }
     bool operator== (std::string_view other) const                  { SOUL_ASSERT (isValid()); return *name == other; }
     bool operator!= (std::string_view other) const                  { SOUL_ASSERT (isValid()); return *name != other; }
 
+    /// Allows an Identifier to be used as a key in a std::unordered_map or std::unordered_set
+    struct Hash
+    {
+        size_t operator() (const Identifier& i) const noexcept      { return std::hash<const std::string_view*>() (i.name); }
+    };
+
     //==============================================================================
+    /** Creates and owns the strings that Identifiers refer to.
+
+        The characters are copied into blocks which are shared by many strings, and are
+        found with an open-addressed hash table, so adding or looking up an identifier
+        doesn't need to search or shuffle a sorted list.
+
+        A pool can be given a parent with setParent(), after which any strings that the
+        parent already contains will be shared rather than copied. The parent's strings
+        are moved into a table which is never modified again, so pools on other threads
+        can read it without locking (e.g. multiple Compilers sharing the names from the
+        built-in library). If the parent adds more strings later, it starts a new table,
+        which won't be visible to the children that it already has.
+    */
     struct Pool  final
     {
         Pool() = default;
         Pool (const Pool&) = delete;
         Pool (Pool&&) = default;
+        Pool& operator= (Pool&&) = default;
 
         Identifier get (std::string_view newString)
         {
             SOUL_ASSERT (! newString.empty());
+            auto hash = std::hash<std::string_view>() (newString);
 
-            size_t s = 0;
-            size_t e = strings.size();
-
-            while (s < e)
-            {
-                auto* elem = strings[s].get();
+            if (strings != nullptr)
+                if (auto s = strings->find (newString, hash))
+                    return Identifier (s);
 
-                if (*elem == newString)
-                    return Identifier (elem);
+            if (parent != nullptr)
+                if (auto s = parent->find (newString, hash))
+                    return Identifier (s);
 
-                auto halfway = (s + e) / 2;
-                bool isBeforeHalfway = (newString < *strings[halfway]);
-
-                if (halfway == s)
-                {
-                    if (! isBeforeHalfway)
-                        ++s;
-
-                    break;
-                }
+            if (strings == nullptr)
+                strings = std::make_unique<Storage>();
 
-                if (isBeforeHalfway)
-                    e = halfway;
-                else
-                    s = halfway;
-            }
-
-            auto* sharedString = new std::string (newString);
-            strings.insert (strings.begin() + (int) s, std::unique_ptr<std::string> (sharedString));
-            return Identifier (sharedString);
+            return Identifier (strings->add (newString, hash));
         }
 
         Identifier get (const Identifier& i)
@@ -92,21 +95,177 @@ struct Identifier  final
             return get (static_cast<std::string_view> (i));
         }
 
+        /// Makes this pool re-use any strings that already exist in another pool. The parent's
+        /// strings are kept alive for as long as this pool (or any other child) needs them.
+        /// This modifies the parent, so it mustn't be called while another thread is using it.
+        void setParent (Pool& newParent)
+        {
+            SOUL_ASSERT (std::addressof (newParent) != this);
+            newParent.freeze();
+            parent = newParent.parent;
+        }
+
+        /// Makes any strings that another pool has created (but which this one doesn't already
+        /// have) findable by this pool. The strings aren't copied, so the other pool must be kept
+        /// alive for as long as this one is used.
+        void addStringsFrom (const Pool& other)
+        {
+            if (other.strings == nullptr)
+                return;
+
+            if (strings == nullptr)
+                strings = std::make_unique<Storage>();
+
+            strings->addMissing (*other.strings, parent.get());
+        }
+
         void clear()
         {
-            strings.clear();
+            strings.reset();
+            parent.reset();
         }
 
     private:
-        std::vector<std::unique_ptr<std::string>> strings;
+        //==============================================================================
+        struct Storage
+        {
+            const std::string_view* find (std::string_view s, size_t hash) const
+            {
+                if (slots.empty())
+                    return nullptr;
+
+                auto mask = slots.size() - 1;
+
+                for (auto i = hash & mask;; i = (i + 1) & mask)
+                {
+                    auto& slot = slots[i];
+
+                    if (slot.string == nullptr)
+                        return nullptr;
+
+                    if (slot.hash == hash && *slot.string == s)
+                        return slot.string;
+                }
+            }
+
+            const std::string_view* add (std::string_view s, size_t hash)
+            {
+                auto newString = std::addressof (pool.allocate<std::string_view> (copyCharacters (s), s.length()));
+                insert ({ hash, newString });
+                return newString;
+            }
+
+            /// Adds the strings from another table, which must stay alive for as long as this one
+            void addAll (std::shared_ptr<const Storage> source)
+            {
+                for (auto& slot : source->slots)
+                    if (slot.string != nullptr)
+                        insert (slot);
+
+                previous = std::move (source);
+            }
+
+            /// Adds any strings from another table which aren't in this one or the given parent table
+            void addMissing (const Storage& source, const Storage* parentTable)
+            {
+                for (auto& slot : source.slots)
+                    if (slot.string != nullptr
+                         && find (*slot.string, slot.hash) == nullptr
+                         && (parentTable == nullptr || parentTable->find (*slot.string, slot.hash) == nullptr))
+                        insert (slot);
+            }
+
+        private:
+            struct Slot
+            {
+                size_t hash;
+                const std::string_view* string;
+            };
+
+            static constexpr size_t charBlockSize = 8192;
+
+            choc::memory::Pool pool;
+            std::vector<std::unique_ptr<char[]>> charBlocks;
+            size_t charBlockSpaceLeft = 0;
+            std::vector<Slot> slots;
+            size_t numStrings = 0;
+            std::shared_ptr<const Storage> previous;
+
+            const char* copyCharacters (std::string_view s)
+            {
+                auto length = s.length();
+
+                // long strings get a block of their own, so that they don't waste the rest of a shared one
+                if (length > charBlockSize / 8)
+                {
+                    charBlocks.insert (charBlocks.begin(), std::make_unique<char[]> (length));
+                    std::memcpy (charBlocks.front().get(), s.data(), length);
+                    return charBlocks.front().get();
+                }
+
+                if (length > charBlockSpaceLeft)
+                {
+                    charBlocks.push_back (std::make_unique<char[]> (charBlockSize));
+                    charBlockSpaceLeft = charBlockSize;
+                }
+
+                auto dest = charBlocks.back().get() + (charBlockSize - charBlockSpaceLeft);
+                std::memcpy (dest, s.data(), length);
+                charBlockSpaceLeft -= length;
+                return dest;
+            }
+
+            void insert (Slot newSlot)
+            {
+                // keep the table no more than half full, so that probe sequences stay short
+                if ((numStrings + 1) * 2 > slots.size())
+                    resize (std::max ((size_t) 64, slots.size() * 2));
+
+                auto mask = slots.size() - 1;
+                auto i = newSlot.hash & mask;
+
+                while (slots[i].string != nullptr)
+                    i = (i + 1) & mask;
+
+                slots[i] = newSlot;
+                ++numStrings;
+            }
+
+            void resize (size_t newSize)
+            {
+                auto oldSlots = std::move (slots);
+                slots.resize (newSize, Slot { 0, nullptr });
+                numStrings = 0;
+
+                for (auto& slot : oldSlots)
+                    if (slot.string != nullptr)
+                        insert (slot);
+            }
+        };
+
+        std::unique_ptr<Storage> strings;
+        std::shared_ptr<const Storage> parent;
+
+        /// Moves any strings added since the last call into the shared table. The parent's
+        /// strings are checked before they're added, so the two tables never overlap.
+        void freeze()
+        {
+            if (strings == nullptr)
+                return;
+
+            if (parent != nullptr)
+                strings->addAll (std::move (parent));
+
+            parent = std::move (strings);
+        }
     };
 
 private:
     //==============================================================================
     friend struct Pool;
-    const std::string* name = nullptr;
+    const std::string_view* name = nullptr;
 
-    explicit Identifier (const std::string* s) : name (s) {}
+    explicit Identifier (const std::string_view* s) : name (s) {}
 };
 
 //==============================================================================
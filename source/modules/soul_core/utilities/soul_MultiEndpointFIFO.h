@@ -109,12 +109,17 @@ struct MultiEndpointFIFO
         return success;
     }
 
-    uint32_t getNumFramesInNextChunk (uint32_t maxNumFrames)
+    /** Returns the size of the next chunk to render, which will end at the next item's start time
+        so that it can be delivered sample-accurately. If splitAtEvents is false, items for event
+        endpoints are ignored when choosing the chunk size, and will instead be passed to the
+        handler with their exact start frame, for a performer which can dispatch them mid-block.
+    */
+    uint32_t getNumFramesInNextChunk (uint32_t maxNumFrames, bool splitAtEvents = true)
     {
         if (currentFrame >= endFrame)
             return 0;
 
-        nextChunkStart = findOffsetOfNextItemAfter (currentFrame, std::min (endFrame, currentFrame + maxNumFrames));
+        nextChunkStart = findOffsetOfNextItemAfter (currentFrame, std::min (endFrame, currentFrame + maxNumFrames), splitAtEvents);
         framesThisTime = static_cast<uint32_t> (nextChunkStart - currentFrame);
         return framesThisTime;
     }
@@ -356,7 +361,7 @@ private:
         return false;
     }
 
-    uint64_t findOffsetOfNextItemAfter (uint64_t start, uint64_t end) const
+    uint64_t findOffsetOfNextItemAfter (uint64_t start, uint64_t end, bool splitAtEvents) const
     {
         auto lowest = end;
 
@@ -364,7 +369,7 @@ private:
         {
             auto frame = i->startFrame;
 
-            if (frame > start && frame < lowest)
+            if (frame > start && frame < lowest && (splitAtEvents || i->endpoint.getType() != EndpointType::event))
                 lowest = frame;
         }
 
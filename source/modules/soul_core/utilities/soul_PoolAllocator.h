@@ -141,11 +141,43 @@ template <typename T1, typename T2> bool operator!= (pool_ptr<T1> p1, pool_ref<T
 template <typename T1, typename T2> bool operator== (pool_ref<T1> p1, pool_ref<T2> p2) noexcept  { return p1.getPointer() == p2.getPointer(); }
 template <typename T1, typename T2> bool operator!= (pool_ref<T1> p1, pool_ref<T2> p2) noexcept  { return p1.getPointer() != p2.getPointer(); }
 
+//==============================================================================
+/** A class hierarchy can avoid the cost of dynamic_cast in cast() and is_type() by giving its
+    root class a `CastRootType` typedef which names itself, and a static method
+    `template <typename TargetType> static TargetType* castTo (CastRootType&)`, which uses some
+    kind of type tag to find the object's concrete class. Any other classes fall back to
+    using dynamic_cast.
+*/
+template <typename Type, typename = void>
+struct HasCustomCast  : std::false_type {};
+
+template <typename Type>
+struct HasCustomCast<Type, std::void_t<typename Type::CastRootType>>  : std::true_type {};
+
+template <typename TargetType, typename SrcType>
+inline TargetType* castPointer (SrcType* object)
+{
+    static_assert (std::is_const<TargetType>::value || ! std::is_const<SrcType>::value, "cast() can't remove constness");
+
+    using Source = typename std::remove_const<SrcType>::type;
+    using Target = typename std::remove_const<TargetType>::type;
+
+    if (object == nullptr)
+        return nullptr;
+
+    if constexpr (std::is_base_of<Target, Source>::value)
+        return object;
+    else if constexpr (HasCustomCast<Source>::value)
+        return Source::CastRootType::template castTo<Target> (*const_cast<Source*> (object));
+    else
+        return dynamic_cast<TargetType*> (object);
+}
+
 template <typename TargetType, typename SrcType>
 inline pool_ptr<TargetType> cast (pool_ptr<SrcType> object)
 {
     pool_ptr<TargetType> p;
-    p.reset (dynamic_cast<TargetType*> (object.get()));
+    p.reset (castPointer<TargetType> (object.get()));
     return p;
 }
 
@@ -153,7 +185,7 @@ template <typename TargetType, typename SrcType>
 inline pool_ptr<TargetType> cast (pool_ref<SrcType> object)
 {
     pool_ptr<TargetType> p;
-    p.reset (dynamic_cast<TargetType*> (object.getPointer()));
+    p.reset (castPointer<TargetType> (object.getPointer()));
     return p;
 }
 
@@ -161,42 +193,26 @@ template <typename TargetType, typename SrcType>
 inline pool_ptr<TargetType> cast (SrcType& object)
 {
     pool_ptr<TargetType> p;
-    p.reset (dynamic_cast<TargetType*> (&object));
+    p.reset (castPointer<TargetType> (std::addressof (object)));
     return p;
 }
 
 template <typename TargetType, typename SrcType>
 inline bool is_type (pool_ptr<SrcType> object)
 {
-    if (object.get() == nullptr)
-        return false;
-
-    if constexpr (std::is_same<TargetType, SrcType>::value)
-        return true;
-    else
-        return dynamic_cast<TargetType*> (object.get()) != nullptr;
+    return castPointer<const TargetType> (object.get()) != nullptr;
 }
 
 template <typename TargetType, typename SrcType>
 inline bool is_type (pool_ref<SrcType> object)
 {
-    ignoreUnused (object);
-
-    if constexpr (std::is_same<TargetType, SrcType>::value)
-        return true;
-    else
-        return dynamic_cast<TargetType*> (object.getPointer()) != nullptr;
+    return castPointer<const TargetType> (object.getPointer()) != nullptr;
 }
 
 template <typename TargetType, typename SrcType>
 inline bool is_type (SrcType& object)
 {
-    ignoreUnused (object);
-
-    if constexpr (std::is_same<TargetType, SrcType>::value)
-        return true;
-    else
-        return dynamic_cast<TargetType*> (&object) != nullptr;
+    return castPointer<const TargetType> (std::addressof (object)) != nullptr;
 }
 
 } // namespace soul
@@ -36,8 +36,23 @@ struct RefCountedObject
 };
 
 //==============================================================================
-/** A smart pointer for referring to classes that inherit from RefCountedObject.
-    Note that this is intended to be fast, not thread-safe!
+/** A variant of RefCountedObject with an atomic counter, for the few objects (such as
+    source code text) which are shared between programs that may be used on different threads.
+*/
+struct ThreadSafeRefCountedObject
+{
+    ThreadSafeRefCountedObject() = default;
+    ThreadSafeRefCountedObject (const ThreadSafeRefCountedObject&) noexcept {}
+    ThreadSafeRefCountedObject (ThreadSafeRefCountedObject&&) noexcept {}
+    ~ThreadSafeRefCountedObject() = default;
+
+    std::atomic<uint32_t> refCount { 0 };
+};
+
+//==============================================================================
+/** A smart pointer for referring to classes that inherit from RefCountedObject or
+    ThreadSafeRefCountedObject.
+    Note that this is intended to be fast, and is only thread-safe if the object's counter is!
 */
 template <typename ObjectType>
 struct RefCountedPtr  final
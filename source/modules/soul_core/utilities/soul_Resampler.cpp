@@ -0,0 +1,148 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+
+namespace soul
+{
+
+static double getWindowedSinc (double x, double numZeroCrossings) noexcept
+{
+    if (x == 0)
+        return 1.0;
+
+    if (x > numZeroCrossings || x < -numZeroCrossings)
+        return 0;
+
+    x *= pi;
+    auto window = 0.5 + 0.5 * std::cos (x / numZeroCrossings);
+    return window * std::sin (x) / x;
+}
+
+ResamplingKernel::ResamplingKernel (double ratio, int numZeroCrossings)
+    : cutoffRatio (ratio), zeroCrossings (numZeroCrossings)
+{
+    SOUL_ASSERT (ratio > 0 && ratio <= 1.0 && numZeroCrossings > 0);
+
+    // When the cutoff is lowered, the kernel gets stretched out, so fewer phases are
+    // needed to keep the same interpolation accuracy
+    static constexpr double phasesPerZeroCrossing = 256.0;
+    numPhases  = std::max (8u, (uint32_t) std::ceil (phasesPerZeroCrossing * ratio));
+    halfLength = (uint32_t) std::ceil (numZeroCrossings / ratio);
+    rowLength  = (2 * halfLength + 3) & ~3u;
+
+    coefficients.resize ((numPhases + 1) * rowLength);
+
+    for (uint32_t phase = 0; phase <= numPhases; ++phase)
+    {
+        auto row = coefficients.data() + phase * rowLength;
+        auto fraction = phase / (double) numPhases;
+
+        for (uint32_t i = 0; i < 2 * halfLength; ++i)
+        {
+            auto distance = (double) i - (double) halfLength + 1.0 - fraction;
+            row[i] = (float) (ratio * getWindowedSinc (ratio * distance, numZeroCrossings));
+        }
+    }
+}
+
+std::shared_ptr<const ResamplingKernel> ResamplingKernel::get (double cutoffRatio, int zeroCrossings)
+{
+    static std::mutex cacheLock;
+    static std::vector<std::shared_ptr<const ResamplingKernel>> cache;
+    static constexpr size_t maxCacheSize = 8;
+
+    std::lock_guard<std::mutex> lock (cacheLock);
+
+    for (auto& k : cache)
+        if (k->cutoffRatio == cutoffRatio && k->zeroCrossings == zeroCrossings)
+            return k;
+
+    if (cache.size() >= maxCacheSize)
+        cache.erase (cache.begin());
+
+    cache.push_back (std::shared_ptr<const ResamplingKernel> (new ResamplingKernel (cutoffRatio, zeroCrossings)));
+    return cache.back();
+}
+
+float ResamplingKernel::interpolatedDotProduct (const float* source, const float* row1, const float* row2,
+                                                float proportion, uint32_t num) noexcept
+{
+    float total1 = 0, total2 = 0;
+    uint32_t i = 0;
+
+   #if SOUL_INTEL
+    auto sum1 = _mm_setzero_ps();
+    auto sum2 = _mm_setzero_ps();
+
+    for (; i + 4 <= num; i += 4)
+    {
+        auto s = _mm_loadu_ps (source + i);
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (s, _mm_loadu_ps (row1 + i)));
+        sum2 = _mm_add_ps (sum2, _mm_mul_ps (s, _mm_loadu_ps (row2 + i)));
+    }
+
+    float parts1[4], parts2[4];
+    _mm_storeu_ps (parts1, sum1);
+    _mm_storeu_ps (parts2, sum2);
+    total1 = (parts1[0] + parts1[1]) + (parts1[2] + parts1[3]);
+    total2 = (parts2[0] + parts2[1]) + (parts2[2] + parts2[3]);
+   #else
+    float sums1[4] = {}, sums2[4] = {};
+
+    for (; i + 4 <= num; i += 4)
+    {
+        for (uint32_t j = 0; j < 4; ++j)
+        {
+            sums1[j] += source[i + j] * row1[i + j];
+            sums2[j] += source[i + j] * row2[i + j];
+        }
+    }
+
+    total1 = (sums1[0] + sums1[1]) + (sums1[2] + sums1[3]);
+    total2 = (sums2[0] + sums2[1]) + (sums2[2] + sums2[3]);
+   #endif
+
+    for (; i < num; ++i)
+    {
+        total1 += source[i] * row1[i];
+        total2 += source[i] * row2[i];
+    }
+
+    return total1 + proportion * (total2 - total1);
+}
+
+double ResamplingKernel::interpolatedDotProduct (const double* source, const float* row1, const float* row2,
+                                                 float proportion, uint32_t num) noexcept
+{
+    double total1 = 0, total2 = 0;
+
+    for (uint32_t i = 0; i < num; ++i)
+    {
+        total1 += source[i] * row1[i];
+        total2 += source[i] * row2[i];
+    }
+
+    return total1 + proportion * (total2 - total1);
+}
+
+}
@@ -21,91 +21,223 @@
 namespace soul
 {
 
-/** A sinc interpolator that can resample a chunk of audio data to fit a new number of frames. */
-template <typename DestType, typename SourceType>
-void resampleToFit (DestType&& dest, const SourceType& source, int zeroCrossings = 50)
+//==============================================================================
+/** A table of windowed-sinc filter kernels, one for each of a set of evenly-spaced
+    fractional phases, which can be used to resample audio without having to evaluate
+    any trig functions per-tap.
+
+    The tables are cached and shared, keyed by their cutoff ratio and number of zero
+    crossings, so creating resamplers repeatedly for the same ratio is cheap.
+*/
+struct ResamplingKernel
 {
-    SOUL_ASSERT (dest.getNumChannels() == source.getNumChannels());
-    using SampleType = typename std::remove_reference<DestType>::type::Sample;
-    static constexpr auto localPi = SampleType (soul::pi);
+    /// Returns a (possibly shared) kernel for the given cutoff ratio, which is the
+    /// fraction of the source's bandwidth to keep, i.e. min (1, destRate / sourceRate).
+    static std::shared_ptr<const ResamplingKernel> get (double cutoffRatio, int zeroCrossings);
+
+    /// Calculates the output sample at a fractional position in some source data.
+    /// Any frames which lie outside the range 0 to numFrames are treated as silent.
+    template <typename SampleType>
+    SampleType getSample (const SampleType* data, int64_t numFrames, double position) const noexcept
+    {
+        auto base = (int64_t) std::floor (position);
+        auto phase = (position - (double) base) * numPhases;
+        auto phaseIndex = std::min ((uint32_t) phase, numPhases - 1);
+        auto row = coefficients.data() + phaseIndex * rowLength;
+        auto firstFrame = base - (int64_t) halfLength + 1;
+        auto firstTap = std::max ((int64_t) 0, -firstFrame);
+        auto endTap = std::min ((int64_t) rowLength, numFrames - firstFrame);
+
+        if (firstTap >= endTap)
+            return {};
+
+        return interpolatedDotProduct (data + (firstFrame + firstTap), row + firstTap, row + rowLength + firstTap,
+                                       (float) (phase - phaseIndex), (uint32_t) (endTap - firstTap));
+    }
+
+    /// The number of source frames either side of the output position that the kernel covers.
+    uint32_t getHalfLength() const noexcept     { return halfLength; }
+
+    const double cutoffRatio;
+    const int zeroCrossings;
+
+private:
+    ResamplingKernel (double cutoffRatio, int zeroCrossings);
+
+    uint32_t numPhases, halfLength, rowLength;
+    std::vector<float> coefficients;
+
+    /// Returns the dot-products of some source data with two adjacent kernel rows,
+    /// linearly interpolated by the given proportion.
+    static float  interpolatedDotProduct (const float* source, const float* row1, const float* row2, float proportion, uint32_t num) noexcept;
+    static double interpolatedDotProduct (const double* source, const float* row1, const float* row2, float proportion, uint32_t num) noexcept;
+};
+
+//==============================================================================
+/** A windowed-sinc resampler which processes a stream of audio in chunks of any size.
 
-    struct Resampler
+    Push source frames in with addInput(), and pull as many output frames as are
+    available with getOutput(). When the source has finished, call endOfInput(), after
+    which the remaining output frames (up to the length of the source) can be pulled.
+*/
+template <typename SampleType>
+struct StreamingResampler
+{
+    /// Creates a resampler which produces one output frame for each sourceFramesPerDestFrame
+    /// frames of input, i.e. sourceRate / destRate.
+    StreamingResampler (choc::buffer::ChannelCount numChannels, double sourceFramesPerDestFrame, int zeroCrossings = 50)
+        : kernel (ResamplingKernel::get (std::min (1.0, 1.0 / sourceFramesPerDestFrame), zeroCrossings)),
+          increment (sourceFramesPerDestFrame),
+          inputChannels (numChannels)
+    {
+        SOUL_ASSERT (sourceFramesPerDestFrame > 0);
+    }
+
+    void reset()
     {
-        static void resample (choc::buffer::MonoView<SampleType> dest, const choc::buffer::MonoView<SampleType>& source, int zeroCrossings)
+        for (auto& c : inputChannels)
+            c.clear();
+
+        bufferStartFrame = 0;
+        numInputFrames = 0;
+        numOutputFrames = 0;
+        inputFinished = false;
+    }
+
+    /// Appends a chunk of source frames to the stream.
+    template <typename SourceView>
+    void addInput (const SourceView& source)
+    {
+        SOUL_ASSERT (source.getNumChannels() == inputChannels.size() && ! inputFinished);
+        auto numFrames = source.getNumFrames();
+
+        for (choc::buffer::ChannelCount chan = 0; chan < inputChannels.size(); ++chan)
         {
-            if (dest.getNumFrames() < source.getNumFrames())
-            {
-                choc::buffer::MonoBuffer<SampleType> bandlimitedInput (1, source.getNumFrames());
-                resample (bandlimitedInput, source, float (dest.getNumFrames()) / float (source.getNumFrames()), zeroCrossings);
-                resample (dest, bandlimitedInput, 1.0f, zeroCrossings);
-            }
-            else
-            {
-                resample (dest, source, 1.0f, zeroCrossings);
-            }
+            auto& c = inputChannels[chan];
+            auto oldSize = c.size();
+            c.resize (oldSize + numFrames);
+
+            for (choc::buffer::FrameCount i = 0; i < numFrames; ++i)
+                c[oldSize + i] = static_cast<SampleType> (source.getSample (chan, i));
         }
 
-        static void resample (choc::buffer::MonoView<SampleType> dest, const choc::buffer::MonoView<SampleType>& source, float ratio, int zeroCrossings) noexcept
+        numInputFrames += numFrames;
+    }
+
+    /// Indicates that there's no more input, so that the tail of the stream can be flushed.
+    void endOfInput()       { inputFinished = true; }
+
+    /// Returns the number of frames that a call to getOutput() could currently produce.
+    uint64_t getNumOutputFramesAvailable() const
+    {
+        if (inputFinished)
+            return getNumOutputFramesBefore ((double) numInputFrames);
+
+        return getNumOutputFramesBefore ((double) numInputFrames - (double) kernel->getHalfLength());
+    }
+
+    /// Writes as many frames as are available into the destination, returning the number written.
+    template <typename DestView>
+    choc::buffer::FrameCount getOutput (DestView&& dest)
+    {
+        SOUL_ASSERT (dest.getNumChannels() == inputChannels.size());
+        auto numFrames = (choc::buffer::FrameCount) std::min ((uint64_t) dest.getNumFrames(), getNumOutputFramesAvailable());
+
+        for (choc::buffer::ChannelCount chan = 0; chan < inputChannels.size(); ++chan)
         {
-            SOUL_ASSERT (source.data.stride == 1);
-            auto sampleIncrement = double (source.getNumFrames()) / double (dest.getNumFrames());
-            auto dst = dest.data;
+            auto& c = inputChannels[chan];
+            auto output = dest.getChannel (chan).data;
 
-            for (choc::buffer::FrameCount i = 0; i < dest.getNumFrames(); ++i)
+            for (choc::buffer::FrameCount i = 0; i < numFrames; ++i)
             {
-                *dst.data = static_cast<SampleType> (ratio * getBandlimitedSample (source, sampleIncrement * i, ratio, zeroCrossings));
-                dst.data += dst.stride;
+                auto position = increment * (double) (numOutputFrames + i) - (double) bufferStartFrame;
+                *output.data = static_cast<typename std::remove_reference<DestView>::type::Sample> (kernel->getSample (c.data(), (int64_t) c.size(), position));
+                output.data += output.stride;
             }
         }
 
-        static SampleType getBandlimitedSample (const choc::buffer::MonoView<SampleType>& source, double pos, float ratio, int numZeroCrossings) noexcept
-        {
-            auto intPos  = (int64_t) pos;
-            auto fracPos = (float) (pos - (double) intPos);
-            auto result = SampleType();
-            auto floatZeroCrossings = SampleType (numZeroCrossings);
-            auto data = source.data.data;
-            auto numFrames = source.getNumFrames();
-
-            if (fracPos > 0)
-            {
-                fracPos = 1.0f - fracPos;
-                ++intPos;
-            }
+        numOutputFrames += numFrames;
+        discardUnneededInput();
+        return numFrames;
+    }
 
-            int crossings = int (float (numZeroCrossings) / ratio);
+private:
+    std::shared_ptr<const ResamplingKernel> kernel;
+    const double increment;
+    std::vector<std::vector<SampleType>> inputChannels;
+    uint64_t bufferStartFrame = 0, numInputFrames = 0, numOutputFrames = 0;
+    bool inputFinished = false;
 
-            for (int i = -crossings; i <= crossings; ++i)
-            {
-                auto sincPosition = SampleType (fracPos + (ratio * float (i)));
-                auto samplePosition = (uint32_t) (intPos + i);
+    uint64_t getNumOutputFramesBefore (double sourcePosition) const
+    {
+        if (sourcePosition <= 0)
+            return 0;
 
-                if (samplePosition < numFrames)
-                    result += static_cast<SampleType> (data[samplePosition] * windowedSinc (sincPosition, floatZeroCrossings));
-            }
+        auto total = (uint64_t) std::ceil (sourcePosition / increment);
+        return total > numOutputFrames ? total - numOutputFrames : 0;
+    }
 
-            return result;
-        }
+    void discardUnneededInput()
+    {
+        auto firstNeeded = (int64_t) std::floor (increment * (double) numOutputFrames) - (int64_t) kernel->getHalfLength();
 
-        static SampleType windowedSinc (SampleType f, SampleType numZeroCrossings) noexcept
+        if (firstNeeded > (int64_t) bufferStartFrame)
         {
-            if (f == SampleType())
-                return static_cast<SampleType> (1);
+            auto numToDiscard = (size_t) ((uint64_t) firstNeeded - bufferStartFrame);
 
-            if (f > numZeroCrossings || f < -numZeroCrossings)
-                return {};
+            // erasing from the front is only worth doing once a decent amount has built up
+            if (numToDiscard > 4096 && numToDiscard * 2 > inputChannels.front().size())
+            {
+                for (auto& c : inputChannels)
+                    c.erase (c.begin(), c.begin() + (std::ptrdiff_t) numToDiscard);
 
-            f *= localPi;
-            const auto window = SampleType (0.5) + SampleType (0.5) * std::cos (f / numZeroCrossings);
-            return window * std::sin (f) / f;
+                bufferStartFrame += numToDiscard;
+            }
         }
-    };
+    }
+};
+
+//==============================================================================
+/** A sinc interpolator that can resample a chunk of audio data to fit a new number of frames. */
+template <typename DestType, typename SourceType>
+void resampleToFit (DestType&& dest, const SourceType& source, int zeroCrossings = 50)
+{
+    SOUL_ASSERT (dest.getNumChannels() == source.getNumChannels());
+    using SampleType = typename std::remove_reference<DestType>::type::Sample;
 
     if (dest.getNumFrames() == source.getNumFrames())
         return copy (dest, source);
 
+    if (dest.getNumFrames() == 0)
+        return;
+
+    auto numSourceFrames = source.getNumFrames();
+    auto increment = double (numSourceFrames) / double (dest.getNumFrames());
+    auto kernel = ResamplingKernel::get (std::min (1.0, 1.0 / increment), zeroCrossings);
+    std::vector<SampleType> channelCopy;
+
     for (choc::buffer::ChannelCount channel = 0; channel < source.getNumChannels(); ++channel)
-        Resampler::resample (dest.getChannel (channel), source.getChannel (channel), zeroCrossings);
+    {
+        auto src = source.getChannel (channel).data;
+        auto dst = dest.getChannel (channel).data;
+        const SampleType* sourceData = src.data;
+
+        if (src.stride != 1)
+        {
+            channelCopy.resize (numSourceFrames);
+
+            for (choc::buffer::FrameCount i = 0; i < numSourceFrames; ++i)
+                channelCopy[i] = src.data[i * src.stride];
+
+            sourceData = channelCopy.data();
+        }
+
+        for (choc::buffer::FrameCount i = 0; i < dest.getNumFrames(); ++i)
+        {
+            *dst.data = kernel->getSample (sourceData, (int64_t) numSourceFrames, increment * i);
+            dst.data += dst.stride;
+        }
+    }
 }
 
 }
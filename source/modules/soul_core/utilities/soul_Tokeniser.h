@@ -97,6 +97,7 @@ struct Tokeniser
         location.location = input;
         auto last = currentType;
         currentType = matchNextToken();
+        CompileProfiler::addToCounter (CompileProfiler::Counter::tokens);
         return last;
     }
 
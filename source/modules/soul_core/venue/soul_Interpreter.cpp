@@ -0,0 +1,3832 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+
+namespace soul::interpreter
+{
+
+//==============================================================================
+template <typename Type>
+static Type load (const void* source) noexcept
+{
+    Type result;
+    std::memcpy (std::addressof (result), source, sizeof (Type));
+    return result;
+}
+
+template <typename Type>
+static void store (void* dest, Type value) noexcept
+{
+    std::memcpy (dest, std::addressof (value), sizeof (Type));
+}
+
+static constexpr uint32_t alignTo8 (uint64_t size)     { return static_cast<uint32_t> ((size + 7u) & ~static_cast<uint64_t> (7u)); }
+
+static int64_t wrapIndex (int64_t index, int64_t size) noexcept
+{
+    if (size == 0)
+        return 0;
+
+    auto result = index % size;
+    return result < 0 ? result + size : result;
+}
+
+/// Values are held in memory using the same packed layout as a soul::Value, except for
+/// unsized arrays, which are held as a pointer and element count rather than a handle
+/// into the program's ConstantTable.
+struct UnsizedArray
+{
+    uint8_t* elements;
+    int64_t numElements;
+};
+
+static uint32_t getPackedSize (const Type& type)
+{
+    if (type.isReference())       return getPackedSize (type.removeReference());
+    if (type.isUnsizedArray())    return sizeof (UnsizedArray);
+    if (type.isFixedSizeArray())  return getPackedSize (type.getArrayElementType()) * static_cast<uint32_t> (type.getArraySize());
+
+    if (type.isStruct())
+    {
+        uint32_t size = 0;
+
+        for (auto& m : type.getStructRef().getMembers())
+            size += getPackedSize (m.type);
+
+        return size;
+    }
+
+    if (type.isVoid())
+        return 0;
+
+    return static_cast<uint32_t> (type.getPackedSizeInBytes());
+}
+
+static uint32_t getStructMemberOffset (const Structure& s, size_t memberIndex)
+{
+    uint32_t offset = 0;
+
+    for (size_t i = 0; i < memberIndex; ++i)
+        offset += getPackedSize (s.getMembers()[i].type);
+
+    return offset;
+}
+
+static bool containsUnsizedArray (const Type& type)
+{
+    if (type.isUnsizedArray())    return true;
+    if (type.isFixedSizeArray())  return containsUnsizedArray (type.getArrayElementType());
+
+    if (type.isStruct())
+        for (auto& m : type.getStructRef().getMembers())
+            if (containsUnsizedArray (m.type))
+                return true;
+
+    return false;
+}
+
+/// Bounded ints are stored as int32s
+static PrimitiveType getStoragePrimitive (const Type& type)
+{
+    if (type.isBoundedInt())
+        return PrimitiveType::int32;
+
+    return type.getPrimitiveType();
+}
+
+static uint32_t getNumVectorElements (const Type& type)
+{
+    return type.isVector() ? static_cast<uint32_t> (type.getVectorSize()) : 1u;
+}
+
+/// Returns true if two types are held in memory in exactly the same way
+static bool haveSameLayout (const Type& a, const Type& b)
+{
+    if (a.isBoundedInt() || b.isBoundedInt())
+        return (a.isBoundedInt() || a.isInteger32()) && (b.isBoundedInt() || b.isInteger32())
+                 && ! (a.isVector() || b.isVector() || a.isArray() || b.isArray());
+
+    return a.isEqual (b, Type::ignoreConst | Type::ignoreReferences | Type::ignoreVectorSize1);
+}
+
+/// If a type is made up of a flat sequence of a single primitive type (i.e. it's a scalar,
+/// vector, or a fixed array of these), this returns that primitive and the number of elements.
+static bool getFlattenedPrimitives (const Type& type, PrimitiveType& primitive, uint32_t& count)
+{
+    if (type.isPrimitive() || type.isBoundedInt() || type.isVector())
+    {
+        primitive = getStoragePrimitive (type);
+        count = getNumVectorElements (type);
+        return true;
+    }
+
+    if (type.isFixedSizeArray() && getFlattenedPrimitives (type.getArrayElementType(), primitive, count))
+    {
+        count *= static_cast<uint32_t> (type.getArraySize());
+        return true;
+    }
+
+    return false;
+}
+
+//==============================================================================
+/// Each function gets a frame which begins with a table of pointers ("slots"), followed
+/// by a data area holding its parameters and local variables. An Address is resolved at
+/// compile-time to a slot and an offset from it, so at runtime, finding any operand is
+/// just a load and an add.
+struct Address
+{
+    uint32_t slot = 0, offset = 0;
+
+    uint8_t* get (uint8_t** slots) const noexcept   { return slots[slot] + offset; }
+    Address withOffset (uint32_t extra) const       { return { slot, offset + extra }; }
+};
+
+enum FixedSlots : uint32_t
+{
+    frameSlot     = 0,
+    stateSlot     = 1,
+    constantsSlot = 2,
+    returnSlot    = 3,
+    nodeSlot      = 4,
+    stackTopSlot  = 5,
+    numFixedSlots = 6
+};
+
+struct Instruction;
+using Handler = const Instruction* (*) (const Instruction&, uint8_t** slots) noexcept;
+
+/// A single step in a compiled function. Every operand has been resolved to an Address, and
+/// every handler is selected for the exact types involved, so at runtime each instruction
+/// simply calls its handler, which returns the next instruction to run (or nullptr when the
+/// function returns). This is call-threaded dispatch: it gets the same benefit as direct
+/// threading (no central switch, one indirect branch per instruction), but in portable C++.
+struct Instruction
+{
+    Handler handler = nullptr;
+    Address dest, a, b;
+    uint32_t size = 0, count = 0, index = 0, extra = 0;
+    const void* data = nullptr;
+    const Instruction* targets[2] = {};
+};
+
+static void execute (const Instruction* ip, uint8_t** slots) noexcept
+{
+    while (ip != nullptr)
+        ip = ip->handler (*ip, slots);
+}
+
+static const Instruction* next (const Instruction& i) noexcept    { return std::addressof (i) + 1; }
+
+//==============================================================================
+namespace handlers
+{
+    static const Instruction* copy (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memmove (i.dest.get (s), i.a.get (s), i.size);
+        return next (i);
+    }
+
+    template <size_t size>
+    static const Instruction* copyFixed (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (i.dest.get (s), i.a.get (s), size);
+        return next (i);
+    }
+
+    static const Instruction* zero (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memset (i.dest.get (s), 0, i.size);
+        return next (i);
+    }
+
+    static const Instruction* bindReference (const Instruction& i, uint8_t** s) noexcept
+    {
+        s[i.dest.slot] = i.a.get (s);
+        return next (i);
+    }
+
+    /// Copies the first element of an array into the rest of it
+    static const Instruction* replicate (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto dest = i.dest.get (s);
+
+        for (uint32_t n = 1; n < i.count; ++n)
+            std::memcpy (dest + n * i.size, dest, i.size);
+
+        return next (i);
+    }
+
+    static const Instruction* jump (const Instruction& i, uint8_t**) noexcept
+    {
+        return i.targets[0];
+    }
+
+    static const Instruction* branchIf (const Instruction& i, uint8_t** s) noexcept
+    {
+        return load<bool> (i.a.get (s)) ? i.targets[0] : i.targets[1];
+    }
+
+    static const Instruction* returnVoid (const Instruction&, uint8_t**) noexcept
+    {
+        return nullptr;
+    }
+
+    static const Instruction* returnValue (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (s[returnSlot], i.a.get (s), i.size);
+        return nullptr;
+    }
+
+    //==============================================================================
+    template <typename Type> using UnsignedOf = std::make_unsigned_t<Type>;
+
+    struct Add       { template <typename T> static T apply (T a, T b) noexcept  { if constexpr (std::is_integral_v<T>) return static_cast<T> (static_cast<UnsignedOf<T>> (a) + static_cast<UnsignedOf<T>> (b)); else return a + b; } };
+    struct Subtract  { template <typename T> static T apply (T a, T b) noexcept  { if constexpr (std::is_integral_v<T>) return static_cast<T> (static_cast<UnsignedOf<T>> (a) - static_cast<UnsignedOf<T>> (b)); else return a - b; } };
+    struct Multiply  { template <typename T> static T apply (T a, T b) noexcept  { if constexpr (std::is_integral_v<T>) return static_cast<T> (static_cast<UnsignedOf<T>> (a) * static_cast<UnsignedOf<T>> (b)); else return a * b; } };
+
+    struct Divide
+    {
+        template <typename T> static T apply (T a, T b) noexcept
+        {
+            if constexpr (std::is_integral_v<T>)
+            {
+                if (b == 0)  return 0;
+                if (b == -1) return Subtract::apply (T(), a);
+            }
+
+            return a / b;
+        }
+    };
+
+    struct Modulo
+    {
+        template <typename T> static T apply (T a, T b) noexcept
+        {
+            if constexpr (std::is_integral_v<T>)
+                return (b == 0 || b == -1) ? T() : a % b;
+            else
+                return std::fmod (a, b);
+        }
+    };
+
+    struct BitwiseAnd  { template <typename T> static T apply (T a, T b) noexcept  { return a & b; } };
+    struct BitwiseOr   { template <typename T> static T apply (T a, T b) noexcept  { return a | b; } };
+    struct BitwiseXor  { template <typename T> static T apply (T a, T b) noexcept  { return a ^ b; } };
+    struct LogicalAnd  { template <typename T> static bool apply (T a, T b) noexcept  { return a && b; } };
+    struct LogicalOr   { template <typename T> static bool apply (T a, T b) noexcept  { return a || b; } };
+
+    template <typename T> static constexpr T shiftMask = static_cast<T> (sizeof (T) * 8 - 1);
+
+    struct LeftShift          { template <typename T> static T apply (T a, T b) noexcept  { return static_cast<T> (static_cast<UnsignedOf<T>> (a) << (b & shiftMask<T>)); } };
+    struct RightShift         { template <typename T> static T apply (T a, T b) noexcept  { return static_cast<T> (a >> (b & shiftMask<T>)); } };
+    struct RightShiftUnsigned { template <typename T> static T apply (T a, T b) noexcept  { return static_cast<T> (static_cast<UnsignedOf<T>> (a) >> (b & shiftMask<T>)); } };
+
+    struct Equals             { template <typename T> static bool apply (T a, T b) noexcept  { return a == b; } };
+    struct NotEquals          { template <typename T> static bool apply (T a, T b) noexcept  { return a != b; } };
+    struct LessThan           { template <typename T> static bool apply (T a, T b) noexcept  { return a < b; } };
+    struct LessThanOrEqual    { template <typename T> static bool apply (T a, T b) noexcept  { return a <= b; } };
+    struct GreaterThan        { template <typename T> static bool apply (T a, T b) noexcept  { return a > b; } };
+    struct GreaterThanOrEqual { template <typename T> static bool apply (T a, T b) noexcept  { return a >= b; } };
+
+    struct Negate             { template <typename T> static T apply (T a) noexcept  { return Subtract::apply (T(), a); } };
+    struct BitwiseNot         { template <typename T> static T apply (T a) noexcept  { return ~a; } };
+    struct LogicalNot         { template <typename T> static bool apply (T a) noexcept  { return ! a; } };
+
+    template <typename T, typename Op>
+    static const Instruction* binaryOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), Op::apply (load<T> (i.a.get (s)), load<T> (i.b.get (s))));
+        return next (i);
+    }
+
+    template <typename T, typename Op>
+    static const Instruction* vectorBinaryOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        using ResultType = decltype (Op::apply (T(), T()));
+        auto dest = i.dest.get (s);
+        auto a = i.a.get (s);
+        auto b = i.b.get (s);
+
+        for (uint32_t n = 0; n < i.count; ++n)
+            store (dest + n * sizeof (ResultType), Op::apply (load<T> (a + n * sizeof (T)), load<T> (b + n * sizeof (T))));
+
+        return next (i);
+    }
+
+    template <typename T, typename Op>
+    static const Instruction* unaryOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), Op::apply (load<T> (i.a.get (s))));
+        return next (i);
+    }
+
+    template <typename T, typename Op>
+    static const Instruction* vectorUnaryOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        using ResultType = decltype (Op::apply (T()));
+        auto dest = i.dest.get (s);
+        auto a = i.a.get (s);
+
+        for (uint32_t n = 0; n < i.count; ++n)
+            store (dest + n * sizeof (ResultType), Op::apply (load<T> (a + n * sizeof (T))));
+
+        return next (i);
+    }
+
+    static const Instruction* bytesEqual (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), std::memcmp (i.a.get (s), i.b.get (s), i.size) == 0);
+        return next (i);
+    }
+
+    static const Instruction* bytesNotEqual (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), std::memcmp (i.a.get (s), i.b.get (s), i.size) != 0);
+        return next (i);
+    }
+
+    //==============================================================================
+    template <typename From, typename To>
+    static To convert (From v) noexcept
+    {
+        if constexpr (std::is_same_v<To, bool>)
+        {
+            return v != 0;
+        }
+        else if constexpr (std::is_floating_point_v<From> && std::is_integral_v<To>)
+        {
+            if (! (v == v))                                                  return 0;
+            if (v >= static_cast<From> (std::numeric_limits<To>::max()))    return std::numeric_limits<To>::max();
+            if (v <= static_cast<From> (std::numeric_limits<To>::min()))    return std::numeric_limits<To>::min();
+            return static_cast<To> (v);
+        }
+        else
+        {
+            return static_cast<To> (v);
+        }
+    }
+
+    template <typename From, typename To>
+    static const Instruction* castOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), convert<From, To> (load<From> (i.a.get (s))));
+        return next (i);
+    }
+
+    template <typename From, typename To>
+    static const Instruction* vectorCastOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto dest = i.dest.get (s);
+        auto source = i.a.get (s);
+
+        for (uint32_t n = 0; n < i.count; ++n)
+            store (dest + n * sizeof (To), convert<From, To> (load<From> (source + n * sizeof (From))));
+
+        return next (i);
+    }
+
+    template <typename From, typename To>
+    static const Instruction* broadcastCastOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto dest = i.dest.get (s);
+        auto value = convert<From, To> (load<From> (i.a.get (s)));
+
+        for (uint32_t n = 0; n < i.count; ++n)
+            store (dest + n * sizeof (To), value);
+
+        return next (i);
+    }
+
+    template <typename From>
+    static const Instruction* wrapOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto value = convert<From, int64_t> (load<From> (i.a.get (s)));
+        store (i.dest.get (s), static_cast<int32_t> (wrapIndex (value, i.count)));
+        return next (i);
+    }
+
+    template <typename From>
+    static const Instruction* clampOp (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto value = convert<From, int64_t> (load<From> (i.a.get (s)));
+        store (i.dest.get (s), static_cast<int32_t> (value < 0 ? 0 : std::min (value, static_cast<int64_t> (i.count) - 1)));
+        return next (i);
+    }
+
+    static const Instruction* makeUnsizedArray (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), UnsizedArray { i.a.get (s), static_cast<int64_t> (i.count) });
+        return next (i);
+    }
+
+    static const Instruction* getUnsizedArraySize (const Instruction& i, uint8_t** s) noexcept
+    {
+        store (i.dest.get (s), static_cast<int32_t> (load<UnsizedArray> (i.a.get (s)).numElements));
+        return next (i);
+    }
+
+    //==============================================================================
+    // These compute the address of an array element, and store it in the destination slot
+
+    template <typename IndexType, bool shouldWrap>
+    static const Instruction* elementAddress (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto index = static_cast<int64_t> (load<IndexType> (i.b.get (s)));
+
+        if constexpr (shouldWrap)
+            index = wrapIndex (index, i.count);
+
+        s[i.dest.slot] = i.a.get (s) + index * static_cast<int64_t> (i.size);
+        return next (i);
+    }
+
+    static uint8_t emptyArrayElement[256] = {};
+
+    template <typename IndexType>
+    static const Instruction* unsizedElementAddress (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto array = load<UnsizedArray> (i.a.get (s));
+
+        if (array.numElements > 0)
+            s[i.dest.slot] = array.elements + wrapIndex (static_cast<int64_t> (load<IndexType> (i.b.get (s))), array.numElements) * i.size;
+        else
+            s[i.dest.slot] = emptyArrayElement;
+
+        return next (i);
+    }
+
+    static const Instruction* unsizedSliceAddress (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto array = load<UnsizedArray> (i.a.get (s));
+        s[i.dest.slot] = array.numElements > 0 ? array.elements + i.size : emptyArrayElement;
+        return next (i);
+    }
+
+    //==============================================================================
+    #define SOUL_INTERPRETER_UNARY_MATHS_FUNCTIONS(X) \
+        X(sqrt) X(exp) X(log) X(log10) X(sin) X(cos) X(tan) X(sinh) X(cosh) X(tanh) \
+        X(asinh) X(acosh) X(atanh) X(asin) X(acos) X(atan)
+
+    #define SOUL_DECLARE_MATHS_FUNCTION(name) \
+        struct Maths_ ## name { template <typename T> static T apply (T a) noexcept  { return std::name (a); } };
+
+    SOUL_INTERPRETER_UNARY_MATHS_FUNCTIONS (SOUL_DECLARE_MATHS_FUNCTION)
+    #undef SOUL_DECLARE_MATHS_FUNCTION
+
+    struct Maths_pow    { template <typename T> static T apply (T a, T b) noexcept  { return std::pow (a, b); } };
+    struct Maths_atan2  { template <typename T> static T apply (T a, T b) noexcept  { return std::atan2 (a, b); } };
+    struct Maths_isnan  { template <typename T> static bool apply (T a) noexcept    { return std::isnan (a); } };
+    struct Maths_isinf  { template <typename T> static bool apply (T a) noexcept    { return std::isinf (a); } };
+}
+
+//==============================================================================
+/// A time-ordered list of events, with their data held in a single block of bytes
+struct EventQueue
+{
+    struct Event
+    {
+        int64_t time;
+        uint32_t typeIndex;
+        int32_t element;
+        uint32_t dataOffset, dataSize;
+    };
+
+    void add (int64_t time, uint32_t typeIndex, int32_t element, const void* source, uint32_t size)
+    {
+        Event e { time, typeIndex, element, static_cast<uint32_t> (data.size()), size };
+        data.insert (data.end(), static_cast<const uint8_t*> (source), static_cast<const uint8_t*> (source) + size);
+
+        if (events.size() == firstEvent || events.back().time <= time)
+            events.push_back (e);
+        else
+            events.insert (std::upper_bound (events.begin() + static_cast<std::ptrdiff_t> (firstEvent), events.end(), time,
+                                             [] (int64_t t, const Event& other) { return t < other.time; }), e);
+    }
+
+    bool isEmpty() const                                { return firstEvent == events.size(); }
+    const Event& front() const                          { return events[firstEvent]; }
+    const uint8_t* getData (const Event& e) const       { return data.data() + e.dataOffset; }
+    bool hasEventBefore (int64_t time) const            { return ! isEmpty() && front().time < time; }
+
+    void removeFront()
+    {
+        if (++firstEvent == events.size())
+            clear();
+    }
+
+    void clear()
+    {
+        events.clear();
+        data.clear();
+        firstEvent = 0;
+    }
+
+    template <typename Fn>
+    void iterate (Fn&& fn) const
+    {
+        for (auto i = firstEvent; i < events.size(); ++i)
+            fn (events[i]);
+    }
+
+    std::vector<Event> events;
+    std::vector<uint8_t> data;
+    size_t firstEvent = 0;
+};
+
+struct Wire;
+
+/// The runtime state of one endpoint of one processor or graph instance
+struct Port
+{
+    Port (const heart::IODeclaration& io, int rate)
+        : endpointType (io.endpointType), dataTypes (io.dataTypes),
+          arraySize (io.arraySize.value_or (1)), isArray (io.arraySize.has_value()), rateExponent (rate)
+    {
+        if (! isEvent (endpointType))
+        {
+            auto& elementType = dataTypes.front();
+            primitive = getStoragePrimitive (elementType);
+            elementSize = getPackedSize (elementType);
+            frameSize = elementSize * arraySize;
+            primitivesPerElement = getNumVectorElements (elementType);
+        }
+
+        if (isValue (endpointType))
+            value.resize (frameSize);
+    }
+
+    Type getFrameType() const
+    {
+        auto& type = dataTypes.front();
+        return isArray ? type.createArray (arraySize) : type;
+    }
+
+    uint8_t* getHistoryFrame (int64_t frame)    { return history.data() + static_cast<size_t> (frame & historyMask) * frameSize; }
+    uint8_t* getChunkFrame (int64_t frame)      { return chunk.data() + static_cast<size_t> (frame - chunkStart) * frameSize; }
+
+    EndpointType endpointType;
+    std::vector<Type> dataTypes;
+    uint32_t arraySize;
+    bool isArray;
+    int rateExponent;
+
+    PrimitiveType primitive;
+    uint32_t elementSize = 0, frameSize = 0, primitivesPerElement = 0;
+
+    int64_t chunkStart = 0;
+    std::vector<uint8_t> chunk, history, value;
+    int64_t historyMask = 0;
+    EventQueue pendingEvents, chunkEvents;
+
+    std::vector<Wire*> incoming, outgoing;
+
+    // For endpoints of the main processor, these hold the data for the current block
+    bool isExternalInput = false, isExternalOutput = false;
+    std::vector<uint8_t> externalFrames;
+    EventQueue externalEvents;
+};
+
+/// A connection between two ports. The delay is measured in frames at the destination's rate.
+struct Wire
+{
+    Port& source;
+    Port& dest;
+    int32_t sourceElement, destElement;
+    int64_t delay;
+    InterpolationType interpolation;
+
+    struct EventTypeMapping
+    {
+        uint32_t destTypeIndex;
+        bool needsConversion;
+    };
+
+    std::vector<EventTypeMapping> eventTypes;
+};
+
+struct CompiledModule;
+struct CompiledFunction;
+
+/// Either an instance of a processor, or a junction that represents one endpoint of a graph
+/// instance. Junctions have a single port which appears as both their input and output.
+struct Node
+{
+    int rateExponent = 0;
+    std::vector<Port*> inputs, outputs;
+
+    CompiledModule* module = nullptr;
+    int32_t instanceID = 0;
+    std::vector<uint64_t> state, runFrame;
+    const Instruction* resumePoint = nullptr;
+    int64_t chunkStart = 0;
+    uint32_t currentFrame = 0, extraFramesAdvanced = 0;
+
+    bool isJunction() const     { return module == nullptr; }
+    uint8_t* getState()         { return reinterpret_cast<uint8_t*> (state.data()); }
+};
+
+/// Describes the way a function's arguments are passed to it
+struct ParameterInfo
+{
+    Type type;
+    bool isReference;
+    uint32_t slotOrOffset, size;
+};
+
+struct CompiledFunction
+{
+    CompiledFunction (heart::Function& f) : function (f) {}
+
+    heart::Function& function;
+    std::vector<Instruction> code;
+    std::vector<ParameterInfo> parameters;
+    std::vector<const CompiledFunction*> callees;
+    uint32_t numSlots = numFixedSlots, dataSize = 0;
+    mutable uint32_t stackSizeNeeded = 0;
+
+    uint32_t getFrameSize() const       { return numSlots * static_cast<uint32_t> (sizeof (uint8_t*)) + alignTo8 (dataSize); }
+
+    /// The total stack needed to run this function, including the deepest chain of calls it can make
+    uint32_t getStackSizeNeeded() const
+    {
+        if (stackSizeNeeded == 0)
+            stackSizeNeeded = getFrameSize() + getStackSizeNeededForCallees();
+
+        return stackSizeNeeded;
+    }
+
+    uint32_t getStackSizeNeededForCallees() const
+    {
+        uint32_t size = 0;
+
+        for (auto c : callees)
+            size = std::max (size, c->getStackSizeNeeded());
+
+        return size;
+    }
+
+    void initialiseSlots (uint8_t** slots, uint8_t* state, uint8_t* constants, uint8_t* returnDest, Node& node) const
+    {
+        auto frame = reinterpret_cast<uint8_t*> (slots);
+        slots[frameSlot]     = frame + numSlots * sizeof (uint8_t*);
+        slots[stateSlot]     = state;
+        slots[constantsSlot] = constants;
+        slots[returnSlot]    = returnDest;
+        slots[nodeSlot]      = reinterpret_cast<uint8_t*> (std::addressof (node));
+        slots[stackTopSlot]  = frame + getFrameSize();
+    }
+};
+
+struct CallArgument
+{
+    Address source;
+    ParameterInfo parameter;
+};
+
+struct CallInfo
+{
+    const CompiledFunction& function;
+    std::vector<CallArgument> arguments;
+};
+
+//==============================================================================
+namespace handlers
+{
+    static Node& getNode (uint8_t** s) noexcept    { return *reinterpret_cast<Node*> (s[nodeSlot]); }
+
+    static const Instruction* call (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto& info = *static_cast<const CallInfo*> (i.data);
+        auto& f = info.function;
+        auto newSlots = reinterpret_cast<uint8_t**> (s[stackTopSlot]);
+        f.initialiseSlots (newSlots, s[stateSlot], s[constantsSlot], i.dest.get (s), getNode (s));
+        auto frameData = newSlots[frameSlot];
+
+        for (auto& arg : info.arguments)
+        {
+            if (arg.parameter.isReference)
+                newSlots[arg.parameter.slotOrOffset] = arg.source.get (s);
+            else
+                std::memcpy (frameData + arg.parameter.slotOrOffset, arg.source.get (s), arg.parameter.size);
+        }
+
+        execute (f.code.data(), newSlots);
+        return next (i);
+    }
+
+    static const Instruction* advance (const Instruction& i, uint8_t** s) noexcept
+    {
+        getNode (s).resumePoint = next (i);
+        return nullptr;
+    }
+
+    // count = the number of frames, which the run function has checked are available
+    static const Instruction* advanceFrames (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto& node = getNode (s);
+        node.resumePoint = next (i);
+        node.extraFramesAdvanced = i.count - 1;
+        return nullptr;
+    }
+
+    template <typename IndexType>
+    static uint32_t getElementOffset (const Instruction& i, uint8_t** s, uint32_t arraySize, uint32_t elementSize) noexcept
+    {
+        return static_cast<uint32_t> (wrapIndex (static_cast<int64_t> (load<IndexType> (i.b.get (s))), arraySize)) * elementSize;
+    }
+
+    static uint8_t* getInputFrame (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto& node = getNode (s);
+        auto& port = *node.inputs[i.index];
+        return port.chunk.data() + node.currentFrame * port.frameSize;
+    }
+
+    static uint8_t* getOutputFrame (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto& node = getNode (s);
+        auto& port = *node.outputs[i.index];
+        return port.chunk.data() + node.currentFrame * port.frameSize;
+    }
+
+    // For stream and value endpoints, index = endpoint index, size = bytes to copy, and either
+    // extra = a fixed byte offset into the frame, or count = the array size for a dynamic element.
+    static const Instruction* readStream (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (i.dest.get (s), getInputFrame (i, s) + i.extra, i.size);
+        return next (i);
+    }
+
+    template <typename IndexType>
+    static const Instruction* readStreamElement (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (i.dest.get (s), getInputFrame (i, s) + getElementOffset<IndexType> (i, s, i.count, i.size), i.size);
+        return next (i);
+    }
+
+    static const Instruction* readValue (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (i.dest.get (s), getNode (s).inputs[i.index]->value.data() + i.extra, i.size);
+        return next (i);
+    }
+
+    template <typename IndexType>
+    static const Instruction* readValueElement (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (i.dest.get (s), getNode (s).inputs[i.index]->value.data() + getElementOffset<IndexType> (i, s, i.count, i.size), i.size);
+        return next (i);
+    }
+
+    template <typename T>
+    static void accumulate (uint8_t* dest, const uint8_t* source, uint32_t count) noexcept
+    {
+        for (uint32_t n = 0; n < count; ++n)
+        {
+            auto d = dest + n * sizeof (T);
+
+            if constexpr (std::is_same_v<T, bool>)
+                store (d, load<T> (d) || load<T> (source + n * sizeof (T)));
+            else
+                store (d, static_cast<T> (load<T> (d) + load<T> (source + n * sizeof (T))));
+        }
+    }
+
+    // Stream writes are summed, so that multiple writes in the same frame get mixed
+    template <typename T>
+    static const Instruction* writeStream (const Instruction& i, uint8_t** s) noexcept
+    {
+        accumulate<T> (getOutputFrame (i, s) + i.extra, i.a.get (s), i.count);
+        return next (i);
+    }
+
+    template <typename T, typename IndexType>
+    static const Instruction* writeStreamElement (const Instruction& i, uint8_t** s) noexcept
+    {
+        accumulate<T> (getOutputFrame (i, s) + getElementOffset<IndexType> (i, s, i.extra, i.size), i.a.get (s), i.count);
+        return next (i);
+    }
+
+    static const Instruction* writeValue (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (getNode (s).outputs[i.index]->value.data() + i.extra, i.a.get (s), i.size);
+        return next (i);
+    }
+
+    template <typename IndexType>
+    static const Instruction* writeValueElement (const Instruction& i, uint8_t** s) noexcept
+    {
+        std::memcpy (getNode (s).outputs[i.index]->value.data() + getElementOffset<IndexType> (i, s, i.count, i.size), i.a.get (s), i.size);
+        return next (i);
+    }
+
+    // For events, count = the type index, and extra = the element index, or the array
+    // size for a dynamic element. An element of -1 means the event goes to all elements.
+    static const Instruction* writeEvent (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto& node = getNode (s);
+        node.outputs[i.index]->chunkEvents.add (node.chunkStart + node.currentFrame, i.count,
+                                                static_cast<int32_t> (i.extra), i.a.get (s), i.size);
+        return next (i);
+    }
+
+    template <typename IndexType>
+    static const Instruction* writeEventElement (const Instruction& i, uint8_t** s) noexcept
+    {
+        auto& node = getNode (s);
+        auto element = wrapIndex (static_cast<int64_t> (load<IndexType> (i.b.get (s))), i.extra);
+        node.outputs[i.index]->chunkEvents.add (node.chunkStart + node.currentFrame, i.count,
+                                                static_cast<int32_t> (element), i.a.get (s), i.size);
+        return next (i);
+    }
+}
+
+//==============================================================================
+struct CompiledModule
+{
+    CompiledModule (Module& m) : module (m) {}
+
+    struct EventHandler
+    {
+        const CompiledFunction* function = nullptr;
+        bool hasIndexParameter = false;
+    };
+
+    Module& module;
+    std::unordered_map<const heart::Variable*, uint32_t> stateOffsets;
+    uint32_t stateSize = 0, periodOffset = 0, frequencyOffset = 0, idOffset = 0, sessionOffset = 0, latencyOffset = 0,
+             framesAvailableOffset = 0;
+    std::vector<uint8_t> initialState;
+    const CompiledFunction* run = nullptr;
+    const CompiledFunction* stateInitialiser = nullptr;
+    const CompiledFunction* systemInit = nullptr;
+    const CompiledFunction* userInit = nullptr;
+    const CompiledFunction* cachedValueUpdater = nullptr;
+    std::vector<std::vector<EventHandler>> eventHandlers;
+
+    uint32_t getPropertyOffset (heart::ProcessorProperty::Property p) const
+    {
+        switch (p)
+        {
+            case heart::ProcessorProperty::Property::period:     return periodOffset;
+            case heart::ProcessorProperty::Property::frequency:  return frequencyOffset;
+            case heart::ProcessorProperty::Property::id:         return idOffset;
+            case heart::ProcessorProperty::Property::session:    return sessionOffset;
+            case heart::ProcessorProperty::Property::latency:    return latencyOffset;
+            case heart::ProcessorProperty::Property::framesAvailable:  return framesAvailableOffset;
+            case heart::ProcessorProperty::Property::none:
+            default:                                             SOUL_ASSERT_FALSE; return 0;
+        }
+    }
+};
+
+//==============================================================================
+/// Holds everything that's produced when a program is translated: the compiled functions,
+/// the layout of each processor's state, and a pool of constant data.
+struct CompiledProgram
+{
+    CompiledProgram (Program p) : program (std::move (p)) {}
+
+    CompiledFunction& getFunction (heart::Function& f)
+    {
+        auto& compiled = functions[std::addressof (f)];
+
+        if (compiled == nullptr)
+        {
+            compiled = std::make_unique<CompiledFunction> (f);
+
+            // Parameters come first in the frame, so that callers know where to put their arguments
+            // before the function itself has been compiled
+            for (auto& p : f.parameters)
+            {
+                auto type = p->type;
+                auto size = getPackedSize (type);
+
+                if (type.isReference())
+                {
+                    compiled->parameters.push_back ({ type, true, compiled->numSlots++, size });
+                }
+                else
+                {
+                    compiled->parameters.push_back ({ type, false, compiled->dataSize, size });
+                    compiled->dataSize += alignTo8 (size);
+                }
+            }
+
+            functionsToCompile.push_back (compiled.get());
+        }
+
+        return *compiled;
+    }
+
+    CompiledModule& getModule (Module& m)
+    {
+        auto& compiled = modules[std::addressof (m)];
+
+        if (compiled == nullptr)
+        {
+            compiled = std::make_unique<CompiledModule> (m);
+            layOutState (*compiled);
+            findEntryPoints (*compiled);
+        }
+
+        return *compiled;
+    }
+
+    CompiledModule* findProcessorContainingFunction (const heart::Function& f)
+    {
+        if (auto m = program.findModuleContainingFunction (f))
+            if (m->isProcessor())
+                return std::addressof (getModule (*m));
+
+        return nullptr;
+    }
+
+    /// Variables which aren't part of a processor's state (i.e. externals, and constants in
+    /// namespaces or other modules) live in the constant pool.
+    uint32_t getGlobalVariable (const heart::Variable& v)
+    {
+        auto found = globalVariables.find (std::addressof (v));
+
+        if (found != globalVariables.end())
+            return found->second;
+
+        auto offset = allocateConstant (getPackedSize (v.type));
+        globalVariables[std::addressof (v)] = offset;
+
+        if (v.isExternal())
+        {
+            if (auto value = program.getConstantTable().getValueForHandle (v.externalHandle))
+                writeValue (constants, offset, *value, v.type);
+        }
+        else if (v.initialValue != nullptr)
+        {
+            auto value = v.initialValue->getAsConstant();
+
+            if (value.isValid())
+                writeValue (constants, offset, value, v.type);
+        }
+
+        return offset;
+    }
+
+    uint32_t addConstant (const Value& value)
+    {
+        auto offset = allocateConstant (getPackedSize (value.getType()));
+        writeValue (constants, offset, value, value.getType());
+        return offset;
+    }
+
+    uint32_t allocateConstant (uint32_t size)
+    {
+        auto offset = alignTo8 (constants.size());
+        constants.resize (offset + std::max (size, 1u));
+        return offset;
+    }
+
+    void compileAllFunctions();
+
+    void finalise()
+    {
+        for (auto& f : fixups)
+            store (f.buffer->data() + f.offset, UnsizedArray { constants.data() + f.targetOffset, f.numElements });
+
+        fixups.clear();
+    }
+
+    Program program;
+    std::vector<uint8_t> constants;
+    std::vector<std::unique_ptr<CallInfo>> callInfos;
+
+private:
+    struct PointerFixup
+    {
+        std::vector<uint8_t>* buffer;
+        uint32_t offset, targetOffset;
+        int64_t numElements;
+    };
+
+    std::unordered_map<const heart::Function*, std::unique_ptr<CompiledFunction>> functions;
+    std::unordered_map<const Module*, std::unique_ptr<CompiledModule>> modules;
+    std::unordered_map<const heart::Variable*, uint32_t> globalVariables;
+    std::vector<CompiledFunction*> functionsToCompile;
+    std::vector<PointerFixup> fixups;
+
+    void writeValue (std::vector<uint8_t>& buffer, uint32_t offset, const Value& value, const Type& targetType)
+    {
+        if (value.getType().isIdentical (targetType.removeReferenceIfPresent().removeConstIfPresent()))
+            return writePackedData (buffer, offset, value.getType(), static_cast<const uint8_t*> (value.getPackedData()));
+
+        auto converted = value.castToTypeExpectingSuccess (targetType.removeReferenceIfPresent().removeConstIfPresent());
+        writePackedData (buffer, offset, converted.getType(), static_cast<const uint8_t*> (converted.getPackedData()));
+    }
+
+    /// Copies the packed data of a Value into a buffer, expanding any unsized arrays that it contains
+    /// into the constant pool, and adding fixups for the pointers to them.
+    void writePackedData (std::vector<uint8_t>& buffer, uint32_t offset, const Type& type, const uint8_t* source)
+    {
+        if (! containsUnsizedArray (type))
+        {
+            std::memcpy (buffer.data() + offset, source, getPackedSize (type));
+            return;
+        }
+
+        if (type.isUnsizedArray())
+        {
+            store (buffer.data() + offset, UnsizedArray { nullptr, 0 });
+
+            if (auto content = program.getConstantTable().getValueForHandle (load<ConstantTable::Handle> (source)))
+            {
+                auto& arrayType = content->getType();
+
+                if (arrayType.isFixedSizeArray())
+                {
+                    auto target = allocateConstant (getPackedSize (arrayType));
+                    writePackedData (constants, target, arrayType, static_cast<const uint8_t*> (content->getPackedData()));
+                    fixups.push_back ({ std::addressof (buffer), offset, target, static_cast<int64_t> (arrayType.getArraySize()) });
+                }
+            }
+
+            return;
+        }
+
+        if (type.isFixedSizeArray())
+        {
+            auto elementType = type.getArrayElementType();
+            auto sourceElementSize = static_cast<uint32_t> (elementType.getPackedSizeInBytes());
+            auto destElementSize = getPackedSize (elementType);
+
+            for (uint32_t i = 0; i < static_cast<uint32_t> (type.getArraySize()); ++i)
+                writePackedData (buffer, offset + i * destElementSize, elementType, source + i * sourceElementSize);
+
+            return;
+        }
+
+        SOUL_ASSERT (type.isStruct());
+
+        for (auto& m : type.getStructRef().getMembers())
+        {
+            writePackedData (buffer, offset, m.type, source);
+            offset += getPackedSize (m.type);
+            source += m.type.getPackedSizeInBytes();
+        }
+    }
+
+    void layOutState (CompiledModule& m)
+    {
+        auto allocate = [&] (uint32_t size)
+        {
+            auto offset = m.stateSize;
+            m.stateSize += alignTo8 (size);
+            return offset;
+        };
+
+        for (auto& v : m.module.stateVariables.get())
+            if (! v->isExternal())
+                m.stateOffsets[std::addressof (v.get())] = allocate (getPackedSize (v->type));
+
+        m.periodOffset    = allocate (sizeof (double));
+        m.frequencyOffset = allocate (sizeof (double));
+        m.idOffset        = allocate (sizeof (int32_t));
+        m.sessionOffset   = allocate (sizeof (int32_t));
+        m.latencyOffset   = allocate (sizeof (int32_t));
+        m.framesAvailableOffset = allocate (sizeof (int32_t));
+
+        m.initialState.resize (m.stateSize);
+        std::vector<pool_ref<heart::Variable>> variablesToInitialise;
+
+        for (auto& v : m.module.stateVariables.get())
+        {
+            if (! v->isExternal() && v->initialValue != nullptr)
+            {
+                auto value = v->initialValue->getAsConstant();
+
+                if (value.isValid())
+                    writeValue (m.initialState, m.stateOffsets[std::addressof (v.get())], value, v->type);
+                else
+                    variablesToInitialise.push_back (v);
+            }
+        }
+
+        // Initial values which aren't constant (e.g. ones that use processor properties) get
+        // calculated by a function that's run before the processor's init functions
+        if (! variablesToInitialise.empty())
+        {
+            auto& f = FunctionBuilder::createFunction (m.module, "_initialiseState", PrimitiveType::void_,
+                                                              [&] (FunctionBuilder& builder)
+            {
+                for (auto& v : variablesToInitialise)
+                    builder.addAssignment (v, *v->initialValue);
+
+                builder.addReturn();
+            });
+
+            m.stateInitialiser = std::addressof (getFunction (f));
+        }
+    }
+
+    void findEntryPoints (CompiledModule& m)
+    {
+        auto& module = m.module;
+        m.eventHandlers.resize (module.inputs.size());
+
+        for (size_t i = 0; i < module.inputs.size(); ++i)
+            m.eventHandlers[i].resize (module.inputs[i]->dataTypes.size());
+
+        for (auto& f : module.functions.get())
+        {
+            if (f->functionType.isRun())         m.run        = std::addressof (getFunction (f));
+            if (f->functionType.isSystemInit())  m.systemInit = std::addressof (getFunction (f));
+            if (f->functionType.isUserInit())    m.userInit   = std::addressof (getFunction (f));
+
+            if (f->name == LoopOptimisations::cachedValueUpdateFunctionName)
+                m.cachedValueUpdater = std::addressof (getFunction (f));
+
+            if (f->functionType.isEvent() && ! f->parameters.empty())
+            {
+                for (size_t i = 0; i < module.inputs.size(); ++i)
+                {
+                    auto& input = module.inputs[i];
+
+                    if (f->name.toString() == heart::getEventFunctionName (input->name.toString(), f->parameters.front()->type))
+                    {
+                        auto valueType = f->parameters.back()->type.removeReferenceIfPresent().removeConstIfPresent();
+                        auto& handlers = m.eventHandlers[i];
+
+                        for (size_t typeIndex = 0; typeIndex < input->dataTypes.size(); ++typeIndex)
+                        {
+                            if (haveSameLayout (input->dataTypes[typeIndex], valueType))
+                            {
+                                handlers[typeIndex].function = std::addressof (getFunction (f));
+                                handlers[typeIndex].hasIndexParameter = f->parameters.size() > 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+//==============================================================================
+/// Translates a HEART function into a list of Instructions
+struct FunctionCompiler
+{
+    FunctionCompiler (CompiledProgram& p, CompiledFunction& f)
+        : program (p), compiled (f), function (f.function),
+          module (p.findProcessorContainingFunction (f.function))
+    {
+    }
+
+    void compile()
+    {
+        function.rebuildBlockPredecessors();
+
+        for (auto& v : CallFlowGraph::findVariablesBeingReadBeforeBeingWritten (function))
+            CodeLocation().throwError (Errors::useOfUninitialisedVariable (v->name, function.name));
+
+        for (size_t i = 0; i < function.parameters.size(); ++i)
+        {
+            auto& param = compiled.parameters[i];
+            variables[function.parameters[i].getPointer()] = param.isReference ? Address { param.slotOrOffset, 0 }
+                                                                               : Address { frameSlot, param.slotOrOffset };
+        }
+
+        for (size_t i = 0; i < function.blocks.size(); ++i)
+        {
+            auto& block = function.blocks[i].get();
+            blockStarts[std::addressof (block)] = code.size();
+            nextBlock = i + 1 < function.blocks.size() ? function.blocks[i + 1].getPointer() : nullptr;
+
+            for (auto s : block.statements)
+                compileStatement (*s);
+
+            compileTerminator (*block.terminator);
+        }
+
+        if (code.empty())
+            emit (handlers::returnVoid);
+
+        compiled.code = std::move (code);
+
+        for (auto& j : jumps)
+            compiled.code[j.instruction].targets[j.targetIndex] = compiled.code.data() + (j.block != nullptr ? blockStarts[j.block] : j.position);
+    }
+
+private:
+    //==============================================================================
+    CompiledProgram& program;
+    CompiledFunction& compiled;
+    heart::Function& function;
+    CompiledModule* module;
+
+    std::vector<Instruction> code;
+    std::unordered_map<const heart::Variable*, Address> variables;
+    std::unordered_map<const heart::Block*, size_t> blockStarts;
+    const heart::Block* nextBlock = nullptr;
+
+    struct JumpTarget
+    {
+        size_t instruction;
+        int targetIndex;
+        const heart::Block* block;
+        size_t position;
+    };
+
+    std::vector<JumpTarget> jumps;
+
+    enum class CastKind { scalar, elementwise, broadcast };
+
+    //==============================================================================
+    size_t emit (Handler handler, Address dest = {}, Address a = {}, Address b = {},
+                 uint32_t size = 0, uint32_t count = 0, uint32_t index = 0, uint32_t extra = 0, const void* data = nullptr)
+    {
+        Instruction i;
+        i.handler = handler;
+        i.dest = dest;
+        i.a = a;
+        i.b = b;
+        i.size = size;
+        i.count = count;
+        i.index = index;
+        i.extra = extra;
+        i.data = data;
+        code.push_back (i);
+        return code.size() - 1;
+    }
+
+    void emitCopy (Address dest, Address source, uint32_t size)
+    {
+        if (size == 0 || (dest.slot == source.slot && dest.offset == source.offset))
+            return;
+
+        switch (size)
+        {
+            case 1:   emit (handlers::copyFixed<1>,  dest, source); break;
+            case 4:   emit (handlers::copyFixed<4>,  dest, source); break;
+            case 8:   emit (handlers::copyFixed<8>,  dest, source); break;
+            case 16:  emit (handlers::copyFixed<16>, dest, source); break;
+            default:  emit (handlers::copy, dest, source, {}, size); break;
+        }
+    }
+
+    void emitZero (Address dest, uint32_t size)
+    {
+        if (size != 0)
+            emit (handlers::zero, dest, {}, {}, size);
+    }
+
+    void emitJump (const heart::Block& target)
+    {
+        jumps.push_back ({ emit (handlers::jump), 0, std::addressof (target), 0 });
+    }
+
+    Address allocateTemp (const Type& type)
+    {
+        Address address { frameSlot, compiled.dataSize };
+        compiled.dataSize += std::max (8u, alignTo8 (getPackedSize (type)));
+        return address;
+    }
+
+    uint32_t allocatePointerSlot()
+    {
+        return compiled.numSlots++;
+    }
+
+    CompiledModule& getModule (const CodeLocation& location)
+    {
+        if (module == nullptr)
+            location.throwError (Errors::notYetImplemented ("Endpoint access outside a processor"));
+
+        return *module;
+    }
+
+    template <typename ListType, typename ItemType>
+    static uint32_t findIndex (const ListType& list, const ItemType& item)
+    {
+        for (size_t i = 0; i < list.size(); ++i)
+            if (list[i].getPointer() == std::addressof (item))
+                return static_cast<uint32_t> (i);
+
+        SOUL_ASSERT_FALSE;
+        return 0;
+    }
+
+    //==============================================================================
+    Address getVariableAddress (const heart::Variable& v)
+    {
+        auto found = variables.find (std::addressof (v));
+
+        if (found != variables.end())
+            return found->second;
+
+        Address address;
+
+        if (v.isState())
+        {
+            if (module != nullptr && module->stateOffsets.find (std::addressof (v)) != module->stateOffsets.end())
+                address = { stateSlot, module->stateOffsets[std::addressof (v)] };
+            else
+                address = { constantsSlot, program.getGlobalVariable (v) };
+        }
+        else
+        {
+            address = allocateTemp (v.type);
+        }
+
+        variables[std::addressof (v)] = address;
+        return address;
+    }
+
+    /// Returns the address of an expression's value, emitting code to calculate it if needed
+    Address getLocation (heart::Expression& e)
+    {
+        if (auto v = cast<heart::Variable> (e))
+            return getVariableAddress (*v);
+
+        if (auto a = cast<heart::ArrayElement> (e))
+            return getArrayElementAddress (*a);
+
+        if (auto s = cast<heart::StructElement> (e))
+        {
+            auto parentType = s->parent->getType().removeReferenceIfPresent();
+            return getLocation (s->parent).withOffset (getStructMemberOffset (parentType.getStructRef(), s->getMemberIndex()));
+        }
+
+        if (auto p = cast<heart::ProcessorProperty> (e))
+            return { stateSlot, getModule (p->location).getPropertyOffset (p->property) };
+
+        auto constant = e.getAsConstant();
+
+        if (constant.isValid())
+            return { constantsSlot, program.addConstant (constant) };
+
+        auto type = e.getType();
+        auto temp = allocateTemp (type);
+        compileInto (e, temp, type);
+        return temp;
+    }
+
+    /// Returns the address of an expression's value, converted to the given type if necessary
+    Address getOperand (heart::Expression& e, const Type& requiredType)
+    {
+        auto type = e.getType();
+
+        if (haveSameLayout (type, requiredType))
+            return getLocation (e);
+
+        checkSliceSource (e, requiredType);
+
+        auto temp = allocateTemp (requiredType);
+        emitCast (requiredType, temp, type, getLocation (e));
+        return temp;
+    }
+
+    /// A dynamic array can only refer to data that will outlive it, so not to a local variable
+    static void checkSliceSource (heart::Expression& source, const Type& destType)
+    {
+        if (destType.isUnsizedArray() && source.getType().isFixedSizeArray())
+            if (auto v = source.getRootVariable())
+                if (v->isMutableLocal())
+                    v->location.throwError (Errors::cannotCreateSliceFromValue());
+    }
+
+    static bool isIndex64Bit (heart::Expression& index)
+    {
+        return index.getType().isInteger64();
+    }
+
+    Address getArrayElementAddress (heart::ArrayElement& e)
+    {
+        auto parentType = e.parent->getType().removeReferenceIfPresent();
+        auto parent = getLocation (e.parent);
+
+        // Indexing a primitive treats it as a vector of size 1
+        if (parentType.isPrimitive())
+            return parent;
+
+        auto elementSize = getPackedSize (parentType.getElementType());
+
+        if (parentType.isUnsizedArray())
+        {
+            Address result { allocatePointerSlot(), 0 };
+
+            if (e.isDynamic())
+            {
+                auto index = getLocation (*e.dynamicIndex);
+                emit (isIndex64Bit (*e.dynamicIndex) ? handlers::unsizedElementAddress<int64_t>
+                                                     : handlers::unsizedElementAddress<int32_t>,
+                      result, parent, index, elementSize);
+            }
+            else if (e.getSliceSize() == 1)
+            {
+                Address index { constantsSlot, program.addConstant (Value::createInt64 (static_cast<int64_t> (e.fixedStartIndex))) };
+                emit (handlers::unsizedElementAddress<int64_t>, result, parent, index, elementSize);
+            }
+            else
+            {
+                emit (handlers::unsizedSliceAddress, result, parent, {}, static_cast<uint32_t> (e.fixedStartIndex) * elementSize);
+            }
+
+            return result;
+        }
+
+        if (! e.isDynamic())
+        {
+            if (e.fixedEndIndex > parentType.getArrayOrVectorSize())
+                e.location.throwError (Errors::indexOutOfRange());
+
+            return parent.withOffset (static_cast<uint32_t> (e.fixedStartIndex) * elementSize);
+        }
+
+        auto arraySize = static_cast<uint32_t> (parentType.getArrayOrVectorSize());
+        auto constantIndex = e.dynamicIndex->getAsConstant();
+
+        if (constantIndex.isValid())
+        {
+            auto index = constantIndex.getAsInt64();
+
+            if (index < 0 || index >= static_cast<int64_t> (arraySize))
+                e.location.throwError (Errors::indexOutOfRange());
+
+            return parent.withOffset (static_cast<uint32_t> (index) * elementSize);
+        }
+
+        Address result { allocatePointerSlot(), 0 };
+        auto index = getLocation (*e.dynamicIndex);
+        auto is64Bit = isIndex64Bit (*e.dynamicIndex);
+
+        Handler handler = e.isRangeTrusted ? (is64Bit ? handlers::elementAddress<int64_t, false> : handlers::elementAddress<int32_t, false>)
+                                           : (is64Bit ? handlers::elementAddress<int64_t, true>  : handlers::elementAddress<int32_t, true>);
+
+        emit (handler, result, parent, index, elementSize, arraySize);
+        return result;
+    }
+
+    //==============================================================================
+    /// Emits code to evaluate an expression and write the result into the given destination
+    void compileInto (heart::Expression& e, Address dest, const Type& destType)
+    {
+        auto sourceType = e.getType();
+
+        if (! haveSameLayout (destType, sourceType))
+            return emitCast (destType, dest, sourceType, getLocation (e));
+
+        auto size = getPackedSize (destType);
+
+        if (! (is_type<heart::Variable> (e) || is_type<heart::ArrayElement> (e) || is_type<heart::StructElement> (e)))
+        {
+            auto constant = e.getAsConstant();
+
+            if (constant.isValid())
+            {
+                if (constant.isZero() && ! containsUnsizedArray (constant.getType()))
+                    return emitZero (dest, size);
+
+                return emitCopy (dest, { constantsSlot, program.addConstant (constant) }, size);
+            }
+        }
+
+        if (auto b = cast<heart::BinaryOperator> (e))     return emitBinaryOp (*b, dest);
+        if (auto u = cast<heart::UnaryOperator> (e))      return emitUnaryOp (*u, dest);
+        if (auto c = cast<heart::TypeCast> (e))
+        {
+            checkSliceSource (c->source, c->destType);
+            return emitCast (c->destType, dest, c->source->getType(), getLocation (c->source));
+        }
+        if (auto f = cast<heart::PureFunctionCall> (e))   return emitFunctionCall (f->function, f->arguments, dest, destType);
+
+        if (auto a = cast<heart::AggregateInitialiserList> (e))
+        {
+            // Building the aggregate in a temporary means that it can safely refer to the old value of the destination
+            auto temp = allocateTemp (a->type);
+            emitAggregate (*a, temp);
+            return emitCopy (dest, temp, size);
+        }
+
+        emitCopy (dest, getLocation (e), size);
+    }
+
+    void emitAggregate (heart::AggregateInitialiserList& list, Address dest)
+    {
+        auto& type = list.type;
+
+        if (type.isStruct())
+        {
+            auto& s = type.getStructRef();
+
+            for (size_t i = 0; i < list.items.size(); ++i)
+                compileInto (list.items[i], dest.withOffset (getStructMemberOffset (s, i)), s.getMembers()[i].type);
+
+            return;
+        }
+
+        if (type.isFixedSizeArray() || type.isVector())
+        {
+            auto elementType = type.getElementType();
+            auto elementSize = getPackedSize (elementType);
+            auto numElements = static_cast<uint32_t> (type.getArrayOrVectorSize());
+
+            if (list.items.size() == 1 && numElements > 1)
+            {
+                compileInto (list.items.front(), dest, elementType);
+                emit (handlers::replicate, dest, {}, {}, elementSize, numElements);
+                return;
+            }
+
+            if (list.items.size() < numElements)
+                emitZero (dest, getPackedSize (type));
+
+            for (size_t i = 0; i < list.items.size(); ++i)
+                compileInto (list.items[i], dest.withOffset (static_cast<uint32_t> (i) * elementSize), elementType);
+
+            return;
+        }
+
+        // A single-item list for a non-aggregate type acts as a cast
+        SOUL_ASSERT (list.items.size() == 1);
+        compileInto (list.items.front(), dest, type);
+    }
+
+    //==============================================================================
+    template <typename Op, bool supportsInts, bool supportsFloats, bool supportsBools>
+    static Handler selectBinaryOp (PrimitiveType p, bool isVector)
+    {
+        if constexpr (supportsInts)
+        {
+            if (p.isInteger32())  return isVector ? handlers::vectorBinaryOp<int32_t, Op> : handlers::binaryOp<int32_t, Op>;
+            if (p.isInteger64())  return isVector ? handlers::vectorBinaryOp<int64_t, Op> : handlers::binaryOp<int64_t, Op>;
+        }
+
+        if constexpr (supportsFloats)
+        {
+            if (p.isFloat32())    return isVector ? handlers::vectorBinaryOp<float, Op>  : handlers::binaryOp<float, Op>;
+            if (p.isFloat64())    return isVector ? handlers::vectorBinaryOp<double, Op> : handlers::binaryOp<double, Op>;
+        }
+
+        if constexpr (supportsBools)
+        {
+            if (p.isBool())       return isVector ? handlers::vectorBinaryOp<bool, Op> : handlers::binaryOp<bool, Op>;
+        }
+
+        return nullptr;
+    }
+
+    template <typename Op, bool supportsInts, bool supportsFloats, bool supportsBools>
+    static Handler selectUnaryOp (PrimitiveType p, bool isVector)
+    {
+        if constexpr (supportsInts)
+        {
+            if (p.isInteger32())  return isVector ? handlers::vectorUnaryOp<int32_t, Op> : handlers::unaryOp<int32_t, Op>;
+            if (p.isInteger64())  return isVector ? handlers::vectorUnaryOp<int64_t, Op> : handlers::unaryOp<int64_t, Op>;
+        }
+
+        if constexpr (supportsFloats)
+        {
+            if (p.isFloat32())    return isVector ? handlers::vectorUnaryOp<float, Op>  : handlers::unaryOp<float, Op>;
+            if (p.isFloat64())    return isVector ? handlers::vectorUnaryOp<double, Op> : handlers::unaryOp<double, Op>;
+        }
+
+        if constexpr (supportsBools)
+        {
+            if (p.isBool())       return isVector ? handlers::vectorUnaryOp<bool, Op> : handlers::unaryOp<bool, Op>;
+        }
+
+        return nullptr;
+    }
+
+    static Handler getBinaryOpHandler (BinaryOp::Op op, PrimitiveType p, bool isVector)
+    {
+        using namespace handlers;
+
+        switch (op)
+        {
+            case BinaryOp::Op::add:                 return selectBinaryOp<Add,                true,  true,  false> (p, isVector);
+            case BinaryOp::Op::subtract:            return selectBinaryOp<Subtract,           true,  true,  false> (p, isVector);
+            case BinaryOp::Op::multiply:            return selectBinaryOp<Multiply,           true,  true,  false> (p, isVector);
+            case BinaryOp::Op::divide:              return selectBinaryOp<Divide,             true,  true,  false> (p, isVector);
+            case BinaryOp::Op::modulo:              return selectBinaryOp<Modulo,             true,  true,  false> (p, isVector);
+            case BinaryOp::Op::bitwiseOr:           return selectBinaryOp<BitwiseOr,          true,  false, false> (p, isVector);
+            case BinaryOp::Op::bitwiseAnd:          return selectBinaryOp<BitwiseAnd,         true,  false, false> (p, isVector);
+            case BinaryOp::Op::bitwiseXor:          return selectBinaryOp<BitwiseXor,         true,  false, false> (p, isVector);
+            case BinaryOp::Op::logicalOr:           return selectBinaryOp<LogicalOr,          false, false, true>  (p, isVector);
+            case BinaryOp::Op::logicalAnd:          return selectBinaryOp<LogicalAnd,         false, false, true>  (p, isVector);
+            case BinaryOp::Op::equals:              return selectBinaryOp<Equals,             true,  true,  true>  (p, isVector);
+            case BinaryOp::Op::notEquals:           return selectBinaryOp<NotEquals,          true,  true,  true>  (p, isVector);
+            case BinaryOp::Op::lessThan:            return selectBinaryOp<LessThan,           true,  true,  false> (p, isVector);
+            case BinaryOp::Op::lessThanOrEqual:     return selectBinaryOp<LessThanOrEqual,    true,  true,  false> (p, isVector);
+            case BinaryOp::Op::greaterThan:         return selectBinaryOp<GreaterThan,        true,  true,  false> (p, isVector);
+            case BinaryOp::Op::greaterThanOrEqual:  return selectBinaryOp<GreaterThanOrEqual, true,  true,  false> (p, isVector);
+            case BinaryOp::Op::leftShift:           return selectBinaryOp<LeftShift,          true,  false, false> (p, isVector);
+            case BinaryOp::Op::rightShift:          return selectBinaryOp<RightShift,         true,  false, false> (p, isVector);
+            case BinaryOp::Op::rightShiftUnsigned:  return selectBinaryOp<RightShiftUnsigned, true,  false, false> (p, isVector);
+            case BinaryOp::Op::unknown:
+            default:                                return nullptr;
+        }
+    }
+
+    static Handler getUnaryOpHandler (UnaryOp::Op op, PrimitiveType p, bool isVector)
+    {
+        using namespace handlers;
+
+        switch (op)
+        {
+            case UnaryOp::Op::negate:       return selectUnaryOp<Negate,     true,  true,  false> (p, isVector);
+            case UnaryOp::Op::bitwiseNot:   return selectUnaryOp<BitwiseNot, true,  false, false> (p, isVector);
+            case UnaryOp::Op::logicalNot:   return selectUnaryOp<LogicalNot, false, false, true>  (p, isVector);
+            case UnaryOp::Op::unknown:
+            default:                        return nullptr;
+        }
+    }
+
+    void applyBoundedIntLimit (const Type& type, Address dest)
+    {
+        if (type.isBoundedInt())
+            emit (type.isWrapped() ? handlers::wrapOp<int32_t> : handlers::clampOp<int32_t>,
+                  dest, dest, {}, 0, static_cast<uint32_t> (type.getBoundedIntLimit()));
+    }
+
+    void emitBinaryOp (heart::BinaryOperator& b, Address dest)
+    {
+        auto types = BinaryOp::getTypes (b.operation, b.lhs->getType(), b.rhs->getType());
+        auto& operandType = types.operandType;
+        auto lhs = getOperand (b.lhs, operandType);
+        auto rhs = getOperand (b.rhs, operandType);
+
+        if (operandType.isStringLiteral())
+        {
+            SOUL_ASSERT (BinaryOp::isEqualityOperator (b.operation));
+            emit (b.operation == BinaryOp::Op::equals ? handlers::bytesEqual : handlers::bytesNotEqual,
+                  dest, lhs, rhs, getPackedSize (operandType));
+            return;
+        }
+
+        auto numElements = getNumVectorElements (operandType);
+        auto handler = getBinaryOpHandler (b.operation, getStoragePrimitive (operandType), numElements > 1);
+
+        if (handler == nullptr)
+            b.location.throwError (Errors::notYetImplemented (std::string ("Operator ") + BinaryOp::getSymbol (b.operation)
+                                                                + " for type " + operandType.getDescription()));
+
+        emit (handler, dest, lhs, rhs, 0, numElements);
+        applyBoundedIntLimit (types.resultType, dest);
+    }
+
+    void emitUnaryOp (heart::UnaryOperator& u, Address dest)
+    {
+        auto type = u.source->getType().removeReferenceIfPresent();
+        auto source = getLocation (u.source);
+        auto numElements = getNumVectorElements (type);
+        auto handler = getUnaryOpHandler (u.operation, getStoragePrimitive (type), numElements > 1);
+
+        if (handler == nullptr)
+            u.location.throwError (Errors::notYetImplemented (std::string ("Operator ") + UnaryOp::getSymbol (u.operation)
+                                                                + " for type " + type.getDescription()));
+
+        emit (handler, dest, source, {}, 0, numElements);
+        applyBoundedIntLimit (u.getType(), dest);
+    }
+
+    //==============================================================================
+    template <typename From, typename To>
+    static Handler getCastHandler (CastKind kind)
+    {
+        if (kind == CastKind::scalar)       return handlers::castOp<From, To>;
+        if (kind == CastKind::elementwise)  return handlers::vectorCastOp<From, To>;
+        return handlers::broadcastCastOp<From, To>;
+    }
+
+    template <typename From>
+    static Handler getCastHandler (PrimitiveType to, CastKind kind)
+    {
+        if (to.isInteger32())  return getCastHandler<From, int32_t> (kind);
+        if (to.isInteger64())  return getCastHandler<From, int64_t> (kind);
+        if (to.isFloat32())    return getCastHandler<From, float> (kind);
+        if (to.isFloat64())    return getCastHandler<From, double> (kind);
+        if (to.isBool())       return getCastHandler<From, bool> (kind);
+        return nullptr;
+    }
+
+    static Handler getCastHandler (PrimitiveType from, PrimitiveType to, CastKind kind)
+    {
+        if (from.isInteger32())  return getCastHandler<int32_t> (to, kind);
+        if (from.isInteger64())  return getCastHandler<int64_t> (to, kind);
+        if (from.isFloat32())    return getCastHandler<float> (to, kind);
+        if (from.isFloat64())    return getCastHandler<double> (to, kind);
+        if (from.isBool())       return getCastHandler<bool> (to, kind);
+        return nullptr;
+    }
+
+    static Handler getBoundedIntCastHandler (PrimitiveType from, bool isWrap)
+    {
+        if (from.isInteger32())  return isWrap ? handlers::wrapOp<int32_t> : handlers::clampOp<int32_t>;
+        if (from.isInteger64())  return isWrap ? handlers::wrapOp<int64_t> : handlers::clampOp<int64_t>;
+        if (from.isFloat32())    return isWrap ? handlers::wrapOp<float>   : handlers::clampOp<float>;
+        if (from.isFloat64())    return isWrap ? handlers::wrapOp<double>  : handlers::clampOp<double>;
+        return nullptr;
+    }
+
+    [[noreturn]] static void throwCastError (const Type& destType, const Type& sourceType)
+    {
+        CodeLocation().throwError (Errors::notYetImplemented ("Cast from " + sourceType.getDescription()
+                                                                + " to " + destType.getDescription()));
+    }
+
+    void emitPrimitiveCast (PrimitiveType to, Address dest, PrimitiveType from, Address source,
+                            CastKind kind, uint32_t numElements, const Type& destType, const Type& sourceType)
+    {
+        if (to == from && kind != CastKind::broadcast)
+            return emitCopy (dest, source, static_cast<uint32_t> (Type (to).getPackedSizeInBytes()) * numElements);
+
+        auto handler = getCastHandler (from, to, kind);
+
+        if (handler == nullptr)
+            throwCastError (destType, sourceType);
+
+        emit (handler, dest, source, {}, 0, numElements);
+    }
+
+    void emitCast (const Type& targetType, Address dest, const Type& originalSourceType, Address source)
+    {
+        auto destType = targetType.removeReferenceIfPresent().removeConstIfPresent();
+        auto sourceType = originalSourceType.removeReferenceIfPresent();
+
+        switch (TypeRules::getCastType (destType, sourceType))
+        {
+            case TypeRules::CastType::identity:
+                return emitCopy (dest, source, getPackedSize (destType));
+
+            case TypeRules::CastType::primitiveNumericLossless:
+            case TypeRules::CastType::primitiveNumericReduction:
+            case TypeRules::CastType::singleElementVectorToScalar:
+                return emitPrimitiveCast (getStoragePrimitive (destType), dest, getStoragePrimitive (sourceType), source,
+                                          CastKind::scalar, 1, destType, sourceType);
+
+            case TypeRules::CastType::valueToArray:
+            {
+                if (destType.isVector())
+                    return emitPrimitiveCast (getStoragePrimitive (destType), dest, getStoragePrimitive (sourceType), source,
+                                              CastKind::broadcast, getNumVectorElements (destType), destType, sourceType);
+
+                auto elementType = destType.getArrayElementType();
+                emitCast (elementType, dest, sourceType, source);
+                emit (handlers::replicate, dest, {}, {}, getPackedSize (elementType), static_cast<uint32_t> (destType.getArraySize()));
+                return;
+            }
+
+            case TypeRules::CastType::arrayElementLossless:
+            case TypeRules::CastType::arrayElementReduction:
+            {
+                PrimitiveType destPrimitive, sourcePrimitive;
+                uint32_t destCount = 0, sourceCount = 0;
+
+                if (getFlattenedPrimitives (destType, destPrimitive, destCount)
+                     && getFlattenedPrimitives (sourceType, sourcePrimitive, sourceCount)
+                     && destCount == sourceCount)
+                    return emitPrimitiveCast (destPrimitive, dest, sourcePrimitive, source,
+                                              CastKind::elementwise, destCount, destType, sourceType);
+
+                auto destElementType = destType.getElementType();
+                auto sourceElementType = sourceType.getElementType();
+                auto destElementSize = getPackedSize (destElementType);
+                auto sourceElementSize = getPackedSize (sourceElementType);
+
+                for (uint32_t i = 0; i < static_cast<uint32_t> (destType.getArrayOrVectorSize()); ++i)
+                    emitCast (destElementType, dest.withOffset (i * destElementSize),
+                              sourceElementType, source.withOffset (i * sourceElementSize));
+
+                return;
+            }
+
+            case TypeRules::CastType::fixedSizeArrayToDynamicArray:
+                emit (handlers::makeUnsizedArray, dest, source, {}, 0, static_cast<uint32_t> (sourceType.getArraySize()));
+                return;
+
+            case TypeRules::CastType::wrapValue:
+            case TypeRules::CastType::clampValue:
+            {
+                auto handler = getBoundedIntCastHandler (getStoragePrimitive (sourceType), destType.isWrapped());
+
+                if (handler == nullptr)
+                    throwCastError (destType, sourceType);
+
+                emit (handler, dest, source, {}, 0, static_cast<uint32_t> (destType.getBoundedIntLimit()));
+                return;
+            }
+
+            case TypeRules::CastType::notPossible:
+            default:
+                break;
+        }
+
+        if (haveSameLayout (destType, sourceType))
+            return emitCopy (dest, source, getPackedSize (destType));
+
+        throwCastError (destType, sourceType);
+    }
+
+    //==============================================================================
+    template <typename ArgList>
+    void emitFunctionCall (heart::Function& f, const ArgList& args, Address dest, const Type& destType)
+    {
+        if (! (destType.isVoid() || haveSameLayout (destType, f.returnType)))
+        {
+            auto temp = allocateTemp (f.returnType);
+            emitFunctionCall (f, args, temp, f.returnType);
+            return emitCast (destType, dest, f.returnType, temp);
+        }
+
+        if (f.intrinsicType != IntrinsicType::none && emitNativeIntrinsic (f, args, dest))
+            return;
+
+        if (f.hasNoBody)
+            f.location.throwError (Errors::functionHasNoImplementation());
+
+        auto& callee = program.getFunction (f);
+        compiled.callees.push_back (std::addressof (callee));
+
+        auto info = std::make_unique<CallInfo> (CallInfo { callee, {} });
+
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            auto& param = callee.parameters[i];
+            info->arguments.push_back ({ getOperand (args[i], param.type.removeReferenceIfPresent()), param });
+        }
+
+        emit (handlers::call, dest, {}, {}, 0, 0, 0, 0, info.get());
+        program.callInfos.push_back (std::move (info));
+    }
+
+    /// Some intrinsics have no body (or a dummy one), and must be performed natively
+    template <typename ArgList>
+    bool emitNativeIntrinsic (heart::Function& f, const ArgList& args, Address dest)
+    {
+        if (args.empty())
+            return false;
+
+        auto type = args.front()->getType().removeReferenceIfPresent().removeConstIfPresent();
+
+        if (f.intrinsicType == IntrinsicType::get_array_size)
+        {
+            if (type.isUnsizedArray())
+            {
+                emit (handlers::getUnsizedArraySize, dest, getLocation (args.front()));
+                return true;
+            }
+
+            auto size = Value::createInt32 (static_cast<int32_t> (type.getArrayOrVectorSize()));
+            emitCopy (dest, { constantsSlot, program.addConstant (size) }, sizeof (int32_t));
+            return true;
+        }
+
+        if (! (type.isPrimitiveOrVector() && type.isFloatingPoint()))
+            return false;
+
+        auto numElements = getNumVectorElements (type);
+        auto isVector = numElements > 1;
+        auto primitive = type.getPrimitiveType();
+        Handler handler = nullptr;
+
+        switch (f.intrinsicType)
+        {
+            #define SOUL_SELECT_MATHS_FUNCTION(name) \
+                case IntrinsicType::name:   handler = selectUnaryOp<handlers::Maths_ ## name, false, true, false> (primitive, isVector); break;
+
+            SOUL_INTERPRETER_UNARY_MATHS_FUNCTIONS (SOUL_SELECT_MATHS_FUNCTION)
+            #undef SOUL_SELECT_MATHS_FUNCTION
+
+            case IntrinsicType::pow:    handler = selectBinaryOp<handlers::Maths_pow,   false, true, false> (primitive, isVector); break;
+            case IntrinsicType::atan2:  handler = selectBinaryOp<handlers::Maths_atan2, false, true, false> (primitive, isVector); break;
+            case IntrinsicType::isnan:  handler = selectUnaryOp<handlers::Maths_isnan,  false, true, false> (primitive, isVector); break;
+            case IntrinsicType::isinf:  handler = selectUnaryOp<handlers::Maths_isinf,  false, true, false> (primitive, isVector); break;
+            default:                    return false;
+        }
+
+        if (handler == nullptr)
+            return false;
+
+        auto a = getOperand (args[0], type);
+        auto b = args.size() > 1 ? getOperand (args[1], type) : Address();
+        emit (handler, dest, a, b, 0, numElements);
+        return true;
+    }
+
+    //==============================================================================
+    void compileStatement (heart::Statement& s)
+    {
+        if (auto a = cast<heart::AssignFromValue> (s))
+        {
+            auto& target = *a->target;
+
+            // The first assignment to a local reference (e.g. an inlined reference parameter)
+            // binds it to its source, and any later ones write through it
+            if (auto v = cast<heart::Variable> (target))
+            {
+                if (v->isFunctionLocal() && v->type.isReference()
+                     && variables.find (v.get()) == variables.end())
+                {
+                    Address bound { allocatePointerSlot(), 0 };
+                    emit (handlers::bindReference, bound, getLocation (a->source));
+                    variables[v.get()] = bound;
+                    return;
+                }
+            }
+
+            return compileInto (a->source, getLocation (target), target.getType());
+        }
+
+        if (auto call = cast<heart::FunctionCall> (s))
+        {
+            auto& f = call->getFunction();
+
+            if (call->target != nullptr)
+                return emitFunctionCall (f, call->arguments, getLocation (*call->target), call->target->getType());
+
+            return emitFunctionCall (f, call->arguments, f.returnType.isVoid() ? Address() : allocateTemp (f.returnType), f.returnType);
+        }
+
+        if (auto r = cast<heart::ReadStream> (s))     return compileReadStream (*r);
+        if (auto w = cast<heart::WriteStream> (s))    return compileWriteStream (*w);
+
+        if (auto a = cast<heart::AdvanceClock> (s))
+        {
+            if (! function.functionType.isRun())
+                s.location.throwError (Errors::notYetImplemented ("advance() outside the run() function"));
+
+            if (a->numFrames > 1)
+                emit (handlers::advanceFrames, {}, {}, {}, 0, a->numFrames);
+            else
+                emit (handlers::advance);
+
+            return;
+        }
+
+        SOUL_ASSERT_FALSE;
+    }
+
+    void compileReadStream (heart::ReadStream& r)
+    {
+        auto& input = r.source.get();
+        auto endpointIndex = findIndex (getModule (r.location).module.inputs, input);
+
+        // The frames of a stream of primitives are packed together, so a vector of
+        // consecutive frames can be copied straight out of the chunk
+        if (r.numFrames > 1)
+            return (void) emit (handlers::readStream, getLocation (*r.target), {}, {}, getPackedSize (r.target->getType()), 0, endpointIndex, 0);
+        auto elementType = input.dataTypes.front();
+        auto elementSize = getPackedSize (elementType);
+        auto arraySize = input.arraySize.value_or (1);
+        auto isStream = input.isStreamEndpoint();
+        auto readType = (r.element != nullptr || ! input.arraySize.has_value()) ? elementType : input.getFrameOrValueType();
+        auto targetType = r.target->getType();
+        auto needsCast = ! haveSameLayout (targetType, readType);
+        auto dest = needsCast ? allocateTemp (readType) : getLocation (*r.target);
+
+        if (r.element == nullptr)
+        {
+            emit (isStream ? handlers::readStream : handlers::readValue, dest, {}, {}, getPackedSize (readType), 0, endpointIndex, 0);
+        }
+        else
+        {
+            auto constantElement = r.element->getAsConstant();
+
+            if (constantElement.isValid())
+            {
+                auto offset = static_cast<uint32_t> (wrapIndex (constantElement.getAsInt64(), arraySize)) * elementSize;
+                emit (isStream ? handlers::readStream : handlers::readValue, dest, {}, {}, elementSize, 0, endpointIndex, offset);
+            }
+            else
+            {
+                auto is64Bit = isIndex64Bit (*r.element);
+                auto index = getLocation (*r.element);
+
+                Handler handler = isStream ? (is64Bit ? handlers::readStreamElement<int64_t> : handlers::readStreamElement<int32_t>)
+                                           : (is64Bit ? handlers::readValueElement<int64_t>  : handlers::readValueElement<int32_t>);
+
+                emit (handler, dest, {}, index, elementSize, arraySize, endpointIndex);
+            }
+        }
+
+        if (needsCast)
+            emitCast (targetType, getLocation (*r.target), readType, dest);
+    }
+
+    static uint32_t findEventTypeIndex (const heart::OutputDeclaration& output, const Type& type)
+    {
+        for (size_t i = 0; i < output.dataTypes.size(); ++i)
+            if (haveSameLayout (output.dataTypes[i], type))
+                return static_cast<uint32_t> (i);
+
+        for (size_t i = 0; i < output.dataTypes.size(); ++i)
+            if (TypeRules::canSilentlyCastTo (output.dataTypes[i], type))
+                return static_cast<uint32_t> (i);
+
+        return 0;
+    }
+
+    template <typename T>
+    static Handler selectStreamWrite (bool isDynamic, bool is64BitIndex)
+    {
+        if (! isDynamic)   return handlers::writeStream<T>;
+        if (is64BitIndex)  return handlers::writeStreamElement<T, int64_t>;
+        return handlers::writeStreamElement<T, int32_t>;
+    }
+
+    static Handler getStreamWriteHandler (PrimitiveType p, bool isDynamic, bool is64BitIndex)
+    {
+        if (p.isInteger32())  return selectStreamWrite<int32_t> (isDynamic, is64BitIndex);
+        if (p.isInteger64())  return selectStreamWrite<int64_t> (isDynamic, is64BitIndex);
+        if (p.isFloat32())    return selectStreamWrite<float>   (isDynamic, is64BitIndex);
+        if (p.isFloat64())    return selectStreamWrite<double>  (isDynamic, is64BitIndex);
+        if (p.isBool())       return selectStreamWrite<bool>    (isDynamic, is64BitIndex);
+        return nullptr;
+    }
+
+    void compileWriteStream (heart::WriteStream& w)
+    {
+        auto& output = w.target.get();
+        auto endpointIndex = findIndex (getModule (w.location).module.outputs, output);
+        auto arraySize = output.arraySize.value_or (1);
+        auto valueType = w.value->getType().removeReferenceIfPresent();
+
+        if (w.numFrames > 1)
+            return (void) emit (getStreamWriteHandler (getStoragePrimitive (valueType), false, false),
+                                {}, getOperand (w.value, valueType), {}, 0, w.numFrames, endpointIndex, 0);
+
+        if (output.isEventEndpoint())
+        {
+            // Writing an array of values to an endpoint array sends one to each element
+            if (w.element == nullptr && output.arraySize.has_value() && valueType.isFixedSizeArray()
+                 && valueType.getArraySize() == arraySize
+                 && ! haveSameLayout (output.dataTypes[findEventTypeIndex (output, valueType)], valueType))
+            {
+                auto elementType = valueType.getArrayElementType();
+                auto typeIndex = findEventTypeIndex (output, elementType);
+                auto& eventType = output.dataTypes[typeIndex];
+                auto source = getOperand (w.value, eventType.createArray (arraySize));
+                auto size = getPackedSize (eventType);
+
+                for (uint32_t i = 0; i < arraySize; ++i)
+                    emit (handlers::writeEvent, {}, source.withOffset (i * size), {}, size, typeIndex, endpointIndex, i);
+
+                return;
+            }
+
+            auto typeIndex = findEventTypeIndex (output, valueType);
+            auto& eventType = output.dataTypes[typeIndex];
+            auto source = getOperand (w.value, eventType);
+            auto size = getPackedSize (eventType);
+
+            if (w.element == nullptr)
+                return (void) emit (handlers::writeEvent, {}, source, {}, size, typeIndex, endpointIndex, static_cast<uint32_t> (-1));
+
+            auto constantElement = w.element->getAsConstant();
+
+            if (constantElement.isValid())
+                return (void) emit (handlers::writeEvent, {}, source, {}, size, typeIndex, endpointIndex,
+                                    static_cast<uint32_t> (wrapIndex (constantElement.getAsInt64(), arraySize)));
+
+            auto index = getLocation (*w.element);
+            emit (isIndex64Bit (*w.element) ? handlers::writeEventElement<int64_t> : handlers::writeEventElement<int32_t>,
+                  {}, source, index, size, typeIndex, endpointIndex, arraySize);
+            return;
+        }
+
+        auto elementType = output.dataTypes.front();
+        auto elementSize = getPackedSize (elementType);
+        auto primitive = getStoragePrimitive (elementType);
+        auto primitivesPerElement = getNumVectorElements (elementType);
+        auto isStream = output.isStreamEndpoint();
+
+        auto emitWrite = [&] (Address source, uint32_t offset, uint32_t numElements)
+        {
+            if (isStream)
+                emit (getStreamWriteHandler (primitive, false, false), {}, source, {}, 0, primitivesPerElement * numElements, endpointIndex, offset);
+            else
+                emit (handlers::writeValue, {}, source, {}, elementSize * numElements, 0, endpointIndex, offset);
+        };
+
+        if (w.element == nullptr)
+        {
+            if (! output.arraySize.has_value() || ! haveSameLayout (valueType, elementType))
+                return emitWrite (getOperand (w.value, output.getFrameOrValueType()), 0, arraySize);
+
+            // Writing a single element to an endpoint array sends it to every element
+            auto source = getOperand (w.value, elementType);
+
+            for (uint32_t i = 0; i < arraySize; ++i)
+                emitWrite (source, i * elementSize, 1);
+
+            return;
+        }
+
+        auto source = getOperand (w.value, elementType);
+        auto constantElement = w.element->getAsConstant();
+
+        if (constantElement.isValid())
+            return emitWrite (source, static_cast<uint32_t> (wrapIndex (constantElement.getAsInt64(), arraySize)) * elementSize, 1);
+
+        auto is64Bit = isIndex64Bit (*w.element);
+        auto index = getLocation (*w.element);
+
+        if (isStream)
+            emit (getStreamWriteHandler (primitive, true, is64Bit), {}, source, index, elementSize, primitivesPerElement, endpointIndex, arraySize);
+        else
+            emit (is64Bit ? handlers::writeValueElement<int64_t> : handlers::writeValueElement<int32_t>,
+                  {}, source, index, elementSize, arraySize, endpointIndex);
+    }
+
+    //==============================================================================
+    void compileTerminator (heart::Terminator& t)
+    {
+        if (auto b = cast<heart::Branch> (t))
+        {
+            copyBlockArguments (b->target, b->targetArgs);
+
+            if (b->target.getPointer() != nextBlock)
+                emitJump (b->target);
+
+            return;
+        }
+
+        if (auto b = cast<heart::BranchIf> (t))
+        {
+            auto condition = getOperand (b->condition, PrimitiveType::bool_);
+            auto branch = emit (handlers::branchIf, {}, condition);
+
+            for (int i = 0; i < 2; ++i)
+            {
+                auto& target = b->targets[i].get();
+
+                if (b->targetArgs[i].empty())
+                {
+                    jumps.push_back ({ branch, i, std::addressof (target), 0 });
+                }
+                else
+                {
+                    jumps.push_back ({ branch, i, nullptr, code.size() });
+                    copyBlockArguments (target, b->targetArgs[i]);
+                    emitJump (target);
+                }
+            }
+
+            return;
+        }
+
+        if (auto r = cast<heart::ReturnValue> (t))
+        {
+            auto& value = r->returnValue.get();
+
+            if (is_type<heart::Variable> (value) || is_type<heart::ArrayElement> (value)
+                 || is_type<heart::StructElement> (value) || value.getAsConstant().isValid())
+            {
+                auto source = getOperand (value, function.returnType);
+                emit (handlers::returnValue, {}, source, {}, getPackedSize (function.returnType));
+                return;
+            }
+
+            compileInto (value, Address { returnSlot, 0 }, function.returnType);
+        }
+
+        emit (handlers::returnVoid);
+    }
+
+    template <typename ArgList>
+    void copyBlockArguments (heart::Block& target, const ArgList& args)
+    {
+        auto& params = target.parameters;
+        SOUL_ASSERT (params.size() == args.size());
+
+        if (args.size() == 1)
+            return compileInto (args.front(), getVariableAddress (params.front()), params.front()->type);
+
+        // All the new values must be calculated before any of the parameters are changed
+        std::vector<Address> temps;
+
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            temps.push_back (allocateTemp (params[i]->type));
+            compileInto (args[i], temps.back(), params[i]->type);
+        }
+
+        for (size_t i = 0; i < args.size(); ++i)
+            emitCopy (getVariableAddress (params[i]), temps[i], getPackedSize (params[i]->type));
+    }
+};
+
+void CompiledProgram::compileAllFunctions()
+{
+    // Unused functions are compiled too, so that any errors in them get reported
+    for (auto& m : program.getModules())
+        for (auto& f : m->functions.get())
+            if (! f->hasNoBody)
+                getFunction (f);
+
+    while (! functionsToCompile.empty())
+    {
+        auto f = functionsToCompile.back();
+        functionsToCompile.pop_back();
+        FunctionCompiler (*this, *f).compile();
+    }
+}
+
+//==============================================================================
+/// Builds the network of nodes and wires for a program's main processor, and renders it.
+///
+/// Rendering happens in chunks: every node processes the whole chunk in turn, in an order where
+/// each node comes after the ones that feed it. Wires with a delay can form feedback loops, so
+/// the chunk length is kept no longer than the shortest delay on a wire that goes backwards in
+/// that order, which guarantees that everything a node reads has already been written.
+struct Runtime
+{
+    Runtime (CompiledProgram& p, double rate, int32_t session, uint32_t maxBlockSize)
+        : program (p), sampleRate (rate), sessionID (session), blockSize (maxBlockSize)
+    {
+        auto& mainProcessor = program.program.getMainProcessor();
+        auto endpoints = instantiate (mainProcessor, 0, mainInstance);
+
+        for (auto& input : mainProcessor.inputs)
+        {
+            auto port = findPort (endpoints, input->name.toString());
+            port->isExternalInput = true;
+            inputs.push_back (port);
+        }
+
+        for (auto& output : mainProcessor.outputs)
+        {
+            auto port = findPort (endpoints, output->name.toString());
+            port->isExternalOutput = true;
+            outputs.push_back (port);
+        }
+
+        program.compileAllFunctions();
+        program.finalise();
+
+        sortNodes();
+        allocateBuffers();
+    }
+
+    void reset()
+    {
+        blockStart = 0;
+
+        for (auto& port : ports)
+        {
+            std::fill (port->chunk.begin(), port->chunk.end(), 0);
+            std::fill (port->history.begin(), port->history.end(), 0);
+            std::fill (port->value.begin(), port->value.end(), 0);
+            std::fill (port->externalFrames.begin(), port->externalFrames.end(), 0);
+            port->pendingEvents.clear();
+            port->chunkEvents.clear();
+            port->externalEvents.clear();
+        }
+
+        for (auto node : processors)
+        {
+            auto& m = *node->module;
+            auto state = node->getState();
+            auto frequency = sampleRate * std::pow (2.0, node->rateExponent);
+
+            std::memcpy (state, m.initialState.data(), m.initialState.size());
+            store (state + m.frequencyOffset, frequency);
+            store (state + m.periodOffset, 1.0 / frequency);
+            store (state + m.idOffset, node->instanceID);
+            store (state + m.sessionOffset, sessionID);
+            store (state + m.latencyOffset, static_cast<int32_t> (m.module.latency));
+        }
+
+        for (auto node : processors)
+            if (auto f = node->module->stateInitialiser)
+                callFunction (*f, *node);
+
+        for (auto node : processors)
+            if (auto f = node->module->systemInit)
+                callFunction (*f, *node);
+
+        for (auto node : processors)
+            if (auto f = node->module->userInit)
+                callFunction (*f, *node);
+
+        for (auto node : processors)
+        {
+            node->resumePoint = nullptr;
+
+            if (auto run = node->module->run)
+            {
+                std::fill (node->runFrame.begin(), node->runFrame.end(), 0);
+                run->initialiseSlots (getRunSlots (*node), node->getState(), program.constants.data(),
+                                      reinterpret_cast<uint8_t*> (returnScratch), *node);
+                node->resumePoint = run->code.data();
+            }
+        }
+    }
+
+    void clearOutputEvents()
+    {
+        for (auto output : outputs)
+            output->externalEvents.clear();
+    }
+
+    void render (uint32_t numFrames)
+    {
+        for (uint32_t done = 0; done < numFrames;)
+        {
+            auto numThisTime = std::min (chunkLength, numFrames - done);
+            renderChunk (blockStart + done, numThisTime);
+            done += numThisTime;
+        }
+
+        blockStart += numFrames;
+    }
+
+    /// Returns the values of the state variables of every processor instance, with the
+    /// variables of each graph's children held in objects named after the child instances.
+    choc::value::Value getState()
+    {
+        return getState (mainInstance);
+    }
+
+    bool setState (const choc::value::ValueView& state)
+    {
+        auto restored = setState (mainInstance, state);
+        updateCachedValues();
+        return restored;
+    }
+
+    /// These copy the same values as getState() and setState(), laid out like the packed data of
+    /// the object that getState() returns, but without allocating.
+    bool getStateData (void* dest, size_t size)
+    {
+        if (copyStateData (mainInstance, nullptr, true) != size)
+            return false;
+
+        copyStateData (mainInstance, static_cast<uint8_t*> (dest), true);
+        return true;
+    }
+
+    bool setStateData (const void* source, size_t size)
+    {
+        if (copyStateData (mainInstance, nullptr, false) != size)
+            return false;
+
+        copyStateData (mainInstance, static_cast<uint8_t*> (const_cast<void*> (source)), false);
+        updateCachedValues();
+        return true;
+    }
+
+    std::vector<Port*> inputs, outputs;
+    int64_t blockStart = 0;
+
+private:
+    //==============================================================================
+    /// A processor or graph instance, used for naming the state of each node
+    struct Instance
+    {
+        std::string name;
+        Node* node = nullptr;
+        bool isArray = false;
+        std::vector<Instance> children;
+    };
+
+    Instance mainInstance;
+
+    choc::value::Value getState (const Instance& instance)
+    {
+        if (instance.isArray)
+        {
+            auto result = choc::value::createEmptyArray();
+
+            for (auto& element : instance.children)
+                result.addArrayElement (getState (element));
+
+            return result;
+        }
+
+        auto result = choc::value::createObject (instance.name);
+
+        if (auto node = instance.node)
+        {
+            for (auto& v : node->module->module.stateVariables.get())
+            {
+                if (v->isExternal() || LoopOptimisations::isCachedValue (v))
+                    continue;
+
+                auto value = PerformerState::capture (v->type, node->getState() + node->module->stateOffsets[std::addressof (v.get())]);
+
+                if (! value.isVoid())
+                    result.addMember (v->name.toString(), value);
+            }
+        }
+
+        for (auto& child : instance.children)
+            result.addMember (child.name, getState (child));
+
+        return result;
+    }
+
+    bool setState (const Instance& instance, const choc::value::ValueView& state)
+    {
+        if (instance.isArray)
+        {
+            if (! state.isArray() || state.size() != instance.children.size())
+                return false;
+
+            bool allRestored = true;
+
+            for (uint32_t i = 0; i < state.size(); ++i)
+                allRestored = setState (instance.children[i], state[i]) && allRestored;
+
+            return allRestored;
+        }
+
+        if (! state.isObject())
+            return false;
+
+        uint32_t numMatched = 0;
+        bool allRestored = true;
+
+        if (auto node = instance.node)
+        {
+            for (auto& v : node->module->module.stateVariables.get())
+            {
+                if (v->isExternal() || LoopOptimisations::isCachedValue (v) || ! PerformerState::canCapture (v->type))
+                    continue;
+
+                auto name = v->name.toString();
+
+                if (! state.hasObjectMember (name))
+                {
+                    allRestored = false;
+                    continue;
+                }
+
+                allRestored = PerformerState::restore (v->type, node->getState() + node->module->stateOffsets[std::addressof (v.get())], state[name])
+                                && allRestored;
+                ++numMatched;
+            }
+        }
+
+        for (auto& child : instance.children)
+        {
+            if (! state.hasObjectMember (child.name))
+            {
+                allRestored = false;
+                continue;
+            }
+
+            allRestored = setState (child, state[child.name]) && allRestored;
+            ++numMatched;
+        }
+
+        return allRestored && numMatched == state.size();
+    }
+
+    /// The state doesn't include the values that loop optimisations cache, so they're
+    /// recalculated from the restored state variables
+    void updateCachedValues()
+    {
+        for (auto node : processors)
+            if (auto f = node->module->cachedValueUpdater)
+                callFunction (*f, *node);
+    }
+
+    /// Walks the instances in the same order as getState(), copying each variable's data to or
+    /// from the state data, and returns the number of bytes it covers. If stateData is nullptr,
+    /// nothing is copied.
+    size_t copyStateData (const Instance& instance, uint8_t* stateData, bool toState)
+    {
+        size_t total = 0;
+
+        auto getStateDataAt = [&]  { return stateData == nullptr ? nullptr : stateData + total; };
+
+        if (auto node = instance.node)
+        {
+            for (auto& v : node->module->module.stateVariables.get())
+            {
+                if (v->isExternal() || LoopOptimisations::isCachedValue (v))
+                    continue;
+
+                auto variableData = node->getState() + node->module->stateOffsets[std::addressof (v.get())];
+
+                total += toState ? PerformerState::captureData (v->type, variableData, getStateDataAt())
+                                 : PerformerState::restoreData (v->type, variableData, getStateDataAt());
+            }
+        }
+
+        for (auto& child : instance.children)
+            total += copyStateData (child, getStateDataAt(), toState);
+
+        return total;
+    }
+
+    //==============================================================================
+    using EndpointMap = std::unordered_map<std::string, Port*>;
+
+    struct EndpointRef
+    {
+        Port* port;
+        int32_t element;
+
+        Type getType() const    { return element >= 0 ? port->dataTypes.front() : port->getFrameType(); }
+    };
+
+    CompiledProgram& program;
+    const double sampleRate;
+    const int32_t sessionID;
+    const uint32_t blockSize;
+    uint32_t chunkLength = 1;
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::vector<std::unique_ptr<Port>> ports;
+    std::vector<std::unique_ptr<Wire>> wires;
+    std::unordered_map<const Port*, Node*> portOwners;
+    std::vector<Node*> order, processors;
+    std::vector<uint64_t> stack;
+    uint64_t returnScratch[8] = {};
+
+    //==============================================================================
+    static Port* findPort (const EndpointMap& endpoints, const std::string& name)
+    {
+        auto found = endpoints.find (name);
+
+        if (found == endpoints.end())
+            CodeLocation().throwError (Errors::cannotFindEndpoint (name));
+
+        return found->second;
+    }
+
+    Node& addNode (int rate)
+    {
+        nodes.push_back (std::make_unique<Node>());
+        nodes.back()->rateExponent = rate;
+        return *nodes.back();
+    }
+
+    Port& addPort (Node& owner, const heart::IODeclaration& io, int rate)
+    {
+        ports.push_back (std::make_unique<Port> (io, rate));
+        portOwners[ports.back().get()] = std::addressof (owner);
+        return *ports.back();
+    }
+
+    static int getRateExponent (const heart::ClockMultiplier& clock)
+    {
+        return static_cast<int> (std::lround (std::log2 (clock.getRatio())));
+    }
+
+    EndpointMap instantiate (Module& module, int rate, Instance& instance)
+    {
+        EndpointMap endpoints;
+
+        if (module.isProcessor())
+        {
+            auto& node = addNode (rate);
+            instance.node = std::addressof (node);
+            node.module = std::addressof (program.getModule (module));
+            node.instanceID = static_cast<int32_t> (processors.size() + 1);
+            processors.push_back (std::addressof (node));
+
+            for (auto& input : module.inputs)
+            {
+                auto& port = addPort (node, input, rate);
+                node.inputs.push_back (std::addressof (port));
+                endpoints[input->name.toString()] = std::addressof (port);
+            }
+
+            for (auto& output : module.outputs)
+            {
+                auto& port = addPort (node, output, rate);
+                node.outputs.push_back (std::addressof (port));
+                endpoints[output->name.toString()] = std::addressof (port);
+            }
+
+            return endpoints;
+        }
+
+        SOUL_ASSERT (module.isGraph());
+
+        auto addJunction = [&] (const heart::IODeclaration& io)
+        {
+            auto& node = addNode (rate);
+            auto& port = addPort (node, io, rate);
+            node.inputs.push_back (std::addressof (port));
+            node.outputs.push_back (std::addressof (port));
+            endpoints[io.name.toString()] = std::addressof (port);
+        };
+
+        for (auto& input : module.inputs)    addJunction (input);
+        for (auto& output : module.outputs)  addJunction (output);
+
+        std::unordered_map<const heart::ProcessorInstance*, std::vector<EndpointMap>> instances;
+
+        for (auto& i : module.processorInstances)
+        {
+            auto& childModule = program.program.getModuleWithName (i->sourceName);
+            auto childRate = rate + getRateExponent (i->clockMultiplier);
+            auto& copies = instances[std::addressof (i.get())];
+            auto& child = instance.children.emplace_back();
+            child.name = i->instanceName;
+
+            if (i->arraySize > 1)
+            {
+                child.isArray = true;
+                child.children.resize (i->arraySize);
+
+                for (auto& element : child.children)
+                    copies.push_back (instantiate (childModule, childRate, element));
+            }
+            else
+            {
+                copies.push_back (instantiate (childModule, childRate, child));
+            }
+        }
+
+        auto resolve = [&] (const heart::EndpointReference& ref)
+        {
+            auto index = ref.endpointIndex.has_value() ? static_cast<int32_t> (*ref.endpointIndex) : -1;
+
+            if (ref.processor == nullptr)
+                return std::vector<EndpointRef> { { findPort (endpoints, ref.endpointName), index } };
+
+            auto& copies = instances[ref.processor.get()];
+
+            if (copies.size() == 1)
+                return std::vector<EndpointRef> { { findPort (copies.front(), ref.endpointName), index } };
+
+            // For an array of processors, the index chooses one of the instances
+            if (index >= 0)
+                return std::vector<EndpointRef> { { findPort (copies[static_cast<size_t> (index) % copies.size()], ref.endpointName), -1 } };
+
+            std::vector<EndpointRef> result;
+
+            for (auto& copy : copies)
+                result.push_back ({ findPort (copy, ref.endpointName), -1 });
+
+            return result;
+        };
+
+        // A processor running at a different rate needs all its inputs (and all its outputs)
+        // to be resampled in the same way
+        std::unordered_map<const heart::ProcessorInstance*, InterpolationType> inputInterpolation, outputInterpolation;
+
+        auto checkInterpolation = [] (auto& types, const heart::ProcessorInstance* processorInstance,
+                                      const heart::Connection& c, bool isInput)
+        {
+            if (processorInstance == nullptr || ! processorInstance->clockMultiplier.hasValue())
+                return;
+
+            auto found = types.find (processorInstance);
+
+            if (found == types.end())
+                types[processorInstance] = c.interpolationType;
+            else if (found->second != c.interpolationType)
+                c.location.throwError (isInput ? Errors::incompatibleInputInterpolationTypes (Program::stripRootNamespaceFromQualifiedPath (processorInstance->sourceName))
+                                               : Errors::incompatibleOutputInterpolationTypes (Program::stripRootNamespaceFromQualifiedPath (processorInstance->sourceName)));
+        };
+
+        for (auto& c : module.connections)
+        {
+            checkInterpolation (outputInterpolation, c->source.processor.get(), c, false);
+            checkInterpolation (inputInterpolation, c->dest.processor.get(), c, true);
+
+            auto sources = resolve (c->source);
+            auto dests = resolve (c->dest);
+            auto delay = c->delayLength.value_or (0);
+
+            auto connect = [&] (EndpointRef source, EndpointRef dest)
+            {
+                if (! isEvent (dest.port->endpointType))
+                {
+                    auto sourceType = source.getType();
+                    auto destType = dest.getType();
+
+                    if (sourceType.isArray() && ! sourceType.isIdentical (destType))
+                        c->location.throwError (Errors::cannotConnectSourceAndSink (sourceType.getDescription(), destType.getDescription()));
+                }
+
+                addWire (source, dest, delay, c->interpolationType);
+            };
+
+            if (sources.size() == dests.size())
+            {
+                for (size_t i = 0; i < sources.size(); ++i)
+                    connect (sources[i], dests[i]);
+            }
+            else
+            {
+                for (auto& source : sources)
+                    for (auto& dest : dests)
+                        connect (source, dest);
+            }
+        }
+
+        return endpoints;
+    }
+
+    void addWire (EndpointRef source, EndpointRef dest, int64_t delay, InterpolationType interpolation)
+    {
+        wires.push_back (std::make_unique<Wire> (Wire { *source.port, *dest.port, source.element, dest.element,
+                                                        delay, interpolation, {} }));
+        auto& wire = *wires.back();
+
+        if (isEvent (dest.port->endpointType))
+        {
+            auto& sourceTypes = source.port->dataTypes;
+            auto& destTypes = dest.port->dataTypes;
+
+            for (auto& sourceType : sourceTypes)
+            {
+                Wire::EventTypeMapping mapping { invalidTypeIndex, false };
+
+                for (size_t i = 0; i < destTypes.size() && mapping.destTypeIndex == invalidTypeIndex; ++i)
+                    if (haveSameLayout (destTypes[i], sourceType))
+                        mapping = { static_cast<uint32_t> (i), false };
+
+                for (size_t i = 0; i < destTypes.size() && mapping.destTypeIndex == invalidTypeIndex; ++i)
+                    if (TypeRules::canSilentlyCastTo (destTypes[i], sourceType))
+                        mapping = { static_cast<uint32_t> (i), true };
+
+                wire.eventTypes.push_back (mapping);
+            }
+        }
+
+        source.port->outgoing.push_back (std::addressof (wire));
+        dest.port->incoming.push_back (std::addressof (wire));
+    }
+
+    static constexpr uint32_t invalidTypeIndex = 0xffffffffu;
+
+    //==============================================================================
+    void sortNodes()
+    {
+        std::unordered_map<const Node*, size_t> numUnsortedSources, positions;
+
+        for (auto& w : wires)
+            if (w->delay <= 0)
+                ++numUnsortedSources[portOwners[std::addressof (w->dest)]];
+
+        std::vector<bool> isSorted (nodes.size());
+
+        while (order.size() < nodes.size())
+        {
+            auto numSortedBefore = order.size();
+
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                auto& node = *nodes[i];
+
+                if (! isSorted[i] && numUnsortedSources[std::addressof (node)] == 0)
+                {
+                    isSorted[i] = true;
+                    positions[std::addressof (node)] = order.size();
+                    order.push_back (std::addressof (node));
+
+                    for (auto output : node.outputs)
+                        for (auto w : output->outgoing)
+                            if (w->delay <= 0)
+                                --numUnsortedSources[portOwners[std::addressof (w->dest)]];
+                }
+            }
+
+            // The compiler should have rejected any feedback loops without a delay,
+            // but if there are any, just run the remaining nodes in their original order
+            if (order.size() == numSortedBefore)
+            {
+                for (size_t i = 0; i < nodes.size(); ++i)
+                {
+                    if (! isSorted[i])
+                    {
+                        positions[nodes[i].get()] = order.size();
+                        order.push_back (nodes[i].get());
+                    }
+                }
+            }
+        }
+
+        chunkLength = blockSize;
+
+        for (auto& w : wires)
+        {
+            auto source = portOwners[std::addressof (w->source)];
+            auto dest = portOwners[std::addressof (w->dest)];
+
+            if (w->delay > 0 && positions[source] >= positions[dest])
+            {
+                auto delayInTopLevelFrames = std::max<int64_t> (1, convertTime (w->delay, w->dest.rateExponent, 0));
+                chunkLength = std::min (chunkLength, static_cast<uint32_t> (std::min<int64_t> (delayInTopLevelFrames, blockSize)));
+            }
+        }
+    }
+
+    uint32_t getMaxChunkFrames (int rate) const
+    {
+        if (rate >= 0)
+            return chunkLength << rate;
+
+        return (chunkLength >> -rate) + 1;
+    }
+
+    /// The number of frames of a wire's source that may be needed, further back than the current chunk
+    static int64_t getReadbackFrames (const Wire& w)
+    {
+        auto shift = w.dest.rateExponent - w.source.rateExponent;
+
+        if (shift >= 0)
+            return (w.delay >> shift) + 2;
+
+        return (w.delay << -shift) + (int64_t (1) << -shift);
+    }
+
+    void allocateBuffers()
+    {
+        for (auto& port : ports)
+        {
+            if (! isStream (port->endpointType))
+                continue;
+
+            auto chunkFrames = getMaxChunkFrames (port->rateExponent);
+            port->chunk.resize (chunkFrames * port->frameSize);
+
+            if (! port->outgoing.empty())
+            {
+                int64_t readback = 0;
+
+                for (auto w : port->outgoing)
+                    readback = std::max (readback, getReadbackFrames (*w));
+
+                auto framesNeeded = static_cast<uint32_t> (chunkFrames + readback + 2);
+                uint32_t historyFrames = 1;
+
+                while (historyFrames < framesNeeded)
+                    historyFrames <<= 1;
+
+                port->history.resize (historyFrames * port->frameSize);
+                port->historyMask = static_cast<int64_t> (historyFrames - 1);
+            }
+
+            if (port->isExternalInput || port->isExternalOutput)
+                port->externalFrames.resize (blockSize * port->frameSize);
+        }
+
+        uint32_t stackSize = 0;
+
+        for (auto node : processors)
+        {
+            auto& m = *node->module;
+            node->state.resize (m.stateSize / sizeof (uint64_t) + 1);
+
+            if (m.run != nullptr)
+                node->runFrame.resize (m.run->getStackSizeNeeded() / sizeof (uint64_t) + 1);
+
+            for (auto f : { m.stateInitialiser, m.systemInit, m.userInit, m.cachedValueUpdater })
+                if (f != nullptr)
+                    stackSize = std::max (stackSize, f->getStackSizeNeeded());
+
+            for (auto& handlers : m.eventHandlers)
+                for (auto& handler : handlers)
+                    if (handler.function != nullptr)
+                        stackSize = std::max (stackSize, handler.function->getStackSizeNeeded());
+        }
+
+        stack.resize (stackSize / sizeof (uint64_t) + 1);
+    }
+
+    //==============================================================================
+    /// Converts a time in frames between two rates, rounding up when the target rate is lower
+    static int64_t convertTime (int64_t time, int fromRate, int toRate)
+    {
+        auto shift = toRate - fromRate;
+
+        if (shift >= 0)
+            return time << shift;
+
+        return -((-time) >> -shift);
+    }
+
+    static uint8_t** getRunSlots (Node& node)
+    {
+        return reinterpret_cast<uint8_t**> (node.runFrame.data());
+    }
+
+    void callFunction (const CompiledFunction& f, Node& node, const uint8_t* arg1 = nullptr, const uint8_t* arg2 = nullptr)
+    {
+        auto slots = reinterpret_cast<uint8_t**> (stack.data());
+        f.initialiseSlots (slots, node.getState(), program.constants.data(), reinterpret_cast<uint8_t*> (returnScratch), node);
+
+        const uint8_t* args[] = { arg1, arg2 };
+
+        for (size_t i = 0; i < f.parameters.size() && i < 2; ++i)
+        {
+            auto& param = f.parameters[i];
+
+            if (param.isReference)
+                slots[param.slotOrOffset] = const_cast<uint8_t*> (args[i]);
+            else
+                std::memcpy (slots[frameSlot] + param.slotOrOffset, args[i], param.size);
+        }
+
+        execute (f.code.data(), slots);
+    }
+
+    void dispatchEvent (Node& node, uint32_t inputIndex, const EventQueue::Event& e, const uint8_t* data)
+    {
+        auto& handlers = node.module->eventHandlers[inputIndex];
+
+        if (e.typeIndex >= handlers.size() || handlers[e.typeIndex].function == nullptr)
+            return;
+
+        auto& handler = handlers[e.typeIndex];
+        auto& f = *handler.function;
+
+        if (! handler.hasIndexParameter)
+            return callFunction (f, node, data);
+
+        auto callWithIndex = [&] (int64_t index)
+        {
+            uint8_t indexData[sizeof (int64_t)];
+
+            if (f.parameters.front().size == sizeof (int64_t))
+                store (indexData, index);
+            else
+                store (indexData, static_cast<int32_t> (index));
+
+            callFunction (f, node, indexData, data);
+        };
+
+        if (e.element >= 0)
+            return callWithIndex (e.element);
+
+        for (uint32_t i = 0; i < node.inputs[inputIndex]->arraySize; ++i)
+            callWithIndex (i);
+    }
+
+    //==============================================================================
+    void renderChunk (int64_t chunkStart, uint32_t numFrames)
+    {
+        for (auto node : order)
+        {
+            auto start = convertTime (chunkStart, 0, node->rateExponent);
+            auto end = convertTime (chunkStart + numFrames, 0, node->rateExponent);
+            auto numNodeFrames = static_cast<uint32_t> (end - start);
+            node->chunkStart = start;
+
+            for (auto input : node->inputs)
+                gather (*input, start, numNodeFrames);
+
+            if (! node->isJunction())
+            {
+                processNode (*node, numNodeFrames);
+
+                for (auto input : node->inputs)
+                    input->chunkEvents.clear();
+            }
+
+            for (auto output : node->outputs)
+                publish (*output, start, numNodeFrames);
+        }
+    }
+
+    void processNode (Node& node, uint32_t numFrames)
+    {
+        for (auto output : node.outputs)
+            if (isStream (output->endpointType))
+                std::fill (output->chunk.begin(), output->chunk.begin() + numFrames * output->frameSize, 0);
+
+        for (uint32_t frame = 0; frame < numFrames; ++frame)
+        {
+            node.currentFrame = frame;
+            auto time = node.chunkStart + frame;
+            auto nextEventTime = node.chunkStart + numFrames;
+            bool hasPendingEvents = false;
+
+            for (uint32_t i = 0; i < node.inputs.size(); ++i)
+            {
+                auto& queue = node.inputs[i]->chunkEvents;
+
+                while (! queue.isEmpty() && queue.front().time <= time)
+                {
+                    auto e = queue.front();
+                    dispatchEvent (node, i, e, queue.getData (e));
+                    queue.removeFront();
+                }
+
+                if (! queue.isEmpty())
+                {
+                    hasPendingEvents = true;
+                    nextEventTime = std::min (nextEventTime, queue.front().time);
+                }
+            }
+
+            if (auto ip = node.resumePoint)
+            {
+                // Code which handles several frames at once checks that none of them
+                // have any events to deliver first
+                store (node.getState() + node.module->framesAvailableOffset, static_cast<int32_t> (nextEventTime - time));
+
+                // The advance() handler sets a new resume point, so if the run function
+                // returns instead, the processor has finished
+                node.resumePoint = nullptr;
+                execute (ip, getRunSlots (node));
+                frame += node.extraFramesAdvanced;
+                node.extraFramesAdvanced = 0;
+            }
+            else if (! hasPendingEvents)
+            {
+                break;
+            }
+        }
+    }
+
+    //==============================================================================
+    void gather (Port& port, int64_t start, uint32_t numFrames)
+    {
+        port.chunkStart = start;
+
+        if (isEvent (port.endpointType))
+        {
+            while (port.pendingEvents.hasEventBefore (start + numFrames))
+            {
+                auto& e = port.pendingEvents.front();
+                port.chunkEvents.add (e.time, e.typeIndex, e.element, port.pendingEvents.getData (e), e.dataSize);
+                port.pendingEvents.removeFront();
+            }
+
+            return;
+        }
+
+        if (isValue (port.endpointType))
+        {
+            for (auto w : port.incoming)
+                copyValue (*w);
+
+            return;
+        }
+
+        if (port.isExternalInput)
+        {
+            std::memcpy (port.chunk.data(), port.externalFrames.data() + static_cast<size_t> (start - blockStart) * port.frameSize,
+                         numFrames * port.frameSize);
+            return;
+        }
+
+        std::fill (port.chunk.begin(), port.chunk.begin() + numFrames * port.frameSize, 0);
+
+        for (auto w : port.incoming)
+            readStream (*w, start, numFrames);
+    }
+
+    void publish (Port& port, int64_t start, uint32_t numFrames)
+    {
+        if (isEvent (port.endpointType))
+        {
+            port.chunkEvents.iterate ([&] (const EventQueue::Event& e)
+            {
+                auto data = port.chunkEvents.getData (e);
+
+                for (auto w : port.outgoing)
+                    deliverEvent (*w, e, data);
+
+                if (port.isExternalOutput)
+                    port.externalEvents.add (e.time - blockStart, e.typeIndex, e.element, data, e.dataSize);
+            });
+
+            port.chunkEvents.clear();
+            return;
+        }
+
+        if (! isStream (port.endpointType))
+            return;
+
+        if (! port.history.empty())
+            for (uint32_t i = 0; i < numFrames; ++i)
+                std::memcpy (port.getHistoryFrame (start + i), port.chunk.data() + i * port.frameSize, port.frameSize);
+
+        if (port.isExternalOutput)
+            std::memcpy (port.externalFrames.data() + static_cast<size_t> (start - blockStart) * port.frameSize,
+                         port.chunk.data(), numFrames * port.frameSize);
+    }
+
+    static uint32_t getSourceElement (const Wire& w, uint32_t destElement)
+    {
+        if (w.sourceElement >= 0)
+            return static_cast<uint32_t> (w.sourceElement);
+
+        return destElement % w.source.arraySize;
+    }
+
+    static void copyValue (const Wire& w)
+    {
+        auto& dest = w.dest;
+        auto& source = w.source;
+
+        if (w.destElement < 0 && w.sourceElement < 0 && source.frameSize == dest.frameSize)
+            return (void) std::memcpy (dest.value.data(), source.value.data(), dest.frameSize);
+
+        auto firstElement = static_cast<uint32_t> (std::max (0, w.destElement));
+        auto numElements = w.destElement >= 0 ? 1u : dest.arraySize;
+
+        for (uint32_t i = firstElement; i < firstElement + numElements; ++i)
+            std::memcpy (dest.value.data() + i * dest.elementSize,
+                         source.value.data() + getSourceElement (w, i) * source.elementSize, dest.elementSize);
+    }
+
+    void deliverEvent (const Wire& w, const EventQueue::Event& e, const uint8_t* data)
+    {
+        if (w.sourceElement >= 0 && e.element >= 0 && e.element != w.sourceElement)
+            return;
+
+        if (e.typeIndex >= w.eventTypes.size() || w.eventTypes[e.typeIndex].destTypeIndex == invalidTypeIndex)
+            return;
+
+        auto& mapping = w.eventTypes[e.typeIndex];
+        auto element = w.destElement >= 0 ? w.destElement : (w.sourceElement >= 0 ? -1 : e.element);
+        auto time = convertTime (e.time, w.source.rateExponent, w.dest.rateExponent) + w.delay;
+
+        if (! mapping.needsConversion)
+            return w.dest.pendingEvents.add (time, mapping.destTypeIndex, element, data, e.dataSize);
+
+        auto& sourceType = w.source.dataTypes[e.typeIndex];
+        auto& destType = w.dest.dataTypes[mapping.destTypeIndex];
+        auto value = Value::createFromRawData (sourceType, data, e.dataSize).castToTypeExpectingSuccess (destType);
+        w.dest.pendingEvents.add (time, mapping.destTypeIndex, element, value.getPackedData(), getPackedSize (destType));
+    }
+
+    //==============================================================================
+    template <typename T>
+    static void addScaled (uint8_t* dest, const uint8_t* source, uint32_t count, double gain)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto d = dest + i * sizeof (T);
+            auto s = source + i * sizeof (T);
+
+            if constexpr (std::is_same_v<T, bool>)
+                store (d, load<T> (d) || load<T> (s));
+            else
+                store (d, static_cast<T> (load<T> (d) + static_cast<T> (static_cast<double> (load<T> (s)) * gain)));
+        }
+    }
+
+    static void addScaled (PrimitiveType p, uint8_t* dest, const uint8_t* source, uint32_t count, double gain)
+    {
+        if (gain == 1.0)
+        {
+            if (p.isFloat32())        return handlers::accumulate<float> (dest, source, count);
+            if (p.isFloat64())        return handlers::accumulate<double> (dest, source, count);
+            if (p.isInteger32())      return handlers::accumulate<int32_t> (dest, source, count);
+            if (p.isInteger64())      return handlers::accumulate<int64_t> (dest, source, count);
+            if (p.isBool())           return handlers::accumulate<bool> (dest, source, count);
+        }
+
+        if (p.isFloat32())            return addScaled<float> (dest, source, count, gain);
+        if (p.isFloat64())            return addScaled<double> (dest, source, count, gain);
+        if (p.isInteger32())          return addScaled<int32_t> (dest, source, count, gain);
+        if (p.isInteger64())          return addScaled<int64_t> (dest, source, count, gain);
+        if (p.isBool())               return addScaled<bool> (dest, source, count, gain);
+    }
+
+    static void addSourceFrame (Port& source, int64_t frame, uint32_t element, Port& dest, uint8_t* destData, double gain)
+    {
+        if (frame >= 0)
+            addScaled (dest.primitive, destData, source.getHistoryFrame (frame) + element * source.elementSize,
+                       dest.primitivesPerElement, gain);
+    }
+
+    /// Mixes the data from a stream wire into its destination's chunk, converting the sample rate if needed
+    static void readStream (const Wire& w, int64_t start, uint32_t numFrames)
+    {
+        auto& source = w.source;
+        auto& dest = w.dest;
+        auto shift = dest.rateExponent - source.rateExponent;
+        auto firstElement = static_cast<uint32_t> (std::max (0, w.destElement));
+        auto numElements = w.destElement >= 0 ? 1u : dest.arraySize;
+        bool interpolate = ! (w.interpolation == InterpolationType::none || w.interpolation == InterpolationType::latch);
+
+        for (uint32_t frame = 0; frame < numFrames; ++frame)
+        {
+            auto time = start + frame - w.delay;
+            auto destFrame = dest.chunk.data() + frame * dest.frameSize;
+
+            for (uint32_t i = firstElement; i < firstElement + numElements; ++i)
+            {
+                auto destData = destFrame + i * dest.elementSize;
+                auto sourceElement = getSourceElement (w, i);
+
+                if (shift == 0)
+                {
+                    addSourceFrame (source, time, sourceElement, dest, destData, 1.0);
+                }
+                else if (shift > 0)
+                {
+                    // Upsampling interpolates towards the most recent source frame, because the
+                    // one after it may not have been rendered yet
+                    auto sourceFrame = time >> shift;
+
+                    if (interpolate)
+                    {
+                        auto fraction = static_cast<double> (time & ((int64_t (1) << shift) - 1)) / static_cast<double> (int64_t (1) << shift);
+                        addSourceFrame (source, sourceFrame - 1, sourceElement, dest, destData, 1.0 - fraction);
+                        addSourceFrame (source, sourceFrame, sourceElement, dest, destData, fraction);
+                    }
+                    else
+                    {
+                        addSourceFrame (source, sourceFrame, sourceElement, dest, destData, 1.0);
+                    }
+                }
+                else
+                {
+                    auto factor = int64_t (1) << -shift;
+                    auto firstSourceFrame = time << -shift;
+
+                    if (interpolate)
+                    {
+                        for (int64_t n = 0; n < factor; ++n)
+                            addSourceFrame (source, firstSourceFrame + n, sourceElement, dest, destData, 1.0 / static_cast<double> (factor));
+                    }
+                    else
+                    {
+                        addSourceFrame (source, firstSourceFrame, sourceElement, dest, destData, 1.0);
+                    }
+                }
+            }
+        }
+    }
+};
+
+//==============================================================================
+struct InterpreterPerformer  : public Performer
+{
+    InterpreterPerformer() = default;
+    ~InterpreterPerformer() override   { unload(); }
+
+    //==============================================================================
+    bool load (CompileMessageList& messageList, const Program& programToLoad) noexcept override
+    {
+        unload();
+
+        try
+        {
+            CompileMessageHandler handler (messageList);
+            program = programToLoad.clone();
+
+            auto& mainProcessor = program.getMainProcessor();
+
+            for (auto& input : mainProcessor.inputs)
+                endpoints.push_back (std::make_unique<EndpointInfo> (input->getDetails(), true, getEndpointTypes (input)));
+
+            for (auto& output : mainProcessor.outputs)
+                endpoints.push_back (std::make_unique<EndpointInfo> (output->getDetails(), false, getEndpointTypes (output)));
+
+            for (auto& e : endpoints)
+                (e->isInput ? inputEndpoints : outputEndpoints).push_back (e->details);
+
+            for (auto& v : program.getExternalVariables())
+                externalVariables.push_back ({ getExternalVariableName (v), v->type.getExternalType(), v->annotation.toExternalValue() });
+
+            return true;
+        }
+        catch (AbortCompilationException) {}
+
+        unload();
+        return false;
+    }
+
+    void unload() noexcept override
+    {
+        unlinkProgram();
+        program = {};
+        endpoints.clear();
+        inputEndpoints.clear();
+        outputEndpoints.clear();
+        externalVariables.clear();
+    }
+
+    choc::span<const EndpointDetails> getInputEndpoints() noexcept override       { return inputEndpoints; }
+    choc::span<const EndpointDetails> getOutputEndpoints() noexcept override      { return outputEndpoints; }
+    choc::span<const ExternalVariable> getExternalVariables() noexcept override   { return externalVariables; }
+
+    bool setExternalVariable (const char* name, const choc::value::ValueView& value) noexcept override
+    {
+        if (! isLoaded() || isLinked())
+            return false;
+
+        for (auto& v : program.getExternalVariables())
+        {
+            if (getExternalVariableName (v) == name)
+            {
+                if (auto newValue = convertValue (v->type, value))
+                {
+                    v->externalHandle = program.getConstantTable().getHandleForValue (std::move (*newValue));
+                    return true;
+                }
+
+                return false;
+            }
+        }
+
+        return false;
+    }
+
+    //==============================================================================
+    bool link (CompileMessageList& messageList, const BuildSettings& settings, LinkerCache*) noexcept override
+    {
+        if (! isLoaded())
+            return false;
+
+        if (isLinked())
+            return true;
+
+        try
+        {
+            CompileMessageHandler handler (messageList);
+            linkProgram (settings);
+            return true;
+        }
+        catch (AbortCompilationException) {}
+
+        unlinkProgram();
+        return false;
+    }
+
+    bool isLoaded() noexcept override     { return ! program.isEmpty(); }
+    bool isLinked() noexcept override     { return runtime != nullptr; }
+
+    void reset() noexcept override
+    {
+        if (isLinked())
+        {
+            runtime->reset();
+
+            for (auto& e : endpoints)
+                e->ramp = {};
+        }
+    }
+
+    EndpointHandle getEndpointHandle (const EndpointID& endpointID) noexcept override
+    {
+        for (size_t i = 0; i < endpoints.size(); ++i)
+        {
+            auto& e = *endpoints[i];
+
+            if (e.details.endpointID == endpointID)
+            {
+                e.isActive = true;
+                return EndpointHandle::create (e.details.endpointType, static_cast<uint32_t> (i + 1));
+            }
+        }
+
+        return {};
+    }
+
+    bool isEndpointActive (const EndpointID& endpointID) noexcept override
+    {
+        for (auto& e : endpoints)
+            if (e->details.endpointID == endpointID)
+                return e->isActive;
+
+        return false;
+    }
+
+    //==============================================================================
+    void prepare (uint32_t numFramesToBeRendered) noexcept override
+    {
+        SOUL_ASSERT (isLinked() && numFramesToBeRendered <= blockSize);
+        numFramesInBlock = numFramesToBeRendered;
+        runtime->clearOutputEvents();
+    }
+
+    void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+        {
+            auto& port = *e->port;
+            auto numFrames = std::min (static_cast<uint32_t> (frameArray.size()), numFramesInBlock);
+            e->ramp.isActive = false;
+
+            if (frameArray.getType().getValueDataSize() == frameArray.size() * port.frameSize)
+                return (void) std::memcpy (port.externalFrames.data(), frameArray.getRawData(), numFrames * port.frameSize);
+
+            // If the caller's data isn't laid out in the same way as ours, each frame has to be converted
+            for (uint32_t i = 0; i < numFrames; ++i)
+                if (auto frame = convertValue (e->types.front(), frameArray[i]))
+                    std::memcpy (port.externalFrames.data() + i * port.frameSize, frame->getPackedData(), port.frameSize);
+        }
+    }
+
+    void setSparseInputStreamTarget (EndpointHandle handle, const choc::value::ValueView& targetFrameValue,
+                                     uint32_t numFramesToReachValue) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+        {
+            auto& port = *e->port;
+
+            if (auto target = convertValue (e->types.front(), targetFrameValue))
+            {
+                auto& ramp = e->ramp;
+                auto numPrimitives = port.primitivesPerElement * port.arraySize;
+
+                if (! ramp.isActive)
+                    ramp.current.assign (numPrimitives, 0.0);
+
+                ramp.target.resize (numPrimitives);
+                ramp.increment.resize (numPrimitives);
+                ramp.isActive = true;
+                ramp.framesRemaining = port.primitive.isFloatingPoint() ? numFramesToReachValue : 0;
+
+                auto data = static_cast<const uint8_t*> (target->getPackedData());
+
+                for (uint32_t i = 0; i < numPrimitives; ++i)
+                {
+                    ramp.target[i] = loadAsDouble (port.primitive, data + i * static_cast<uint32_t> (port.primitive.getPackedSizeInBytes()));
+
+                    if (ramp.framesRemaining == 0)
+                        ramp.current[i] = ramp.target[i];
+
+                    ramp.increment[i] = ramp.framesRemaining == 0 ? 0.0 : (ramp.target[i] - ramp.current[i]) / ramp.framesRemaining;
+                }
+            }
+        }
+    }
+
+    void setInputValue (EndpointHandle handle, const choc::value::ValueView& newValue) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+            if (auto value = convertValue (e->types.front(), newValue))
+                std::memcpy (e->port->value.data(), value->getPackedData(), e->port->frameSize);
+    }
+
+    void addInputEvent (EndpointHandle handle, const choc::value::ValueView& eventData) noexcept override
+    {
+        addInputEventAtFrame (handle, 0, eventData);
+    }
+
+    void addInputEventAtFrame (EndpointHandle handle, uint32_t frameOffset, const choc::value::ValueView& eventData) noexcept override
+    {
+        if (auto e = getEndpoint (handle, true))
+        {
+            auto typeIndex = e->findTypeIndexForValue (eventData);
+
+            if (typeIndex >= 0)
+            {
+                auto& type = e->types[static_cast<size_t> (typeIndex)];
+
+                if (auto value = convertValue (type, eventData))
+                    e->port->pendingEvents.add (runtime->blockStart + (numFramesInBlock == 0 ? 0 : std::min (frameOffset, numFramesInBlock - 1)),
+                                                static_cast<uint32_t> (typeIndex), -1,
+                                                value->getPackedData(), getPackedSize (type));
+            }
+        }
+    }
+
+    bool supportsTimestampedInputEvents() noexcept override     { return true; }
+
+    void advance() noexcept override
+    {
+        for (auto& e : endpoints)
+            if (e->ramp.isActive)
+                renderRamp (*e);
+
+        runtime->render (numFramesInBlock);
+    }
+
+    //==============================================================================
+    choc::value::ValueView getOutputStreamFrames (EndpointHandle handle) noexcept override
+    {
+        if (auto e = getEndpoint (handle, false))
+        {
+            auto& port = *e->port;
+            auto frameType = e->externalTypes.front();
+
+            if (frameType.getValueDataSize() == port.frameSize)
+                return choc::value::ValueView (choc::value::Type::createArray (std::move (frameType), numFramesInBlock),
+                                               port.externalFrames.data(), nullptr);
+
+            e->outputFrames = choc::value::Value (choc::value::Type::createArray (frameType, numFramesInBlock));
+
+            for (uint32_t i = 0; i < numFramesInBlock; ++i)
+            {
+                auto frame = Value::createFromRawData (e->types.front(), port.externalFrames.data() + i * port.frameSize, port.frameSize)
+                               .toExternalValue (program.getConstantTable(), program.getStringDictionary());
+                std::memcpy (e->outputFrames.getViewReference()[i].getRawData(), frame.getRawData(), frameType.getValueDataSize());
+            }
+
+            return e->outputFrames;
+        }
+
+        return {};
+    }
+
+    choc::value::ValueView getOutputValue (EndpointHandle handle) noexcept override
+    {
+        if (auto e = getEndpoint (handle, false))
+        {
+            auto& port = *e->port;
+            e->outputValue = Value::createFromRawData (e->types.front(), port.value.data(), port.frameSize)
+                               .toExternalValue (program.getConstantTable(), program.getStringDictionary());
+            return e->outputValue;
+        }
+
+        return {};
+    }
+
+    void iterateOutputEvents (EndpointHandle handle, HandleNextOutputEventFn handleEvent) noexcept override
+    {
+        if (auto e = getEndpoint (handle, false))
+        {
+            auto& events = e->port->externalEvents;
+            bool shouldContinue = true;
+
+            events.iterate ([&] (const EventQueue::Event& event)
+            {
+                if (shouldContinue)
+                {
+                    auto value = Value::createFromRawData (e->types[event.typeIndex], events.getData (event), event.dataSize)
+                                   .toExternalValue (program.getConstantTable(), program.getStringDictionary());
+
+                    shouldContinue = handleEvent (static_cast<uint32_t> (event.time), value);
+                }
+            });
+        }
+    }
+
+    //==============================================================================
+    uint32_t getLatency() noexcept override           { return isLoaded() ? program.getMainProcessor().latency : 0; }
+    uint32_t getXRuns() noexcept override             { return 0; }
+    uint32_t getBlockSize() noexcept override         { return blockSize; }
+    bool hasError() noexcept override                 { return false; }
+    const char* getError() noexcept override          { return nullptr; }
+
+    choc::value::Value getState() noexcept override
+    {
+        return isLinked() ? runtime->getState() : choc::value::Value();
+    }
+
+    bool setState (const choc::value::ValueView& state) noexcept override
+    {
+        if (! isLinked())
+            return false;
+
+        return runtime->setState (state);
+    }
+
+    bool getStateData (void* dest, size_t size) noexcept override
+    {
+        return isLinked() && runtime->getStateData (dest, size);
+    }
+
+    bool setStateData (const void* source, size_t size) noexcept override
+    {
+        return isLinked() && runtime->setStateData (source, size);
+    }
+
+private:
+    //==============================================================================
+    static constexpr uint32_t defaultBlockSize = 512;
+    static constexpr double defaultSampleRate = 44100.0;
+
+    struct SparseRamp
+    {
+        std::vector<double> current, target, increment;
+        uint32_t framesRemaining = 0;
+        bool isActive = false;
+    };
+
+    struct EndpointInfo
+    {
+        EndpointInfo (EndpointDetails d, bool input, std::vector<Type> t)
+            : details (std::move (d)), isInput (input), types (std::move (t))
+        {
+            for (auto& type : types)
+                externalTypes.push_back (type.getExternalType());
+        }
+
+        int findTypeIndexForValue (const choc::value::ValueView& v) const
+        {
+            for (size_t i = 0; i < externalTypes.size(); ++i)
+                if (externalTypes[i] == v.getType())
+                    return static_cast<int> (i);
+
+            return externalTypes.size() == 1 ? 0 : -1;
+        }
+
+        EndpointDetails details;
+        bool isInput, isActive = false;
+        std::vector<Type> types;
+        std::vector<choc::value::Type> externalTypes;
+        Port* port = nullptr;
+        choc::value::Value outputValue, outputFrames;
+        SparseRamp ramp;
+    };
+
+    //==============================================================================
+    Program program;
+    std::vector<std::unique_ptr<EndpointInfo>> endpoints;
+    std::vector<EndpointDetails> inputEndpoints, outputEndpoints;
+    std::vector<ExternalVariable> externalVariables;
+    std::unique_ptr<CompiledProgram> compiledProgram;
+    std::unique_ptr<Runtime> runtime;
+    uint32_t blockSize = 0, numFramesInBlock = 0;
+
+    //==============================================================================
+    /// Streams and values are handled a whole frame at a time, so an endpoint array
+    /// is treated as a single endpoint whose type is an array
+    static std::vector<Type> getEndpointTypes (const heart::IODeclaration& io)
+    {
+        if (io.isEventEndpoint())
+            return io.dataTypes;
+
+        return { io.getFrameOrValueType() };
+    }
+
+    std::string getExternalVariableName (const heart::Variable& v) const
+    {
+        return Program::stripRootNamespaceFromQualifiedPath (program.getExternalVariableName (v));
+    }
+
+    EndpointInfo* getEndpoint (EndpointHandle handle, bool isInput)
+    {
+        auto index = handle.getRawHandle() - 1;
+
+        if (isLinked() && index < endpoints.size())
+        {
+            auto& e = *endpoints[index];
+
+            if (e.isInput == isInput)
+                return std::addressof (e);
+        }
+
+        return nullptr;
+    }
+
+    std::optional<Value> convertValue (const Type& targetType, const choc::value::ValueView& source)
+    {
+        CompileMessageList messageList;
+
+        try
+        {
+            CompileMessageHandler handler (messageList);
+            return Value::fromExternalValue (targetType, source, program.getConstantTable(), program.getStringDictionary());
+        }
+        catch (AbortCompilationException) {}
+
+        return {};
+    }
+
+    static double loadAsDouble (PrimitiveType p, const uint8_t* data)
+    {
+        if (p.isFloat32())    return static_cast<double> (interpreter::load<float> (data));
+        if (p.isFloat64())    return interpreter::load<double> (data);
+        if (p.isInteger32())  return static_cast<double> (interpreter::load<int32_t> (data));
+        if (p.isInteger64())  return static_cast<double> (interpreter::load<int64_t> (data));
+        if (p.isBool())       return interpreter::load<bool> (data) ? 1.0 : 0.0;
+        return 0;
+    }
+
+    static void storeAsPrimitive (PrimitiveType p, uint8_t* data, double value)
+    {
+        if (p.isFloat32())    return interpreter::store (data, static_cast<float> (value));
+        if (p.isFloat64())    return interpreter::store (data, value);
+        if (p.isInteger32())  return interpreter::store (data, static_cast<int32_t> (value));
+        if (p.isInteger64())  return interpreter::store (data, static_cast<int64_t> (value));
+        if (p.isBool())       return interpreter::store (data, value != 0);
+    }
+
+    void renderRamp (EndpointInfo& e)
+    {
+        auto& port = *e.port;
+        auto& ramp = e.ramp;
+        auto primitiveSize = static_cast<uint32_t> (port.primitive.getPackedSizeInBytes());
+
+        for (uint32_t frame = 0; frame < numFramesInBlock; ++frame)
+        {
+            auto frameData = port.externalFrames.data() + frame * port.frameSize;
+
+            for (size_t i = 0; i < ramp.current.size(); ++i)
+                storeAsPrimitive (port.primitive, frameData + i * primitiveSize, ramp.current[i]);
+
+            if (ramp.framesRemaining > 0)
+            {
+                if (--ramp.framesRemaining == 0)
+                    ramp.current = ramp.target;
+                else
+                    for (size_t i = 0; i < ramp.current.size(); ++i)
+                        ramp.current[i] += ramp.increment[i];
+            }
+        }
+    }
+
+    void unlinkProgram()
+    {
+        runtime.reset();
+        compiledProgram.reset();
+
+        for (auto& e : endpoints)
+            e->port = nullptr;
+
+        blockSize = 0;
+        numFramesInBlock = 0;
+    }
+
+    //==============================================================================
+    /// Any externals which haven't been given a value can be filled with their default
+    /// value, or with audio data that's generated from their annotation
+    void resolveExternals()
+    {
+        for (auto& v : program.getExternalVariables())
+        {
+            if (v->externalHandle != 0)
+                continue;
+
+            Value value;
+
+            if (v->annotation.hasValue ("default"))
+            {
+                auto defaultValue = v->annotation.getValue ("default");
+                CompileMessage errorMessage;
+
+                if (TypeRules::canSilentlyCastTo (v->type, defaultValue))
+                    value = defaultValue.tryCastToType (v->type, errorMessage);
+
+                if (! value.isValid())
+                    v->location.throwError (Errors::cannotConvertExternalType (defaultValue.getType().getDescription(),
+                                                                               v->type.getDescription()));
+            }
+            else
+            {
+                auto waveform = generateWaveform (v->annotation);
+
+                if (waveform.isVoid())
+                    v->location.throwError (Errors::unresolvedExternal (v->name.toString()));
+
+                auto coerced = coerceAudioFileObjectToTargetType (v->type, waveform);
+
+                if (! coerced.isVoid())
+                    value = Value::fromExternalValue (v->type, coerced, program.getConstantTable(), program.getStringDictionary());
+
+                if (! value.isValid())
+                    v->location.throwError (Errors::cannotConvertExternalType (Type (PrimitiveType::void_).getDescription(),
+                                                                               v->type.getDescription()));
+            }
+
+            v->externalHandle = program.getConstantTable().getHandleForValue (std::move (value));
+        }
+    }
+
+    void linkProgram (const BuildSettings& settings)
+    {
+        resolveExternals();
+
+        blockSize = settings.maxBlockSize != 0 ? settings.maxBlockSize : defaultBlockSize;
+        auto sampleRate = settings.sampleRate > 0 ? settings.sampleRate : defaultSampleRate;
+
+        compiledProgram = std::make_unique<CompiledProgram> (program.clone());
+        DelayCompensation::apply (compiledProgram->program.getMainProcessor());
+        runtime = std::make_unique<Runtime> (*compiledProgram, sampleRate, settings.sessionID, blockSize);
+
+        size_t inputIndex = 0, outputIndex = 0;
+
+        for (auto& e : endpoints)
+            e->port = e->isInput ? runtime->inputs[inputIndex++] : runtime->outputs[outputIndex++];
+
+        runtime->reset();
+    }
+};
+
+//==============================================================================
+std::unique_ptr<Performer> createPerformer()
+{
+    return std::make_unique<InterpreterPerformer>();
+}
+
+std::unique_ptr<PerformerFactory> createPerformerFactory()
+{
+    struct InterpreterPerformerFactory  : public PerformerFactory
+    {
+        std::unique_ptr<Performer> createPerformer() override   { return interpreter::createPerformer(); }
+        bool supportsRunLoopVectorisation() const override      { return true; }
+    };
+
+    return std::make_unique<InterpreterPerformerFactory>();
+}
+
+} // namespace soul::interpreter
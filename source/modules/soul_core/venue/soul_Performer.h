@@ -159,6 +159,20 @@ public:
     */
     virtual void addInputEvent (EndpointHandle, const choc::value::ValueView& eventData) noexcept = 0;
 
+    /** Adds an event to an input queue, to be dispatched at a given frame within the next block.
+        This behaves like addInputEvent(), but if supportsTimestampedInputEvents() returns true, the
+        event will be delivered at the given frame offset during the next call to advance(), so a
+        caller doesn't need to split its blocks at each event's position to keep it sample-accurate.
+        Performers which don't support this will deliver the event at the start of the block.
+    */
+    virtual void addInputEventAtFrame (EndpointHandle handle, uint32_t /*frameOffset*/,
+                                       const choc::value::ValueView& eventData) noexcept    { addInputEvent (handle, eventData); }
+
+    /** Returns true if this performer will honour the frame offsets given to addInputEventAtFrame().
+        This may change after a call to prepare(), so should be checked before each block.
+    */
+    virtual bool supportsTimestampedInputEvents() noexcept                                  { return false; }
+
     /** Retrieves the most recent block of frames from an output stream.
         After a successful call to advance(), this may be called to get the block of frames which
         were rendered during that call. A nullptr return value indicates an error.
@@ -212,6 +226,36 @@ public:
     /** Returns the error message for the performer - if no error is present, this returns nullptr
     */
     virtual const char* getError() noexcept = 0;
+
+    /** Returns an object containing the current values of the linked program's state variables.
+        The result can be passed to setState() on another performer which has linked the same
+        program, which lets a caller move a running program from one performer to another.
+        A performer which doesn't support this will return a void value.
+    */
+    virtual choc::value::Value getState() noexcept                              { return {}; }
+
+    /** Overwrites the linked program's state variables with values that were returned by getState().
+        Like advance(), this must only be called between blocks. Returns false if the performer
+        doesn't support this, or if the value didn't contain a matching value for every one of the
+        program's state variables, or contained values that don't belong to any of them. If it
+        returns false, some of the variables may still have been overwritten.
+    */
+    virtual bool setState (const choc::value::ValueView&) noexcept              { return false; }
+
+    /** Copies the values that getState() would return into a block of memory laid out like the
+        packed data of that value, without allocating, so that it can be done on the audio thread.
+        Like advance(), this must only be called between blocks. Returns false if the performer
+        doesn't support this, or if the size doesn't match the size of the getState() data.
+    */
+    virtual bool getStateData (void* /*dest*/, size_t /*size*/) noexcept        { return false; }
+
+    /** Overwrites the program's state variables from a block of memory that was filled in by
+        getStateData(), without allocating. The caller must make sure that the data came from a
+        performer whose getState() returns the same type as this one. Like advance(), this must only
+        be called between blocks. Returns false if the performer doesn't support this, or if the
+        size doesn't match the size of the getState() data.
+    */
+    virtual bool setStateData (const void* /*source*/, size_t /*size*/) noexcept { return false; }
 };
 
 //==============================================================================
@@ -253,6 +297,12 @@ public:
     virtual ~PerformerFactory() {}
 
     virtual std::unique_ptr<Performer> createPerformer() = 0;
+
+    /** Returns true if the performers that this factory creates can run programs which use
+        multi-frame stream reads, writes and advances, and the processor.framesAvailable
+        property. If so, programs built for them can enable RunLoopVectorisation.
+    */
+    virtual bool supportsRunLoopVectorisation() const   { return false; }
 };
 
 
@@ -281,6 +331,8 @@ struct PerformerWrapper  : public soul::Performer
     void setSparseInputStreamTarget (soul::EndpointHandle h, const choc::value::ValueView& v, uint32_t t) noexcept override { performer->setSparseInputStreamTarget (h, v, t); }
     void setInputValue (soul::EndpointHandle h, const choc::value::ValueView& v) noexcept override                          { performer->setInputValue (h, v); }
     void addInputEvent (soul::EndpointHandle h, const choc::value::ValueView& v) noexcept override                          { performer->addInputEvent (h, v); }
+    void addInputEventAtFrame (soul::EndpointHandle h, uint32_t f, const choc::value::ValueView& v) noexcept override       { performer->addInputEventAtFrame (h, f, v); }
+    bool supportsTimestampedInputEvents() noexcept override                                                                 { return performer->supportsTimestampedInputEvents(); }
     choc::value::ValueView getOutputStreamFrames (soul::EndpointHandle h) noexcept override                                 { return performer->getOutputStreamFrames (h); }
     choc::value::ValueView getOutputValue (soul::EndpointHandle h) noexcept override                                        { return performer->getOutputValue (h); }
     void iterateOutputEvents (soul::EndpointHandle h, HandleNextOutputEventFn f) noexcept override                          { return performer->iterateOutputEvents (h, std::move (f)); }
@@ -292,9 +344,218 @@ struct PerformerWrapper  : public soul::Performer
     uint32_t getBlockSize() noexcept override                                                                               { return performer->getBlockSize(); }
     bool hasError() noexcept override                                                                                       { return performer->hasError(); }
     const char* getError() noexcept override                                                                                { return performer->getError(); }
+    choc::value::Value getState() noexcept override                                                                         { return performer->getState(); }
+    bool setState (const choc::value::ValueView& v) noexcept override                                                       { return performer->setState (v); }
+    bool getStateData (void* dest, size_t size) noexcept override                                                           { return performer->getStateData (dest, size); }
+    bool setStateData (const void* source, size_t size) noexcept override                                                   { return performer->setStateData (source, size); }
 
     std::unique_ptr<soul::Performer> performer;
 };
 
+//==============================================================================
+/**
+    Helper functions for performers which implement Performer::getState(), setState(),
+    getStateData() and setStateData() by copying the packed data of their state variables.
+*/
+struct PerformerState
+{
+    /** Returns the type which getState() uses to hold a variable of the given type, or a void
+        type if it can't be moved between performers. (Slices and strings refer to data which
+        belongs to a particular performer, so can't be moved).
+    */
+    static choc::value::Type getStateType (const Type& type)
+    {
+        if (type.isBoundedInt())
+            return choc::value::Type::createInt32();
+
+        if (type.isFixedSizeArray())
+        {
+            auto elementType = getStateType (type.getArrayElementType());
+
+            if (elementType.isVoid())
+                return {};
+
+            return choc::value::Type::createArray (std::move (elementType), static_cast<uint32_t> (type.getArraySize()));
+        }
+
+        if (type.isStruct())
+        {
+            auto& s = type.getStructRef();
+            auto o = choc::value::Type::createObject (s.getName());
+
+            for (auto& m : s.getMembers())
+            {
+                auto memberType = getStateType (m.type);
+
+                if (memberType.isVoid())
+                    return {};
+
+                o.addObjectMember (m.name, std::move (memberType));
+            }
+
+            return o;
+        }
+
+        if (type.isPrimitiveOrVector() && (type.isInteger() || type.isFloatingPoint() || type.isBool()))
+            return type.getExternalType();
+
+        return {};
+    }
+
+    /** Returns true if getStateType() returns a non-void type for the given type. Unlike
+        getStateType(), this doesn't allocate.
+    */
+    static bool hasStateType (const Type& type)
+    {
+        if (type.isBoundedInt())
+            return true;
+
+        if (type.isFixedSizeArray())
+            return hasStateType (type.getArrayElementType());
+
+        if (type.isStruct())
+        {
+            for (auto& m : type.getStructRef().getMembers())
+                if (! hasStateType (m.type))
+                    return false;
+
+            return true;
+        }
+
+        return type.isPrimitiveOrVector() && (type.isInteger() || type.isFloatingPoint() || type.isBool());
+    }
+
+    /** Returns true if capture() returns a non-void value for the given type. */
+    static bool canCapture (const Type& type)
+    {
+        return type.isStruct() || hasStateType (type);
+    }
+
+    /** Returns a copy of the packed data for a variable of the given type, or a void value if it
+        can't be moved. Structures become objects, with any members which can't be moved left out.
+    */
+    static choc::value::Value capture (const Type& type, const void* data)
+    {
+        if (type.isStruct())
+        {
+            auto& s = type.getStructRef();
+            auto result = choc::value::createObject (s.getName());
+            auto d = static_cast<const uint8_t*> (data);
+
+            for (auto& m : s.getMembers())
+            {
+                auto member = capture (m.type, d);
+
+                if (! member.isVoid())
+                    result.addMember (m.name, member);
+
+                d += m.type.getPackedSizeInBytes();
+            }
+
+            return result;
+        }
+
+        auto stateType = getStateType (type);
+
+        if (stateType.isVoid())
+            return {};
+
+        return choc::value::Value (choc::value::ValueView (std::move (stateType), const_cast<void*> (data), nullptr));
+    }
+
+    /** Copies a value which was returned by capture() into the packed data of a variable.
+        Structures are matched member-by-member. Returns false if any member that capture()
+        would have produced is missing or has the wrong type, or if the value has members
+        that the structure doesn't, in which case the other members are still copied.
+    */
+    static bool restore (const Type& type, void* dest, const choc::value::ValueView& source)
+    {
+        if (type.isStruct())
+        {
+            if (! source.isObject())
+                return false;
+
+            auto d = static_cast<uint8_t*> (dest);
+            uint32_t numMatched = 0;
+            bool allRestored = true;
+
+            for (auto& m : type.getStructRef().getMembers())
+            {
+                if (canCapture (m.type))
+                {
+                    if (source.hasObjectMember (m.name))
+                    {
+                        allRestored = restore (m.type, d, source[m.name]) && allRestored;
+                        ++numMatched;
+                    }
+                    else
+                    {
+                        allRestored = false;
+                    }
+                }
+
+                d += m.type.getPackedSizeInBytes();
+            }
+
+            return allRestored && numMatched == source.size();
+        }
+
+        if (source.getType() != getStateType (type))
+            return false;
+
+        std::memcpy (dest, source.getRawData(), static_cast<size_t> (type.getPackedSizeInBytes()));
+        return true;
+    }
+
+    /** Copies the data that capture() would return for a variable into dest, without
+        allocating, and returns the number of bytes written. If dest is nullptr, this
+        just returns the number of bytes that would be written.
+    */
+    static size_t captureData (const Type& type, const void* data, void* dest)
+    {
+        return copyData (type, static_cast<uint8_t*> (const_cast<void*> (data)), static_cast<uint8_t*> (dest), true);
+    }
+
+    /** Copies data which was written by captureData() back into the packed data of a
+        variable, without allocating, and returns the number of bytes read.
+    */
+    static size_t restoreData (const Type& type, void* dest, const void* source)
+    {
+        return copyData (type, static_cast<uint8_t*> (dest), static_cast<uint8_t*> (const_cast<void*> (source)), false);
+    }
+
+private:
+    static size_t copyData (const Type& type, uint8_t* variableData, uint8_t* stateData, bool toState)
+    {
+        if (type.isStruct())
+        {
+            size_t total = 0;
+
+            for (auto& m : type.getStructRef().getMembers())
+            {
+                total += copyData (m.type, variableData, stateData == nullptr ? nullptr : stateData + total, toState);
+                variableData += m.type.getPackedSizeInBytes();
+            }
+
+            return total;
+        }
+
+        if (! hasStateType (type))
+            return 0;
+
+        auto size = static_cast<size_t> (type.getPackedSizeInBytes());
+
+        if (stateData != nullptr)
+        {
+            if (toState)
+                std::memcpy (stateData, variableData, size);
+            else
+                std::memcpy (variableData, stateData, size);
+        }
+
+        return size;
+    }
+};
+
 
 } // namespace soul
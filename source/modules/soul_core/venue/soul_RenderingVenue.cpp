@@ -26,177 +26,492 @@ namespace soul
 {
 
 //==============================================================================
-struct TaskThread
+/** Runs tasks from any number of queues on a pool of worker threads.
+
+    Tasks in the same queue always run one at a time and in the order they were added,
+    but different queues get serviced in parallel. When more queues have work waiting than
+    there are idle workers, the queue whose next task has the highest priority goes first,
+    and tasks of equal priority run in the order in which they were added.
+*/
+struct TaskScheduler
 {
-    TaskThread()
+    TaskScheduler (uint32_t numWorkers)
     {
         queues.reserve (8);
-        thread = std::thread ([this] { run(); });
+
+        for (uint32_t i = 0; i < std::max (1u, numWorkers); ++i)
+            workers.emplace_back ([this] { runWorker(); });
     }
 
-    ~TaskThread()
+    ~TaskScheduler()
     {
         shutdown();
     }
 
-    void sendShutdownSignal()
+    /** Cancels all pending tasks, tells any running tasks to stop, and waits for the workers to finish. */
+    void shutdown()
     {
-        shuttingDown = 1;
-        std::lock_guard<std::mutex> l (queueLock);
-
-        for (auto& q : queues)
-            q->cancelPendingTasks();
+        {
+            std::lock_guard<std::mutex> l (lock);
+            shuttingDown = true;
 
-        checkQueues.notify_all();
-    }
+            for (auto& q : queues)
+                q->cancelAllTasks();
+        }
 
-    void waitForThreadToFinish()
-    {
-        SOUL_ASSERT (std::this_thread::get_id() != thread.get_id());
-        SOUL_ASSERT (shuttingDown);
+        workAvailable.notify_all();
 
-        if (thread.joinable())
+        for (auto& w : workers)
         {
-            thread.join();
-            thread = {};
+            SOUL_ASSERT (std::this_thread::get_id() != w.get_id());
+
+            if (w.joinable())
+                w.join();
         }
-    }
 
-    void shutdown()
-    {
-        sendShutdownSignal();
-        waitForThreadToFinish();
+        workers.clear();
         queues.clear();
     }
 
     using ShouldStopFlag = std::atomic<int>;
 
+    enum class Priority
+    {
+        background,
+        normal,
+        high
+    };
+
     //==============================================================================
     struct Queue
     {
-        Queue (TaskThread& t)  : ownerThread (t)
+        Queue (TaskScheduler& s)  : owner (s) {}
+        ~Queue()  { SOUL_ASSERT (! isAttached); }
+
+        using TaskFunction = std::function<void(ShouldStopFlag&)>;
+
+        void attach()
         {
-            tasks.reserve (16);
+            std::lock_guard<std::mutex> l (owner.lock);
+            SOUL_ASSERT (! isAttached);
+            isAttached = true;
+            owner.queues.push_back (this);
         }
 
-        using TaskFunction = std::function<void(ShouldStopFlag&)>;
+        /** Removes the queue from its scheduler, discarding any pending tasks. If one of its tasks
+            is running on another thread, this tells it to stop and waits for it to finish.
+        */
+        void detach()
+        {
+            decltype (tasks) tasksToDiscard;
 
-        void attach()  { ownerThread.addQueue (*this); }
-        void detach()  { ownerThread.removeQueue (*this); }
+            {
+                std::unique_lock<std::mutex> l (owner.lock);
+                removeIf (owner.queues, [this] (Queue* q) { return q == this; });
+                isAttached = false;
+                tasksToDiscard = std::move (tasks);
+                tasks.clear();
 
-        void addTask (TaskFunction&& task)
+                if (runningTask != nullptr)
+                {
+                    if (runningThread == std::this_thread::get_id())
+                    {
+                        // Being detached by its own task, so the worker mustn't touch this queue afterwards
+                        runningTask->queue = nullptr;
+                        runningTask = nullptr;
+                    }
+                    else
+                    {
+                        runningTask->cancelled = 1;
+                        owner.taskFinished.wait (l, [this] { return runningTask == nullptr; });
+                    }
+                }
+            }
+        }
+
+        void addTask (TaskFunction&& task, Priority priority = Priority::normal)
         {
-            std::lock_guard<std::mutex> l (taskListLock);
+            {
+                std::lock_guard<std::mutex> l (owner.lock);
 
-            if (ownerThread.shuttingDown)
-                return;
+                if (owner.shuttingDown || ! isAttached)
+                    return;
+
+                auto taskHolder = std::make_unique<TaskHolder>();
+                taskHolder->function = std::move (task);
+                taskHolder->priority = priority;
+                taskHolder->sequenceNumber = ++owner.nextSequenceNumber;
+                tasks.push_back (std::move (taskHolder));
+            }
+
+            owner.workAvailable.notify_one();
+        }
+
+        /** Discards any tasks that haven't yet started, and tells a running task that it should stop. */
+        void cancelPendingTasks()
+        {
+            decltype (tasks) tasksToDiscard;
+
+            std::lock_guard<std::mutex> l (owner.lock);
+            tasksToDiscard = std::move (tasks);
+            tasks.clear();
 
-            auto taskHolder = std::make_unique<TaskHolder>();
-            taskHolder->function = std::move (task);
-            tasks.emplace_back (std::move (taskHolder));
-            ownerThread.checkQueues.notify_all();
+            if (runningTask != nullptr)
+                runningTask->cancelled = 1;
         }
 
     private:
-        TaskThread& ownerThread;
-        friend struct TaskThread;
+        TaskScheduler& owner;
+        friend struct TaskScheduler;
 
         struct TaskHolder
         {
             TaskFunction function;
             ShouldStopFlag cancelled { 0 };
+            Priority priority = Priority::normal;
+            uint64_t sequenceNumber = 0;
+            Queue* queue = nullptr;
         };
 
-        std::vector<std::unique_ptr<TaskHolder>> tasks;
-        std::mutex taskListLock;
+        // All of these are protected by the owner's lock
+        std::deque<std::unique_ptr<TaskHolder>> tasks;
+        TaskHolder* runningTask = nullptr;
+        std::thread::id runningThread;
+        bool isAttached = false;
 
-        bool serviceNextTask()
+        bool isReady() const      { return runningTask == nullptr && ! tasks.empty(); }
+
+        bool shouldRunBefore (const Queue& other) const
         {
-            std::unique_lock<std::mutex> l (taskListLock);
+            auto& next = *tasks.front();
+            auto& otherNext = *other.tasks.front();
 
-            if (tasks.empty())
-                return false;
+            if (next.priority != otherNext.priority)
+                return next.priority > otherNext.priority;
+
+            return next.sequenceNumber < otherNext.sequenceNumber;
+        }
+
+        void cancelAllTasks()
+        {
+            for (auto& t : tasks)
+                t->cancelled = 1;
+
+            if (runningTask != nullptr)
+                runningTask->cancelled = 1;
+        }
+    };
 
-            auto task = std::move (tasks.front());
-            tasks.erase (tasks.begin());
+private:
+    //==============================================================================
+    std::vector<std::thread> workers;
+    std::vector<Queue*> queues;
+    std::mutex lock;
+    std::condition_variable workAvailable, taskFinished;
+    uint64_t nextSequenceNumber = 0;
+    bool shuttingDown = false;
+
+    Queue* findNextQueueToService() const
+    {
+        Queue* best = nullptr;
+
+        for (auto q : queues)
+            if (q->isReady() && (best == nullptr || q->shouldRunBefore (*best)))
+                best = q;
+
+        return best;
+    }
+
+    void runWorker()
+    {
+        std::unique_lock<std::mutex> l (lock);
+
+        for (;;)
+        {
+            if (shuttingDown)
+                return;
+
+            auto queue = findNextQueueToService();
+
+            if (queue == nullptr)
+            {
+                workAvailable.wait (l);
+                continue;
+            }
+
+            auto task = std::move (queue->tasks.front());
+            queue->tasks.pop_front();
+            queue->runningTask = task.get();
+            queue->runningThread = std::this_thread::get_id();
+            task->queue = queue;
             l.unlock();
 
             if (! task->cancelled)
                 task->function (task->cancelled);
 
-            return true;
+            task->function = {};
+
+            l.lock();
+
+            if (task->queue != nullptr)
+                task->queue->runningTask = nullptr;
+
+            taskFinished.notify_all();
         }
+    }
+};
 
-        void cancelPendingTasks()
+//==============================================================================
+/** A fixed set of worker threads which help the calling thread to get through a
+    list of independent jobs, with each thread taking the next unclaimed job until
+    there are none left.
+
+    perform() runs on the audio thread, so it never locks or waits for a worker to wake up.
+    Each worker has an atomic state holding the number of the latest batch it was given and
+    whether it has picked it up yet. The caller posts a new batch to every worker, gets on with
+    the jobs itself, and then takes back any batch which a worker hasn't started, so it only
+    ever waits for workers which are part-way through a job. Idle workers poll their own state,
+    yielding for a while before dropping back to short sleeps.
+
+    The calling thread waits for the workers, so they'd hold up an audio callback if they
+    were scheduled at a lower priority. Each worker gives itself the same priority as the
+    thread that called perform() before it starts on that thread's jobs. The priority is
+    copied on the worker's thread, so perform() doesn't make any extra system calls. Where
+    the OS refuses (e.g. a Linux process without permission to use SCHED_FIFO), the workers
+    carry on at their normal priority.
+*/
+struct RenderThreadPool
+{
+    RenderThreadPool (uint32_t numThreads)
+    {
+        for (uint32_t i = 0; i < numThreads; ++i)
         {
-            std::lock_guard<std::mutex> l (taskListLock);
+            auto w = std::make_unique<Worker>();
+            auto& worker = *w;
+            workers.push_back (std::move (w));
+            worker.thread = std::thread ([this, &worker] { runWorker (worker); });
+        }
+    }
 
-            for (auto& t : tasks)
-                t->cancelled = 1;
+    ~RenderThreadPool()
+    {
+        shuttingDown.store (true, std::memory_order_release);
+
+        for (auto& w : workers)
+            w->thread.join();
+    }
+
+    bool isEmpty() const        { return workers.empty(); }
+
+    /** A job returns nullptr if it succeeded, or an error message which must outlive the call to perform(). */
+    using JobFunction = const char*(*)(void* context, size_t jobIndex);
+
+    /** Calls the function for every index up to numJobs, and returns when they've all finished.
+        If any of the jobs fails, the first error message is returned, and any exception that a job
+        throws is reported as a failure rather than escaping from a worker thread.
+        This doesn't allocate or take any locks.
+    */
+    const char* perform (size_t numJobs, JobFunction function, void* context)
+    {
+        currentFunction = function;
+        currentContext = context;
+        numJobsInBatch = numJobs;
+        nextJob = 0;
+        error = nullptr;
+        callingThread = getCurrentThreadID();
 
-            ownerThread.checkQueues.notify_all();
+        auto batch = ++currentBatch;
+
+        for (auto& w : workers)
+            w->state.store (makeState (batch, Phase::pending), std::memory_order_release);
+
+        performJobs();
+
+        for (auto& w : workers)
+        {
+            // All the jobs have been claimed by now, so a worker that hasn't picked up
+            // this batch yet can be stood down rather than waited for
+            auto pending = makeState (batch, Phase::pending);
+
+            if (w->state.compare_exchange_strong (pending, makeState (batch, Phase::idle), std::memory_order_acq_rel))
+                continue;
+
+            for (uint32_t spins = 0; w->state.load (std::memory_order_acquire) != makeState (batch, Phase::idle); ++spins)
+                if (spins >= spinsBeforeYielding)
+                    std::this_thread::yield();
         }
-    };
+
+        return error.load();
+    }
 
 private:
-    //==============================================================================
-    std::thread thread;
-    ShouldStopFlag shuttingDown { 0 };
+   #ifdef WIN32
+    using ThreadID = DWORD;
+    static ThreadID getCurrentThreadID()                    { return GetCurrentThreadId(); }
+    static bool isSameThread (ThreadID a, ThreadID b)       { return a == b; }
+   #else
+    using ThreadID = pthread_t;
+    static ThreadID getCurrentThreadID()                    { return pthread_self(); }
+    static bool isSameThread (ThreadID a, ThreadID b)       { return pthread_equal (a, b) != 0; }
+   #endif
+
+    /** A worker's state is its latest batch number, shifted up to make room for one of these. */
+    enum class Phase : uint64_t
+    {
+        idle     = 0,
+        pending  = 1,
+        running  = 2
+    };
 
-    std::vector<Queue*> queues;
-    std::mutex queueLock;
-    std::condition_variable checkQueues;
+    static constexpr uint64_t makeState (uint64_t batch, Phase phase)     { return (batch << 2) | static_cast<uint64_t> (phase); }
+    static constexpr uint64_t getBatch (uint64_t state)                   { return state >> 2; }
+    static constexpr Phase getPhase (uint64_t state)                      { return static_cast<Phase> (state & 3); }
 
-    void run()
+    struct Worker
     {
-        while (! shuttingDown)
+        std::thread thread;
+        std::atomic<uint64_t> state { 0 };
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> shuttingDown { false };
+    uint64_t currentBatch = 0;
+    ThreadID callingThread {};
+
+    static constexpr uint64_t batchesBetweenPriorityChecks = 512;
+    static constexpr uint32_t spinsBeforeYielding = 1000;
+    static constexpr uint32_t pollsBeforeSleeping = 200;
+    static constexpr uint32_t pollsBeforeLongSleep = pollsBeforeSleeping + 2000;
+
+    JobFunction currentFunction = nullptr;
+    void* currentContext = nullptr;
+    size_t numJobsInBatch = 0;
+    std::atomic<size_t> nextJob { 0 };
+    std::atomic<const char*> error { nullptr };
+
+    void runWorker (Worker& worker)
+    {
+        uint64_t nextPriorityCheck = 0;
+        ThreadID priorityCopiedFrom {};
+        uint32_t pollsWithoutWork = 0;
+
+        while (! shuttingDown.load (std::memory_order_acquire))
         {
-            bool anyTasksDone = false;
-            std::unique_lock<std::mutex> l (queueLock);
+            auto state = worker.state.load (std::memory_order_acquire);
 
-            // NB: avoid iterator because the vector can be modified during the loop
-            for (size_t i = 0; i < queues.size(); ++i)
+            if (getPhase (state) != Phase::pending
+                 || ! worker.state.compare_exchange_strong (state, makeState (getBatch (state), Phase::running),
+                                                            std::memory_order_acq_rel))
             {
-                if (shuttingDown)
-                    return;
+                waitForWork (pollsWithoutWork++);
+                continue;
+            }
 
-                if (queues[i]->serviceNextTask())
-                    anyTasksDone = true;
+            pollsWithoutWork = 0;
+            auto batch = getBatch (state);
+            auto caller = callingThread;
+
+            // The caller is blocked until this batch is finished, so it's safe to query it here.
+            // It's re-checked now and then, as a host may change its audio thread's priority.
+            if (batch >= nextPriorityCheck || ! isSameThread (caller, priorityCopiedFrom))
+            {
+                copyThreadPriority (caller);
+                priorityCopiedFrom = caller;
+                nextPriorityCheck = batch + batchesBetweenPriorityChecks;
             }
 
-            if (! anyTasksDone)
-                checkQueues.wait_for (l, std::chrono::milliseconds (500));
+            performJobs();
+            worker.state.store (makeState (batch, Phase::idle), std::memory_order_release);
         }
     }
 
-    void addQueue (Queue& queue)
+    static void waitForWork (uint32_t pollsWithoutWork)
     {
-        std::unique_lock<std::mutex> l;
+        if (pollsWithoutWork < pollsBeforeSleeping)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for (std::chrono::microseconds (pollsWithoutWork < pollsBeforeLongSleep ? 50 : 1000));
+    }
 
-        if (std::this_thread::get_id() != thread.get_id())
-            l = std::unique_lock<std::mutex> (queueLock);
+    void performJobs()
+    {
+        for (;;)
+        {
+            auto job = nextJob.fetch_add (1);
 
-        queues.push_back (std::addressof (queue));
+            if (job >= numJobsInBatch)
+                return;
+
+            const char* jobError = nullptr;
+
+            try
+            {
+                jobError = currentFunction (currentContext, job);
+            }
+            catch (const choc::value::Error& e)
+            {
+                jobError = e.description;
+            }
+            catch (...)
+            {
+                jobError = "Unknown exception in a render job";
+            }
+
+            if (jobError != nullptr)
+            {
+                const char* noError = nullptr;
+                error.compare_exchange_strong (noError, jobError);
+            }
+        }
     }
 
-    void removeQueue (Queue& queue)
+    /** Gives the current thread the same scheduling priority as another one, if the OS allows it. */
+    static void copyThreadPriority (ThreadID source)
     {
-        std::unique_lock<std::mutex> l;
-
-        if (std::this_thread::get_id() != thread.get_id())
-            l = std::unique_lock<std::mutex> (queueLock);
+       #ifdef WIN32
+        if (auto handle = OpenThread (THREAD_QUERY_LIMITED_INFORMATION, FALSE, source))
+        {
+            auto priority = GetThreadPriority (handle);
+            CloseHandle (handle);
 
-        removeIf (queues, [&] (Queue* q) { return q == std::addressof (queue); });
+            if (priority != THREAD_PRIORITY_ERROR_RETURN)
+                SetThreadPriority (GetCurrentThread(), priority);
+        }
+       #else
+        #ifdef __APPLE__
+         // CoreAudio threads use a time-constraint policy rather than a POSIX priority
+         thread_time_constraint_policy_data_t timeConstraints;
+         mach_msg_type_number_t count = THREAD_TIME_CONSTRAINT_POLICY_COUNT;
+         boolean_t isDefault = false;
+
+         if (thread_policy_get (pthread_mach_thread_np (source), THREAD_TIME_CONSTRAINT_POLICY,
+                                (thread_policy_t) &timeConstraints, &count, &isDefault) == KERN_SUCCESS
+              && ! isDefault)
+         {
+             thread_policy_set (pthread_mach_thread_np (pthread_self()), THREAD_TIME_CONSTRAINT_POLICY,
+                                (thread_policy_t) &timeConstraints, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+             return;
+         }
+        #endif
+
+        int policy = 0;
+        sched_param param {};
+
+        if (pthread_getschedparam (source, &policy, &param) == 0)
+            pthread_setschedparam (pthread_self(), policy, &param);
+       #endif
     }
 };
 
 //==============================================================================
 struct RenderingVenue::Pimpl
 {
-    Pimpl (std::unique_ptr<PerformerFactory> p)
+    Pimpl (std::unique_ptr<PerformerFactory> p, std::unique_ptr<PerformerFactory> optimising, uint32_t numRenderThreads)
         : performerFactory (std::move (p)),
-          taskThread(),
-          createSessionQueue (taskThread)
+          optimisingPerformerFactory (std::move (optimising)),
+          taskScheduler (std::max (1u, std::thread::hardware_concurrency())),
+          createSessionQueue (taskScheduler),
+          renderThreadPool (numRenderThreads)
     {
         createSessionQueue.attach();
         loadMeasurer.reset();
@@ -204,22 +519,32 @@ struct RenderingVenue::Pimpl
 
     ~Pimpl()
     {
-        std::lock_guard<std::mutex> l (sessionListLock);
-        SOUL_ASSERT (activeSessions.empty());
+        std::unique_ptr<SessionList> list (activeSessions.exchange (nullptr));
+        SOUL_ASSERT (list->sessions.empty());
         createSessionQueue.detach();
-        taskThread.shutdown();
+        taskScheduler.shutdown();
     }
 
     //==============================================================================
     struct SessionImpl  : public Venue::Session
     {
-        SessionImpl (Pimpl& v, std::unique_ptr<soul::Performer> p)
+        SessionImpl (Pimpl& v, std::unique_ptr<soul::Performer> p, std::unique_ptr<soul::Performer> optimisingPerformer)
             : venue (v),
-              taskQueue (venue.taskThread),
+              taskQueue (venue.taskScheduler),
               performer (std::move (p))
         {
             SOUL_ASSERT (performer != nullptr);
             taskQueue.attach();
+
+            // The optimising performer gets linked by a background task on this session's queue, so it
+            // can't overlap with a load or unload, and can't run after the session has been deleted
+            if (optimisingPerformer != nullptr)
+                performer = createTieredPerformer (std::move (performer), std::move (optimisingPerformer),
+                                                   [this] (std::function<void()> task)
+                                                   {
+                                                       taskQueue.addTask ([t = std::move (task)] (TaskScheduler::ShouldStopFlag&) { t(); },
+                                                                         TaskScheduler::Priority::background);
+                                                   });
         }
 
         ~SessionImpl() override
@@ -235,11 +560,13 @@ struct RenderingVenue::Pimpl
             if (program.isEmpty())
                 return false;
 
-            taskQueue.addTask ([this, program,
-                                callback = std::move (loadFinishedCallback)] (TaskThread::ShouldStopFlag& cancelled)
+            // Programs aren't thread-safe (not even their ref-counts), and other sessions may be
+            // loading this one in parallel, so the task gets a private copy to work with
+            taskQueue.addTask ([this, programCopy = program.clone(),
+                                callback = std::move (loadFinishedCallback)] (TaskScheduler::ShouldStopFlag& cancelled)
             {
                 CompileMessageList messageList;
-                bool ok = performer->load (messageList, program);
+                bool ok = performer->load (messageList, programCopy);
 
                 if (cancelled)
                     return;
@@ -257,7 +584,7 @@ struct RenderingVenue::Pimpl
         {
             stop();
 
-            taskQueue.addTask ([this] (TaskThread::ShouldStopFlag&)
+            taskQueue.addTask ([this] (TaskScheduler::ShouldStopFlag&)
             {
                 performer->unload();
                 setState (SessionState::empty);
@@ -266,7 +593,7 @@ struct RenderingVenue::Pimpl
 
         bool start() override
         {
-            taskQueue.addTask ([this] (TaskThread::ShouldStopFlag&)
+            taskQueue.addTask ([this] (TaskScheduler::ShouldStopFlag&)
             {
                 if (state == SessionState::linked)
                 {
@@ -285,7 +612,7 @@ struct RenderingVenue::Pimpl
 
         void stop() override
         {
-            taskQueue.addTask ([this] (TaskThread::ShouldStopFlag&)
+            taskQueue.addTask ([this] (TaskScheduler::ShouldStopFlag&)
             {
                 if (isRunning())
                 {
@@ -313,7 +640,7 @@ struct RenderingVenue::Pimpl
         //==============================================================================
         bool link (const BuildSettings& settings, CompileTaskFinishedCallback linkFinishedCallback) override
         {
-            taskQueue.addTask ([this, settings, callback = std::move (linkFinishedCallback)] (TaskThread::ShouldStopFlag& cancelled)
+            taskQueue.addTask ([this, settings, callback = std::move (linkFinishedCallback)] (TaskScheduler::ShouldStopFlag& cancelled)
             {
                 if (state == SessionState::loaded)
                 {
@@ -325,12 +652,13 @@ struct RenderingVenue::Pimpl
 
                     maxBlockSize = performer->getBlockSize();
                     SOUL_ASSERT (maxBlockSize != 0);
+                    renderProfiler.setSampleRate (settings.sampleRate);
                     callback (messageList);
 
                     if (ok)
                         setState (SessionState::linked);
                 }
-            });
+            }, TaskScheduler::Priority::high);
 
             return true;
         }
@@ -344,6 +672,11 @@ struct RenderingVenue::Pimpl
             return s;
         }
 
+        RenderProfiler* getRenderProfiler() override
+        {
+            return std::addressof (renderProfiler);
+        }
+
         //==============================================================================
         void setIOServiceCallbacks (BeginNextBlockFn start, GetNextNumFramesFn size, PrepareInputsFn pre, ReadOutputsFn post) override
         {
@@ -395,8 +728,64 @@ struct RenderingVenue::Pimpl
             }
         };
 
-        void render (uint32_t numFrames)
+        /** Renders the next block, returning nullptr if it worked, or a description of whatever
+            was thrown by the performer or one of the callbacks. The message is kept in this session,
+            and stays valid until it next renders, so that a failure can be reported without allocating.
+        */
+        const char* render (uint32_t numFrames) noexcept
+        {
+            try
+            {
+                renderBlock (numFrames);
+                return nullptr;
+            }
+            catch (const choc::value::Error& e)     { return setRenderError (e.description); }
+            catch (const std::exception& e)         { return setRenderError (e.what()); }
+            catch (...)                             { return setRenderError ("Unknown exception while rendering"); }
+        }
+
+        uint32_t maxBlockSize = 0;
+
+    private:
+        RenderingVenue::Pimpl& venue;
+        TaskScheduler::Queue taskQueue;
+        std::unique_ptr<Performer> performer;
+        std::atomic<SessionState> state { SessionState::empty };
+        std::atomic<uint64_t> totalFramesRendered { 0 };
+        RenderProfiler renderProfiler;
+        std::array<char, 256> renderError {};
+
+        BeginNextBlockFn beginNextBlockCallback;
+        GetNextNumFramesFn getBlockSizeCallback;
+        PrepareInputsFn preRenderCallback;
+        ReadOutputsFn postRenderCallback;
+
+        void setState (SessionState newState)
+        {
+            state = newState;
+        }
+
+        const char* setRenderError (const char* message) noexcept
+        {
+            if (message == nullptr)
+                message = "Unknown exception while rendering";
+
+            size_t length = 0;
+
+            while (length < renderError.size() - 1 && message[length] != 0)
+            {
+                renderError[length] = message[length];
+                ++length;
+            }
+
+            renderError[length] = 0;
+            return renderError.data();
+        }
+
+        void renderBlock (uint32_t numFrames)
         {
+            renderProfiler.beginBlock (totalFramesRendered, numFrames);
+
             if (beginNextBlockCallback != nullptr)
                 beginNextBlockCallback (numFrames);
 
@@ -415,18 +804,28 @@ struct RenderingVenue::Pimpl
                     }
                 }
 
-                performer->prepare (framesToDo);
+                renderProfiler.beginChunk();
+
+                {
+                    RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::prepare);
+                    performer->prepare (framesToDo);
+                }
 
                 if (preRenderCallback != nullptr)
                 {
+                    RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::inputDelivery);
                     InputActions actions (*performer);
                     preRenderCallback (actions, framesToDo);
                 }
 
-                performer->advance();
+                {
+                    RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::advance);
+                    performer->advance();
+                }
 
                 if (postRenderCallback != nullptr)
                 {
+                    RenderProfiler::ScopedStage stage (std::addressof (renderProfiler), RenderProfiler::Stage::outputCollection);
                     OutputActions actions (*performer);
                     postRenderCallback (actions, framesToDo);
                 }
@@ -434,44 +833,39 @@ struct RenderingVenue::Pimpl
                 totalFramesRendered += framesToDo;
                 numFrames -= framesToDo;
             }
-        }
 
-        uint32_t maxBlockSize = 0;
-
-    private:
-        RenderingVenue::Pimpl& venue;
-        TaskThread::Queue taskQueue;
-        std::unique_ptr<Performer> performer;
-        std::atomic<SessionState> state { SessionState::empty };
-        std::atomic<uint64_t> totalFramesRendered { 0 };
-
-        BeginNextBlockFn beginNextBlockCallback;
-        GetNextNumFramesFn getBlockSizeCallback;
-        PrepareInputsFn preRenderCallback;
-        ReadOutputsFn postRenderCallback;
-
-        void setState (SessionState newState)
-        {
-            state = newState;
+            renderProfiler.endBlock();
         }
     };
 
     //==============================================================================
-    std::unique_ptr<PerformerFactory> performerFactory;
-    TaskThread taskThread;
-    TaskThread::Queue createSessionQueue;
+    std::unique_ptr<PerformerFactory> performerFactory, optimisingPerformerFactory;
+    TaskScheduler taskScheduler;
+    TaskScheduler::Queue createSessionQueue;
+
+    // The render thread reads the active session list without locking: changes are made
+    // to a copy which then replaces it, and the old list is only deleted once no render
+    // can still be using it.
+    struct SessionList
+    {
+        std::vector<SessionImpl*> sessions;
+    };
 
-    std::mutex sessionListLock;
-    std::vector<SessionImpl*> activeSessions;
+    std::atomic<SessionList*> activeSessions { new SessionList() };
+    std::atomic<uint32_t> numRendersInProgress { 0 };
+    std::mutex sessionListWriteLock;
 
+    RenderThreadPool renderThreadPool;
     CPULoadMeasurer loadMeasurer;
 
     //==============================================================================
     bool createSession (SessionReadyCallback cb)
     {
-        createSessionQueue.addTask ([this, callback = std::move (cb)] (TaskThread::ShouldStopFlag&)
+        createSessionQueue.addTask ([this, callback = std::move (cb)] (TaskScheduler::ShouldStopFlag&)
         {
-            callback (std::make_unique<Pimpl::SessionImpl> (*this, performerFactory->createPerformer()), "");
+            callback (std::make_unique<Pimpl::SessionImpl> (*this, performerFactory->createPerformer(),
+                                                            optimisingPerformerFactory != nullptr ? optimisingPerformerFactory->createPerformer()
+                                                                                                  : std::unique_ptr<Performer>()), "");
         });
 
         return true;
@@ -479,38 +873,89 @@ struct RenderingVenue::Pimpl
 
     void addActiveSession (SessionImpl& session)
     {
-        std::lock_guard<std::mutex> l (sessionListLock);
-        activeSessions.push_back (std::addressof (session));
+        updateActiveSessions ([&] (std::vector<SessionImpl*>& sessions) { sessions.push_back (std::addressof (session)); });
     }
 
     void removeActiveSession (SessionImpl& session)
     {
-        std::lock_guard<std::mutex> l (sessionListLock);
-        removeIf (activeSessions, [&] (SessionImpl* s) { return s == std::addressof (session); });
+        updateActiveSessions ([&] (std::vector<SessionImpl*>& sessions)
+                              {
+                                  removeIf (sessions, [&] (SessionImpl* s) { return s == std::addressof (session); });
+                              });
+    }
+
+    template <typename ModifierFn>
+    void updateActiveSessions (ModifierFn&& modify)
+    {
+        std::lock_guard<std::mutex> l (sessionListWriteLock);
+
+        auto newList = std::make_unique<SessionList> (*activeSessions.load());
+        modify (newList->sessions);
+        std::unique_ptr<SessionList> oldList (activeSessions.exchange (newList.release()));
+
+        // Once this returns, a removed session may be deleted, so we need to wait for
+        // any render that could have picked up the old list to finish with it
+        while (numRendersInProgress.load() != 0)
+            std::this_thread::yield();
     }
 
     const char* renderActiveSessions (uint32_t numFrames)
     {
+        if (numFrames == 0)
+            return "Illegal frame count";
+
         loadMeasurer.startMeasurement();
 
+        struct ScopedRenderInProgress
         {
-            std::lock_guard<std::mutex> l (sessionListLock);
+            ScopedRenderInProgress (std::atomic<uint32_t>& c) : count (c)   { ++count; }
+            ~ScopedRenderInProgress()                                       { --count; }
 
-            if (numFrames == 0)
-                return "Illegal frame count";
+            std::atomic<uint32_t>& count;
+        };
+
+        ScopedRenderInProgress renderInProgress (numRendersInProgress);
+        auto& sessions = activeSessions.load()->sessions;
+        const char* error = nullptr;
 
-            for (auto& s : activeSessions)
-                s->render (numFrames);
+        if (renderThreadPool.isEmpty() || sessions.size() < 2)
+        {
+            for (auto& s : sessions)
+                if (auto sessionError = s->render (numFrames))
+                    if (error == nullptr)
+                        error = sessionError;
+        }
+        else
+        {
+            struct RenderContext
+            {
+                SessionImpl** sessions;
+                uint32_t numFrames;
+            };
+
+            RenderContext context { sessions.data(), numFrames };
+
+            error = renderThreadPool.perform (sessions.size(), [] (void* c, size_t index) -> const char*
+                                              {
+                                                  auto& rc = *static_cast<RenderContext*> (c);
+                                                  return rc.sessions[index]->render (rc.numFrames);
+                                              },
+                                              std::addressof (context));
         }
 
         loadMeasurer.stopMeasurement();
-        return {};
+        return error;
     }
 };
 
 //==============================================================================
 RenderingVenue::RenderingVenue (std::unique_ptr<PerformerFactory> p)
-    : pimpl (std::make_unique<Pimpl> (std::move (p)))
+    : pimpl (std::make_unique<Pimpl> (std::move (p), nullptr, 0))
+{
+}
+
+RenderingVenue::RenderingVenue (std::unique_ptr<PerformerFactory> p, std::unique_ptr<PerformerFactory> optimising, uint32_t numRenderThreads)
+    : pimpl (std::make_unique<Pimpl> (std::move (p), std::move (optimising), numRenderThreads))
 {
 }
 
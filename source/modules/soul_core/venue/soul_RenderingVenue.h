@@ -30,6 +30,20 @@ class RenderingVenue  : public Venue
 {
 public:
     RenderingVenue (std::unique_ptr<PerformerFactory>);
+
+    /** Creates a venue whose sessions start running each program on a performer from the first
+        factory, while a performer from the optimising factory is linked on the venue's task
+        thread. When that's ready, the session switches over to it (see createTieredPerformer()).
+        The optimising factory may be null.
+
+        If numRenderThreads is non-zero, the venue also starts that many worker threads, and each
+        call to render() shares its active sessions between those workers and the calling thread,
+        returning when they've all been rendered. The sessions' IO callbacks will then be called
+        concurrently, so they must be safe to run in parallel with those of other sessions. The
+        workers take on the scheduling priority of the thread that calls render(), if the OS allows.
+    */
+    RenderingVenue (std::unique_ptr<PerformerFactory>, std::unique_ptr<PerformerFactory> optimisingPerformerFactory,
+                    uint32_t numRenderThreads = 0);
     ~RenderingVenue() override;
 
     /** This method needs to be called by either a thread or an audio callback
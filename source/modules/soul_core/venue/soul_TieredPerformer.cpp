@@ -0,0 +1,643 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if ! SOUL_INSIDE_CORE_CPP
+ #error "Don't add this cpp file to your build, it gets included indirectly by soul_core.cpp"
+#endif
+
+namespace soul
+{
+
+//==============================================================================
+struct TieredPerformer  : public Performer
+{
+    TieredPerformer (std::unique_ptr<Performer> initial, std::unique_ptr<Performer> optimised, RunBackgroundTaskFn runTask)
+        : initialPerformer (std::move (initial)),
+          optimisedPerformer (std::move (optimised)),
+          runBackgroundTask (std::move (runTask))
+    {
+        SOUL_ASSERT (initialPerformer != nullptr && optimisedPerformer != nullptr);
+        activePerformer = initialPerformer.get();
+    }
+
+    ~TieredPerformer() override   { unload(); }
+
+    //==============================================================================
+    bool load (CompileMessageList& messageList, const Program& programToLoad) noexcept override
+    {
+        unload();
+
+        if (! initialPerformer->load (messageList, programToLoad))
+            return false;
+
+        program = programToLoad;
+        return true;
+    }
+
+    void unload() noexcept override
+    {
+        cancelBuild();
+
+        optimisedReady = false;
+        optimisedLinked = false;
+        canTransferState = false;
+        activePerformer = initialPerformer.get();
+        initialPerformer->unload();
+        optimisedPerformer->unload();
+        program = {};
+        endpoints.clear();
+        externals.clear();
+        stateCopies.clear();
+        initialStateData.clear();
+        optimisedStateData.clear();
+    }
+
+    choc::span<const EndpointDetails> getInputEndpoints() noexcept override       { return initialPerformer->getInputEndpoints(); }
+    choc::span<const EndpointDetails> getOutputEndpoints() noexcept override      { return initialPerformer->getOutputEndpoints(); }
+    choc::span<const ExternalVariable> getExternalVariables() noexcept override   { return initialPerformer->getExternalVariables(); }
+
+    bool setExternalVariable (const char* name, const choc::value::ValueView& value) noexcept override
+    {
+        if (! initialPerformer->setExternalVariable (name, value))
+            return false;
+
+        externals.push_back ({ name, choc::value::Value (value) });
+        return true;
+    }
+
+    //==============================================================================
+    bool link (CompileMessageList& messageList, const BuildSettings& settings, LinkerCache* cache) noexcept override
+    {
+        if (isLinked())
+            return true;
+
+        if (! initialPerformer->link (messageList, settings, cache))
+            return false;
+
+        // The optimised performer has to match the initial one exactly, so that it can take over mid-stream
+        auto optimisedSettings = settings;
+        optimisedSettings.maxBlockSize = initialPerformer->getBlockSize();
+        auto latency = initialPerformer->getLatency();
+
+        // Nothing is rendering yet, so this is a safe moment to find out how the state is laid out
+        auto stateType = initialPerformer->getState().getType();
+
+        // The task gets its own copies of everything it reads, so that it doesn't race with
+        // calls on this thread. It only uses this object while holding the job's lock and
+        // before the job is cancelled, which unload() waits for.
+        auto job = std::make_shared<BuildJob>();
+        currentBuild = job;
+
+        auto build = [this, job, optimisedSettings, cache, latency, stateType,
+                      programCopy = program.clone(), externalsCopy = externals]
+        {
+            std::lock_guard<std::mutex> lock (job->lock);
+
+            if (! job->cancelled)
+                buildOptimisedPerformer (*job, programCopy, externalsCopy, optimisedSettings, cache, latency, stateType);
+        };
+
+        if (runBackgroundTask != nullptr)
+            runBackgroundTask (std::move (build));
+        else
+            build();
+
+        return true;
+    }
+
+    bool isLoaded() noexcept override     { return initialPerformer->isLoaded(); }
+    bool isLinked() noexcept override     { return initialPerformer->isLinked(); }
+
+    void reset() noexcept override
+    {
+        // A reset puts both performers into the same state, so if the state couldn't be
+        // moved across, this is where the optimised one takes over
+        if (optimisedReady && activePerformer != optimisedPerformer.get())
+            activePerformer = optimisedPerformer.get();
+
+        activePerformer->reset();
+
+        for (auto& e : endpoints)
+        {
+            e.hasLastValue = false;
+            e.framesUntilTarget = 0;
+        }
+    }
+
+    EndpointHandle getEndpointHandle (const EndpointID& endpointID) noexcept override
+    {
+        std::lock_guard<std::mutex> lock (endpointLock);
+
+        for (size_t i = 0; i < endpoints.size(); ++i)
+            if (endpoints[i].endpointID == endpointID)
+                return EndpointHandle::create (endpoints[i].initialHandle.getType(), static_cast<uint32_t> (i + 1));
+
+        auto handle = initialPerformer->getEndpointHandle (endpointID);
+
+        if (! handle.isValid())
+            return {};
+
+        Endpoint e { endpointID, handle, {}, {}, false, 0 };
+
+        // If the optimised performer has already been linked, the endpoint has to be usable
+        // on both of them, as either one may be rendering
+        if (optimisedLinked)
+        {
+            e.optimisedHandle = optimisedPerformer->getEndpointHandle (endpointID);
+
+            if (! e.optimisedHandle.isValid())
+                return {};
+        }
+
+        endpoints.push_back (std::move (e));
+        return EndpointHandle::create (handle.getType(), static_cast<uint32_t> (endpoints.size()));
+    }
+
+    bool isEndpointActive (const EndpointID& endpointID) noexcept override
+    {
+        return initialPerformer->isEndpointActive (endpointID);
+    }
+
+    //==============================================================================
+    void prepare (uint32_t numFramesToBeRendered) noexcept override
+    {
+        auto hasSwitched = isReadyToSwitch() && switchToOptimisedPerformer();
+
+        activePerformer->prepare (numFramesToBeRendered);
+        numFramesInBlock = numFramesToBeRendered;
+
+        if (hasSwitched)
+            resendInputValues();
+    }
+
+    void setNextInputStreamFrames (EndpointHandle handle, const choc::value::ValueView& frameArray) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+            activePerformer->setNextInputStreamFrames (getActiveHandle (*e), frameArray);
+    }
+
+    void setSparseInputStreamTarget (EndpointHandle handle, const choc::value::ValueView& targetFrameValue,
+                                     uint32_t numFramesToReachValue) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+        {
+            if (activePerformer == initialPerformer.get())
+            {
+                remember (*e, targetFrameValue);
+                e->framesUntilTarget = numFramesToReachValue;
+            }
+
+            activePerformer->setSparseInputStreamTarget (getActiveHandle (*e), targetFrameValue, numFramesToReachValue);
+        }
+    }
+
+    void setInputValue (EndpointHandle handle, const choc::value::ValueView& newValue) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+        {
+            if (activePerformer == initialPerformer.get())
+                remember (*e, newValue);
+
+            activePerformer->setInputValue (getActiveHandle (*e), newValue);
+        }
+    }
+
+    void addInputEvent (EndpointHandle handle, const choc::value::ValueView& eventData) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+            activePerformer->addInputEvent (getActiveHandle (*e), eventData);
+    }
+
+    void addInputEventAtFrame (EndpointHandle handle, uint32_t frameOffset, const choc::value::ValueView& eventData) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+            activePerformer->addInputEventAtFrame (getActiveHandle (*e), frameOffset, eventData);
+    }
+
+    bool supportsTimestampedInputEvents() noexcept override
+    {
+        // If a switch is about to happen in the next prepare(), we can't know yet whether
+        // the performer that'll receive the events will be able to honour their timestamps
+        if (isReadyToSwitch())
+            return false;
+
+        return activePerformer->supportsTimestampedInputEvents();
+    }
+
+    void advance() noexcept override
+    {
+        activePerformer->advance();
+
+        if (activePerformer == initialPerformer.get())
+            for (auto& e : endpoints)
+                e.framesUntilTarget -= std::min (e.framesUntilTarget, numFramesInBlock);
+    }
+
+    //==============================================================================
+    choc::value::ValueView getOutputStreamFrames (EndpointHandle handle) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+            return activePerformer->getOutputStreamFrames (getActiveHandle (*e));
+
+        return {};
+    }
+
+    choc::value::ValueView getOutputValue (EndpointHandle handle) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+            return activePerformer->getOutputValue (getActiveHandle (*e));
+
+        return {};
+    }
+
+    void iterateOutputEvents (EndpointHandle handle, HandleNextOutputEventFn handleEvent) noexcept override
+    {
+        if (auto e = getEndpoint (handle))
+            activePerformer->iterateOutputEvents (getActiveHandle (*e), std::move (handleEvent));
+    }
+
+    //==============================================================================
+    uint32_t getLatency() noexcept override           { return activePerformer->getLatency(); }
+    uint32_t getXRuns() noexcept override             { return activePerformer->getXRuns(); }
+    uint32_t getBlockSize() noexcept override         { return activePerformer->getBlockSize(); }
+    bool hasError() noexcept override                 { return activePerformer->hasError(); }
+    const char* getError() noexcept override          { return activePerformer->getError(); }
+
+    choc::value::Value getState() noexcept override                               { return activePerformer->getState(); }
+    bool setState (const choc::value::ValueView& state) noexcept override         { return activePerformer->setState (state); }
+    bool getStateData (void* dest, size_t size) noexcept override                 { return activePerformer->getStateData (dest, size); }
+    bool setStateData (const void* source, size_t size) noexcept override         { return activePerformer->setStateData (source, size); }
+
+private:
+    //==============================================================================
+    struct Endpoint
+    {
+        EndpointID endpointID;
+        EndpointHandle initialHandle, optimisedHandle;
+
+        // The most recent value or sparse stream target, which the optimised performer
+        // needs to be given when it takes over
+        choc::value::Value lastValue;
+        bool hasLastValue;
+        uint32_t framesUntilTarget;
+    };
+
+    /// The optimised performer is built by a task which may run after its TieredPerformer has
+    /// unloaded or been deleted, so it shares this with the task rather than using a member
+    struct BuildJob
+    {
+        std::mutex lock;
+        std::atomic<bool> cancelled { false };
+    };
+
+    /// Copies part of the data from the initial performer's getStateData() into the data
+    /// for the optimised performer's setStateData()
+    struct StateCopy
+    {
+        size_t sourceOffset, destOffset, size;
+    };
+
+    /// One of the primitives, vectors or arrays of primitives in a getState() object, named by
+    /// joining the names of the objects and array indexes that lead to it
+    struct StateItem
+    {
+        std::string path;
+        choc::value::Type type;
+        size_t offset;
+    };
+
+    struct External
+    {
+        std::string name;
+        choc::value::Value value;
+    };
+
+    std::unique_ptr<Performer> initialPerformer, optimisedPerformer;
+    Performer* activePerformer = nullptr;
+    RunBackgroundTaskFn runBackgroundTask;
+
+    Program program;
+    std::vector<Endpoint> endpoints;
+    std::vector<External> externals;
+    uint32_t numFramesInBlock = 0;
+
+    std::shared_ptr<BuildJob> currentBuild;
+    std::mutex endpointLock;
+    bool optimisedLinked = false;
+    std::atomic<bool> optimisedReady { false };
+
+    // These are set up by the background task before it sets optimisedReady, so that the
+    // switch doesn't have to allocate
+    bool canTransferState = false;
+    std::vector<StateCopy> stateCopies;
+    std::vector<uint8_t> initialStateData, optimisedStateData;
+
+    //==============================================================================
+    Endpoint* getEndpoint (EndpointHandle handle)
+    {
+        auto index = handle.getRawHandle() - 1;
+
+        if (index < endpoints.size())
+            return std::addressof (endpoints[index]);
+
+        return nullptr;
+    }
+
+    EndpointHandle getActiveHandle (const Endpoint& e) const
+    {
+        return activePerformer == initialPerformer.get() ? e.initialHandle : e.optimisedHandle;
+    }
+
+    bool isReadyToSwitch() const
+    {
+        return optimisedReady && canTransferState && activePerformer != optimisedPerformer.get();
+    }
+
+    /// Copies a value into some existing storage. This happens on the audio thread, so it
+    /// only allocates if the value's type has changed.
+    static void remember (Endpoint& e, const choc::value::ValueView& source)
+    {
+        if (e.lastValue.getType() == source.getType() && ! source.getType().usesStrings())
+            std::memcpy (e.lastValue.getRawData(), source.getRawData(), source.getType().getValueDataSize());
+        else
+            e.lastValue = choc::value::Value (source);
+
+        e.hasLastValue = true;
+    }
+
+    /// Stops any background task from starting to build the optimised performer, and waits
+    /// for one that's already running to finish
+    void cancelBuild()
+    {
+        if (auto job = std::move (currentBuild))
+        {
+            job->cancelled = true;
+            std::lock_guard<std::mutex> lock (job->lock);
+        }
+    }
+
+    //==============================================================================
+    /// Runs on the background thread. If anything fails, the initial performer just carries on.
+    void buildOptimisedPerformer (const BuildJob& job, const Program& programToBuild, const std::vector<External>& externalsToSet,
+                                  const BuildSettings& settings, LinkerCache* cache, uint32_t latency,
+                                  const choc::value::Type& initialStateType)
+    {
+        CompileMessageList messageList;
+
+        if (optimisedPerformer->load (messageList, programToBuild)
+             && setExternalVariables (externalsToSet)
+             && ! job.cancelled
+             && optimisedPerformer->link (messageList, settings, cache)
+             && ! job.cancelled
+             && optimisedPerformer->getBlockSize() == settings.maxBlockSize
+             && optimisedPerformer->getLatency() == latency
+             && resolveOptimisedHandles())
+        {
+            canTransferState = createStateTransfer (initialStateType, optimisedPerformer->getState().getType());
+            optimisedReady = true;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock (endpointLock);
+        optimisedLinked = false;
+        optimisedPerformer->unload();
+    }
+
+    bool setExternalVariables (const std::vector<External>& externalsToSet)
+    {
+        for (auto& e : externalsToSet)
+            if (! optimisedPerformer->setExternalVariable (e.name.c_str(), e.value))
+                return false;
+
+        return true;
+    }
+
+    /// Finds the optimised performer's handles for the endpoints that have been requested so far.
+    /// Any that are requested after this get both handles in getEndpointHandle().
+    bool resolveOptimisedHandles()
+    {
+        std::lock_guard<std::mutex> lock (endpointLock);
+
+        for (auto& e : endpoints)
+        {
+            e.optimisedHandle = optimisedPerformer->getEndpointHandle (e.endpointID);
+
+            if (! e.optimisedHandle.isValid())
+                return false;
+        }
+
+        optimisedLinked = true;
+        return true;
+    }
+
+    //==============================================================================
+    /// The two performers may lay out their state differently (e.g. an interpreter keeps each
+    /// processor instance's variables in a nested object, where native code may flatten them
+    /// into a single structure), so the values are matched up by name rather than by position.
+    /// This only succeeds if every value in each state has exactly one value with the same name
+    /// and type in the other, so that nothing gets left behind or reset.
+    bool createStateTransfer (const choc::value::Type& initialStateType, const choc::value::Type& optimisedStateType)
+    {
+        stateCopies.clear();
+
+        if (! (initialStateType.isObject() && optimisedStateType.isObject()))
+            return false;
+
+        std::vector<StateItem> sourceItems, destItems;
+        size_t sourceSize = 0, destSize = 0;
+        findStateItems (initialStateType, {}, sourceSize, sourceItems);
+        findStateItems (optimisedStateType, {}, destSize, destItems);
+
+        if (sourceItems.size() != destItems.size())
+            return false;
+
+        auto comparePaths = [] (const StateItem& a, const StateItem& b)  { return a.path < b.path; };
+        std::sort (sourceItems.begin(), sourceItems.end(), comparePaths);
+        std::sort (destItems.begin(), destItems.end(), comparePaths);
+
+        for (size_t i = 0; i < sourceItems.size(); ++i)
+        {
+            auto& source = sourceItems[i];
+            auto& dest = destItems[i];
+
+            if (source.path != dest.path || source.type != dest.type
+                 || (i > 0 && source.path == sourceItems[i - 1].path))
+            {
+                stateCopies.clear();
+                return false;
+            }
+
+            stateCopies.push_back ({ source.offset, dest.offset, source.type.getValueDataSize() });
+        }
+
+        // When the layouts match, this merges everything into a single copy
+        std::sort (stateCopies.begin(), stateCopies.end(),
+                   [] (const StateCopy& a, const StateCopy& b) { return a.sourceOffset < b.sourceOffset; });
+
+        std::vector<StateCopy> mergedCopies;
+
+        for (auto& c : stateCopies)
+        {
+            if (! mergedCopies.empty())
+            {
+                auto& last = mergedCopies.back();
+
+                if (last.sourceOffset + last.size == c.sourceOffset && last.destOffset + last.size == c.destOffset)
+                {
+                    last.size += c.size;
+                    continue;
+                }
+            }
+
+            mergedCopies.push_back (c);
+        }
+
+        stateCopies = std::move (mergedCopies);
+        initialStateData.resize (sourceSize);
+        optimisedStateData.resize (destSize);
+        return true;
+    }
+
+    /// Lists the items in the packed data of a value of the given type, in the order that
+    /// getStateData() lays them out
+    static void findStateItems (const choc::value::Type& type, const std::string& path,
+                                size_t& offset, std::vector<StateItem>& items)
+    {
+        auto getChildPath = [&] (std::string_view name)
+        {
+            return path.empty() ? std::string (name) : path + "_" + std::string (name);
+        };
+
+        if (type.isObject())
+        {
+            for (uint32_t i = 0; i < type.getNumElements(); ++i)
+            {
+                auto& member = type.getObjectMember (i);
+                findStateItems (member.type, getChildPath (member.name), offset, items);
+            }
+
+            return;
+        }
+
+        if (type.isArray() && containsObjects (type))
+        {
+            for (uint32_t i = 0; i < type.getNumElements(); ++i)
+                findStateItems (type.getArrayElementType (i), getChildPath (std::to_string (i)), offset, items);
+
+            return;
+        }
+
+        items.push_back ({ path, type, offset });
+        offset += type.getValueDataSize();
+    }
+
+    static bool containsObjects (const choc::value::Type& type)
+    {
+        if (type.isObject())
+            return true;
+
+        if (type.isArray())
+        {
+            auto numToCheck = type.isUniformArray() ? std::min (1u, type.getNumElements()) : type.getNumElements();
+
+            for (uint32_t i = 0; i < numToCheck; ++i)
+                if (containsObjects (type.getArrayElementType (i)))
+                    return true;
+        }
+
+        return false;
+    }
+
+    /// Called on the audio thread between blocks, so that no rendering is in progress. If the
+    /// state can't be moved, the switch is left until the next reset().
+    bool switchToOptimisedPerformer()
+    {
+        if (! initialPerformer->getStateData (initialStateData.data(), initialStateData.size()))
+        {
+            canTransferState = false;
+            return false;
+        }
+
+        for (auto& c : stateCopies)
+            std::memcpy (optimisedStateData.data() + c.destOffset, initialStateData.data() + c.sourceOffset, c.size);
+
+        if (! optimisedPerformer->setStateData (optimisedStateData.data(), optimisedStateData.size()))
+        {
+            canTransferState = false;
+            return false;
+        }
+
+        activePerformer = optimisedPerformer.get();
+        return true;
+    }
+
+    void resendInputValues()
+    {
+        for (auto& e : endpoints)
+        {
+            if (! e.hasLastValue)
+                continue;
+
+            if (e.optimisedHandle.isValue())
+                optimisedPerformer->setInputValue (e.optimisedHandle, e.lastValue);
+            else if (e.optimisedHandle.isStream())
+                optimisedPerformer->setSparseInputStreamTarget (e.optimisedHandle, e.lastValue, e.framesUntilTarget);
+        }
+    }
+};
+
+//==============================================================================
+std::unique_ptr<Performer> createTieredPerformer (std::unique_ptr<Performer> initialPerformer,
+                                                  std::unique_ptr<Performer> optimisedPerformer,
+                                                  RunBackgroundTaskFn runBackgroundTask)
+{
+    return std::make_unique<TieredPerformer> (std::move (initialPerformer), std::move (optimisedPerformer),
+                                              std::move (runBackgroundTask));
+}
+
+std::unique_ptr<PerformerFactory> createTieredPerformerFactory (std::unique_ptr<PerformerFactory> initialPerformerFactory,
+                                                                std::unique_ptr<PerformerFactory> optimisedPerformerFactory,
+                                                                RunBackgroundTaskFn runBackgroundTask)
+{
+    struct TieredPerformerFactory  : public PerformerFactory
+    {
+        TieredPerformerFactory (std::unique_ptr<PerformerFactory> i, std::unique_ptr<PerformerFactory> o, RunBackgroundTaskFn r)
+            : initialFactory (std::move (i)), optimisedFactory (std::move (o)), runTask (std::move (r)) {}
+
+        std::unique_ptr<Performer> createPerformer() override
+        {
+            return createTieredPerformer (initialFactory->createPerformer(), optimisedFactory->createPerformer(), runTask);
+        }
+
+        bool supportsRunLoopVectorisation() const override
+        {
+            return initialFactory->supportsRunLoopVectorisation() && optimisedFactory->supportsRunLoopVectorisation();
+        }
+
+        std::unique_ptr<PerformerFactory> initialFactory, optimisedFactory;
+        RunBackgroundTaskFn runTask;
+    };
+
+    return std::make_unique<TieredPerformerFactory> (std::move (initialPerformerFactory),
+                                                     std::move (optimisedPerformerFactory),
+                                                     std::move (runBackgroundTask));
+}
+
+} // namespace soul
@@ -0,0 +1,54 @@
+/*
+    _____ _____ _____ __
+   |   __|     |  |  |  |      The SOUL language
+   |__   |  |  |  |  |  |__    Copyright (c) 2019 - ROLI Ltd.
+   |_____|_____|_____|_____|
+
+   The code in this file is provided under the terms of the ISC license:
+
+   Permission to use, copy, modify, and/or distribute this software for any purpose
+   with or without fee is hereby granted, provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD
+   TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN
+   NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+   DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+   IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+   CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+namespace soul
+{
+    /// A function which runs a task on some other thread. A task which runs after the performer
+    /// that asked for it has been unloaded or deleted will just return without doing anything.
+    using RunBackgroundTaskFn = std::function<void(std::function<void()>)>;
+
+    /// Creates a Performer which starts rendering a program on one performer, which should be
+    /// one that links quickly (e.g. an interpreter), while a second one which produces faster
+    /// code is linked in the background. When the second performer is ready, the values of the
+    /// program's state variables are moved across to it at the start of a block, and it takes
+    /// over the rendering.
+    ///
+    /// The second performer is only used if it links successfully and can use every endpoint that
+    /// the first one has been asked for. The values are moved across with Performer::getStateData()
+    /// and setStateData(), matching them up by the names of the objects, members and array
+    /// indexes that lead to them in getState(), so the two performers can lay out their state
+    /// differently. The switch only happens at the start of a block if every value in each
+    /// performer's state has a counterpart in the other. If not, the second performer takes over
+    /// at the next call to reset() instead, when neither needs any state from the other. The
+    /// state is copied through buffers that are allocated in advance, so the switch doesn't
+    /// allocate on the audio thread. Anything held in local variables of a run() function isn't
+    /// part of the state, so those functions start again from the beginning.
+    ///
+    /// The background task is given to runBackgroundTask when link() is called. If that
+    /// function is null, the second performer is linked synchronously by link() instead.
+    std::unique_ptr<Performer> createTieredPerformer (std::unique_ptr<Performer> initialPerformer,
+                                                      std::unique_ptr<Performer> optimisedPerformer,
+                                                      RunBackgroundTaskFn runBackgroundTask);
+
+    /// Returns a factory which creates tiered performers from a pair of other factories.
+    std::unique_ptr<PerformerFactory> createTieredPerformerFactory (std::unique_ptr<PerformerFactory> initialPerformerFactory,
+                                                                    std::unique_ptr<PerformerFactory> optimisedPerformerFactory,
+                                                                    RunBackgroundTaskFn runBackgroundTask);
+}
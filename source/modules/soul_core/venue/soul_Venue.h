@@ -64,6 +64,11 @@ public:
         /** Returns the venue's current status. */
         virtual Status getStatus() = 0;
 
+        /** Returns the session's real-time render profiler, if the venue provides one.
+            It's disabled by default, so call RenderProfiler::setEnabled() to start measuring.
+        */
+        virtual RenderProfiler* getRenderProfiler()     { return nullptr; }
+
         /** Loads a set of fully-resolved modules.
             If the session is not in a state where loading is possible, this will return false.
             Otherwise, it will and return true and will begin asynchronously compiling and loading
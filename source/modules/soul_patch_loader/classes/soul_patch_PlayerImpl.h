@@ -79,12 +79,13 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
     //==============================================================================
     soul::Program compileSources (soul::CompileMessageList& messageList,
                                   const BuildSettings& settings,
+                                  CompilerCache* cache,
                                   SourceFilePreprocessor* preprocessor)
     {
         BuildBundle build;
         fileList.addSource (build, preprocessor);
         build.settings = settings;
-        auto program = Compiler::build (messageList, build);
+        auto program = Compiler::build (messageList, build, CacheConverter::create (cache).get());
 
        #if JUCE_BELA
         {
@@ -107,7 +108,7 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
         if (performer == nullptr)
             return messageList.addError ("Failed to initialise JIT engine", {});
 
-        auto program = compileSources (messageList, settings, preprocessor);
+        auto program = compileSources (messageList, settings, cache, preprocessor);
 
         if (program.isEmpty())
         {
@@ -309,6 +310,8 @@ struct PatchPlayerImpl final  : public RefCountHelper<PatchPlayer, PatchPlayerIm
                              return readRampLengthForEndpoint (endpoint);
                          });
 
+        wrapper.getRenderProfiler().setSampleRate (config.sampleRate);
+
         parameterList.rebuildList (wrapper.getParameterEndpoints(), wrapper.parameterList);
         parameterSpan = makeSpan (parameterList.parameters);
     }
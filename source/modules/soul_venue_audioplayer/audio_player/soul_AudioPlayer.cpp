@@ -85,6 +85,8 @@ struct AudioPlayerVenue::Pimpl  : private AudioMIDISystem::Callback
             return s;
         }
 
+        RenderProfiler* getRenderProfiler() override     { return session->getRenderProfiler(); }
+
         //==============================================================================
         choc::span<const EndpointDetails> getInputEndpoints() override   { return session->getInputEndpoints(); }
         choc::span<const EndpointDetails> getOutputEndpoints() override  { return session->getOutputEndpoints(); }
@@ -197,9 +199,6 @@ struct AudioPlayerVenue::Pimpl  : private AudioMIDISystem::Callback
             SOUL_ASSERT (numFrames <= maxBlockSize);
             auto framePos = venue.pimpl->totalFramesRendered;
 
-            if (! audioInputList.addToFIFO (inputFIFO, framePos, venue.pimpl->currentInputBuffer))
-                ++xruns;
-
             if (! midiInputList.addToFIFO (inputFIFO, framePos, venue.pimpl->currentMIDIBuffer))
                 ++xruns;
 
@@ -223,6 +222,8 @@ struct AudioPlayerVenue::Pimpl  : private AudioMIDISystem::Callback
             if (preRenderCallback != nullptr)
                 preRenderCallback (actions, numFrames);
 
+            audioInputList.setInputFrames (actions, venue.pimpl->currentInputBuffer.getFrameRange ({ frameOffset, frameOffset + numFrames }));
+
             inputFIFO.processNextChunk ([&] (soul::EndpointHandle endpoint, uint64_t /*frame*/,
                                              const choc::value::ValueView& value)
             {